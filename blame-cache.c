@@ -0,0 +1,265 @@
+#include "cache.h"
+#include "blame-cache.h"
+#include "dir.h"
+#include "lockfile.h"
+#include "object-store.h"
+#include "repository.h"
+
+#define BLAME_CACHE_SIGNATURE 0x424c4d43 /* "BLMC" */
+#define BLAME_CACHE_VERSION 1
+#define BLAME_CACHE_OID_VERSION 1 /* SHA-1 */
+
+/*
+ * A record file consists of:
+ *
+ *  - a 28-byte header: the signature, the version, the hash version,
+ *    two padding bytes, the xdiff options and blame flags of the key,
+ *    and the number of lines, of origins and of entries (all 4-byte
+ *    network order integers except the two versions);
+ *  - the names of the blamed commit and blob;
+ *  - the NUL-terminated blamed path;
+ *  - for each origin, its commit and blob names, the 4-byte mode and
+ *    index of the preceding origin, and its NUL-terminated path;
+ *  - for each entry, its line number, number of lines, origin index
+ *    and line number in the origin, as 4-byte integers;
+ *  - a checksum of the above.
+ */
+#define BLAME_CACHE_HEADER_SIZE 28
+#define BLAME_CACHE_ENTRY_SIZE 16
+
+/*
+ * Records are named after the hash of their key and fanned out like
+ * loose objects.
+ */
+static char *get_blame_cache_filename(struct repository *r,
+				      const struct blame_cache_key *key)
+{
+	struct strbuf name = STRBUF_INIT;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+	char *hex, *filename;
+
+	strbuf_addf(&name, "%s %u %u %s", oid_to_hex(key->commit),
+		    key->xdl_opts, key->flags, key->path);
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, name.buf, name.len);
+	the_hash_algo->final_fn(hash, &ctx);
+	strbuf_release(&name);
+
+	hex = sha1_to_hex(hash);
+	filename = xstrfmt("%s/info/blame-cache/%.2s/%s",
+			   r->objects->objectdir, hex, hex + 2);
+	return filename;
+}
+
+/*
+ * Consume a NUL-terminated string from the 'len' bytes at '*p'.
+ * Returns NULL if there is none.
+ */
+static const char *parse_path(const char **p, size_t *len)
+{
+	const char *path = *p;
+	const char *end = memchr(path, '\0', *len);
+
+	if (!end)
+		return NULL;
+	*len -= end + 1 - path;
+	*p = end + 1;
+	return path;
+}
+
+static int parse_blame_cache(const struct blame_cache_key *key,
+			     struct blame_cache_record *rec)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	const char *data = rec->buf.buf;
+	size_t len = rec->buf.len;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	const char *path;
+	git_hash_ctx ctx;
+	uint32_t i, next_lno;
+
+	if (len < BLAME_CACHE_HEADER_SIZE + 3 * hashsz)
+		return -1;
+	len -= hashsz;
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, data, len);
+	the_hash_algo->final_fn(hash, &ctx);
+	if (!hasheq(hash, (const unsigned char *)data + len))
+		return -1;
+
+	if (get_be32(data) != BLAME_CACHE_SIGNATURE ||
+	    data[4] != BLAME_CACHE_VERSION ||
+	    data[5] != BLAME_CACHE_OID_VERSION)
+		return -1;
+	/* another key with the same hash; rather not cache it at all */
+	if (get_be32(data + 8) != key->xdl_opts ||
+	    get_be32(data + 12) != key->flags ||
+	    !hasheq((const unsigned char *)data + BLAME_CACHE_HEADER_SIZE,
+		    key->commit->hash))
+		return 1;
+	rec->num_lines = get_be32(data + 16);
+	rec->origins_nr = get_be32(data + 20);
+	rec->entries_nr = get_be32(data + 24);
+	hashcpy(rec->blob.hash,
+		(const unsigned char *)data + BLAME_CACHE_HEADER_SIZE + hashsz);
+	data += BLAME_CACHE_HEADER_SIZE + 2 * hashsz;
+	len -= BLAME_CACHE_HEADER_SIZE + 2 * hashsz;
+
+	path = parse_path(&data, &len);
+	if (!path)
+		return -1;
+	if (strcmp(path, key->path))
+		return 1;
+
+	if (rec->origins_nr > len / (2 * hashsz + 9))
+		return -1;
+	ALLOC_ARRAY(rec->origins, rec->origins_nr);
+	for (i = 0; i < rec->origins_nr; i++) {
+		struct blame_cache_origin *o = &rec->origins[i];
+
+		if (len < 2 * hashsz + 8)
+			return -1;
+		hashcpy(o->commit.hash, (const unsigned char *)data);
+		hashcpy(o->blob.hash, (const unsigned char *)data + hashsz);
+		o->mode = get_be32(data + 2 * hashsz);
+		o->previous = get_be32(data + 2 * hashsz + 4);
+		data += 2 * hashsz + 8;
+		len -= 2 * hashsz + 8;
+		o->path = parse_path(&data, &len);
+		if (!o->path)
+			return -1;
+		if (o->previous != BLAME_CACHE_NO_PREVIOUS &&
+		    o->previous >= rec->origins_nr)
+			return -1;
+	}
+
+	if (len != (uint64_t)rec->entries_nr * BLAME_CACHE_ENTRY_SIZE)
+		return -1;
+	ALLOC_ARRAY(rec->entries, rec->entries_nr);
+	for (i = 0, next_lno = 0; i < rec->entries_nr; i++) {
+		struct blame_cache_entry *e = &rec->entries[i];
+
+		e->lno = get_be32(data);
+		e->num_lines = get_be32(data + 4);
+		e->origin = get_be32(data + 8);
+		e->s_lno = get_be32(data + 12);
+		data += BLAME_CACHE_ENTRY_SIZE;
+
+		if (e->lno != next_lno || !e->num_lines ||
+		    e->num_lines > rec->num_lines - e->lno ||
+		    e->origin >= rec->origins_nr ||
+		    e->s_lno > UINT32_MAX - e->num_lines)
+			return -1;
+		next_lno += e->num_lines;
+	}
+	if (next_lno != rec->num_lines)
+		return -1;
+	return 0;
+}
+
+int read_blame_cache(struct repository *r, const struct blame_cache_key *key,
+		     struct blame_cache_record *rec)
+{
+	char *filename = get_blame_cache_filename(r, key);
+	int ret;
+
+	memset(rec, 0, sizeof(*rec));
+	strbuf_init(&rec->buf, 0);
+	if (strbuf_read_file(&rec->buf, filename, 0) < 0) {
+		free(filename);
+		blame_cache_record_release(rec);
+		return -1;
+	}
+
+	ret = parse_blame_cache(key, rec);
+	if (ret < 0)
+		warning(_("ignoring corrupt blame cache record %s"), filename);
+	free(filename);
+	if (ret) {
+		blame_cache_record_release(rec);
+		return -1;
+	}
+	return 0;
+}
+
+void blame_cache_record_release(struct blame_cache_record *rec)
+{
+	FREE_AND_NULL(rec->origins);
+	FREE_AND_NULL(rec->entries);
+	rec->origins_nr = rec->entries_nr = 0;
+	strbuf_release(&rec->buf);
+}
+
+static void add_be32(struct strbuf *sb, uint32_t value)
+{
+	uint32_t be = htonl(value);
+	strbuf_add(sb, &be, sizeof(be));
+}
+
+void write_blame_cache(struct repository *r, const struct blame_cache_key *key,
+		       const struct blame_cache_record *rec)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+	char *filename;
+	uint32_t i;
+
+	filename = get_blame_cache_filename(r, key);
+	if (file_exists(filename) ||
+	    safe_create_leading_directories(filename) ||
+	    hold_lock_file_for_update(&lk, filename, 0) < 0) {
+		free(filename);
+		return;
+	}
+
+	add_be32(&buf, BLAME_CACHE_SIGNATURE);
+	strbuf_addch(&buf, BLAME_CACHE_VERSION);
+	strbuf_addch(&buf, BLAME_CACHE_OID_VERSION);
+	strbuf_addch(&buf, 0); /* unused padding byte */
+	strbuf_addch(&buf, 0); /* unused padding byte */
+	add_be32(&buf, key->xdl_opts);
+	add_be32(&buf, key->flags);
+	add_be32(&buf, rec->num_lines);
+	add_be32(&buf, rec->origins_nr);
+	add_be32(&buf, rec->entries_nr);
+	strbuf_add(&buf, key->commit->hash, hashsz);
+	strbuf_add(&buf, rec->blob.hash, hashsz);
+	strbuf_add(&buf, key->path, strlen(key->path) + 1);
+
+	for (i = 0; i < rec->origins_nr; i++) {
+		const struct blame_cache_origin *o = &rec->origins[i];
+
+		strbuf_add(&buf, o->commit.hash, hashsz);
+		strbuf_add(&buf, o->blob.hash, hashsz);
+		add_be32(&buf, o->mode);
+		add_be32(&buf, o->previous);
+		strbuf_add(&buf, o->path, strlen(o->path) + 1);
+	}
+	for (i = 0; i < rec->entries_nr; i++) {
+		const struct blame_cache_entry *e = &rec->entries[i];
+
+		add_be32(&buf, e->lno);
+		add_be32(&buf, e->num_lines);
+		add_be32(&buf, e->origin);
+		add_be32(&buf, e->s_lno);
+	}
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, buf.buf, buf.len);
+	the_hash_algo->final_fn(hash, &ctx);
+	strbuf_add(&buf, hash, hashsz);
+
+	/*
+	 * Unlike a hashfile, which dies on errors, leave no trace of a
+	 * record that could not be written, e.g. on a full disk.
+	 */
+	if (write_in_full(get_lock_file_fd(&lk), buf.buf, buf.len) < 0 ||
+	    commit_lock_file(&lk) < 0)
+		rollback_lock_file(&lk);
+	strbuf_release(&buf);
+	free(filename);
+}
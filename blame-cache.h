@@ -0,0 +1,83 @@
+#ifndef BLAME_CACHE_H
+#define BLAME_CACHE_H
+
+#include "cache.h"
+
+struct repository;
+
+/*
+ * An optional cache of finished blames, kept one file per blamed
+ * (commit, path) pair below "$GIT_OBJECT_DIRECTORY/info/blame-cache"
+ * when "blame.cache" is set.
+ *
+ * A record lists, for every line of the blamed file, the origin (commit
+ * and path) the line was blamed on and its line number there, so that
+ * a later blame whose history walk reaches the same (commit, path) can
+ * take these results instead of digging further.
+ *
+ * Blames depend on the diff options, so those are part of the key.
+ * A record never goes stale, as the history of a commit is immutable;
+ * removing the directory simply empties the cache.
+ */
+
+#define BLAME_CACHE_FIRST_PARENT	(1 << 0)
+#define BLAME_CACHE_NO_RENAMES		(1 << 1)
+
+struct blame_cache_origin {
+	struct object_id commit;
+	struct object_id blob;
+	unsigned mode;
+	/* index of the preceding origin, or BLAME_CACHE_NO_PREVIOUS */
+	uint32_t previous;
+	const char *path;
+};
+
+#define BLAME_CACHE_NO_PREVIOUS 0xffffffff
+
+/* all line numbers are 0 based, as in struct blame_entry */
+struct blame_cache_entry {
+	uint32_t lno;
+	uint32_t num_lines;
+	uint32_t origin;
+	uint32_t s_lno;
+};
+
+struct blame_cache_key {
+	const struct object_id *commit;
+	const char *path;
+	unsigned xdl_opts;
+	unsigned flags;
+};
+
+struct blame_cache_record {
+	/* the blob blamed, and the blame of its lines */
+	struct object_id blob;
+	uint32_t num_lines;
+	struct blame_cache_origin *origins;
+	uint32_t origins_nr;
+	/* sorted, without gaps and covering all num_lines lines */
+	struct blame_cache_entry *entries;
+	uint32_t entries_nr;
+
+	/* internal: the file contents the origin paths point into */
+	struct strbuf buf;
+};
+
+/*
+ * Look up the record for 'key'. Returns 0 and fills 'rec' when it was
+ * found and is valid, and -1 otherwise (a corrupt record is warned
+ * about). A filled record must be released with
+ * blame_cache_record_release().
+ */
+int read_blame_cache(struct repository *r, const struct blame_cache_key *key,
+		     struct blame_cache_record *rec);
+void blame_cache_record_release(struct blame_cache_record *rec);
+
+/*
+ * Store 'rec' for 'key', unless a record for it exists already. Failing
+ * to do so is not an error, as the cache is only an optimization.
+ */
+void write_blame_cache(struct repository *r, const struct blame_cache_key *key,
+		       const struct blame_cache_record *rec);
+
+#endif /* BLAME_CACHE_H */
@@ -9,6 +9,10 @@
 #include "blame.h"
 #include "alloc.h"
 #include "commit-slab.h"
+#include "bloom.h"
+#include "blame-cache.h"
+#include "replace-object.h"
+#include "userdiff.h"
 
 define_commit_slab(blame_suspects, struct blame_origin *);
 static struct blame_suspects blame_suspects;
@@ -474,7 +478,8 @@ void blame_coalesce(struct blame_scoreboard *sb)
 
 	for (ent = sb->ent; ent && (next = ent->next); ent = next) {
 		if (ent->suspect == next->suspect &&
-		    ent->s_lno + ent->num_lines == next->s_lno) {
+		    ent->s_lno + ent->num_lines == next->s_lno &&
+		    ent->lno + ent->num_lines == next->lno) {
 			ent->num_lines += next->num_lines;
 			ent->next = next->next;
 			blame_origin_decref(next->suspect);
@@ -559,6 +564,21 @@ static struct blame_origin *find_origin(struct repository *r,
 			return blame_origin_incref (porigin);
 		}
 
+	/*
+	 * If the commit-graph has a changed-path filter saying that
+	 * origin->path is untouched relative to the first parent, we
+	 * do not need to run diff-tree at all.
+	 */
+	if (!is_null_oid(&origin->commit->object.oid) &&
+	    origin->commit->parents &&
+	    origin->commit->parents->item == parent &&
+	    !bloom_filter_maybe_changed_path(r, origin->commit, origin->path)) {
+		porigin = get_origin(parent, origin->path);
+		oidcpy(&porigin->blob_oid, &origin->blob_oid);
+		porigin->mode = origin->mode;
+		return porigin;
+	}
+
 	/* See if the origin->path is different between parent
 	 * and origin first.  Most of the time they are the
 	 * same and diff-tree is fairly efficient about this.
@@ -1565,6 +1585,303 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 		free(sg_origin);
 }
 
+/*
+ * A cached blame of some (commit, path) is only what digging further
+ * would find if nothing but the history of that commit matters: no
+ * bottom commits or age limit, no moves or copies from other files
+ * (whose detection depends on which lines are still suspected), no
+ * textconv, and no grafts or replacements.
+ */
+static int blame_cache_usable(struct blame_scoreboard *sb, int opt)
+{
+	struct repository *r = sb->repo;
+	struct rev_info *revs = sb->revs;
+	unsigned int i;
+
+	if (!sb->use_cache || sb->reverse ||
+	    (opt & (PICKAXE_BLAME_MOVE | PICKAXE_BLAME_COPY)) ||
+	    revs->max_age != -1)
+		return 0;
+	for (i = 0; i < revs->cmdline.nr; i++)
+		if (revs->cmdline.rev[i].flags & UNINTERESTING)
+			return 0;
+
+	if (revs->diffopt.flags.allow_textconv) {
+		struct userdiff_driver *drv;
+
+		drv = userdiff_find_by_path(r->index, sb->path);
+		if (drv && drv->textconv)
+			return 0;
+	}
+
+	if (read_replace_refs) {
+		prepare_replace_object(r);
+		if (hashmap_get_size(&r->objects->replace_map->map))
+			return 0;
+	}
+	prepare_commit_graft(r);
+	if (r->parsed_objects->grafts_nr || is_repository_shallow(r))
+		return 0;
+	return 1;
+}
+
+static void blame_cache_key(struct blame_scoreboard *sb,
+			    struct commit *commit, const char *path,
+			    struct blame_cache_key *key)
+{
+	key->commit = &commit->object.oid;
+	key->path = path;
+	key->xdl_opts = sb->xdl_opts;
+	key->flags = 0;
+	if (sb->revs->first_parent_only)
+		key->flags |= BLAME_CACHE_FIRST_PARENT;
+	if (sb->no_whole_file_rename)
+		key->flags |= BLAME_CACHE_NO_RENAMES;
+}
+
+/*
+ * Ship a blame entry whose origin is known to the final blame list.
+ */
+static void take_responsibility(struct blame_scoreboard *sb,
+				struct blame_entry *ent)
+{
+	ent->suspect->guilty = 1;
+	if (sb->found_guilty_entry)
+		sb->found_guilty_entry(ent, sb->found_guilty_entry_data);
+	ent->next = sb->ent;
+	sb->ent = ent;
+}
+
+static struct blame_origin *get_cached_origin(struct blame_scoreboard *sb,
+					      const struct blame_cache_origin *co)
+{
+	struct commit *commit = lookup_commit(sb->repo, &co->commit);
+	struct blame_origin *o;
+
+	if (!commit)
+		return NULL;
+	o = get_origin(commit, co->path);
+	if (is_null_oid(&o->blob_oid)) {
+		oidcpy(&o->blob_oid, &co->blob);
+		o->mode = co->mode;
+	}
+	return o;
+}
+
+/*
+ * If the blame cache knows how the lines of 'origin' were blamed, blame
+ * its suspects accordingly and return 1.
+ */
+static int take_blame_from_cache(struct blame_scoreboard *sb,
+				 struct blame_origin *origin)
+{
+	struct blame_cache_key key;
+	struct blame_cache_record rec;
+	struct blame_origin **origins;
+	struct blame_entry *e, *next;
+	uint32_t i;
+	int ok = 1;
+
+	if (is_null_oid(&origin->commit->object.oid) ||
+	    is_null_oid(&origin->blob_oid))
+		return 0;
+	blame_cache_key(sb, origin->commit, origin->path, &key);
+	if (read_blame_cache(sb->repo, &key, &rec))
+		return 0;
+	if (!oideq(&rec.blob, &origin->blob_oid)) {
+		blame_cache_record_release(&rec);
+		return 0;
+	}
+	for (e = origin->suspects; e; e = e->next)
+		if (e->s_lno + e->num_lines > rec.num_lines) {
+			blame_cache_record_release(&rec);
+			return 0;
+		}
+
+	/*
+	 * Set up the origins blamed before touching the suspects, so
+	 * that we can still fall back to digging.
+	 */
+	origins = xcalloc(rec.origins_nr, sizeof(*origins));
+	for (i = 0; ok && i < rec.entries_nr; i++) {
+		uint32_t j = rec.entries[i].origin;
+		struct commit *commit;
+
+		if (origins[j])
+			continue;
+		origins[j] = get_cached_origin(sb, &rec.origins[j]);
+		if (!origins[j] || parse_commit(origins[j]->commit)) {
+			ok = 0;
+			break;
+		}
+		commit = origins[j]->commit;
+		/* treat root commit as boundary, as assign_blame() does */
+		if (!commit->parents && !sb->show_root)
+			commit->object.flags |= UNINTERESTING;
+	}
+	for (i = 0; ok && i < rec.origins_nr; i++) {
+		uint32_t prev = rec.origins[i].previous;
+
+		if (!origins[i] || origins[i]->previous ||
+		    prev == BLAME_CACHE_NO_PREVIOUS)
+			continue;
+		if (!origins[prev])
+			origins[prev] = get_cached_origin(sb, &rec.origins[prev]);
+		if (!origins[prev])
+			ok = 0;
+		else
+			origins[i]->previous = blame_origin_incref(origins[prev]);
+	}
+
+	if (ok) {
+		for (e = origin->suspects; e; e = next) {
+			uint32_t lno = e->s_lno, end = e->s_lno + e->num_lines;
+			uint32_t lo = 0, hi = rec.entries_nr;
+
+			next = e->next;
+			/* the last cached entry starting at or before lno */
+			while (hi - lo > 1) {
+				uint32_t mi = lo + (hi - lo) / 2;
+				if (rec.entries[mi].lno <= lno)
+					lo = mi;
+				else
+					hi = mi;
+			}
+			for (i = lo; lno < end; i++) {
+				const struct blame_cache_entry *ce = &rec.entries[i];
+				struct blame_entry *piece;
+				uint32_t ce_end = ce->lno + ce->num_lines;
+
+				piece = xcalloc(1, sizeof(*piece));
+				piece->lno = e->lno + lno - e->s_lno;
+				piece->num_lines = (end < ce_end ? end : ce_end) - lno;
+				piece->suspect = blame_origin_incref(origins[ce->origin]);
+				piece->s_lno = ce->s_lno + lno - ce->lno;
+				take_responsibility(sb, piece);
+				lno += piece->num_lines;
+			}
+			blame_origin_decref(e->suspect);
+			free(e);
+		}
+		origin->suspects = NULL;
+	}
+
+	for (i = 0; i < rec.origins_nr; i++)
+		blame_origin_decref(origins[i]);
+	free(origins);
+	blame_cache_record_release(&rec);
+	return ok;
+}
+
+static int compare_blame_final_ptr(const void *a, const void *b)
+{
+	return compare_blame_final(*(const struct blame_entry **)a,
+				   *(const struct blame_entry **)b);
+}
+
+static int compare_origin_ptr(const void *a, const void *b)
+{
+	const struct blame_origin *o1 = *(const struct blame_origin **)a;
+	const struct blame_origin *o2 = *(const struct blame_origin **)b;
+
+	if (o1 == o2)
+		return 0;
+	return (intptr_t)o1 > (intptr_t)o2 ? 1 : -1;
+}
+
+static uint32_t find_origin_index(struct blame_origin **origins, size_t nr,
+				  struct blame_origin *o)
+{
+	struct blame_origin **found;
+
+	found = bsearch(&o, origins, nr, sizeof(*origins), compare_origin_ptr);
+	return found ? found - origins : BLAME_CACHE_NO_PREVIOUS;
+}
+
+/*
+ * Record the finished blame of the final commit in the blame cache,
+ * if it covers the whole file.
+ */
+static void store_blame_in_cache(struct blame_scoreboard *sb)
+{
+	struct blame_cache_key key;
+	struct blame_cache_record rec = { { { 0 } } };
+	struct blame_entry *e, **ents;
+	struct blame_origin **origins;
+	size_t nr = 0, origins_nr, i;
+	unsigned mode;
+
+	if (is_null_oid(&sb->final->object.oid) || !sb->num_lines ||
+	    get_tree_entry(&sb->final->object.oid, sb->path, &rec.blob, &mode))
+		return;
+
+	for (e = sb->ent; e; e = e->next)
+		nr++;
+	ALLOC_ARRAY(ents, nr);
+	ALLOC_ARRAY(origins, 2 * nr);
+	for (i = 0, e = sb->ent; e; e = e->next, i++)
+		ents[i] = e;
+	QSORT(ents, nr, compare_blame_final_ptr);
+
+	for (i = 0, origins_nr = 0; i < nr; i++) {
+		if (ents[i]->lno != (i ? ents[i - 1]->lno + ents[i - 1]->num_lines : 0))
+			goto out; /* only some lines were blamed */
+		origins[origins_nr++] = ents[i]->suspect;
+		if (ents[i]->suspect->previous)
+			origins[origins_nr++] = ents[i]->suspect->previous;
+	}
+	if (!nr || ents[nr - 1]->lno + ents[nr - 1]->num_lines != sb->num_lines)
+		goto out;
+
+	QSORT(origins, origins_nr, compare_origin_ptr);
+	for (i = 0, rec.origins_nr = 0; i < origins_nr; i++)
+		if (!rec.origins_nr || origins[rec.origins_nr - 1] != origins[i])
+			origins[rec.origins_nr++] = origins[i];
+	ALLOC_ARRAY(rec.origins, rec.origins_nr);
+	for (i = 0; i < rec.origins_nr; i++) {
+		struct blame_cache_origin *co = &rec.origins[i];
+
+		oidcpy(&co->commit, &origins[i]->commit->object.oid);
+		oidcpy(&co->blob, &origins[i]->blob_oid);
+		co->mode = origins[i]->mode;
+		co->path = origins[i]->path;
+		co->previous = BLAME_CACHE_NO_PREVIOUS;
+		if (origins[i]->previous)
+			co->previous = find_origin_index(origins, rec.origins_nr,
+							 origins[i]->previous);
+	}
+
+	ALLOC_ARRAY(rec.entries, nr);
+	for (i = 0; i < nr; i++) {
+		struct blame_cache_entry *ce;
+
+		if (rec.entries_nr) {
+			ce = &rec.entries[rec.entries_nr - 1];
+			if (origins[ce->origin] == ents[i]->suspect &&
+			    ce->s_lno + ce->num_lines == ents[i]->s_lno) {
+				ce->num_lines += ents[i]->num_lines;
+				continue;
+			}
+		}
+		ce = &rec.entries[rec.entries_nr++];
+		ce->lno = ents[i]->lno;
+		ce->num_lines = ents[i]->num_lines;
+		ce->origin = find_origin_index(origins, rec.origins_nr,
+					       ents[i]->suspect);
+		ce->s_lno = ents[i]->s_lno;
+	}
+	rec.num_lines = sb->num_lines;
+
+	blame_cache_key(sb, sb->final, sb->path, &key);
+	write_blame_cache(sb->repo, &key, &rec);
+
+out:
+	free(rec.origins);
+	free(rec.entries);
+	free(origins);
+	free(ents);
+}
+
 /*
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
@@ -1573,7 +1890,9 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 {
 	struct rev_info *revs = sb->revs;
 	struct commit *commit = prio_queue_get(&sb->commits);
+	int use_cache = blame_cache_usable(sb, opt);
 
+	trace_performance_enter();
 	while (commit) {
 		struct blame_entry *ent;
 		struct blame_origin *suspect = get_blame_suspects(commit);
@@ -1597,9 +1916,10 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		parse_commit(commit);
 		if (sb->reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
-		     !(revs->max_age != -1 && commit->date < revs->max_age)))
-			pass_blame(sb, suspect, opt);
-		else {
+		     !(revs->max_age != -1 && commit->date < revs->max_age))) {
+			if (!use_cache || !take_blame_from_cache(sb, suspect))
+				pass_blame(sb, suspect, opt);
+		} else {
 			commit->object.flags |= UNINTERESTING;
 			if (commit->object.parsed)
 				mark_parents_uninteresting(commit);
@@ -1631,6 +1951,10 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		if (sb->debug) /* sanity */
 			sanity_check_refcnt(sb);
 	}
+
+	if (use_cache)
+		store_blame_in_cache(sb);
+	trace_performance_leave("assign_blame");
 }
 
 static const char *get_next_line(const char *start, const char *end)
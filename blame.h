@@ -142,6 +142,8 @@ struct blame_scoreboard {
 	int xdl_opts;
 	int no_whole_file_rename;
 	int debug;
+	/* take finished blames from, and add them to, the blame cache */
+	int use_cache;
 
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
@@ -0,0 +1,342 @@
+#include "cache.h"
+#include "bloom.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "commit-graph.h"
+#include "commit.h"
+#include "commit-slab.h"
+#include "object-store.h"
+#include "string-list.h"
+
+define_commit_slab(bloom_filter_slab, struct bloom_filter);
+
+static struct bloom_filter_slab bloom_filters;
+static int bloom_filters_initialized;
+
+static uint32_t rotate_left(uint32_t value, int32_t count)
+{
+	uint32_t mask = 8 * sizeof(uint32_t) - 1;
+	count &= mask;
+	return ((value << count) | (value >> ((-count) & mask)));
+}
+
+static inline unsigned char get_bitmask(uint32_t pos)
+{
+	return ((unsigned char)1) << (pos & (BITS_PER_WORD - 1));
+}
+
+uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	const uint32_t r1 = 15;
+	const uint32_t r2 = 13;
+	const uint32_t m = 5;
+	const uint32_t n = 0xe6546b64;
+	size_t i, len4 = len / sizeof(uint32_t);
+	const unsigned char *tail;
+	uint32_t k1 = 0;
+
+	for (i = 0; i < len4; i++) {
+		uint32_t k = (uint32_t)bytes[4 * i] |
+			     ((uint32_t)bytes[4 * i + 1] << 8) |
+			     ((uint32_t)bytes[4 * i + 2] << 16) |
+			     ((uint32_t)bytes[4 * i + 3] << 24);
+		k *= c1;
+		k = rotate_left(k, r1);
+		k *= c2;
+
+		seed ^= k;
+		seed = rotate_left(seed, r2) * m + n;
+	}
+
+	tail = bytes + len4 * sizeof(uint32_t);
+
+	switch (len & (sizeof(uint32_t) - 1)) {
+	case 3:
+		k1 ^= ((uint32_t)tail[2]) << 16;
+		/* fallthrough */
+	case 2:
+		k1 ^= ((uint32_t)tail[1]) << 8;
+		/* fallthrough */
+	case 1:
+		k1 ^= ((uint32_t)tail[0]);
+		k1 *= c1;
+		k1 = rotate_left(k1, r1);
+		k1 *= c2;
+		seed ^= k1;
+		break;
+	}
+
+	seed ^= (uint32_t)len;
+	seed ^= (seed >> 16);
+	seed *= 0x85ebca6b;
+	seed ^= (seed >> 13);
+	seed *= 0xc2b2ae35;
+	seed ^= (seed >> 16);
+
+	return seed;
+}
+
+void fill_bloom_key(const char *data,
+		    size_t len,
+		    struct bloom_key *key,
+		    const struct bloom_filter_settings *settings)
+{
+	int i;
+	const uint32_t seed0 = 0x293ae76f;
+	const uint32_t seed1 = 0x7e646e2c;
+	const uint32_t hash0 = murmur3_seeded(seed0, data, len);
+	const uint32_t hash1 = murmur3_seeded(seed1, data, len);
+
+	/*
+	 * Double hashing: the i-th hash is h0 + i * h1, which gives us
+	 * 'num_hashes' reasonably independent bit positions out of two
+	 * calls to murmur3.
+	 */
+	ALLOC_ARRAY(key->hashes, settings->num_hashes);
+	for (i = 0; i < settings->num_hashes; i++)
+		key->hashes[i] = hash0 + i * hash1;
+}
+
+void clear_bloom_key(struct bloom_key *key)
+{
+	FREE_AND_NULL(key->hashes);
+}
+
+void add_key_to_filter(const struct bloom_key *key,
+		       struct bloom_filter *filter,
+		       const struct bloom_filter_settings *settings)
+{
+	int i;
+	uint64_t mod = filter->len * BITS_PER_WORD;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t hash_mod = key->hashes[i] % mod;
+		uint64_t block_pos = hash_mod / BITS_PER_WORD;
+
+		filter->data[block_pos] |= get_bitmask(hash_mod);
+	}
+}
+
+int load_bloom_filter_from_graph(struct commit_graph *g,
+				 struct bloom_filter *filter,
+				 struct commit *c)
+{
+	uint32_t lex_pos, start_index, end_index;
+
+	if (!g)
+		return 0;
+	if (c->graph_pos == COMMIT_NOT_FROM_GRAPH)
+		return 0;
+	if (c->graph_pos >= g->num_commits + g->num_commits_in_base)
+		return 0;
+
+	g = graph_layer_for_pos(g, c->graph_pos, &lex_pos);
+	if (!g->chunk_bloom_indexes)
+		return 0;
+
+	end_index = get_be32(g->chunk_bloom_indexes + 4 * lex_pos);
+	if (lex_pos > 0)
+		start_index = get_be32(g->chunk_bloom_indexes + 4 * (lex_pos - 1));
+	else
+		start_index = 0;
+
+	if (end_index < start_index ||
+	    end_index > g->bloom_data_size - BLOOMDATA_CHUNK_HEADER_SIZE) {
+		warning(_("ignoring out-of-range offsets (%"PRIu32", %"PRIu32") "
+			  "of the changed-path filter of commit %s"),
+			start_index, end_index, oid_to_hex(&c->object.oid));
+		return 0;
+	}
+
+	filter->len = end_index - start_index;
+	filter->data = (unsigned char *)(g->chunk_bloom_data +
+					 BLOOMDATA_CHUNK_HEADER_SIZE +
+					 start_index);
+	return 1;
+}
+
+void init_bloom_filters(void)
+{
+	if (bloom_filters_initialized)
+		return;
+	init_bloom_filter_slab(&bloom_filters);
+	bloom_filters_initialized = 1;
+}
+
+void deinit_bloom_filters(void)
+{
+	unsigned int i, j;
+
+	if (!bloom_filters_initialized)
+		return;
+	for (i = 0; i < bloom_filters.slab_count; i++) {
+		if (!bloom_filters.slab[i])
+			continue;
+		for (j = 0; j < bloom_filters.slab_size; j++)
+			free(bloom_filters.slab[i][j].data);
+	}
+	clear_bloom_filter_slab(&bloom_filters);
+	bloom_filters_initialized = 0;
+}
+
+static void add_path_with_leading_dirs(struct string_list *paths,
+				       const char *path)
+{
+	size_t len = strlen(path);
+
+	string_list_append(paths, path);
+	while (len--) {
+		if (path[len] == '/')
+			string_list_append_nodup(paths, xstrndup(path, len));
+	}
+}
+
+static void compute_bloom_filter(struct repository *r,
+				 struct commit *c,
+				 struct bloom_filter *filter,
+				 const struct bloom_filter_settings *settings)
+{
+	struct diff_options diffopt;
+	struct string_list paths = STRING_LIST_INIT_DUP;
+	int i;
+
+	repo_diff_setup(r, &diffopt);
+	diffopt.flags.recursive = 1;
+	diff_setup_done(&diffopt);
+
+	if (c->parents) {
+		struct commit *parent = c->parents->item;
+		if (parse_commit(parent))
+			die(_("unable to parse commit %s"),
+			    oid_to_hex(&parent->object.oid));
+		diff_tree_oid(get_commit_tree_oid(parent),
+			      get_commit_tree_oid(c), "", &diffopt);
+	} else {
+		diff_tree_oid(NULL, get_commit_tree_oid(c), "", &diffopt);
+	}
+
+	if (diff_queued_diff.nr <= BLOOM_FILTER_MAX_CHANGED_PATHS) {
+		for (i = 0; i < diff_queued_diff.nr; i++) {
+			struct diff_filepair *p = diff_queued_diff.queue[i];
+			add_path_with_leading_dirs(&paths, p->two->path);
+		}
+		string_list_sort(&paths);
+		string_list_remove_duplicates(&paths, 0);
+
+		/*
+		 * An empty diff still gets a one-word filter with no bits
+		 * set, so that every query against it says "definitely
+		 * not"; a zero-length filter would instead mean "unknown".
+		 */
+		filter->len = (paths.nr * settings->bits_per_entry +
+			       BITS_PER_WORD - 1) / BITS_PER_WORD;
+		if (!filter->len)
+			filter->len = 1;
+		filter->data = xcalloc(filter->len, sizeof(unsigned char));
+
+		for (i = 0; i < paths.nr; i++) {
+			struct bloom_key key;
+			const char *path = paths.items[i].string;
+
+			fill_bloom_key(path, strlen(path), &key, settings);
+			add_key_to_filter(&key, filter, settings);
+			clear_bloom_key(&key);
+		}
+	} else {
+		filter->len = 1;
+		filter->data = xmalloc(1);
+		filter->data[0] = 0xFF;
+	}
+
+	for (i = 0; i < diff_queued_diff.nr; i++)
+		diff_free_filepair(diff_queued_diff.queue[i]);
+	free(diff_queued_diff.queue);
+	DIFF_QUEUE_CLEAR(&diff_queued_diff);
+	string_list_clear(&paths, 0);
+}
+
+struct bloom_filter *get_bloom_filter(struct repository *r,
+				      struct commit *c)
+{
+	struct bloom_filter *filter;
+	struct bloom_filter stored;
+	struct bloom_filter_settings settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+
+	if (!bloom_filters_initialized)
+		BUG("get_bloom_filter() called before init_bloom_filters()");
+
+	filter = bloom_filter_slab_at(&bloom_filters, c);
+	if (filter->data)
+		return filter;
+
+	if (parse_commit(c))
+		die(_("unable to parse commit %s"), oid_to_hex(&c->object.oid));
+
+	/*
+	 * Reuse the filter that an existing commit-graph already carries
+	 * for this commit; the filter only depends on the commit and its
+	 * first parent, so it is valid for any graph we write.
+	 */
+	load_commit_graph_info(r, c);
+	if (load_bloom_filter_from_graph(r->objects->commit_graph, &stored, c) &&
+	    stored.len) {
+		filter->len = stored.len;
+		filter->data = xmemdupz(stored.data, stored.len);
+		return filter;
+	}
+
+	compute_bloom_filter(r, c, filter, &settings);
+	return filter;
+}
+
+int bloom_filter_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings)
+{
+	int i;
+	uint64_t mod = filter->len * BITS_PER_WORD;
+
+	if (!mod)
+		return -1;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t hash_mod = key->hashes[i] % mod;
+		uint64_t block_pos = hash_mod / BITS_PER_WORD;
+
+		if (!(filter->data[block_pos] & get_bitmask(hash_mod)))
+			return 0;
+	}
+
+	return 1;
+}
+
+int bloom_filter_maybe_changed_path(struct repository *r,
+				    struct commit *c,
+				    const char *path)
+{
+	struct commit_graph *g;
+	struct bloom_filter_settings *settings;
+	struct bloom_filter filter;
+	struct bloom_key key;
+	int result;
+
+	if (!prepare_commit_graph(r))
+		return 1;
+	g = r->objects->commit_graph;
+	settings = get_bloom_filter_settings(g);
+	if (!settings)
+		return 1;
+
+	load_commit_graph_info(r, c);
+	if (!load_bloom_filter_from_graph(g, &filter, c))
+		return 1;
+
+	fill_bloom_key(path, strlen(path), &key, settings);
+	result = bloom_filter_contains(&filter, &key, settings);
+	clear_bloom_key(&key);
+
+	return !!result;
+}
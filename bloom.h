@@ -0,0 +1,127 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+struct commit;
+struct commit_graph;
+struct repository;
+
+struct bloom_filter_settings {
+	/*
+	 * The version of the hashing technique being used.
+	 * We currently only support version = 1 which is
+	 * the seeded murmur3 hashing technique implemented
+	 * in bloom.c.
+	 */
+	uint32_t hash_version;
+
+	/*
+	 * The number of times a path is hashed, i.e. the
+	 * number of bit positions that cumulatively
+	 * determine whether a path is present in the
+	 * Bloom filter.
+	 */
+	uint32_t num_hashes;
+
+	/*
+	 * The minimum number of bits per entry in the Bloom
+	 * filter. If the filter contains 'n' entries, then
+	 * filter size is the minimum number of 8-bit words
+	 * that contain n*b bits.
+	 */
+	uint32_t bits_per_entry;
+};
+
+#define DEFAULT_BLOOM_FILTER_SETTINGS { 1, 7, 10 }
+#define BITS_PER_WORD 8
+#define BLOOMDATA_CHUNK_HEADER_SIZE (3 * sizeof(uint32_t))
+
+/*
+ * A commit whose first-parent diff touches more than this many paths
+ * gets a filter with every bit set, so that every query against it
+ * answers "maybe".
+ */
+#define BLOOM_FILTER_MAX_CHANGED_PATHS 512
+
+/*
+ * A Bloom filter over the paths changed by a commit relative to its
+ * first parent (or relative to the empty tree for a root commit).
+ * Leading directories of every changed path are included as well, so
+ * that a query for "dir" matches a change to "dir/file".
+ *
+ * A filter with 'len' zero carries no information and every query
+ * against it answers "maybe".
+ */
+struct bloom_filter {
+	unsigned char *data;
+	size_t len;
+};
+
+/*
+ * A bloom_key represents the k hash values for a given string. These
+ * can be precomputed and reused for multiple bloom_filter_contains()
+ * calls, e.g. for every commit visited by a path-limited walk.
+ */
+struct bloom_key {
+	uint32_t *hashes;
+};
+
+/*
+ * Calculate the murmur3 32-bit hash value for the given data
+ * using the given seed.
+ * Produces a uniformly distributed hash value.
+ * Not considered to be cryptographically secure.
+ * Implemented as described in https://en.wikipedia.org/wiki/MurmurHash#Algorithm
+ */
+uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len);
+
+void fill_bloom_key(const char *data,
+		    size_t len,
+		    struct bloom_key *key,
+		    const struct bloom_filter_settings *settings);
+void clear_bloom_key(struct bloom_key *key);
+
+void add_key_to_filter(const struct bloom_key *key,
+		       struct bloom_filter *filter,
+		       const struct bloom_filter_settings *settings);
+
+/*
+ * Point 'filter' at the changed-path filter stored for 'c' in the
+ * commit-graph 'g'. The filter data is borrowed from the mmap'd graph
+ * and must not be freed. Returns 1 on success, and 0 if the graph has
+ * no filter for 'c'.
+ */
+int load_bloom_filter_from_graph(struct commit_graph *g,
+				 struct bloom_filter *filter,
+				 struct commit *c);
+
+/*
+ * Return the changed-path filter for 'c', computing it from the first
+ * parent diff (or copying it out of the commit-graph, if one is
+ * available there) the first time it is asked for. The result is cached
+ * until deinit_bloom_filters() is called.
+ */
+struct bloom_filter *get_bloom_filter(struct repository *r,
+				      struct commit *c);
+
+void init_bloom_filters(void);
+void deinit_bloom_filters(void);
+
+/*
+ * Return 0 if the path represented by 'key' is definitely not in the
+ * filter, 1 if it may be in the filter, and -1 if the filter does not
+ * carry any information at all.
+ */
+int bloom_filter_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings);
+
+/*
+ * Consult the commit-graph's changed-path filter for 'c'. Return 0 if
+ * 'path' is definitely the same in 'c' and in its first parent, and 1
+ * if it may have changed (or if no filter is available for 'c').
+ */
+int bloom_filter_maybe_changed_path(struct repository *r,
+				    struct commit *c,
+				    const char *path);
+
+#endif
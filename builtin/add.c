@@ -19,6 +19,7 @@
 #include "bulk-checkin.h"
 #include "argv-array.h"
 #include "submodule.h"
+#include "sparse-index.h"
 
 static const char * const builtin_add_usage[] = {
 	N_("git add [<options>] [--] <pathspec>..."),
@@ -454,9 +455,14 @@ int cmd_add(int argc, const char **argv, const char *prefix)
 		       PATHSPEC_SYMLINK_LEADING_PATH,
 		       prefix, argv);
 
+	command_requires_full_index = 0;
 	if (read_cache_preload(&pathspec) < 0)
 		die(_("index file corrupt"));
 
+	/* these look at (and may change) every matching tracked file */
+	if (add_renormalize || chmod_arg)
+		ensure_full_index(&the_index);
+
 	die_in_unpopulated_submodule(&the_index, prefix);
 	die_path_inside_submodule(&the_index, &pathspec);
 
@@ -488,8 +494,19 @@ int cmd_add(int argc, const char **argv, const char *prefix)
 	if (pathspec.nr) {
 		int i;
 
-		if (!seen)
+		if (!seen) {
 			seen = find_pathspecs_matching_against_index(&pathspec, &the_index);
+			/*
+			 * A pathspec may only match files hidden in a
+			 * sparse directory entry.
+			 */
+			if (the_index.sparse_index &&
+			    memchr(seen, 0, pathspec.nr)) {
+				ensure_full_index(&the_index);
+				free(seen);
+				seen = find_pathspecs_matching_against_index(&pathspec, &the_index);
+			}
+		}
 
 		/*
 		 * file_exists() assumes exact match
@@ -43,6 +43,7 @@ static int max_orig_digits;
 static int max_digits;
 static int max_score_digits;
 static int show_root;
+static int use_blame_cache;
 static int reverse;
 static int blank_boundary;
 static int incremental;
@@ -72,6 +73,7 @@ static unsigned blame_copy_score;
 struct progress_info {
 	struct progress *progress;
 	int blamed_lines;
+	struct blame_stream *stream;
 };
 
 static const char *nth_line_cb(void *data, long lno)
@@ -266,28 +268,6 @@ static int emit_one_suspect_detail(struct blame_origin *suspect, int repeat)
 	return 1;
 }
 
-/*
- * The blame_entry is found to be guilty for the range.
- * Show it in incremental output.
- */
-static void found_guilty_entry(struct blame_entry *ent, void *data)
-{
-	struct progress_info *pi = (struct progress_info *)data;
-
-	if (incremental) {
-		struct blame_origin *suspect = ent->suspect;
-
-		printf("%s %d %d %d\n",
-		       oid_to_hex(&suspect->commit->object.oid),
-		       ent->s_lno + 1, ent->lno + 1, ent->num_lines);
-		emit_one_suspect_detail(suspect, 0);
-		write_filename_info(suspect);
-		maybe_flush_or_die(stdout, "stdout");
-	}
-	pi->blamed_lines += ent->num_lines;
-	display_progress(pi->progress, pi->blamed_lines);
-}
-
 static const char *format_time(timestamp_t time, const char *tz_str,
 			       int show_raw_time)
 {
@@ -375,6 +355,114 @@ static void emit_porcelain(struct blame_scoreboard *sb, struct blame_entry *ent,
 		putchar('\n');
 }
 
+/*
+ * The porcelain formats are shown in final line order, but need no
+ * alignment across the whole output, so a group of lines can be shown
+ * as soon as it and all lines before it are blamed, long before the
+ * blame of an old file is done.
+ */
+struct blame_stream {
+	struct blame_scoreboard *sb;
+	int option;
+	/* blamed entries that are not shown yet, by their first line */
+	struct blame_entry **pending;
+	/* the line ranges to show, and where we are in them */
+	const struct range *ranges;
+	unsigned int nr, cur;
+	long lno;
+};
+
+/*
+ * A commit blamed under more than one path repeats the filename with
+ * each group of lines; we can only tell once its second path shows up.
+ */
+static void check_more_than_one_path(struct commit *commit)
+{
+	struct blame_origin *suspect;
+	int count = 0;
+
+	if (commit->object.flags & MORE_THAN_ONE_PATH)
+		return;
+	for (suspect = get_blame_suspects(commit); suspect; suspect = suspect->next)
+		if (suspect->guilty && count++) {
+			commit->object.flags |= MORE_THAN_ONE_PATH;
+			break;
+		}
+}
+
+/*
+ * Show the groups of lines from the current line on for which we know
+ * everything: their lines and whether the next entry extends them, as
+ * blame_coalesce() would.
+ */
+static void flush_blame_stream(struct blame_stream *st)
+{
+	int shown = 0;
+
+	while (st->cur < st->nr) {
+		const struct range *r = &st->ranges[st->cur];
+		struct blame_entry *e, group;
+		long end;
+
+		if (st->lno >= r->end) {
+			if (++st->cur < st->nr)
+				st->lno = st->ranges[st->cur].start;
+			continue;
+		}
+		e = st->pending[st->lno];
+		if (!e)
+			break;
+
+		group = *e;
+		end = e->lno + e->num_lines;
+		while (end < r->end) {
+			struct blame_entry *next = st->pending[end];
+
+			if (!next)
+				goto out; /* it might extend this group */
+			if (next->suspect != group.suspect ||
+			    group.s_lno + group.num_lines != next->s_lno)
+				break;
+			group.num_lines += next->num_lines;
+			end += next->num_lines;
+		}
+
+		check_more_than_one_path(group.suspect->commit);
+		emit_porcelain(st->sb, &group, st->option);
+		st->lno = end;
+		shown = 1;
+	}
+out:
+	if (shown)
+		maybe_flush_or_die(stdout, "stdout");
+}
+
+/*
+ * The blame_entry is found to be guilty for the range.
+ * Show it in incremental output, and in porcelain output once
+ * the lines before it are shown.
+ */
+static void found_guilty_entry(struct blame_entry *ent, void *data)
+{
+	struct progress_info *pi = (struct progress_info *)data;
+
+	if (incremental) {
+		struct blame_origin *suspect = ent->suspect;
+
+		printf("%s %d %d %d\n",
+		       oid_to_hex(&suspect->commit->object.oid),
+		       ent->s_lno + 1, ent->lno + 1, ent->num_lines);
+		emit_one_suspect_detail(suspect, 0);
+		write_filename_info(suspect);
+		maybe_flush_or_die(stdout, "stdout");
+	} else if (pi->stream) {
+		pi->stream->pending[ent->lno] = ent;
+		flush_blame_stream(pi->stream);
+	}
+	pi->blamed_lines += ent->num_lines;
+	display_progress(pi->progress, pi->blamed_lines);
+}
+
 static struct color_field {
 	timestamp_t hop;
 	char col[COLOR_MAXLEN];
@@ -677,6 +765,10 @@ static int git_blame_config(const char *var, const char *value, void *cb)
 		show_root = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "blame.cache")) {
+		use_blame_cache = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "blame.blankboundary")) {
 		blank_boundary = git_config_bool(var, value);
 		return 0;
@@ -783,6 +875,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	struct blame_entry *ent = NULL;
 	long dashdash_pos, lno;
 	struct progress_info pi = { NULL, 0 };
+	struct blame_stream stream = { NULL };
 
 	struct string_list range_list = STRING_LIST_INIT_NODUP;
 	int output_option = 0, opt = 0;
@@ -1033,7 +1126,6 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 
 	blame_origin_decref(o);
 
-	range_set_release(&ranges);
 	string_list_clear(&range_list, 0);
 
 	sb.ent = NULL;
@@ -1050,6 +1142,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	sb.show_root = show_root;
 	sb.xdl_opts = xdl_opts;
 	sb.no_whole_file_rename = no_whole_file_rename;
+	sb.use_cache = use_blame_cache;
 
 	read_mailmap(&mailmap, NULL);
 
@@ -1058,10 +1151,31 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	if (show_progress)
 		pi.progress = start_delayed_progress(_("Blaming lines"), sb.num_lines);
 
+	if (!incremental && (output_option & OUTPUT_PORCELAIN)) {
+		stream.sb = &sb;
+		stream.option = output_option;
+		stream.pending = xcalloc(st_add(sb.num_lines, 1),
+					 sizeof(*stream.pending));
+		stream.ranges = ranges.ranges;
+		stream.nr = ranges.nr;
+		stream.lno = ranges.nr ? ranges.ranges[0].start : 0;
+		pi.stream = &stream;
+		setup_pager();
+	}
+
 	assign_blame(&sb, opt);
 
 	stop_progress(&pi.progress);
 
+	if (pi.stream) {
+		if (stream.cur < stream.nr)
+			BUG("blame stream stopped at line %ld", stream.lno + 1);
+		free(stream.pending);
+		goto cleanup;
+	}
+
+	range_set_release(&ranges);
+
 	if (!incremental)
 		setup_pager();
 	else
@@ -1086,6 +1200,9 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 		output_option &= ~(OUTPUT_COLOR_LINE | OUTPUT_SHOW_AGE_WITH_COLOR);
 
 	output(&sb, output_option);
+
+cleanup:
+	range_set_release(&ranges);
 	free((void *)sb.final_buf);
 	for (ent = sb.ent; ent; ) {
 		struct blame_entry *e = ent->next;
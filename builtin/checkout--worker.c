@@ -0,0 +1,124 @@
+/*
+ * Write the entries that "git checkout" and friends hand out to a
+ * parallel checkout worker; see parallel-checkout.c.
+ */
+#include "builtin.h"
+#include "config.h"
+#include "parallel-checkout.h"
+#include "parse-options.h"
+#include "pkt-line.h"
+
+static void packet_to_pc_item(const char *buffer, int len,
+			      struct parallel_checkout_item *pc_item)
+{
+	struct pc_item_fixed_portion fixed_portion;
+	const char *variant;
+	char *encoding;
+
+	if (len < sizeof(fixed_portion))
+		BUG("checkout worker received too short item (got %d bytes, expected at least %d)",
+		    len, (int)sizeof(fixed_portion));
+
+	/* the packet buffer is not necessarily aligned */
+	memcpy(&fixed_portion, buffer, sizeof(fixed_portion));
+
+	if (len - sizeof(fixed_portion) !=
+	    fixed_portion.name_len + fixed_portion.working_tree_encoding_len)
+		BUG("checkout worker received corrupted item");
+
+	variant = buffer + sizeof(fixed_portion);
+
+	if (fixed_portion.working_tree_encoding_len) {
+		encoding = xmemdupz(variant,
+				    fixed_portion.working_tree_encoding_len);
+		variant += fixed_portion.working_tree_encoding_len;
+	} else {
+		encoding = NULL;
+	}
+
+	memset(pc_item, 0, sizeof(*pc_item));
+	pc_item->ce = make_empty_transient_cache_entry(fixed_portion.name_len);
+	pc_item->ce->ce_namelen = fixed_portion.name_len;
+	pc_item->ce->ce_mode = fixed_portion.ce_mode;
+	memcpy(pc_item->ce->name, variant, pc_item->ce->ce_namelen);
+	oidcpy(&pc_item->ce->oid, &fixed_portion.oid);
+
+	pc_item->id = fixed_portion.id;
+	pc_item->ca.crlf_action = fixed_portion.crlf_action;
+	pc_item->ca.ident = fixed_portion.ident;
+	pc_item->ca.working_tree_encoding = encoding;
+}
+
+static void report_result(struct parallel_checkout_item *pc_item)
+{
+	struct pc_item_result res;
+
+	memset(&res, 0, sizeof(res));
+	res.id = pc_item->id;
+	res.status = pc_item->status;
+	if (pc_item->status == PC_ITEM_WRITTEN)
+		res.st = pc_item->st;
+
+	packet_write(1, (const char *)&res, sizeof(res));
+}
+
+static void worker_loop(struct checkout *state)
+{
+	struct parallel_checkout_item *items = NULL;
+	size_t i, nr = 0, alloc = 0;
+
+	/*
+	 * Read all the items before writing anything back, so that the
+	 * main process can send them without waiting on us.
+	 */
+	while (1) {
+		int len = packet_read(0, NULL, NULL, packet_buffer,
+				      sizeof(packet_buffer), 0);
+
+		if (!len)
+			break; /* flush */
+
+		ALLOC_GROW(items, nr + 1, alloc);
+		packet_to_pc_item(packet_buffer, len, &items[nr++]);
+	}
+
+	for (i = 0; i < nr; i++) {
+		struct parallel_checkout_item *pc_item = &items[i];
+		write_pc_item(pc_item, state);
+		report_result(pc_item);
+		discard_cache_entry(pc_item->ce);
+		free((char *)pc_item->ca.working_tree_encoding);
+	}
+
+	packet_flush(1);
+	free(items);
+}
+
+static const char * const checkout_worker_usage[] = {
+	N_("git checkout--worker"),
+	NULL
+};
+
+int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
+{
+	struct checkout state = CHECKOUT_INIT;
+	struct option checkout_worker_options[] = {
+		OPT_END()
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(checkout_worker_usage,
+				   checkout_worker_options);
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, checkout_worker_options,
+			     checkout_worker_usage, 0);
+	if (argc > 0)
+		usage_with_options(checkout_worker_usage, checkout_worker_options);
+
+	/* the main process decides whether to use the stat data */
+	state.refresh_cache = 1;
+
+	worker_loop(&state);
+	return 0;
+}
@@ -0,0 +1,58 @@
+#include "cache.h"
+#include "config.h"
+#include "builtin.h"
+#include "parse-options.h"
+#include "run-command.h"
+#include "string-list.h"
+
+static const char * const for_each_repo_usage[] = {
+	N_("git for-each-repo --config=<config> <command-args>"),
+	NULL
+};
+
+static int run_command_on_repo(const char *path,
+			       const struct argv_array *args)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	child.git_cmd = 1;
+	argv_array_pushl(&child.args, "-C", path, NULL);
+	argv_array_pushv(&child.args, args->argv);
+
+	return run_command(&child);
+}
+
+int cmd_for_each_repo(int argc, const char **argv, const char *prefix)
+{
+	static const char *config_key = NULL;
+	int i, result = 0;
+	const struct string_list *values;
+	struct argv_array args = ARGV_ARRAY_INIT;
+
+	const struct option options[] = {
+		OPT_STRING(0, "config", &config_key, N_("config"),
+			   N_("config key storing a list of repository paths")),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, options, for_each_repo_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+
+	if (!config_key)
+		die(_("missing --config=<config>"));
+
+	argv_array_pushv(&args, argv);
+
+	values = git_config_get_value_multi(config_key);
+
+	/*
+	 * Do as many as possible: a failure in one repository is
+	 * reported, but does not stop the others.
+	 */
+	for (i = 0; values && i < values->nr; i++)
+		if (run_command_on_repo(values->items[i].string, &args))
+			result = 1;
+
+	argv_array_clear(&args);
+	return result;
+}
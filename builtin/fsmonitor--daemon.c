@@ -0,0 +1,655 @@
+#include "builtin.h"
+#include "config.h"
+#include "parse-options.h"
+#include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
+#include "run-command.h"
+#include "argv-array.h"
+
+static const char * const builtin_fsmonitor__daemon_usage[] = {
+	N_("git fsmonitor--daemon (start|run|stop|status)"),
+	NULL
+};
+
+#ifdef HAVE_FSMONITOR_DAEMON
+
+#include <sys/inotify.h>
+#include "dir.h"
+#include "hashmap.h"
+#include "tempfile.h"
+#include "unix-socket.h"
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+		    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+		    IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+/*
+ * Clients compute their tokens with their own getnanotime(), which may be
+ * calibrated slightly differently from ours; report a little more than
+ * asked for rather than miss a change.
+ */
+#define TOKEN_SLACK_NS ((uint64_t)1000 * 1000 * 1000)
+
+/*
+ * The journal only grows while the daemon runs, as every path that
+ * ever changed (including temporary files long gone) keeps its entry.
+ * Past this many entries it is dropped, and clients with older tokens
+ * rescan everything, as after the kernel dropped events.
+ */
+#define JOURNAL_MAX_ENTRIES (1 << 18)
+
+/*
+ * How long a client may take to send its request and to read our
+ * response. Clients are served one at a time, so one that stalls holds
+ * up everybody else until then.
+ */
+#define CLIENT_TIMEOUT_MS 1000
+
+/* Requests are a single short line; anything longer is bogus. */
+#define MAX_REQUEST_SIZE 256
+
+/*
+ * The change journal: for each path that changed since the daemon
+ * started, the time of the last change. Directories that went away are
+ * recorded with a trailing slash.
+ */
+struct changed_path {
+	struct hashmap_entry ent;
+	uint64_t time;
+	char path[FLEX_ARRAY];
+};
+
+static struct hashmap changed_paths;
+
+/* Clients with a token older than this must rescan everything. */
+static uint64_t journal_start;
+
+static int inotify_fd = -1;
+
+/*
+ * The absolute path of the worktree, with a trailing slash. The daemon
+ * does not keep its cwd there, as that would keep the kernel from ever
+ * reporting the deletion of the worktree.
+ */
+static struct strbuf worktree_root = STRBUF_INIT;
+
+/*
+ * The directory watched by each watch descriptor, relative to the
+ * worktree: "" for its root, otherwise with a trailing slash.
+ */
+static char **watched_dirs;
+static int watched_dirs_alloc;
+
+static struct tempfile *socket_file;
+
+/*
+ * The directory holding our socket. The bound socket keeps that
+ * directory (and so a worktree containing it) alive in the kernel, so a
+ * removed worktree is noticed through the removal of the socket instead.
+ */
+static int socket_dir_wd = -1;
+static const char *socket_name;
+
+static int changed_path_cmp(const void *unused_cmp_data,
+			    const void *entry,
+			    const void *entry_or_key,
+			    const void *keydata)
+{
+	const struct changed_path *a = entry;
+	const struct changed_path *b = entry_or_key;
+
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+/*
+ * Forget all changes recorded so far, without rescanning the worktree:
+ * clients holding older tokens get told to check everything.
+ */
+static void truncate_journal(void)
+{
+	hashmap_free(&changed_paths, 1);
+	hashmap_init(&changed_paths, changed_path_cmp, NULL, 0);
+	journal_start = getnanotime();
+}
+
+static void record_change(const char *path)
+{
+	struct hashmap_entry key;
+	struct changed_path *e;
+	unsigned int hash = strhash(path);
+
+	hashmap_entry_init(&key, hash);
+	e = hashmap_get(&changed_paths, &key, path);
+	if (!e) {
+		if (hashmap_get_size(&changed_paths) >= JOURNAL_MAX_ENTRIES)
+			truncate_journal();
+		FLEX_ALLOC_STR(e, path, path);
+		hashmap_entry_init(e, hash);
+		hashmap_add(&changed_paths, e);
+	}
+	e->time = getnanotime();
+}
+
+static void set_watched_dir(int wd, const char *dir)
+{
+	if (wd >= watched_dirs_alloc) {
+		int old_alloc = watched_dirs_alloc;
+
+		ALLOC_GROW(watched_dirs, wd + 1, watched_dirs_alloc);
+		memset(watched_dirs + old_alloc, 0,
+		       (watched_dirs_alloc - old_alloc) * sizeof(*watched_dirs));
+	}
+	free(watched_dirs[wd]);
+	watched_dirs[wd] = dir ? xstrdup(dir) : NULL;
+}
+
+/*
+ * Watch the directory 'rel' (relative to the worktree, "" or with a
+ * trailing slash) and everything below it. With 'report', also record
+ * everything found as changed, as is needed for a directory that just
+ * appeared.
+ */
+static void watch_directory(struct strbuf *rel, int report)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t len = rel->len, path_len;
+	struct dirent *de;
+	DIR *dir;
+	int wd;
+
+	strbuf_addbuf(&path, &worktree_root);
+	strbuf_addbuf(&path, rel);
+	path_len = path.len;
+
+	wd = inotify_add_watch(inotify_fd, path.buf, WATCH_MASK);
+	if (wd < 0) {
+		if (errno == ENOENT || errno == ENOTDIR)
+			goto out; /* raced with a deletion */
+		if (errno == ENOSPC)
+			die(_("too many directories to watch; consider raising "
+			      "fs.inotify.max_user_watches"));
+		die_errno(_("unable to watch '%s'"), path.buf);
+	}
+	set_watched_dir(wd, rel->buf);
+
+	if (report && len)
+		record_change(rel->buf);
+
+	dir = opendir(path.buf);
+	if (!dir)
+		goto out;
+	while ((de = readdir(dir)) != NULL) {
+		struct stat st;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		if (!len && !fspathcmp(de->d_name, ".git"))
+			continue;
+
+		strbuf_setlen(&path, path_len);
+		strbuf_addstr(&path, de->d_name);
+		if (lstat(path.buf, &st))
+			continue;
+
+		strbuf_setlen(rel, len);
+		strbuf_addstr(rel, de->d_name);
+		if (S_ISDIR(st.st_mode)) {
+			strbuf_addch(rel, '/');
+			watch_directory(rel, report);
+		} else if (report)
+			record_change(rel->buf);
+	}
+	strbuf_setlen(rel, len);
+	closedir(dir);
+out:
+	strbuf_release(&path);
+}
+
+/* Stop watching 'prefix' (with a trailing slash) and everything below. */
+static void forget_directory(const char *prefix)
+{
+	int wd;
+
+	for (wd = 0; wd < watched_dirs_alloc; wd++) {
+		if (!watched_dirs[wd] || !starts_with(watched_dirs[wd], prefix))
+			continue;
+		inotify_rm_watch(inotify_fd, wd);
+		FREE_AND_NULL(watched_dirs[wd]);
+	}
+}
+
+/*
+ * Forget everything and rescan, e.g. after the kernel dropped events:
+ * clients holding older tokens get told to check everything.
+ */
+static void reset_journal(void)
+{
+	struct strbuf root = STRBUF_INIT;
+	int wd;
+
+	for (wd = 0; wd < watched_dirs_alloc; wd++) {
+		if (!watched_dirs[wd])
+			continue;
+		inotify_rm_watch(inotify_fd, wd);
+		FREE_AND_NULL(watched_dirs[wd]);
+	}
+	watch_directory(&root, 0);
+	truncate_journal();
+	strbuf_release(&root);
+}
+
+static void handle_event(const struct inotify_event *ev)
+{
+	struct strbuf path = STRBUF_INIT;
+	const char *dir;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		reset_journal();
+		return;
+	}
+
+	if (ev->wd == socket_dir_wd &&
+	    ((ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) ||
+	     (ev->len && !strcmp(ev->name, socket_name)))) {
+		/* nobody can reach us anymore */
+		delete_tempfile(&socket_file);
+		exit(0);
+	}
+
+	if (ev->wd < 0 || ev->wd >= watched_dirs_alloc ||
+	    !watched_dirs[ev->wd])
+		return;
+	dir = watched_dirs[ev->wd];
+
+	if (ev->mask & IN_IGNORED) {
+		FREE_AND_NULL(watched_dirs[ev->wd]);
+		return;
+	}
+	if (!*dir && (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF))) {
+		/* the worktree itself is gone; nothing left to watch */
+		delete_tempfile(&socket_file);
+		exit(0);
+	}
+	if (!ev->len)
+		return; /* reported by the parent directory */
+	if (!*dir && !fspathcmp(ev->name, ".git"))
+		return;
+
+	strbuf_addf(&path, "%s%s", dir, ev->name);
+	if (ev->mask & IN_ISDIR) {
+		strbuf_addch(&path, '/');
+		if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			forget_directory(path.buf);
+			record_change(path.buf);
+		}
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+			watch_directory(&path, 1);
+	} else
+		record_change(path.buf);
+
+	strbuf_release(&path);
+}
+
+/* Process all pending events without blocking. */
+static void handle_events(void)
+{
+	union {
+		struct inotify_event ev;
+		char buf[4096 + sizeof(struct inotify_event) + NAME_MAX + 1];
+	} u;
+
+	for (;;) {
+		ssize_t len = read(inotify_fd, u.buf, sizeof(u.buf));
+		char *p;
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			die_errno(_("unable to read filesystem events"));
+		}
+
+		for (p = u.buf; p < u.buf + len; ) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			handle_event(ev);
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+}
+
+static void answer_query(uint64_t since, struct strbuf *out)
+{
+	struct hashmap_iter iter;
+	struct changed_path *e;
+
+	/* the response starts with the current token */
+	strbuf_addf(out, "%"PRIuMAX, (uintmax_t)getnanotime());
+	strbuf_addch(out, '\0');
+
+	if (since < journal_start) {
+		strbuf_addch(out, '/');
+		return;
+	}
+
+	since = since > TOKEN_SLACK_NS ? since - TOKEN_SLACK_NS : 0;
+	hashmap_iter_init(&changed_paths, &iter);
+	while ((e = hashmap_iter_next(&iter))) {
+		if (e->time < since)
+			continue;
+		strbuf_addstr(out, e->path);
+		strbuf_addch(out, '\0');
+	}
+}
+
+/*
+ * Wait until 'fd' is ready for 'events', but not past 'deadline' (in
+ * getnanotime() units). Returns 0 when it is ready, -1 on timeout.
+ */
+static int wait_for_client(int fd, short events, uint64_t deadline)
+{
+	for (;;) {
+		struct pollfd pfd;
+		uint64_t now = getnanotime();
+		int r;
+
+		if (now >= deadline)
+			return -1;
+		pfd.fd = fd;
+		pfd.events = events;
+		r = poll(&pfd, 1, (deadline - now) / 1000000 + 1);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		return 0;
+	}
+}
+
+/*
+ * Read the request of a non-blocking client, up to EOF. Returns -1 if
+ * the client does not finish sending it in time.
+ */
+static int read_request(int fd, struct strbuf *request, uint64_t deadline)
+{
+	for (;;) {
+		char buf[MAX_REQUEST_SIZE];
+		ssize_t len;
+
+		if (wait_for_client(fd, POLLIN, deadline))
+			return error("client did not send its request in time");
+		len = read(fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == EWOULDBLOCK)
+				continue;
+			return error_errno("unable to read request");
+		}
+		if (!len)
+			return 0;
+		strbuf_add(request, buf, len);
+		if (request->len > MAX_REQUEST_SIZE)
+			return error("client sent an oversized request");
+	}
+}
+
+/* Write the response to a non-blocking client, giving up on timeout. */
+static int write_response(int fd, const struct strbuf *response,
+			  uint64_t deadline)
+{
+	const char *p = response->buf;
+	size_t left = response->len;
+
+	while (left) {
+		ssize_t len;
+
+		if (wait_for_client(fd, POLLOUT, deadline))
+			return error("client did not read the response in time");
+		len = write(fd, p, left);
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == EWOULDBLOCK)
+				continue;
+			return error_errno("unable to write response");
+		}
+		p += len;
+		left -= len;
+	}
+	return 0;
+}
+
+static void serve_one_client(int listen_fd)
+{
+	uint64_t deadline;
+	int flags;
+
+	struct strbuf request = STRBUF_INIT;
+	struct strbuf response = STRBUF_INIT;
+	const char *arg;
+	int client;
+
+	client = accept(listen_fd, NULL, NULL);
+	if (client < 0) {
+		warning_errno("accept failed");
+		return;
+	}
+
+	/* do not let a stalled client block us for everybody else */
+	flags = fcntl(client, F_GETFL);
+	if (flags < 0 || fcntl(client, F_SETFL, flags | O_NONBLOCK) < 0) {
+		warning_errno("unable to make client socket non-blocking");
+		goto out;
+	}
+	deadline = getnanotime() + (uint64_t)CLIENT_TIMEOUT_MS * 1000000;
+
+	if (read_request(client, &request, deadline) < 0)
+		goto out;
+	strbuf_trim_trailing_newline(&request);
+
+	/* make sure we know about everything that happened up to now */
+	handle_events();
+
+	if (skip_prefix(request.buf, "query ", &arg)) {
+		char *end;
+		uint64_t since = strtoumax(arg, &end, 10);
+
+		if (*end)
+			warning("client sent bogus token: %s", arg);
+		else
+			answer_query(since, &response);
+	} else if (!strcmp(request.buf, "status")) {
+		strbuf_addf(&response, _("fsmonitor-daemon is watching '%s'\n"),
+			    get_git_work_tree());
+	} else if (!strcmp(request.buf, "stop")) {
+		/*
+		 * Remove the socket before the client sees EOF, so that
+		 * "stop" returns only once the daemon is gone.
+		 */
+		delete_tempfile(&socket_file);
+		exit(0);
+	} else
+		warning("client sent unknown request: %s", request.buf);
+
+	write_response(client, &response, deadline);
+out:
+	close(client);
+	strbuf_release(&request);
+	strbuf_release(&response);
+}
+
+static void close_inherited_fds(void)
+{
+	DIR *dir = opendir("/proc/self/fd");
+	struct dirent *de;
+	int *fds = NULL;
+	int nr = 0, alloc = 0, i;
+
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		int fd = atoi(de->d_name);
+
+		if (fd < 3 || fd == dirfd(dir))
+			continue;
+		ALLOC_GROW(fds, nr + 1, alloc);
+		fds[nr++] = fd;
+	}
+	closedir(dir);
+
+	for (i = 0; i < nr; i++)
+		close(fds[i]);
+	free(fds);
+}
+
+static int fsmonitor_run_daemon(void)
+{
+	const char *socket_path = fsmonitor_ipc_get_path();
+	struct strbuf root = STRBUF_INIT;
+	int listen_fd;
+
+	if (!fsmonitor_ipc_send_command("status", &root))
+		die(_("fsmonitor--daemon is already running"));
+	strbuf_reset(&root);
+
+	/*
+	 * We outlive the command that started us; do not keep its pipes
+	 * open (e.g. "git status | less" would never see EOF).
+	 */
+	close_inherited_fds();
+
+	strbuf_add_absolute_path(&worktree_root, get_git_work_tree());
+	strbuf_addch(&worktree_root, '/');
+
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0)
+		die_errno(_("unable to initialize inotify"));
+
+	hashmap_init(&changed_paths, changed_path_cmp, NULL, 0);
+	watch_directory(&root, 0);
+	journal_start = getnanotime();
+
+	socket_file = register_tempfile(socket_path);
+	listen_fd = unix_stream_listen(socket_path);
+	if (listen_fd < 0)
+		die_errno(_("unable to bind to '%s'"), socket_path);
+
+	socket_name = find_last_dir_sep(socket_path) + 1;
+	strbuf_add(&root, socket_path, socket_name - socket_path);
+	socket_dir_wd = inotify_add_watch(inotify_fd, root.buf,
+					  IN_DELETE | IN_MOVED_FROM |
+					  IN_DELETE_SELF | IN_MOVE_SELF |
+					  IN_ONLYDIR | IN_MASK_ADD);
+	if (socket_dir_wd < 0)
+		die_errno(_("unable to watch '%s'"), root.buf);
+	strbuf_release(&root);
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGHUP, SIG_IGN);
+
+	/* see worktree_root */
+	if (chdir("/"))
+		die_errno(_("unable to leave the worktree"));
+
+	printf("ok\n");
+	fclose(stdout);
+	if (!freopen("/dev/null", "w", stderr))
+		die_errno("unable to point stderr to /dev/null");
+
+	for (;;) {
+		struct pollfd pfd[2];
+
+		pfd[0].fd = inotify_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = listen_fd;
+		pfd[1].events = POLLIN;
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die_errno("poll failed");
+		}
+
+		if (pfd[0].revents & POLLIN)
+			handle_events();
+		if (pfd[1].revents & POLLIN)
+			serve_one_client(listen_fd);
+	}
+}
+
+static int fsmonitor_start_daemon(void)
+{
+	struct child_process daemon = CHILD_PROCESS_INIT;
+	struct strbuf answer = STRBUF_INIT;
+	char buf[128];
+	int r;
+
+	if (!fsmonitor_ipc_send_command("status", &answer)) {
+		strbuf_release(&answer);
+		return error(_("fsmonitor--daemon is already running"));
+	}
+
+	argv_array_pushl(&daemon.args, "fsmonitor--daemon", "run", NULL);
+	daemon.git_cmd = 1;
+	daemon.no_stdin = 1;
+	daemon.out = -1;
+
+	if (start_command(&daemon))
+		die_errno(_("unable to start fsmonitor daemon"));
+	r = read_in_full(daemon.out, buf, sizeof(buf));
+	if (r < 0)
+		die_errno(_("unable to read result code from fsmonitor daemon"));
+	if (r != 3 || memcmp(buf, "ok\n", 3))
+		die(_("fsmonitor daemon did not start: %.*s"), (int)r, buf);
+	close(daemon.out);
+	return 0;
+}
+
+#endif
+
+int cmd_fsmonitor__daemon(int argc, const char **argv, const char *prefix)
+{
+	struct strbuf answer = STRBUF_INIT;
+	const char *subcmd;
+	struct option options[] = {
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_fsmonitor__daemon_usage, 0);
+	if (argc != 1)
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+	subcmd = argv[0];
+
+	if (!fsmonitor_ipc_is_supported())
+		die(_("fsmonitor--daemon is not supported on this platform"));
+
+#ifdef HAVE_FSMONITOR_DAEMON
+	if (!strcmp(subcmd, "start"))
+		return fsmonitor_start_daemon() ? 1 : 0;
+	if (!strcmp(subcmd, "run"))
+		return fsmonitor_run_daemon() ? 1 : 0;
+#endif
+
+	if (!strcmp(subcmd, "stop")) {
+		if (fsmonitor_ipc_send_command("stop", &answer) < 0) {
+			error(_("fsmonitor--daemon is not running"));
+			return 1;
+		}
+		strbuf_release(&answer);
+		return 0;
+	}
+
+	if (!strcmp(subcmd, "status")) {
+		if (fsmonitor_ipc_send_command("status", &answer) < 0) {
+			printf(_("fsmonitor-daemon is not watching '%s'\n"),
+			       get_git_work_tree());
+			return 1;
+		}
+		fputs(answer.buf, stdout);
+		strbuf_release(&answer);
+		return 0;
+	}
+
+	die(_("unrecognized subcommand: %s"), subcmd);
+}
@@ -17,12 +17,14 @@
 #include "run-command.h"
 #include "userdiff.h"
 #include "grep.h"
+#include "grep-index.h"
 #include "quote.h"
 #include "dir.h"
 #include "pathspec.h"
 #include "submodule.h"
 #include "submodule-config.h"
 #include "object-store.h"
+#include "sha1-array.h"
 
 static char const * const grep_usage[] = {
 	N_("git grep [<options>] [-e] <pattern> [<rev>...] [[--] <path>...]"),
@@ -194,6 +196,9 @@ static void strbuf_out(struct grep_opt *opt, const void *buf, size_t size)
 	strbuf_add(&w->out, buf, size);
 }
 
+/* Whether start_threads() made object reads concurrent. */
+static int concurrent_object_reads;
+
 static void start_threads(struct grep_opt *opt)
 {
 	int i;
@@ -206,6 +211,15 @@ static void start_threads(struct grep_opt *opt)
 	pthread_cond_init(&cond_result, NULL);
 	grep_use_locks = 1;
 
+	/*
+	 * Let the workers read blobs without grep_read_mutex, unless we
+	 * are going to add submodule alternates while they run.
+	 */
+	if (!recurse_submodules && startup_info->have_repository) {
+		enable_concurrent_object_reads(the_repository);
+		concurrent_object_reads = 1;
+	}
+
 	for (i = 0; i < ARRAY_SIZE(todo); i++) {
 		strbuf_init(&todo[i].out, 0);
 	}
@@ -255,6 +269,11 @@ static int wait_all(void)
 
 	free(threads);
 
+	if (concurrent_object_reads) {
+		disable_concurrent_object_reads(the_repository);
+		concurrent_object_reads = 0;
+	}
+
 	pthread_mutex_destroy(&grep_mutex);
 	pthread_mutex_destroy(&grep_read_mutex);
 	pthread_mutex_destroy(&grep_attr_mutex);
@@ -447,9 +466,8 @@ static int grep_submodule(struct grep_opt *opt, struct repository *superproject,
 		unsigned long size;
 		struct strbuf base = STRBUF_INIT;
 
-		object = parse_object_or_die(oid, oid_to_hex(oid));
-
 		grep_read_lock();
+		object = parse_object_or_die(oid, oid_to_hex(oid));
 		data = read_object_with_reference(&object->oid, tree_type,
 						  &size, NULL);
 		grep_read_unlock();
@@ -644,6 +662,12 @@ static int grep_objects(struct grep_opt *opt, const struct pathspec *pathspec,
 
 	for (i = 0; i < nr; i++) {
 		struct object *real_obj;
+
+		/*
+		 * The worker threads may be reading blobs of the previous
+		 * revision meanwhile.
+		 */
+		grep_read_lock();
 		real_obj = deref_tag(the_repository, list->objects[i].item,
 				     NULL, 0);
 
@@ -652,6 +676,8 @@ static int grep_objects(struct grep_opt *opt, const struct pathspec *pathspec,
 			submodule_free(the_repository);
 			gitmodules_config_oid(&real_obj->oid);
 		}
+		grep_read_unlock();
+
 		if (grep_object(opt, pathspec, real_obj, list->objects[i].name,
 				list->objects[i].path)) {
 			hit = 1;
@@ -778,6 +804,36 @@ static int pattern_callback(const struct option *opt, const char *arg,
 	return 0;
 }
 
+/*
+ * "git grep --build-index [<tree>...]": add the blobs of the given
+ * trees (or of HEAD) to the grep index.
+ */
+static int build_grep_index(int argc, const char **argv)
+{
+	struct oid_array trees = OID_ARRAY_INIT;
+	const char *head = "HEAD";
+	int i;
+
+	if (!argc) {
+		argv = &head;
+		argc = 1;
+	}
+	for (i = 0; i < argc; i++) {
+		struct object_id oid;
+		struct tree *tree;
+
+		if (get_oid(argv[i], &oid) ||
+		    !(tree = parse_tree_indirect(&oid)))
+			die(_("not a tree object: %s"), argv[i]);
+		oid_array_append(&trees, &tree->object.oid);
+	}
+
+	write_grep_index(the_repository, trees.oid, trees.nr,
+			 isatty(2) ? GREP_INDEX_PROGRESS : 0);
+	oid_array_clear(&trees);
+	return 0;
+}
+
 int cmd_grep(int argc, const char **argv, const char *prefix)
 {
 	int hit = 0;
@@ -792,6 +848,8 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	int i;
 	int dummy;
 	int use_index = 1;
+	int build_index = 0;
+	struct grep_index_query index_query = { NULL };
 	int pattern_type_arg = GREP_PATTERN_TYPE_UNSPECIFIED;
 	int allow_revs;
 
@@ -806,6 +864,8 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 			    N_("ignore files specified via '.gitignore'"), 1),
 		OPT_BOOL(0, "recurse-submodules", &recurse_submodules,
 			 N_("recursively search in each submodule")),
+		OPT_BOOL(0, "build-index", &build_index,
+			 N_("index the blobs of the given trees to speed up later searches")),
 		OPT_GROUP(""),
 		OPT_BOOL('v', "invert-match", &opt.invert,
 			N_("show non-matching lines")),
@@ -944,6 +1004,12 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 			setup_git_directory();
 	}
 
+	if (build_index) {
+		if (!use_index)
+			die(_("--build-index cannot be used with --no-index"));
+		return build_grep_index(argc, argv);
+	}
+
 	/*
 	 * skip a -- separator; we know it cannot be
 	 * separating revisions from pathnames if
@@ -1046,7 +1112,7 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	pathspec.recursive = 1;
 	pathspec.recurse_submodules = !!recurse_submodules;
 
-	if (list.nr || cached || show_in_pager) {
+	if (show_in_pager) {
 		if (num_threads > 1)
 			warning(_("invalid option combination, ignoring --threads"));
 		num_threads = 1;
@@ -1058,6 +1124,12 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	else if (num_threads == 0)
 		num_threads = HAVE_THREADS ? GREP_NUM_THREADS_DEFAULT : 1;
 
+	if (use_index && !untracked && (cached || list.nr)) {
+		opt.index = load_grep_index(the_repository);
+		if (opt.index && !compile_grep_index_query(&opt, &index_query))
+			opt.index_query = &index_query;
+	}
+
 	if (num_threads > 1) {
 		if (!HAVE_THREADS)
 			BUG("Somebody got num_threads calculation wrong!");
@@ -1131,5 +1203,7 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		run_pager(&opt, prefix);
 	clear_pathspec(&pathspec);
 	free_grep_patterns(&opt);
+	clear_grep_index_query(&index_query);
+	close_grep_index(opt.index);
 	return !hit;
 }
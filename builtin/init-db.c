@@ -227,6 +227,14 @@ static int create_default_files(const char *template_path,
 	safe_create_dir(git_path("refs"), 1);
 	adjust_shared_perm(git_path("refs"));
 
+	/*
+	 * Check for an existing HEAD before setting up the refs db,
+	 * which might write one.
+	 */
+	path = git_path_buf(&buf, "HEAD");
+	reinit = (!access(path, R_OK)
+		  || readlink(path, junk, sizeof(junk)-1) != -1);
+
 	if (refs_init_db(&err))
 		die("failed to set up refs db: %s", err.buf);
 
@@ -234,9 +242,6 @@ static int create_default_files(const char *template_path,
 	 * Create the default symlink from ".git/HEAD" to the "master"
 	 * branch, if it does not exist yet.
 	 */
-	path = git_path_buf(&buf, "HEAD");
-	reinit = (!access(path, R_OK)
-		  || readlink(path, junk, sizeof(junk)-1) != -1);
 	if (!reinit) {
 		if (create_symref("HEAD", "refs/heads/master", NULL) < 0)
 			exit(1);
@@ -244,8 +249,12 @@ static int create_default_files(const char *template_path,
 
 	/* This forces creation of new config file */
 	xsnprintf(repo_version_string, sizeof(repo_version_string),
-		  "%d", GIT_REPO_VERSION);
+		  "%d", the_repository->ref_storage_format ?
+		  GIT_REPO_VERSION_READ : GIT_REPO_VERSION);
 	git_config_set("core.repositoryformatversion", repo_version_string);
+	if (the_repository->ref_storage_format)
+		git_config_set("extensions.refstorage",
+			       the_repository->ref_storage_format);
 
 	/* Check filemode trustability */
 	path = git_path_buf(&buf, "config");
@@ -338,8 +347,36 @@ static void separate_git_dir(const char *git_dir, const char *git_link)
 	write_file(git_link, "gitdir: %s", git_dir);
 }
 
+/*
+ * Pick the ref storage format of the repository: an existing one
+ * keeps its own, and a new one uses `ref_format`, or the default.
+ */
+static void set_ref_storage_format(const char *ref_format)
+{
+	const char *existing = the_repository->ref_storage_format;
+
+	if (!access(git_path("HEAD"), F_OK)) {
+		if (ref_format &&
+		    strcmp(ref_format, existing ? existing : "files"))
+			die(_("attempt to reinitialize repository with a "
+			      "different ref storage format"));
+		return;
+	}
+
+	if (!ref_format)
+		ref_format = getenv(DEFAULT_REF_FORMAT_ENVIRONMENT);
+	if (ref_format && !ref_storage_backend_exists(ref_format))
+		die(_("unknown ref storage format '%s'"), ref_format);
+
+	free(the_repository->ref_storage_format);
+	the_repository->ref_storage_format =
+		ref_format && strcmp(ref_format, "files") ?
+		xstrdup(ref_format) : NULL;
+}
+
 int init_db(const char *git_dir, const char *real_git_dir,
-	    const char *template_dir, unsigned int flags)
+	    const char *template_dir, const char *ref_format,
+	    unsigned int flags)
 {
 	int reinit;
 	int exist_ok = flags & INIT_DB_EXIST_OK;
@@ -377,6 +414,7 @@ int init_db(const char *git_dir, const char *real_git_dir,
 	 * is an attempt to reinitialize new repository with an old tool.
 	 */
 	check_repository_format();
+	set_ref_storage_format(ref_format);
 
 	reinit = create_default_files(template_dir, original_git_dir);
 
@@ -463,7 +501,7 @@ static int shared_callback(const struct option *opt, const char *arg, int unset)
 }
 
 static const char *const init_db_usage[] = {
-	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [<directory>]"),
+	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [--ref-format=<format>] [<directory>]"),
 	NULL
 };
 
@@ -479,6 +517,7 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 	const char *real_git_dir = NULL;
 	const char *work_tree;
 	const char *template_dir = NULL;
+	const char *ref_format = NULL;
 	unsigned int flags = 0;
 	const struct option init_db_options[] = {
 		OPT_STRING(0, "template", &template_dir, N_("template-directory"),
@@ -492,6 +531,8 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 		OPT_BIT('q', "quiet", &flags, N_("be quiet"), INIT_DB_QUIET),
 		OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
 			   N_("separate git dir from working tree")),
+		OPT_STRING(0, "ref-format", &ref_format, N_("format"),
+			   N_("specify the ref storage format to use")),
 		OPT_END()
 	};
 
@@ -590,5 +631,5 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 	UNLEAK(real_git_dir);
 
 	flags |= INIT_DB_EXIST_OK;
-	return init_db(git_dir, real_git_dir, template_dir, flags);
+	return init_db(git_dir, real_git_dir, template_dir, ref_format, flags);
 }
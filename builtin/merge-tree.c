@@ -7,8 +7,13 @@
 #include "exec-cmd.h"
 #include "merge-blobs.h"
 #include "config.h"
+#include "commit.h"
+#include "merge-ort.h"
+#include "quote.h"
 
-static const char merge_tree_usage[] = "git merge-tree <base-tree> <branch1> <branch2>";
+static const char merge_tree_usage[] =
+"git merge-tree <base-tree> <branch1> <branch2>\n"
+"   or: git merge-tree --write-tree <branch1> <branch2>";
 
 struct merge_list {
 	struct merge_list *next;
@@ -28,7 +33,7 @@ static void add_merge_entry(struct merge_list *entry)
 	merge_result_end = &entry->next;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base);
+static void trivial_merge_trees(struct tree_desc t[3], const char *base);
 
 static const char *explanation(struct merge_list *entry)
 {
@@ -224,7 +229,7 @@ static void unresolved_directory(const struct traverse_info *info,
 	buf2 = fill_tree_descriptor(t + 2, ENTRY_OID(n + 2));
 #undef ENTRY_OID
 
-	merge_trees(t, newbase);
+	trivial_merge_trees(t, newbase);
 
 	free(buf0);
 	free(buf1);
@@ -341,7 +346,7 @@ static int threeway_callback(int n, unsigned long mask, unsigned long dirmask, s
 	return mask;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base)
+static void trivial_merge_trees(struct tree_desc t[3], const char *base)
 {
 	struct traverse_info info;
 
@@ -363,11 +368,64 @@ static void *get_tree_descriptor(struct tree_desc *desc, const char *rev)
 	return buf;
 }
 
+/*
+ * Merge the two commits in memory, write the merged tree and show it,
+ * with the conflicts and the messages of the merge.
+ */
+static int real_merge(const char *branch1, const char *branch2)
+{
+	struct commit *parent1, *parent2;
+	struct merge_options opt;
+	struct merge_result result;
+	struct string_list_item *item;
+
+	parent1 = get_merge_parent(branch1);
+	if (!parent1)
+		die(_("'%s' does not point to a commit"), branch1);
+	parent2 = get_merge_parent(branch2);
+	if (!parent2)
+		die(_("'%s' does not point to a commit"), branch2);
+
+	init_merge_options(&opt);
+	opt.branch1 = branch1;
+	opt.branch2 = branch2;
+	/* the messages come after the conflicts */
+	opt.buffer_output = 2;
+
+	merge_incore_recursive(&opt, NULL, parent1, parent2, &result);
+	if (result.clean < 0)
+		die(_("failure to merge"));
+
+	puts(oid_to_hex(&result.tree->object.oid));
+	for_each_string_list_item(item, &result.conflicts) {
+		struct merge_conflict *c = item->util;
+		int i;
+
+		for (i = 0; i < 3; i++) {
+			if (!c->stages[i].mode)
+				continue;
+			printf("%06o %s %d\t", c->stages[i].mode,
+			       oid_to_hex(&c->stages[i].oid), i + 1);
+			write_name_quoted(item->string, stdout, '\n');
+		}
+	}
+	if (opt.obuf.len) {
+		putchar('\n');
+		fputs(opt.obuf.buf, stdout);
+	}
+
+	merge_finalize(&opt, &result);
+	strbuf_release(&opt.obuf);
+	return !result.clean;
+}
+
 int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 {
 	struct tree_desc t[3];
 	void *buf1, *buf2, *buf3;
 
+	if (argc == 4 && !strcmp(argv[1], "--write-tree"))
+		return real_merge(argv[2], argv[3]);
 	if (argc != 4)
 		usage(merge_tree_usage);
 
@@ -375,7 +433,7 @@ int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 	buf1 = get_tree_descriptor(t+0, argv[1]);
 	buf2 = get_tree_descriptor(t+1, argv[2]);
 	buf3 = get_tree_descriptor(t+2, argv[3]);
-	merge_trees(t, "");
+	trivial_merge_trees(t, "");
 	free(buf1);
 	free(buf2);
 	free(buf3);
@@ -27,6 +27,7 @@
 #include "rerere.h"
 #include "help.h"
 #include "merge-recursive.h"
+#include "merge-ort.h"
 #include "resolve-undo.h"
 #include "remote.h"
 #include "fmt-merge-msg.h"
@@ -85,6 +86,7 @@ static struct strategy all_strategy[] = {
 	{ "resolve",    0 },
 	{ "ours",       NO_FAST_FORWARD | NO_TRIVIAL },
 	{ "subtree",    NO_FAST_FORWARD | NO_TRIVIAL },
+	{ "ort",        NO_TRIVIAL },
 };
 
 static const char *pull_twohead, *pull_octopus;
@@ -441,15 +443,14 @@ static void finish(struct commit *head_commit,
 		if (verbosity >= 0 && !merge_msg.len)
 			printf(_("No merge message -- not updating HEAD\n"));
 		else {
-			const char *argv_gc_auto[] = { "gc", "--auto", NULL };
 			update_ref(reflog_message.buf, "HEAD", new_head, head,
 				   0, UPDATE_REFS_DIE_ON_ERR);
 			/*
-			 * We ignore errors in 'gc --auto', since the
-			 * user should see them.
+			 * We ignore errors in 'maintenance run --auto',
+			 * since the user should see them.
 			 */
 			close_all_packs(the_repository->objects);
-			run_command_v_opt(argv_gc_auto, RUN_GIT_CMD);
+			run_auto_maintenance(verbosity < 0);
 		}
 	}
 	if (new_head && show_diffstat) {
@@ -677,6 +678,30 @@ static void write_tree_trivial(struct object_id *oid)
 		die(_("git write-tree failed to write a tree"));
 }
 
+static int merge_ort(struct merge_options *o, struct commit *head,
+		     struct commit *remote, struct commit_list *common)
+{
+	struct merge_result result;
+	struct strbuf sb = STRBUF_INIT;
+	struct tree *head_tree = get_commit_tree(head);
+
+	if (index_has_changes(&the_index, head_tree, &sb)) {
+		error(_("Your local changes to the following files would be overwritten by merge:\n  %s"),
+		      sb.buf);
+		strbuf_release(&sb);
+		return -1;
+	}
+
+	merge_incore_recursive(o, common, head, remote, &result);
+	merge_switch_to_result(o, head_tree, &result, 1, 1);
+	if (o->verbosity >= 2)
+		diff_warn_rename_limit("merge.renamelimit",
+				       o->needed_rename_limit, 0);
+	merge_finalize(o, &result);
+	strbuf_release(&o->obuf);
+	return result.clean;
+}
+
 static int try_merge_strategy(const char *strategy, struct commit_list *common,
 			      struct commit_list *remoteheads,
 			      struct commit *head)
@@ -690,7 +715,11 @@ static int try_merge_strategy(const char *strategy, struct commit_list *common,
 			       COMMIT_LOCK | SKIP_IF_UNCHANGED))
 		return error(_("Unable to write index."));
 
-	if (!strcmp(strategy, "recursive") || !strcmp(strategy, "subtree")) {
+	if (!strcmp(strategy, "recursive") && merge_ort_by_default())
+		strategy = "ort";
+
+	if (!strcmp(strategy, "recursive") || !strcmp(strategy, "subtree") ||
+	    !strcmp(strategy, "ort")) {
 		int clean, x;
 		struct commit *result;
 		struct commit_list *reversed = NULL;
@@ -721,8 +750,11 @@ static int try_merge_strategy(const char *strategy, struct commit_list *common,
 			commit_list_insert(j->item, &reversed);
 
 		hold_locked_index(&lock, LOCK_DIE_ON_ERROR);
-		clean = merge_recursive(&o, head,
-				remoteheads->item, reversed, &result);
+		if (!strcmp(strategy, "ort") && !o.subtree_shift)
+			clean = merge_ort(&o, head, remoteheads->item, reversed);
+		else
+			clean = merge_recursive(&o, head,
+					remoteheads->item, reversed, &result);
 		if (clean < 0)
 			exit(128);
 		if (write_locked_index(&the_index, &lock,
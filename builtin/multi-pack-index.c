@@ -5,12 +5,14 @@
 #include "midx.h"
 
 static char const * const builtin_multi_pack_index_usage[] = {
-	N_("git multi-pack-index [--object-dir=<dir>] (write|verify)"),
+	N_("git multi-pack-index [--object-dir=<dir>] (write|verify|expire|repack --batch-size=<size>) [--bitmap]"),
 	NULL
 };
 
 static struct opts_multi_pack_index {
 	const char *object_dir;
+	int bitmap;
+	unsigned long batch_size;
 } opts;
 
 int cmd_multi_pack_index(int argc, const char **argv,
@@ -19,8 +21,13 @@ int cmd_multi_pack_index(int argc, const char **argv,
 	static struct option builtin_multi_pack_index_options[] = {
 		OPT_FILENAME(0, "object-dir", &opts.object_dir,
 		  N_("object directory containing set of packfile and pack-index pairs")),
+		OPT_BOOL(0, "bitmap", &opts.bitmap,
+			 N_("write a reachability bitmap for the multi-pack-index")),
+		OPT_MAGNITUDE(0, "batch-size", &opts.batch_size,
+		  N_("during repack, collect pack-files of smaller size into a batch that is larger than this size")),
 		OPT_END(),
 	};
+	unsigned flags;
 
 	git_config(git_default_config, NULL);
 
@@ -40,10 +47,23 @@ int cmd_multi_pack_index(int argc, const char **argv,
 		return 1;
 	}
 
+	flags = opts.bitmap ? MIDX_WRITE_BITMAP : 0;
+
+	if (!strcmp(argv[0], "repack"))
+		return midx_repack(opts.object_dir, (size_t)opts.batch_size,
+				   flags);
+	if (opts.batch_size)
+		die(_("--batch-size option is only for 'repack' verb"));
+
 	if (!strcmp(argv[0], "write"))
-		return write_midx_file(opts.object_dir);
-	if (!strcmp(argv[0], "verify"))
+		return write_midx_file(opts.object_dir, flags);
+	if (!strcmp(argv[0], "expire"))
+		return expire_midx_packs(opts.object_dir, flags);
+	if (!strcmp(argv[0], "verify")) {
+		if (opts.bitmap)
+			die(_("--bitmap cannot be used with 'verify'"));
 		return verify_midx_file(opts.object_dir);
+	}
 
 	die(_("unrecognized verb: %s"), argv[0]);
 }
@@ -11,6 +11,7 @@
 #include "delta.h"
 #include "pack.h"
 #include "pack-revindex.h"
+#include "pack-mtimes.h"
 #include "csum-file.h"
 #include "tree-walk.h"
 #include "diff.h"
@@ -70,6 +71,8 @@ static int reuse_delta = 1, reuse_object = 1;
 static int keep_unreachable, unpack_unreachable, include_tag;
 static timestamp_t unpack_unreachable_expiration;
 static int pack_loose_unreachable;
+static int cruft;
+static timestamp_t cruft_expiration;
 static int local;
 static int have_non_local_packs;
 static int incremental;
@@ -88,9 +91,10 @@ static int thin;
 static int num_preferred_base;
 static struct progress *progress_state;
 
-static struct packed_git *reuse_packfile;
+static struct bitmapped_pack *reuse_packs;
+static size_t reuse_packs_nr;
 static uint32_t reuse_packfile_objects;
-static off_t reuse_packfile_offset;
+static struct bitmap *reuse_packfile_bitmap;
 
 static int use_bitmap_index_default = 1;
 static int use_bitmap_index = -1;
@@ -398,7 +402,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 {
 	struct packed_git *p = IN_PACK(entry);
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	off_t offset;
 	enum object_type type = oe_type(entry);
 	off_t datalen;
@@ -415,10 +419,15 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 					      type, entry_size);
 
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	if (offset_to_pack_pos(p, offset, &pos) < 0)
+		die(_("write_reuse_object: could not locate %s, expected at "
+		      "offset %"PRIuMAX" in pack %s"),
+		    oid_to_hex(&entry->idx.oid), (uintmax_t)offset,
+		    p->pack_name);
+	datalen = pack_pos_to_offset(p, pos + 1) - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen,
+			   pack_pos_to_index(p, pos))) {
 		error(_("bad packed object CRC for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
@@ -778,63 +787,217 @@ static struct object_entry **compute_write_order(void)
 	return wo;
 }
 
-static off_t write_reused_pack(struct hashfile *f)
+/*
+ * The reused objects of one packfile are written in chunks of
+ * consecutive objects. Each chunk records the offset of its first
+ * object in the packfile, and how much further that is than its
+ * offset in the pack we are writing, so that OFS_DELTA objects can
+ * be fixed up when objects between them and their base are skipped.
+ */
+static struct reused_chunk {
+	off_t original;
+	off_t difference;
+} *reused_chunks;
+static int reused_chunks_nr;
+static int reused_chunks_alloc;
+
+static void record_reused_object(off_t where, off_t offset)
 {
-	unsigned char buffer[8192];
-	off_t to_write, total;
-	int fd;
+	if (reused_chunks_nr && reused_chunks[reused_chunks_nr-1].difference == offset)
+		return;
 
-	if (!is_pack_valid(reuse_packfile))
-		die(_("packfile is invalid: %s"), reuse_packfile->pack_name);
+	ALLOC_GROW(reused_chunks, reused_chunks_nr + 1,
+		   reused_chunks_alloc);
+	reused_chunks[reused_chunks_nr].original = where;
+	reused_chunks[reused_chunks_nr].difference = offset;
+	reused_chunks_nr++;
+}
 
-	fd = git_open(reuse_packfile->pack_name);
-	if (fd < 0)
-		die_errno(_("unable to open packfile for reuse: %s"),
-			  reuse_packfile->pack_name);
+/*
+ * Binary search to find the chunk that "where" is in. Note that we are
+ * not looking for an exact match, just the last chunk starting at or
+ * before it (which implicitly ends at the start of the next chunk).
+ */
+static off_t find_reused_offset(off_t where)
+{
+	int lo = 0, hi = reused_chunks_nr;
+	while (lo < hi) {
+		int mi = lo + ((hi - lo) / 2);
+		if (where == reused_chunks[mi].original)
+			return reused_chunks[mi].difference;
+		if (where < reused_chunks[mi].original)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
 
-	if (lseek(fd, sizeof(struct pack_header), SEEK_SET) == -1)
-		die_errno(_("unable to seek in reused packfile"));
+	/*
+	 * The base of a reused delta is reused too, so it comes after
+	 * the start of the first chunk.
+	 */
+	assert(lo);
+	return reused_chunks[lo-1].difference;
+}
 
-	if (reuse_packfile_offset < 0)
-		reuse_packfile_offset = reuse_packfile->pack_size - the_hash_algo->rawsz;
+/* Return the position in "pack" order of the reused object "pos". */
+static uint32_t reused_pack_pos(struct bitmapped_pack *pack, uint32_t pos,
+				off_t *offset)
+{
+	uint32_t pack_pos;
+
+	if (pack->bitmap_nr == pack->p->num_objects) {
+		pack_pos = pos - pack->bitmap_pos;
+		*offset = pack_pos_to_offset(pack->p, pack_pos);
+		return pack_pos;
+	}
 
-	total = to_write = reuse_packfile_offset - sizeof(struct pack_header);
+	*offset = bitmap_pos_to_offset(bitmap_git, pos);
+	if (offset_to_pack_pos(pack->p, *offset, &pack_pos) < 0)
+		die(_("unable to find reused object in %s"), pack->p->pack_name);
+	return pack_pos;
+}
 
-	while (to_write) {
-		int read_pack = xread(fd, buffer, sizeof(buffer));
+static off_t write_reused_pack_one(struct bitmapped_pack *pack, uint32_t pos,
+				   struct hashfile *out, off_t out_offset,
+				   struct pack_window **w_curs)
+{
+	struct packed_git *p = pack->p;
+	off_t offset, next, cur;
+	enum object_type type;
+	unsigned long size;
 
-		if (read_pack <= 0)
-			die_errno(_("unable to read from reused packfile"));
+	next = pack_pos_to_offset(p, reused_pack_pos(pack, pos, &offset) + 1);
 
-		if (read_pack > to_write)
-			read_pack = to_write;
+	record_reused_object(offset, offset - out_offset);
 
-		hashwrite(f, buffer, read_pack);
-		to_write -= read_pack;
+	cur = offset;
+	type = unpack_object_header(p, w_curs, &cur, &size);
+	assert(type >= 0);
 
-		/*
-		 * We don't know the actual number of objects written,
-		 * only how many bytes written, how many bytes total, and
-		 * how many objects total. So we can fake it by pretending all
-		 * objects we are writing are the same size. This gives us a
-		 * smooth progress meter, and at the end it matches the true
-		 * answer.
-		 */
-		written = reuse_packfile_objects *
-				(((double)(total - to_write)) / total);
-		display_progress(progress_state, written);
+	if (type == OBJ_OFS_DELTA) {
+		off_t base_offset;
+		off_t fixup;
+
+		base_offset = get_delta_base(p, w_curs, &cur, type, offset);
+		assert(base_offset != 0);
+
+		/* See if we need to rewrite the offset... */
+		fixup = find_reused_offset(offset) -
+			find_reused_offset(base_offset);
+		if (fixup) {
+			unsigned char header[MAX_PACK_OBJECT_HEADER];
+			unsigned char ofs_header[10];
+			unsigned i, len, ofs_len;
+			off_t ofs = offset - base_offset - fixup;
+
+			len = encode_in_pack_object_header(header, sizeof(header),
+							   OBJ_OFS_DELTA, size);
+
+			i = sizeof(ofs_header) - 1;
+			ofs_header[i] = ofs & 127;
+			while (ofs >>= 7)
+				ofs_header[--i] = 128 | (--ofs & 127);
+
+			ofs_len = sizeof(ofs_header) - i;
+
+			hashwrite(out, header, len);
+			hashwrite(out, ofs_header + sizeof(ofs_header) - ofs_len, ofs_len);
+			copy_pack_data(out, p, w_curs, cur, next - cur);
+			return out_offset + len + ofs_len + (next - cur);
+		}
+
+		/* ...otherwise we have no fixup, and can write it verbatim */
+	}
+
+	copy_pack_data(out, p, w_curs, offset, next - offset);
+	return out_offset + (next - offset);
+}
+
+/*
+ * If the reused objects of "pack" start with the first objects of the
+ * packfile, write them in one go, since no delta among them needs a
+ * fixup. Return the number of objects written.
+ */
+static uint32_t write_reused_pack_verbatim(struct bitmapped_pack *pack,
+					   struct hashfile *out,
+					   off_t *out_offset,
+					   struct pack_window **w_curs)
+{
+	uint32_t nr = 0, lo, hi;
+	off_t start = sizeof(struct pack_header), to_write;
+
+	while (nr < pack->bitmap_nr &&
+	       bitmap_get(reuse_packfile_bitmap, pack->bitmap_pos + nr))
+		nr++;
+
+	/*
+	 * Find the longest such run whose last object is also the nr-th
+	 * object of the packfile; since objects of a pack are in bitmap
+	 * order, the ones before it are then the first objects, too.
+	 */
+	lo = 0;
+	hi = nr;
+	while (lo < hi) {
+		uint32_t mi = hi - (hi - lo) / 2;
+		off_t offset;
+
+		if (reused_pack_pos(pack, pack->bitmap_pos + mi - 1, &offset) == mi - 1)
+			lo = mi;
+		else
+			hi = mi - 1;
 	}
+	if (!lo)
+		return 0;
+
+	to_write = pack_pos_to_offset(pack->p, lo) - start;
+
+	/* We're recording one chunk, not one object. */
+	record_reused_object(start, start - *out_offset);
+	copy_pack_data(out, pack->p, w_curs, start, to_write);
+	*out_offset += to_write;
 
-	close(fd);
-	written = reuse_packfile_objects;
+	written += lo;
 	display_progress(progress_state, written);
-	return reuse_packfile_offset - sizeof(struct pack_header);
+	return lo;
+}
+
+static off_t write_reused_pack(struct bitmapped_pack *pack,
+			       struct hashfile *f, off_t offset)
+{
+	struct pack_window *w_curs = NULL;
+	uint32_t pos, end = pack->bitmap_pos + pack->bitmap_nr;
+
+	if (!is_pack_valid(pack->p))
+		die(_("packfile is invalid: %s"), pack->p->pack_name);
+
+	reused_chunks_nr = 0;
+
+	pos = pack->bitmap_pos + write_reused_pack_verbatim(pack, f, &offset,
+							     &w_curs);
+	for (; pos < end; pos++) {
+		if (!bitmap_get(reuse_packfile_bitmap, pos))
+			continue;
+
+		offset = write_reused_pack_one(pack, pos, f, offset, &w_curs);
+		display_progress(progress_state, ++written);
+	}
+
+	unuse_pack(&w_curs);
+	return offset;
 }
 
 static const char no_split_warning[] = N_(
 "disabling bitmap writing, packs are split due to pack.packSizeLimit"
 );
 
+static int idx_entry_cmp(const void *va, const void *vb)
+{
+	const struct pack_idx_entry *a = *(const struct pack_idx_entry **)va;
+	const struct pack_idx_entry *b = *(const struct pack_idx_entry **)vb;
+
+	return oidcmp(&a->oid, &b->oid);
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
@@ -843,6 +1006,7 @@ static void write_pack_file(void)
 	uint32_t nr_remaining = nr_result;
 	time_t last_mtime = 0;
 	struct object_entry **write_order;
+	uint32_t *mtimes = NULL;
 
 	if (progress > pack_to_stdout)
 		progress_state = start_progress(_("Writing objects"), nr_result);
@@ -860,12 +1024,12 @@ static void write_pack_file(void)
 
 		offset = write_pack_header(f, nr_remaining);
 
-		if (reuse_packfile) {
-			off_t packfile_size;
+		if (reuse_packfile_bitmap) {
 			assert(pack_to_stdout);
 
-			packfile_size = write_reused_pack(f);
-			offset += packfile_size;
+			for (j = 0; j < reuse_packs_nr; j++)
+				offset = write_reused_pack(&reuse_packs[j], f,
+							   offset);
 		}
 
 		nr_written = 0;
@@ -926,8 +1090,17 @@ static void write_pack_file(void)
 					&to_pack, written_list, nr_written);
 			}
 
+			if (cruft) {
+				QSORT(written_list, nr_written, idx_entry_cmp);
+				REALLOC_ARRAY(mtimes, nr_written);
+				for (j = 0; j < nr_written; j++)
+					mtimes[j] = oe_cruft_mtime(&to_pack,
+						(struct object_entry *)written_list[j]);
+			}
+
 			finish_tmp_packfile(&tmpname, pack_tmp_name,
 					    written_list, nr_written,
+					    cruft ? mtimes : NULL,
 					    &pack_idx_opts, oid.hash);
 
 			if (write_bitmap_index) {
@@ -958,6 +1131,7 @@ static void write_pack_file(void)
 
 	free(written_list);
 	free(write_order);
+	free(mtimes);
 	stop_progress(&progress_state);
 	if (written != nr_result)
 		die(_("wrote %"PRIu32" objects while expecting %"PRIu32),
@@ -1596,11 +1770,11 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				uint32_t pos;
+				if (offset_to_pack_pos(p, ofs, &pos) < 0)
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p,
+						pack_pos_to_index(p, pos));
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
@@ -1953,11 +2127,6 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 	return 0;
 }
 
-/* Protect access to object database */
-static pthread_mutex_t read_mutex;
-#define read_lock()		pthread_mutex_lock(&read_mutex)
-#define read_unlock()		pthread_mutex_unlock(&read_mutex)
-
 /* Protect delta_cache_size */
 static pthread_mutex_t cache_mutex;
 #define cache_lock()		pthread_mutex_lock(&cache_mutex)
@@ -1993,11 +2162,9 @@ unsigned long oe_get_size_slow(struct packing_data *pack,
 	unsigned long used, avail, size;
 
 	if (e->type_ != OBJ_OFS_DELTA && e->type_ != OBJ_REF_DELTA) {
-		read_lock();
 		if (oid_object_info(the_repository, &e->idx.oid, &size) < 0)
 			die(_("unable to get size of %s"),
 			    oid_to_hex(&e->idx.oid));
-		read_unlock();
 		return size;
 	}
 
@@ -2005,7 +2172,6 @@ unsigned long oe_get_size_slow(struct packing_data *pack,
 	if (!p)
 		BUG("when e->type is a delta, it must belong to a pack");
 
-	read_lock();
 	w_curs = NULL;
 	buf = use_pack(p, &w_curs, e->in_pack_offset, &avail);
 	used = unpack_object_header_buffer(buf, avail, &type, &size);
@@ -2014,7 +2180,6 @@ unsigned long oe_get_size_slow(struct packing_data *pack,
 		    oid_to_hex(&e->idx.oid));
 
 	unuse_pack(&w_curs);
-	read_unlock();
 	return size;
 }
 
@@ -2076,9 +2241,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 
 	/* Load data if not already done */
 	if (!trg->data) {
-		read_lock();
 		trg->data = read_object_file(&trg_entry->idx.oid, &type, &sz);
-		read_unlock();
 		if (!trg->data)
 			die(_("object %s cannot be read"),
 			    oid_to_hex(&trg_entry->idx.oid));
@@ -2089,9 +2252,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		*mem_usage += sz;
 	}
 	if (!src->data) {
-		read_lock();
 		src->data = read_object_file(&src_entry->idx.oid, &type, &sz);
-		read_unlock();
 		if (!src->data) {
 			if (src_entry->preferred_base) {
 				static int warned = 0;
@@ -2335,15 +2496,6 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 	free(array);
 }
 
-static void try_to_free_from_threads(size_t size)
-{
-	read_lock();
-	release_pack_memory(size);
-	read_unlock();
-}
-
-static try_to_free_t old_try_to_free_routine;
-
 /*
  * The main object list is split into smaller lists, each is handed to
  * one worker.
@@ -2381,18 +2533,16 @@ static pthread_cond_t progress_cond;
  */
 static void init_threaded_search(void)
 {
-	init_recursive_mutex(&read_mutex);
 	pthread_mutex_init(&cache_mutex, NULL);
 	pthread_mutex_init(&progress_mutex, NULL);
 	pthread_cond_init(&progress_cond, NULL);
-	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
+	enable_concurrent_object_reads(the_repository);
 }
 
 static void cleanup_threaded_search(void)
 {
-	set_try_to_free_routine(old_try_to_free_routine);
+	disable_concurrent_object_reads(the_repository);
 	pthread_cond_destroy(&progress_cond);
-	pthread_mutex_destroy(&read_mutex);
 	pthread_mutex_destroy(&cache_mutex);
 	pthread_mutex_destroy(&progress_mutex);
 }
@@ -2728,6 +2878,13 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -2898,44 +3055,56 @@ static int ofscmp(const void *a_, const void *b_)
 		return oidcmp(&a->object->oid, &b->object->oid);
 }
 
+static void mark_pack_objects(struct packed_git *p, struct in_pack *in_pack)
+{
+	struct object_id oid;
+	struct object *o;
+	uint32_t i;
+
+	if (open_pack_index(p))
+		die(_("cannot open pack index"));
+
+	ALLOC_GROW(in_pack->array,
+		   in_pack->nr + p->num_objects,
+		   in_pack->alloc);
+
+	for (i = 0; i < p->num_objects; i++) {
+		nth_packed_object_oid(&oid, p, i);
+		o = lookup_unknown_object(oid.hash);
+		if (!(o->flags & OBJECT_ADDED))
+			mark_in_pack_object(o, p, in_pack);
+		o->flags |= OBJECT_ADDED;
+	}
+}
+
+static void add_in_pack_objects(struct in_pack *in_pack)
+{
+	uint32_t i;
+
+	if (in_pack->nr) {
+		QSORT(in_pack->array, in_pack->nr, ofscmp);
+		for (i = 0; i < in_pack->nr; i++) {
+			struct object *o = in_pack->array[i].object;
+			add_object_entry(&o->oid, o->type, "", 0);
+		}
+	}
+	free(in_pack->array);
+}
+
 static void add_objects_in_unpacked_packs(struct rev_info *revs)
 {
 	struct packed_git *p;
 	struct in_pack in_pack;
-	uint32_t i;
 
 	memset(&in_pack, 0, sizeof(in_pack));
 
 	for (p = get_all_packs(the_repository); p; p = p->next) {
-		struct object_id oid;
-		struct object *o;
-
 		if (!p->pack_local || p->pack_keep || p->pack_keep_in_core)
 			continue;
-		if (open_pack_index(p))
-			die(_("cannot open pack index"));
-
-		ALLOC_GROW(in_pack.array,
-			   in_pack.nr + p->num_objects,
-			   in_pack.alloc);
-
-		for (i = 0; i < p->num_objects; i++) {
-			nth_packed_object_oid(&oid, p, i);
-			o = lookup_unknown_object(oid.hash);
-			if (!(o->flags & OBJECT_ADDED))
-				mark_in_pack_object(o, p, &in_pack);
-			o->flags |= OBJECT_ADDED;
-		}
+		mark_pack_objects(p, &in_pack);
 	}
 
-	if (in_pack.nr) {
-		QSORT(in_pack.array, in_pack.nr, ofscmp);
-		for (i = 0; i < in_pack.nr; i++) {
-			struct object *o = in_pack.array[i].object;
-			add_object_entry(&o->oid, o->type, "", 0);
-		}
-	}
-	free(in_pack.array);
+	add_in_pack_objects(&in_pack);
 }
 
 static int add_loose_object(const struct object_id *oid, const char *path,
@@ -2964,6 +3133,239 @@ static void add_unreachable_loose_objects(void)
 				      NULL, NULL, NULL);
 }
 
+/*
+ * Read the names of packs from stdin, one per line, and pack all
+ * objects of these packs, except for those also found in the packs
+ * whose name is prefixed with '^'.
+ */
+static void read_pack_names_from_stdin(struct string_list *include_packs,
+				       struct string_list *exclude_packs)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list_item *item;
+	struct packed_git *p;
+
+	while (strbuf_getline(&buf, stdin) != EOF) {
+		if (!buf.len)
+			continue;
+		if (*buf.buf == '^')
+			string_list_append(exclude_packs, buf.buf + 1);
+		else
+			string_list_append(include_packs, buf.buf);
+	}
+	string_list_sort(include_packs);
+	string_list_sort(exclude_packs);
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		const char *name = basename(p->pack_name);
+
+		item = string_list_lookup(include_packs, name);
+		if (!item)
+			item = string_list_lookup(exclude_packs, name);
+		if (item)
+			item->util = p;
+	}
+
+	for_each_string_list_item(item, include_packs)
+		if (!item->util)
+			die(_("could not find pack '%s'"), item->string);
+
+	/* Excluded packs are treated like packs given with --keep-pack. */
+	for_each_string_list_item(item, exclude_packs) {
+		p = item->util;
+		if (!p)
+			die(_("could not find pack '%s'"), item->string);
+		p->pack_keep_in_core = 1;
+		ignore_packed_keep_in_core = 1;
+	}
+
+	strbuf_release(&buf);
+}
+
+static void read_packs_list_from_stdin(void)
+{
+	struct string_list include_packs = STRING_LIST_INIT_DUP;
+	struct string_list exclude_packs = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	struct in_pack in_pack;
+
+	read_pack_names_from_stdin(&include_packs, &exclude_packs);
+
+	memset(&in_pack, 0, sizeof(in_pack));
+	for_each_string_list_item(item, &include_packs)
+		mark_pack_objects(item->util, &in_pack);
+	add_in_pack_objects(&in_pack);
+
+	string_list_clear(&include_packs, 0);
+	string_list_clear(&exclude_packs, 0);
+}
+
+struct cruft_object {
+	struct object_id oid;
+	uint32_t mtime;
+};
+
+struct cruft_objects {
+	struct cruft_object *objects;
+	size_t nr, alloc;
+};
+
+static void append_cruft_object(struct cruft_objects *cruft_objects,
+				const struct object_id *oid, time_t mtime)
+{
+	struct cruft_object *c;
+
+	ALLOC_GROW(cruft_objects->objects, cruft_objects->nr + 1,
+		   cruft_objects->alloc);
+	c = &cruft_objects->objects[cruft_objects->nr++];
+	oidcpy(&c->oid, oid);
+	c->mtime = mtime;
+}
+
+static int add_packed_cruft_object(const struct object_id *oid,
+				   struct packed_git *p, uint32_t pos,
+				   void *data)
+{
+	append_cruft_object(data, oid, packed_object_mtime(p, pos));
+	return 0;
+}
+
+static int add_loose_cruft_object(const struct object_id *oid,
+				  const char *path, void *data)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0) {
+		/* the object may have been packed and pruned meanwhile */
+		if (errno == ENOENT)
+			return 0;
+		return error_errno(_("unable to stat %s"), oid_to_hex(oid));
+	}
+	append_cruft_object(data, oid, st.st_mtime);
+	return 0;
+}
+
+static void add_cruft_object_entry(const struct object_id *oid, uint32_t mtime)
+{
+	struct object_entry *entry;
+
+	add_object_entry(oid, OBJ_NONE, "", 0);
+
+	/* keep the newest mtime of an object found more than once */
+	entry = packlist_find(&to_pack, oid->hash, NULL);
+	if (entry && oe_cruft_mtime(&to_pack, entry) < mtime)
+		oe_set_cruft_mtime(&to_pack, entry, mtime);
+}
+
+static void add_recent_cruft_object(struct rev_info *revs,
+				    const struct object_id *oid)
+{
+	struct object *obj;
+
+	switch (oid_object_info(the_repository, oid, NULL)) {
+	case OBJ_TAG:
+	case OBJ_COMMIT:
+		obj = parse_object(the_repository, oid);
+		break;
+	case OBJ_TREE:
+		obj = (struct object *)lookup_tree(the_repository, oid);
+		break;
+	default:
+		/* a blob does not keep other objects around */
+		return;
+	}
+	if (obj)
+		add_pending_object(revs, obj, "");
+}
+
+static void show_cruft_commit(struct commit *commit, void *data)
+{
+}
+
+static void show_cruft_object(struct object *obj, const char *name,
+			      void *data)
+{
+}
+
+/*
+ * Mark the objects reachable from the cruft objects that are more
+ * recent than the expiration as SEEN: they are kept even if they are
+ * older themselves, lest the recent objects become corrupt.
+ */
+static void mark_cruft_objects_reachable_from_recent(struct cruft_objects *cruft_objects)
+{
+	struct rev_info revs;
+	size_t i;
+
+	init_revisions(&revs, NULL);
+	revs.tag_objects = 1;
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+	revs.ignore_missing_links = 1;
+
+	for (i = 0; i < cruft_objects->nr; i++) {
+		struct cruft_object *c = &cruft_objects->objects[i];
+
+		if (c->mtime > cruft_expiration)
+			add_recent_cruft_object(&revs, &c->oid);
+	}
+
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+	traverse_commit_list(&revs, show_cruft_commit, show_cruft_object, NULL);
+}
+
+/*
+ * Read the names of packs from stdin, one per line: the packs about to
+ * be deleted, and, prefixed with '^', those that are retained. Pack
+ * the objects of the former and all loose objects that are in none of
+ * the latter, recording their mtimes, into a cruft pack. With
+ * --cruft-expiration, objects that are older are left out, unless
+ * they are reachable from a more recent one.
+ */
+static void read_cruft_objects(void)
+{
+	struct string_list discard_packs = STRING_LIST_INIT_DUP;
+	struct string_list retain_packs = STRING_LIST_INIT_DUP;
+	struct cruft_objects cruft_objects = { NULL };
+	struct string_list_item *item;
+	size_t i;
+
+	read_pack_names_from_stdin(&discard_packs, &retain_packs);
+
+	for_each_string_list_item(item, &discard_packs)
+		if (open_pack_index(item->util) ||
+		    for_each_object_in_pack(item->util, add_packed_cruft_object,
+					    &cruft_objects,
+					    FOR_EACH_OBJECT_PACK_ORDER))
+			die(_("unable to read objects of pack '%s'"),
+			    item->string);
+	if (for_each_loose_file_in_objdir(get_object_directory(),
+					  add_loose_cruft_object,
+					  NULL, NULL, &cruft_objects))
+		die(_("unable to read loose objects"));
+
+	if (cruft_expiration)
+		mark_cruft_objects_reachable_from_recent(&cruft_objects);
+
+	for (i = 0; i < cruft_objects.nr; i++) {
+		struct cruft_object *c = &cruft_objects.objects[i];
+
+		if (cruft_expiration && c->mtime <= cruft_expiration) {
+			struct object *obj = lookup_object(the_repository,
+							   c->oid.hash);
+
+			if (!obj || !(obj->flags & SEEN))
+				continue;
+		}
+		add_cruft_object_entry(&c->oid, c->mtime);
+	}
+
+	free(cruft_objects.objects);
+	string_list_clear(&discard_packs, 0);
+	string_list_clear(&retain_packs, 0);
+}
+
 static int has_sha1_pack_kept_or_nonlocal(const struct object_id *oid)
 {
 	static struct packed_git *last_found = (void *)1;
@@ -3024,12 +3426,16 @@ static void loosen_unused_packed_objects(struct rev_info *revs)
 			die(_("cannot open pack index"));
 
 		for (i = 0; i < p->num_objects; i++) {
+			time_t mtime;
+
 			nth_packed_object_oid(&oid, p, i);
-			if (!packlist_find(&to_pack, oid.hash, NULL) &&
-			    !has_sha1_pack_kept_or_nonlocal(&oid) &&
-			    !loosened_object_can_be_discarded(&oid, p->mtime))
-				if (force_object_loose(&oid, p->mtime))
-					die(_("unable to force loose object"));
+			if (packlist_find(&to_pack, oid.hash, NULL) ||
+			    has_sha1_pack_kept_or_nonlocal(&oid))
+				continue;
+			mtime = packed_object_mtime(p, i);
+			if (!loosened_object_can_be_discarded(&oid, mtime) &&
+			    force_object_loose(&oid, mtime))
+				die(_("unable to force loose object"));
 		}
 	}
 }
@@ -3057,9 +3463,10 @@ static int get_object_list_from_bitmap(struct rev_info *revs)
 	if (pack_options_allow_reuse() &&
 	    !reuse_partial_packfile_from_bitmap(
 			bitmap_git,
-			&reuse_packfile,
+			&reuse_packs,
+			&reuse_packs_nr,
 			&reuse_packfile_objects,
-			&reuse_packfile_offset)) {
+			&reuse_packfile_bitmap)) {
 		assert(reuse_packfile_objects);
 		nr_result += reuse_packfile_objects;
 		display_progress(progress_state, nr_result);
@@ -3230,6 +3637,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	int all_progress_implied = 0;
 	struct argv_array rp = ARGV_ARRAY_INIT;
 	int rev_list_unpacked = 0, rev_list_all = 0, rev_list_reflog = 0;
+	int stdin_packs = 0;
 	int rev_list_index = 0;
 	struct string_list keep_pack_list = STRING_LIST_INIT_NODUP;
 	struct option pack_objects_options[] = {
@@ -3267,6 +3675,12 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			    N_("use threads when searching for best delta matches")),
 		OPT_BOOL(0, "non-empty", &non_empty,
 			 N_("do not create an empty pack output")),
+		OPT_BOOL(0, "stdin-packs", &stdin_packs,
+			 N_("read packs from stdin")),
+		OPT_BOOL(0, "cruft", &cruft,
+			 N_("create a cruft pack of the unreachable objects")),
+		OPT_EXPIRY_DATE(0, "cruft-expiration", &cruft_expiration,
+				N_("leave out cruft objects older than <time>")),
 		OPT_BOOL(0, "revs", &use_internal_rev_list,
 			 N_("read revision arguments from standard input")),
 		OPT_SET_INT_F(0, "unpacked", &rev_list_unpacked,
@@ -3325,6 +3739,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	read_replace_refs = 0;
 
 	reset_pack_idx_option(&pack_idx_opts);
+	if (git_env_bool(GIT_TEST_WRITE_REV_INDEX, 0))
+		pack_idx_opts.flags |= WRITE_REV;
 	git_config(git_pack_config, NULL);
 
 	progress = isatty(2);
@@ -3370,7 +3786,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		use_internal_rev_list = 1;
 		argv_array_push(&rp, "--indexed-objects");
 	}
-	if (rev_list_unpacked) {
+	if (rev_list_unpacked && !stdin_packs) {
 		use_internal_rev_list = 1;
 		argv_array_push(&rp, "--unpacked");
 	}
@@ -3407,6 +3823,18 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (!pack_to_stdout && thin)
 		die(_("--thin cannot be used to build an indexable pack"));
 
+	if (stdin_packs && use_internal_rev_list)
+		die(_("--stdin-packs is incompatible with --revs"));
+
+	if (cruft) {
+		if (use_internal_rev_list)
+			die(_("--cruft is incompatible with --revs"));
+		if (stdin_packs)
+			die(_("--cruft is incompatible with --stdin-packs"));
+		if (pack_to_stdout)
+			die(_("--cruft cannot be used to build a pack for transfer"));
+	}
+
 	if (keep_unreachable && unpack_unreachable)
 		die(_("--keep-unreachable and --unpack-unreachable are incompatible"));
 	if (!rev_list_all || !rev_list_reflog || !rev_list_index)
@@ -3474,7 +3902,13 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (progress)
 		progress_state = start_progress(_("Enumerating objects"), 0);
-	if (!use_internal_rev_list)
+	if (stdin_packs) {
+		read_packs_list_from_stdin();
+		if (rev_list_unpacked)
+			add_unreachable_loose_objects();
+	} else if (cruft)
+		read_cruft_objects();
+	else if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
 		get_object_list(rp.argc, rp.argv);
@@ -3493,7 +3927,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (progress)
 		fprintf_ln(stderr,
 			   _("Total %"PRIu32" (delta %"PRIu32"),"
-			     " reused %"PRIu32" (delta %"PRIu32")"),
-			   written, written_delta, reused, reused_delta);
+			     " reused %"PRIu32" (delta %"PRIu32"),"
+			     " pack-reused %"PRIu32),
+			   written, written_delta, reused, reused_delta,
+			   reuse_packfile_objects);
 	return 0;
 }
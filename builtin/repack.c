@@ -129,19 +129,10 @@ static void get_non_kept_pack_filenames(struct string_list *fname_list,
 
 static void remove_redundant_pack(const char *dir_name, const char *base_name)
 {
-	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap", ".promisor"};
-	int i;
 	struct strbuf buf = STRBUF_INIT;
-	size_t plen;
 
-	strbuf_addf(&buf, "%s/%s", dir_name, base_name);
-	plen = buf.len;
-
-	for (i = 0; i < ARRAY_SIZE(exts); i++) {
-		strbuf_setlen(&buf, plen);
-		strbuf_addstr(&buf, exts[i]);
-		unlink(buf.buf);
-	}
+	strbuf_addf(&buf, "%s/%s.pack", dir_name, base_name);
+	unlink_pack_path(buf.buf, 1);
 	strbuf_release(&buf);
 }
 
@@ -256,8 +247,163 @@ static void repack_promisor_objects(const struct pack_objects_args *args,
 		die("Could not finish pack-objects to repack promisor objects");
 }
 
+struct pack_geometry {
+	struct packed_git **pack;
+	uint32_t pack_nr, pack_alloc;
+	/* The packs below this index are rolled up into a new pack. */
+	uint32_t split;
+};
+
+static int geometry_cmp(const void *va, const void *vb)
+{
+	const struct packed_git *a = *(const struct packed_git **)va;
+	const struct packed_git *b = *(const struct packed_git **)vb;
+
+	if (a->num_objects < b->num_objects)
+		return -1;
+	if (a->num_objects > b->num_objects)
+		return 1;
+	return 0;
+}
+
+/*
+ * Collect the packs that a geometric repack may roll up: the local
+ * packs which are neither kept nor from a promisor remote, sorted by
+ * their number of objects.
+ */
+static void init_pack_geometry(struct pack_geometry *geometry,
+			       const struct string_list *extra_keep)
+{
+	struct packed_git *p;
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		const char *name = basename(p->pack_name);
+		int i;
+
+		if (!p->pack_local || p->pack_keep || p->pack_promisor)
+			continue;
+
+		for (i = 0; i < extra_keep->nr; i++)
+			if (!fspathcmp(name, extra_keep->items[i].string))
+				break;
+		if (i < extra_keep->nr)
+			continue;
+
+		if (open_pack_index(p))
+			die(_("cannot open index for %s"), p->pack_name);
+
+		ALLOC_GROW(geometry->pack, geometry->pack_nr + 1,
+			   geometry->pack_alloc);
+		geometry->pack[geometry->pack_nr++] = p;
+	}
+
+	QSORT(geometry->pack, geometry->pack_nr, geometry_cmp);
+}
+
+/*
+ * Find the packs to combine so that each of the remaining ones holds
+ * at least "factor" times as many objects as the next smaller one,
+ * counting the combined pack as the smallest.
+ *
+ * Walking down from the largest pack, the packs form a progression
+ * until the first neighbours that violate it; the smaller of them
+ * and everything below are rolled up. The combined pack may then be
+ * too large to sit below the next larger pack, which is rolled up as
+ * well, and so on.
+ */
+static void split_pack_geometry(struct pack_geometry *geometry, int factor)
+{
+	uint32_t i, split;
+	uint64_t total = 0;
+
+	if (!geometry->pack_nr)
+		return;
+
+	for (i = geometry->pack_nr - 1; i > 0; i--) {
+		struct packed_git *ours = geometry->pack[i];
+		struct packed_git *prev = geometry->pack[i - 1];
+
+		if (ours->num_objects < (uint64_t)factor * prev->num_objects)
+			break;
+	}
+	split = i ? i + 1 : 0;
+
+	for (i = 0; i < split; i++)
+		total += geometry->pack[i]->num_objects;
+	for (i = split; i < geometry->pack_nr; i++) {
+		struct packed_git *ours = geometry->pack[i];
+
+		if (ours->num_objects >= (uint64_t)factor * total)
+			break;
+		total += ours->num_objects;
+		split = i + 1;
+	}
+
+	geometry->split = split;
+}
+
+static void free_pack_geometry(struct pack_geometry *geometry)
+{
+	free(geometry->pack);
+}
+
+/*
+ * Write a cruft pack of the unreachable objects of the packs in
+ * "existing_packs", which are about to be deleted, and of the loose
+ * objects; the reachable ones are in the new packs "names", which are
+ * still under their temporary names. Add the name of the cruft pack
+ * to "names".
+ */
+static int write_cruft_pack(const struct pack_objects_args *args,
+			    const char *cruft_expiration,
+			    const struct string_list *keep_pack_list,
+			    struct string_list *names,
+			    const struct string_list *existing_packs)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	struct strbuf line = STRBUF_INIT;
+	struct string_list_item *item;
+	FILE *in, *out;
+	int ret;
+
+	prepare_pack_objects(&cmd, args);
+
+	argv_array_push(&cmd.args, "--cruft");
+	if (cruft_expiration)
+		argv_array_pushf(&cmd.args, "--cruft-expiration=%s",
+				 cruft_expiration);
+	argv_array_push(&cmd.args, "--honor-pack-keep");
+	for_each_string_list_item(item, keep_pack_list)
+		argv_array_pushf(&cmd.args, "--keep-pack=%s", item->string);
+	argv_array_push(&cmd.args, "--non-empty");
+	cmd.in = -1;
+
+	ret = start_command(&cmd);
+	if (ret)
+		return ret;
+
+	in = xfdopen(cmd.in, "w");
+	for_each_string_list_item(item, names)
+		fprintf(in, "^%s-%s.pack\n", basename(packtmp), item->string);
+	for_each_string_list_item(item, existing_packs)
+		fprintf(in, "%s.pack\n", item->string);
+	fclose(in);
+
+	out = xfdopen(cmd.out, "r");
+	while (strbuf_getline_lf(&line, out) != EOF) {
+		if (line.len != the_hash_algo->hexsz)
+			die("repack: Expecting full hex object ID lines only from pack-objects.");
+		string_list_append(names, line.buf);
+	}
+	fclose(out);
+	strbuf_release(&line);
+
+	return finish_command(&cmd);
+}
+
 #define ALL_INTO_ONE 1
 #define LOOSEN_UNREACHABLE 2
+#define PACK_CRUFT 4
 
 int cmd_repack(int argc, const char **argv, const char *prefix)
 {
@@ -266,6 +412,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		unsigned optional:1;
 	} exts[] = {
 		{".pack"},
+		{".rev", 1},
+		{".mtimes", 1},
 		{".idx"},
 		{".bitmap", 1},
 		{".promisor", 1},
@@ -283,10 +431,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	int pack_everything = 0;
 	int delete_redundant = 0;
 	const char *unpack_unreachable = NULL;
+	const char *cruft_expiration = NULL;
 	int keep_unreachable = 0;
 	struct string_list keep_pack_list = STRING_LIST_INIT_NODUP;
 	int no_update_server_info = 0;
 	int midx_cleared = 0;
+	int geometric_factor = 0;
+	struct pack_geometry geometry = { NULL };
 	struct pack_objects_args po_args = {NULL};
 
 	struct option builtin_repack_options[] = {
@@ -295,6 +446,11 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		OPT_BIT('A', NULL, &pack_everything,
 				N_("same as -a, and turn unreachable objects loose"),
 				   LOOSEN_UNREACHABLE | ALL_INTO_ONE),
+		OPT_BIT(0, "cruft", &pack_everything,
+				N_("same as -a, and pack unreachable objects into a cruft pack"),
+				PACK_CRUFT | ALL_INTO_ONE),
+		OPT_STRING(0, "cruft-expiration", &cruft_expiration, N_("approxidate"),
+				N_("with --cruft, expire objects older than this")),
 		OPT_BOOL('d', NULL, &delete_redundant,
 				N_("remove redundant packs, and run git-prune-packed")),
 		OPT_BOOL('f', NULL, &po_args.no_reuse_delta,
@@ -328,6 +484,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("repack objects in packs marked with .keep")),
 		OPT_STRING_LIST(0, "keep-pack", &keep_pack_list, N_("name"),
 				N_("do not repack this pack")),
+		OPT_INTEGER('g', "geometric", &geometric_factor,
+				N_("find a geometric progression with factor <n>")),
 		OPT_END()
 	};
 
@@ -343,10 +501,28 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	    (unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE)))
 		die(_("--keep-unreachable and -A are incompatible"));
 
+	if (pack_everything & PACK_CRUFT) {
+		if (unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE))
+			die(_("--cruft and -A are incompatible"));
+		if (keep_unreachable)
+			die(_("--cruft and --keep-unreachable are incompatible"));
+		if (!delete_redundant)
+			die(_("--cruft requires -d"));
+	} else if (cruft_expiration)
+		die(_("--cruft-expiration requires --cruft"));
+
+	if (geometric_factor) {
+		if (geometric_factor < 2)
+			die(_("--geometric factor must be at least 2"));
+		if (pack_everything)
+			die(_("--geometric is incompatible with -a and -A"));
+	}
+
 	if (pack_kept_objects < 0)
-		pack_kept_objects = write_bitmaps;
+		pack_kept_objects = write_bitmaps && !geometric_factor;
 
-	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE))
+	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE) &&
+	    !geometric_factor)
 		die(_(incremental_bitmap_conflict_error));
 
 	packdir = mkpathdup("%s/pack", get_object_directory());
@@ -363,15 +539,17 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_pushf(&cmd.args, "--keep-pack=%s",
 				 keep_pack_list.items[i].string);
 	argv_array_push(&cmd.args, "--non-empty");
-	argv_array_push(&cmd.args, "--all");
-	argv_array_push(&cmd.args, "--reflog");
-	argv_array_push(&cmd.args, "--indexed-objects");
-	if (repository_format_partial_clone)
-		argv_array_push(&cmd.args, "--exclude-promisor-objects");
-	if (write_bitmaps)
-		argv_array_push(&cmd.args, "--write-bitmap-index");
-	if (use_delta_islands)
-		argv_array_push(&cmd.args, "--delta-islands");
+	if (!geometric_factor) {
+		argv_array_push(&cmd.args, "--all");
+		argv_array_push(&cmd.args, "--reflog");
+		argv_array_push(&cmd.args, "--indexed-objects");
+		if (repository_format_partial_clone)
+			argv_array_push(&cmd.args, "--exclude-promisor-objects");
+		if (write_bitmaps)
+			argv_array_push(&cmd.args, "--write-bitmap-index");
+		if (use_delta_islands)
+			argv_array_push(&cmd.args, "--delta-islands");
+	}
 
 	if (pack_everything & ALL_INTO_ONE) {
 		get_non_kept_pack_filenames(&existing_packs, &keep_pack_list);
@@ -379,7 +557,10 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		repack_promisor_objects(&po_args, &names);
 
 		if (existing_packs.nr && delete_redundant) {
-			if (unpack_unreachable) {
+			if (pack_everything & PACK_CRUFT) {
+				/* unreachable objects go to the cruft pack */
+				argv_array_push(&cmd.env_array, "GIT_REF_PARANOIA=1");
+			} else if (unpack_unreachable) {
 				argv_array_pushf(&cmd.args,
 						"--unpack-unreachable=%s",
 						unpack_unreachable);
@@ -394,17 +575,48 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				argv_array_push(&cmd.env_array, "GIT_REF_PARANOIA=1");
 			}
 		}
+	} else if (geometric_factor) {
+		/*
+		 * Roll the packs below the split and the loose objects
+		 * into a new pack, which becomes the smallest pack of the
+		 * progression; the larger packs are left alone.
+		 */
+		init_pack_geometry(&geometry, &keep_pack_list);
+		split_pack_geometry(&geometry, geometric_factor);
+		for (i = 0; i < geometry.split; i++) {
+			const char *name = basename(geometry.pack[i]->pack_name);
+			size_t len;
+
+			if (strip_suffix(name, ".pack", &len))
+				string_list_append_nodup(&existing_packs,
+							 xmemdupz(name, len));
+		}
+
+		argv_array_push(&cmd.args, "--stdin-packs");
+		argv_array_push(&cmd.args, "--unpacked");
 	} else {
 		argv_array_push(&cmd.args, "--unpacked");
 		argv_array_push(&cmd.args, "--incremental");
 	}
 
-	cmd.no_stdin = 1;
+	if (geometric_factor)
+		cmd.in = -1;
+	else
+		cmd.no_stdin = 1;
 
 	ret = start_command(&cmd);
 	if (ret)
 		return ret;
 
+	if (geometric_factor) {
+		FILE *in = xfdopen(cmd.in, "w");
+
+		for (i = 0; i < geometry.pack_nr; i++)
+			fprintf(in, "%s%s\n", i < geometry.split ? "" : "^",
+				basename(geometry.pack[i]->pack_name));
+		fclose(in);
+	}
+
 	out = xfdopen(cmd.out, "r");
 	while (strbuf_getline_lf(&line, out) != EOF) {
 		if (line.len != the_hash_algo->hexsz)
@@ -416,6 +628,14 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (ret)
 		return ret;
 
+	if (pack_everything & PACK_CRUFT) {
+		ret = write_cruft_pack(&po_args, cruft_expiration,
+				       &keep_pack_list, &names,
+				       &existing_packs);
+		if (ret)
+			return ret;
+	}
+
 	if (!names.nr && !po_args.quiet)
 		printf("Nothing new to pack.\n");
 
@@ -563,12 +783,24 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		update_server_info(0);
 	remove_temporary_files();
 
-	if (git_env_bool(GIT_TEST_MULTI_PACK_INDEX, 0))
-		write_midx_file(get_object_directory());
+	if (geometric_factor) {
+		/*
+		 * Packs may have been rolled up without a new pack to
+		 * show for it, if their objects were all in the larger
+		 * ones; write the multi-pack-index from scratch then.
+		 */
+		if (delete_redundant && existing_packs.nr && !midx_cleared)
+			clear_midx_file(the_repository);
+		if (write_midx_file(get_object_directory(),
+				    write_bitmaps ? MIDX_WRITE_BITMAP : 0))
+			die(_("could not write multi-pack-index"));
+	} else if (git_env_bool(GIT_TEST_MULTI_PACK_INDEX, 0))
+		write_midx_file(get_object_directory(), 0);
 
 	string_list_clear(&names, 0);
 	string_list_clear(&rollback, 0);
 	string_list_clear(&existing_packs, 0);
+	free_pack_geometry(&geometry);
 	strbuf_release(&line);
 
 	return 0;
@@ -256,6 +256,19 @@ static int update_one(struct cache_tree *it,
 	if (0 <= it->entry_count && has_sha1_file(it->oid.hash))
 		return it->entry_count;
 
+	/*
+	 * A sparse directory entry for this level stands for the whole
+	 * tree, which we already know.
+	 */
+	if (entries && baselen &&
+	    S_ISSPARSEDIR(cache[0]->ce_mode) &&
+	    ce_namelen(cache[0]) == baselen &&
+	    !memcmp(cache[0]->name, base, baselen)) {
+		oidcpy(&it->oid, &cache[0]->oid);
+		it->entry_count = 1;
+		return 1;
+	}
+
 	/*
 	 * We first scan for subtrees and update them; we start by
 	 * marking existing subtrees -- the ones that are unmarked
@@ -583,7 +596,7 @@ struct cache_tree *cache_tree_read(const char *buffer, unsigned long size)
 	return read_one(&buffer, &size);
 }
 
-static struct cache_tree *cache_tree_find(struct cache_tree *it, const char *path)
+struct cache_tree *cache_tree_find(struct cache_tree *it, const char *path)
 {
 	if (!it)
 		return NULL;
@@ -694,6 +707,32 @@ void prime_cache_tree(struct index_state *istate, struct tree *tree)
 	istate->cache_changed |= CACHE_TREE_CHANGED;
 }
 
+void prime_cache_tree_subtree(struct index_state *istate, const char *path,
+			      struct tree *tree)
+{
+	struct cache_tree *it = istate->cache_tree;
+	struct cache_tree *sub = cache_tree_find(it, path);
+	int delta;
+
+	if (!sub || sub->entry_count < 0 || sub->subtree_nr) {
+		cache_tree_invalidate_path(istate, path);
+		return;
+	}
+
+	prime_cache_tree_rec(sub, tree);
+	delta = sub->entry_count - 1;
+
+	/* the ancestors now cover that many more index entries */
+	while (it != sub) {
+		const char *slash = strchrnul(path, '/');
+
+		if (it->entry_count >= 0)
+			it->entry_count += delta;
+		it = find_subtree(it, path, slash - path, 0)->cache_tree;
+		path = slash + 1;
+	}
+}
+
 /*
  * find the cache_tree that corresponds to the current level without
  * exploding the full path into textual form.  The root of the
@@ -747,6 +786,15 @@ static void verify_one(struct index_state *istate,
 
 	if (path->len) {
 		pos = index_name_pos(istate, path->buf, path->len);
+		if (pos >= 0) {
+			struct cache_entry *ce = istate->cache[pos];
+
+			if (!S_ISSPARSEDIR(ce->ce_mode) || it->entry_count != 1 ||
+			    !oideq(&ce->oid, &it->oid))
+				BUG("cache-tree for sparse directory %s does not match",
+				    ce->name);
+			return;
+		}
 		pos = -pos - 1;
 	} else {
 		pos = 0;
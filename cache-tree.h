@@ -26,6 +26,7 @@ struct cache_tree *cache_tree(void);
 void cache_tree_free(struct cache_tree **);
 void cache_tree_invalidate_path(struct index_state *, const char *);
 struct cache_tree_sub *cache_tree_sub(struct cache_tree *, const char *);
+struct cache_tree *cache_tree_find(struct cache_tree *, const char *);
 
 void cache_tree_write(struct strbuf *, struct cache_tree *root);
 struct cache_tree *cache_tree_read(const char *buffer, unsigned long size);
@@ -49,6 +50,13 @@ void cache_tree_verify(struct index_state *);
 int write_index_as_tree(struct object_id *oid, struct index_state *index_state, const char *index_path, int flags, const char *prefix);
 void prime_cache_tree(struct index_state *, struct tree *);
 
+/*
+ * The sparse directory entry 'path' (with its trailing slash) has been
+ * replaced in the index by the entries of 'tree'; update the cache-tree
+ * to match.
+ */
+void prime_cache_tree_subtree(struct index_state *, const char *path, struct tree *);
+
 int cache_tree_matches_traversal(struct cache_tree *, struct name_entry *ent, struct traverse_info *info);
 
 #ifndef NO_THE_INDEX_COMPATIBILITY_MACROS
@@ -82,6 +82,13 @@ struct object_id {
 #define S_IFGITLINK	0160000
 #define S_ISGITLINK(m)	(((m) & S_IFMT) == S_IFGITLINK)
 
+/*
+ * A sparse directory entry stands in the index for a whole directory
+ * outside of the sparse checkout; see sparse-index.h. Its name ends with
+ * a slash and its object name is that of the tree it replaces.
+ */
+#define S_ISSPARSEDIR(m)	((m) == S_IFDIR)
+
 /*
  * Some mode bits are also used internally for computations.
  *
@@ -328,7 +335,8 @@ struct index_state {
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
 		 initialized : 1,
-		 drop_cache_tree : 1;
+		 drop_cache_tree : 1,
+		 sparse_index : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	struct object_id oid;
@@ -476,6 +484,7 @@ static inline enum object_type object_type(unsigned int mode)
 #define GRAFT_ENVIRONMENT "GIT_GRAFT_FILE"
 #define GIT_SHALLOW_FILE_ENVIRONMENT "GIT_SHALLOW_FILE"
 #define TEMPLATE_DIR_ENVIRONMENT "GIT_TEMPLATE_DIR"
+#define DEFAULT_REF_FORMAT_ENVIRONMENT "GIT_DEFAULT_REF_FORMAT"
 #define CONFIG_ENVIRONMENT "GIT_CONFIG"
 #define CONFIG_DATA_ENVIRONMENT "GIT_CONFIG_PARAMETERS"
 #define EXEC_PATH_ENVIRONMENT "GIT_EXEC_PATH"
@@ -633,7 +642,8 @@ extern int path_inside_repo(const char *prefix, const char *path);
 #define INIT_DB_EXIST_OK 0x0002
 
 extern int init_db(const char *git_dir, const char *real_git_dir,
-		   const char *template_dir, unsigned int flags);
+		   const char *template_dir, const char *ref_format,
+		   unsigned int flags);
 
 extern void sanitize_stdfds(void);
 extern int daemonize(void);
@@ -886,6 +896,12 @@ extern char *git_replace_ref_base;
 extern int fsync_object_files;
 extern int core_preload_index;
 extern int core_apply_sparse_checkout;
+
+/*
+ * Commands that know how to deal with sparse directory entries clear
+ * this before reading the index; everybody else gets a full index.
+ */
+extern int command_requires_full_index;
 extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
@@ -966,6 +982,7 @@ struct repository_format {
 	int precious_objects;
 	char *partial_clone; /* value of extensions.partialclone */
 	int worktree_config;
+	char *ref_storage; /* value of extensions.refstorage */
 	int is_bare;
 	int hash_algo;
 	char *work_tree;
@@ -980,6 +997,12 @@ struct repository_format {
  */
 int read_repository_format(struct repository_format *format, const char *path);
 
+/*
+ * Free the memory held onto by "format", which must have been filled in by
+ * read_repository_format().
+ */
+void clear_repository_format(struct repository_format *format);
+
 /*
  * Verify that the repository described by repository_format is something we
  * can read. If it is, return 0. Otherwise, return -1, and "err" will describe
@@ -1543,6 +1566,15 @@ struct checkout {
 extern int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath);
 extern void enable_delayed_checkout(struct checkout *state);
 extern int finish_delayed_checkout(struct checkout *state);
+extern void *read_blob_entry(const struct cache_entry *ce, unsigned long *size);
+/*
+ * fstat() the freshly written 'fd' into 'st' if that is reliable and
+ * the result is going to be used; returns whether it did.
+ */
+extern int fstat_checkout_output(int fd, const struct checkout *state, struct stat *st);
+/* Record the stat data of the entry just written to the working tree. */
+extern void update_ce_after_write(const struct checkout *state,
+				  struct cache_entry *ce, struct stat *st);
 
 struct cache_def {
 	struct strbuf path;
@@ -16,12 +16,19 @@
 #include "hashmap.h"
 #include "replace-object.h"
 #include "progress.h"
+#include "bloom.h"
 
 #define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
 #define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
 #define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_GENERATION_DATA 0x47444154 /* "GDAT" */
+#define GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW 0x47444f56 /* "GDOV" */
 #define GRAPH_CHUNKID_LARGEEDGES 0x45444745 /* "EDGE" */
+#define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
+#define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
+#define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
+#define MAX_NUM_CHUNKS 9
 
 #define GRAPH_DATA_WIDTH 36
 
@@ -40,6 +47,8 @@
 
 #define GRAPH_LAST_EDGE 0x80000000
 
+#define CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW 0x80000000
+
 #define GRAPH_HEADER_SIZE 8
 #define GRAPH_FANOUT_SIZE (4 * 256)
 #define GRAPH_CHUNKLOOKUP_WIDTH 12
@@ -51,6 +60,19 @@ char *get_commit_graph_filename(const char *obj_dir)
 	return xstrfmt("%s/info/commit-graph", obj_dir);
 }
 
+static char *get_split_graph_filename(const char *obj_dir,
+				      const char *oid_hex)
+{
+	return xstrfmt("%s/info/commit-graphs/graph-%s.graph",
+		       obj_dir,
+		       oid_hex);
+}
+
+char *get_commit_graph_chain_filename(const char *obj_dir)
+{
+	return xstrfmt("%s/info/commit-graphs/commit-graph-chain", obj_dir);
+}
+
 static struct commit_graph *alloc_commit_graph(void)
 {
 	struct commit_graph *g = xcalloc(1, sizeof(*g));
@@ -135,6 +157,7 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 
 	graph->hash_len = GRAPH_OID_LEN;
 	graph->num_chunks = *(unsigned char*)(data + 6);
+	graph->num_base_graphs = *(unsigned char*)(data + 7);
 	graph->graph_fd = fd;
 	graph->data = graph_map;
 	graph->data_len = graph_size;
@@ -177,12 +200,58 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 				graph->chunk_commit_data = data + chunk_offset;
 			break;
 
+		case GRAPH_CHUNKID_GENERATION_DATA:
+			if (graph->chunk_generation_data)
+				chunk_repeated = 1;
+			else
+				graph->chunk_generation_data = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW:
+			if (graph->chunk_generation_data_overflow)
+				chunk_repeated = 1;
+			else
+				graph->chunk_generation_data_overflow = data + chunk_offset;
+			break;
+
 		case GRAPH_CHUNKID_LARGEEDGES:
 			if (graph->chunk_large_edges)
 				chunk_repeated = 1;
 			else
 				graph->chunk_large_edges = data + chunk_offset;
 			break;
+
+		case GRAPH_CHUNKID_BASE:
+			if (graph->chunk_base_graphs)
+				chunk_repeated = 1;
+			else
+				graph->chunk_base_graphs = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_BLOOMINDEXES:
+			if (graph->chunk_bloom_indexes)
+				chunk_repeated = 1;
+			else
+				graph->chunk_bloom_indexes = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_BLOOMDATA:
+			if (graph->chunk_bloom_data)
+				chunk_repeated = 1;
+			else {
+				uint32_t hash_version;
+				graph->chunk_bloom_data = data + chunk_offset;
+				hash_version = get_be32(data + chunk_offset);
+
+				if (hash_version != 1)
+					break;
+
+				graph->bloom_filter_settings = xmalloc(sizeof(struct bloom_filter_settings));
+				graph->bloom_filter_settings->hash_version = hash_version;
+				graph->bloom_filter_settings->num_hashes = get_be32(data + chunk_offset + 4);
+				graph->bloom_filter_settings->bits_per_entry = get_be32(data + chunk_offset + 8);
+			}
+			break;
 		}
 
 		if (chunk_repeated) {
@@ -195,11 +264,39 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 			graph->num_commits = (chunk_offset - last_chunk_offset)
 					     / graph->hash_len;
 		}
+		if (last_chunk_id == GRAPH_CHUNKID_BLOOMDATA &&
+		    chunk_offset > last_chunk_offset)
+			graph->bloom_data_size = chunk_offset - last_chunk_offset;
 
 		last_chunk_id = chunk_id;
 		last_chunk_offset = chunk_offset;
 	}
 
+	/* the last chunk ends where the checksum starts */
+	if (last_chunk_id == GRAPH_CHUNKID_BLOOMDATA)
+		graph->bloom_data_size = graph_size - graph->hash_len -
+					 last_chunk_offset;
+
+	if (!graph->chunk_bloom_indexes || !graph->bloom_filter_settings ||
+	    graph->bloom_data_size < BLOOMDATA_CHUNK_HEADER_SIZE) {
+		/*
+		 * Only use changed-path Bloom filters when both chunks
+		 * are present and we understand how they were hashed.
+		 */
+		graph->chunk_bloom_indexes = NULL;
+		graph->chunk_bloom_data = NULL;
+		FREE_AND_NULL(graph->bloom_filter_settings);
+	}
+
+	if (graph->num_base_graphs && !graph->chunk_base_graphs) {
+		error(_("commit-graph %s has %d base graphs but no base graphs chunk"),
+		      graph_file, graph->num_base_graphs);
+		goto cleanup_fail;
+	}
+
+	hashcpy(graph->oid.hash, graph->data + graph->data_len - graph->hash_len);
+	graph->filename = xstrdup(graph_file);
+
 	return graph;
 
 cleanup_fail:
@@ -208,27 +305,162 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 	exit(1);
 }
 
-static void prepare_commit_graph_one(struct repository *r, const char *obj_dir)
+static int add_graph_to_chain(struct commit_graph *g,
+			      struct commit_graph *chain,
+			      struct object_id *oids,
+			      int n)
 {
-	char *graph_name;
+	struct commit_graph *cur_g = chain;
 
-	if (r->objects->commit_graph)
-		return;
+	if (n && !g->chunk_base_graphs) {
+		warning(_("commit-graph has no base graphs chunk"));
+		return 0;
+	}
+
+	if (g->num_base_graphs != n) {
+		warning(_("commit-graph has %d base graphs, expected %d"),
+			g->num_base_graphs, n);
+		return 0;
+	}
 
-	graph_name = get_commit_graph_filename(obj_dir);
-	r->objects->commit_graph =
-		load_commit_graph_one(graph_name);
+	while (n) {
+		n--;
 
-	FREE_AND_NULL(graph_name);
+		if (!cur_g ||
+		    !hasheq(oids[n].hash,
+			    g->chunk_base_graphs + g->hash_len * n)) {
+			warning(_("commit-graph chain does not match"));
+			return 0;
+		}
+
+		cur_g = cur_g->base_graph;
+	}
+
+	g->base_graph = chain;
+
+	if (chain)
+		g->num_commits_in_base = chain->num_commits + chain->num_commits_in_base;
+
+	return 1;
 }
 
 /*
- * Return 1 if commit_graph is non-NULL, and 0 otherwise.
- *
- * On the first invocation, this function attemps to load the commit
- * graph if the_repository is configured to have one.
+ * Load the layers listed in the commit-graph-chain file, bottom layer
+ * first. Stop at the first layer that is missing or does not agree with
+ * the layers below it, and use whatever prefix of the chain is valid.
  */
-static int prepare_commit_graph(struct repository *r)
+static struct commit_graph *load_commit_graph_chain(const char *obj_dir)
+{
+	struct commit_graph *graph_chain = NULL;
+	struct strbuf line = STRBUF_INIT;
+	struct stat st;
+	struct object_id *oids;
+	int i = 0, valid = 1, count;
+	char *chain_name = get_commit_graph_chain_filename(obj_dir);
+	FILE *fp;
+	int stat_res;
+
+	fp = fopen(chain_name, "r");
+	stat_res = stat(chain_name, &st);
+	free(chain_name);
+
+	if (!fp ||
+	    stat_res ||
+	    st.st_size <= the_hash_algo->hexsz) {
+		if (fp)
+			fclose(fp);
+		return NULL;
+	}
+
+	count = st.st_size / (the_hash_algo->hexsz + 1);
+	oids = xcalloc(count, sizeof(struct object_id));
+
+	for (i = 0; i < count && valid; i++) {
+		char *graph_name;
+		struct commit_graph *g;
+
+		if (strbuf_getline_lf(&line, fp) == EOF)
+			break;
+
+		if (get_oid_hex(line.buf, &oids[i])) {
+			warning(_("invalid commit-graph chain: line '%s' not a hash"),
+				line.buf);
+			valid = 0;
+			break;
+		}
+
+		graph_name = get_split_graph_filename(obj_dir, line.buf);
+		g = load_commit_graph_one(graph_name);
+		free(graph_name);
+
+		if (g && add_graph_to_chain(g, graph_chain, oids, i)) {
+			g->obj_dir = obj_dir;
+			graph_chain = g;
+		} else {
+			free_commit_graph(g);
+			valid = 0;
+		}
+	}
+
+	free(oids);
+	fclose(fp);
+	strbuf_release(&line);
+
+	return graph_chain;
+}
+
+/*
+ * Mixing corrected commit dates of some layers with topological levels
+ * of others would break the ordering of generation numbers, so only
+ * read generation data if every layer of the chain has it.
+ */
+static void set_read_generation_data(struct commit_graph *g, int enable)
+{
+	struct commit_graph *p;
+
+	for (p = g; enable && p; p = p->base_graph)
+		if (!p->chunk_generation_data)
+			enable = 0;
+
+	for (p = g; p; p = p->base_graph)
+		p->read_generation_data = enable;
+}
+
+struct commit_graph *read_commit_graph_one(const char *obj_dir)
+{
+	char *graph_name = get_commit_graph_filename(obj_dir);
+	struct commit_graph *g = load_commit_graph_one(graph_name);
+	free(graph_name);
+
+	if (g)
+		g->obj_dir = obj_dir;
+	else
+		g = load_commit_graph_chain(obj_dir);
+
+	set_read_generation_data(g, 1);
+	return g;
+}
+
+static int commit_graph_generation_version(struct repository *r)
+{
+	int version;
+
+	if (repo_config_get_int(r, "commitgraph.generationversion", &version))
+		return 2;
+	return version;
+}
+
+static void prepare_commit_graph_one(struct repository *r, const char *obj_dir)
+{
+	if (r->objects->commit_graph)
+		return;
+
+	r->objects->commit_graph = read_commit_graph_one(obj_dir);
+	if (commit_graph_generation_version(r) < 2)
+		set_read_generation_data(r->objects->commit_graph, 0);
+}
+
+int prepare_commit_graph(struct repository *r)
 {
 	struct alternate_object_database *alt;
 	char *obj_dir;
@@ -274,22 +506,81 @@ int generation_numbers_enabled(struct repository *r)
 	if (!g->num_commits)
 		return 0;
 
+	if (g->read_generation_data)
+		return 1;
+
 	first_generation = get_be32(g->chunk_commit_data +
 				    g->hash_len + 8) >> 2;
 
 	return !!first_generation;
 }
 
+int corrected_commit_dates_enabled(struct repository *r)
+{
+	if (!prepare_commit_graph(r))
+		return 0;
+
+	return r->objects->commit_graph->read_generation_data;
+}
+
 void close_commit_graph(struct repository *r)
 {
 	free_commit_graph(r->objects->commit_graph);
 	r->objects->commit_graph = NULL;
 }
 
+/*
+ * Commits in a chain of graphs are numbered consecutively, starting with
+ * the bottom layer, so the position of a commit stored in (or referred to
+ * by) a layer is global to the chain. Return the layer that holds
+ * position 'pos', and store its position within that layer in *lex_index.
+ */
+struct commit_graph *graph_layer_for_pos(struct commit_graph *g,
+					 uint32_t pos,
+					 uint32_t *lex_index)
+{
+	while (g && pos < g->num_commits_in_base)
+		g = g->base_graph;
+
+	if (!g)
+		BUG("NULL commit-graph");
+
+	if (pos >= g->num_commits + g->num_commits_in_base)
+		die(_("invalid commit position. commit-graph is likely corrupt"));
+
+	*lex_index = pos - g->num_commits_in_base;
+	return g;
+}
+
+struct bloom_filter_settings *get_bloom_filter_settings(struct commit_graph *g)
+{
+	for (; g; g = g->base_graph)
+		if (g->bloom_filter_settings)
+			return g->bloom_filter_settings;
+	return NULL;
+}
+
 static int bsearch_graph(struct commit_graph *g, struct object_id *oid, uint32_t *pos)
 {
-	return bsearch_hash(oid->hash, g->chunk_oid_fanout,
-			    g->chunk_oid_lookup, g->hash_len, pos);
+	for (; g; g = g->base_graph) {
+		uint32_t lex_index;
+
+		if (bsearch_hash(oid->hash, g->chunk_oid_fanout,
+				 g->chunk_oid_lookup, g->hash_len, &lex_index)) {
+			*pos = lex_index + g->num_commits_in_base;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void load_oid_from_graph(struct commit_graph *g, uint32_t pos,
+				struct object_id *oid)
+{
+	uint32_t lex_index;
+
+	g = graph_layer_for_pos(g, pos, &lex_index);
+	hashcpy(oid->hash, g->chunk_oid_lookup + g->hash_len * lex_index);
 }
 
 static struct commit_list **insert_parent_or_die(struct commit_graph *g,
@@ -299,10 +590,10 @@ static struct commit_list **insert_parent_or_die(struct commit_graph *g,
 	struct commit *c;
 	struct object_id oid;
 
-	if (pos >= g->num_commits)
+	if (pos >= g->num_commits + g->num_commits_in_base)
 		die("invalid parent position %"PRIu64, pos);
 
-	hashcpy(oid.hash, g->chunk_oid_lookup + g->hash_len * pos);
+	load_oid_from_graph(g, pos, &oid);
 	c = lookup_commit(the_repository, &oid);
 	if (!c)
 		die(_("could not find commit %s"), oid_to_hex(&oid));
@@ -310,31 +601,95 @@ static struct commit_list **insert_parent_or_die(struct commit_graph *g,
 	return &commit_list_insert(c, pptr)->next;
 }
 
+static timestamp_t load_commit_date(struct commit_graph *g,
+				    const unsigned char *commit_data)
+{
+	uint64_t date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
+	uint64_t date_low = get_be32(commit_data + g->hash_len + 12);
+
+	return (timestamp_t)((date_high << 32) | date_low);
+}
+
+static uint32_t load_topo_level(struct commit_graph *g,
+				const unsigned char *commit_data)
+{
+	return get_be32(commit_data + g->hash_len + 8) >> 2;
+}
+
+/*
+ * Return the generation number of the commit at 'lex_index' in the layer
+ * 'g': its corrected commit date if we read generation data, and its
+ * topological level otherwise.
+ */
+static timestamp_t load_generation(struct commit_graph *g, uint32_t lex_index)
+{
+	const unsigned char *commit_data =
+		g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
+	uint32_t offset;
+
+	if (!g->read_generation_data)
+		return load_topo_level(g, commit_data);
+
+	offset = get_be32(g->chunk_generation_data + sizeof(uint32_t) * lex_index);
+	if (offset & CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW) {
+		if (!g->chunk_generation_data_overflow)
+			die(_("commit-graph requires overflow generation data but has none"));
+
+		offset ^= CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW;
+		return load_commit_date(g, commit_data) +
+		       get_be64(g->chunk_generation_data_overflow + 8 * offset);
+	}
+
+	return load_commit_date(g, commit_data) + offset;
+}
+
+static uint32_t topo_level_at(struct commit_graph *g, uint32_t pos)
+{
+	uint32_t lex_index;
+
+	g = graph_layer_for_pos(g, pos, &lex_index);
+	return load_topo_level(g, g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index);
+}
+
+static timestamp_t generation_at(struct commit_graph *g, uint32_t pos)
+{
+	uint32_t lex_index;
+
+	g = graph_layer_for_pos(g, pos, &lex_index);
+	return load_generation(g, lex_index);
+}
+
 static void fill_commit_graph_info(struct commit *item, struct commit_graph *g, uint32_t pos)
 {
-	const unsigned char *commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+	uint32_t lex_index;
+
+	g = graph_layer_for_pos(g, pos, &lex_index);
 	item->graph_pos = pos;
-	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+	item->generation = load_generation(g, lex_index);
 }
 
 static int fill_commit_in_graph(struct commit *item, struct commit_graph *g, uint32_t pos)
 {
 	uint32_t edge_value;
 	uint32_t *parent_data_ptr;
-	uint64_t date_low, date_high;
 	struct commit_list **pptr;
-	const unsigned char *commit_data = g->chunk_commit_data + (g->hash_len + 16) * pos;
+	const unsigned char *commit_data;
+	uint32_t lex_index;
+
+	/*
+	 * Parent positions are global to the chain, so keep 'g' as the
+	 * top of the chain and only use 'layer' for this commit's data.
+	 */
+	struct commit_graph *layer = graph_layer_for_pos(g, pos, &lex_index);
+	commit_data = layer->chunk_commit_data + (layer->hash_len + 16) * lex_index;
 
 	item->object.parsed = 1;
 	item->graph_pos = pos;
 
 	item->maybe_tree = NULL;
 
-	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
-	date_low = get_be32(commit_data + g->hash_len + 12);
-	item->date = (timestamp_t)((date_high << 32) | date_low);
-
-	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+	item->date = load_commit_date(layer, commit_data);
+	item->generation = load_generation(layer, lex_index);
 
 	pptr = &item->parents;
 
@@ -351,7 +706,7 @@ static int fill_commit_in_graph(struct commit *item, struct commit_graph *g, uin
 		return 1;
 	}
 
-	parent_data_ptr = (uint32_t*)(g->chunk_large_edges +
+	parent_data_ptr = (uint32_t*)(layer->chunk_large_edges +
 			  4 * (uint64_t)(edge_value & GRAPH_EDGE_LAST_MASK));
 	do {
 		edge_value = get_be32(parent_data_ptr);
@@ -406,8 +761,11 @@ void load_commit_graph_info(struct repository *r, struct commit *item)
 static struct tree *load_tree_for_commit(struct commit_graph *g, struct commit *c)
 {
 	struct object_id oid;
-	const unsigned char *commit_data = g->chunk_commit_data +
-					   GRAPH_DATA_WIDTH * (c->graph_pos);
+	const unsigned char *commit_data;
+	uint32_t lex_index;
+
+	g = graph_layer_for_pos(g, c->graph_pos, &lex_index);
+	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
 
 	hashcpy(oid.hash, commit_data);
 	c->maybe_tree = lookup_tree(the_repository, &oid);
@@ -431,12 +789,70 @@ struct tree *get_commit_tree_in_graph(struct repository *r, const struct commit
 	return get_commit_tree_in_graph_one(r->objects->commit_graph, c);
 }
 
+struct packed_commit_list {
+	struct commit **list;
+	int nr;
+	int alloc;
+};
+
+struct packed_oid_list {
+	struct object_id *list;
+	int nr;
+	int alloc;
+};
+
+/*
+ * The two generation numbers of a commit being written: its topological
+ * level for the Commit Data chunk, and its corrected commit date for
+ * the Generation Data chunk. A zero topo_level means "not computed".
+ */
+struct commit_generation {
+	uint32_t topo_level;
+	timestamp_t corrected_date;
+};
+
+define_commit_slab(commit_generation_slab, struct commit_generation);
+
+struct write_commit_graph_context {
+	struct repository *r;
+	const char *obj_dir;
+	char *graph_name;
+	char *base_graph_name;
+	struct packed_oid_list oids;
+	struct packed_commit_list commits;
+	int num_extra_edges;
+	unsigned long approx_nr_objects;
+	struct progress *progress;
+	int progress_done;
+
+	/*
+	 * The commit-graph of obj_dir as it was before this write, and
+	 * the layer of it that the new layer is written on top of (NULL
+	 * if the new graph does not build on any existing layer).
+	 */
+	struct commit_graph *existing;
+	struct commit_graph *new_base_graph;
+	uint32_t new_num_commits_in_base;
+	int num_commit_graphs_after;
+
+	struct commit_generation_slab generations;
+	uint32_t num_generation_data_overflows;
+
+	unsigned append:1,
+		 report_progress:1,
+		 split:1,
+		 changed_paths:1,
+		 write_generation_data:1;
+
+	const struct split_commit_graph_opts *split_opts;
+	size_t total_bloom_filter_data_size;
+};
+
 static void write_graph_chunk_fanout(struct hashfile *f,
-				     struct commit **commits,
-				     int nr_commits)
+				     struct write_commit_graph_context *ctx)
 {
 	int i, count = 0;
-	struct commit **list = commits;
+	struct commit **list = ctx->commits.list;
 
 	/*
 	 * Write the first-level table (the list is sorted,
@@ -444,7 +860,7 @@ static void write_graph_chunk_fanout(struct hashfile *f,
 	 * having to do eight extra binary search iterations).
 	 */
 	for (i = 0; i < 256; i++) {
-		while (count < nr_commits) {
+		while (count < ctx->commits.nr) {
 			if ((*list)->object.oid.hash[0] != i)
 				break;
 			count++;
@@ -456,11 +872,11 @@ static void write_graph_chunk_fanout(struct hashfile *f,
 }
 
 static void write_graph_chunk_oids(struct hashfile *f, int hash_len,
-				   struct commit **commits, int nr_commits)
+				   struct write_commit_graph_context *ctx)
 {
-	struct commit **list = commits;
+	struct commit **list = ctx->commits.list;
 	int count;
-	for (count = 0; count < nr_commits; count++, list++)
+	for (count = 0; count < ctx->commits.nr; count++, list++)
 		hashwrite(f, (*list)->object.oid.hash, (int)hash_len);
 }
 
@@ -470,11 +886,36 @@ static const unsigned char *commit_to_sha1(size_t index, void *table)
 	return commits[index]->object.oid.hash;
 }
 
+/*
+ * Return the position that the graph being written assigns to 'c': its
+ * position in the new layer (offset by the commits in the layers below
+ * it), or its position in one of the layers we build on. Return -1 if
+ * 'c' is in neither.
+ */
+static int get_graph_position(struct write_commit_graph_context *ctx,
+			      struct commit *c)
+{
+	uint32_t graph_pos;
+	int pos = sha1_pos(c->object.oid.hash,
+			   ctx->commits.list,
+			   ctx->commits.nr,
+			   commit_to_sha1);
+
+	if (pos >= 0)
+		return pos + ctx->new_num_commits_in_base;
+
+	if (ctx->new_base_graph &&
+	    bsearch_graph(ctx->new_base_graph, &c->object.oid, &graph_pos))
+		return graph_pos;
+
+	return -1;
+}
+
 static void write_graph_chunk_data(struct hashfile *f, int hash_len,
-				   struct commit **commits, int nr_commits)
+				   struct write_commit_graph_context *ctx)
 {
-	struct commit **list = commits;
-	struct commit **last = commits + nr_commits;
+	struct commit **list = ctx->commits.list;
+	struct commit **last = ctx->commits.list + ctx->commits.nr;
 	uint32_t num_extra_edges = 0;
 
 	while (list < last) {
@@ -490,10 +931,7 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 		if (!parent)
 			edge_value = GRAPH_PARENT_NONE;
 		else {
-			edge_value = sha1_pos(parent->item->object.oid.hash,
-					      commits,
-					      nr_commits,
-					      commit_to_sha1);
+			edge_value = get_graph_position(ctx, parent->item);
 
 			if (edge_value < 0)
 				edge_value = GRAPH_PARENT_MISSING;
@@ -509,10 +947,7 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 		else if (parent->next)
 			edge_value = GRAPH_OCTOPUS_EDGES_NEEDED | num_extra_edges;
 		else {
-			edge_value = sha1_pos(parent->item->object.oid.hash,
-					      commits,
-					      nr_commits,
-					      commit_to_sha1);
+			edge_value = get_graph_position(ctx, parent->item);
 			if (edge_value < 0)
 				edge_value = GRAPH_PARENT_MISSING;
 		}
@@ -531,7 +966,7 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 		else
 			packedDate[0] = 0;
 
-		packedDate[0] |= htonl((*list)->generation << 2);
+		packedDate[0] |= htonl(commit_generation_slab_at(&ctx->generations, *list)->topo_level << 2);
 
 		packedDate[1] = htonl((*list)->date);
 		hashwrite(f, packedDate, 8);
@@ -540,12 +975,45 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 	}
 }
 
+static void write_graph_chunk_generation_data(struct hashfile *f,
+					      struct write_commit_graph_context *ctx)
+{
+	int i, num_overflows = 0;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		timestamp_t offset =
+			commit_generation_slab_at(&ctx->generations, c)->corrected_date - c->date;
+
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX)
+			offset = CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW | num_overflows++;
+
+		hashwrite_be32(f, offset);
+	}
+}
+
+static void write_graph_chunk_generation_data_overflow(struct hashfile *f,
+						       struct write_commit_graph_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+		timestamp_t offset =
+			commit_generation_slab_at(&ctx->generations, c)->corrected_date - c->date;
+
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX) {
+			hashwrite_be32(f, offset >> 32);
+			hashwrite_be32(f, (uint32_t)offset);
+		}
+	}
+}
+
 static void write_graph_chunk_large_edges(struct hashfile *f,
-					  struct commit **commits,
-					  int nr_commits)
+					  struct write_commit_graph_context *ctx)
 {
-	struct commit **list = commits;
-	struct commit **last = commits + nr_commits;
+	struct commit **list = ctx->commits.list;
+	struct commit **last = ctx->commits.list + ctx->commits.nr;
 	struct commit_list *parent;
 
 	while (list < last) {
@@ -561,10 +1029,7 @@ static void write_graph_chunk_large_edges(struct hashfile *f,
 
 		/* Since num_parents > 2, this initializer is safe. */
 		for (parent = (*list)->parents->next; parent; parent = parent->next) {
-			int edge_value = sha1_pos(parent->item->object.oid.hash,
-						  commits,
-						  nr_commits,
-						  commit_to_sha1);
+			int edge_value = get_graph_position(ctx, parent->item);
 
 			if (edge_value < 0)
 				edge_value = GRAPH_PARENT_MISSING;
@@ -578,6 +1043,50 @@ static void write_graph_chunk_large_edges(struct hashfile *f,
 	}
 }
 
+static void write_graph_chunk_bloom_indexes(struct hashfile *f,
+					    struct write_commit_graph_context *ctx)
+{
+	struct commit **list = ctx->commits.list;
+	struct commit **last = ctx->commits.list + ctx->commits.nr;
+	uint32_t cur_pos = 0;
+
+	while (list < last) {
+		struct bloom_filter *filter = get_bloom_filter(ctx->r, *list);
+		cur_pos += filter->len;
+		hashwrite_be32(f, cur_pos);
+		list++;
+	}
+}
+
+static void write_graph_chunk_bloom_data(struct hashfile *f,
+					 struct write_commit_graph_context *ctx,
+					 const struct bloom_filter_settings *settings)
+{
+	struct commit **list = ctx->commits.list;
+	struct commit **last = ctx->commits.list + ctx->commits.nr;
+
+	hashwrite_be32(f, settings->hash_version);
+	hashwrite_be32(f, settings->num_hashes);
+	hashwrite_be32(f, settings->bits_per_entry);
+
+	while (list < last) {
+		struct bloom_filter *filter = get_bloom_filter(ctx->r, *list);
+		hashwrite(f, filter->data, filter->len * sizeof(unsigned char));
+		list++;
+	}
+}
+
+static void write_graph_chunk_base(struct hashfile *f,
+				   struct commit_graph *base,
+				   int num_base_graphs)
+{
+	if (!num_base_graphs)
+		return;
+
+	write_graph_chunk_base(f, base->base_graph, num_base_graphs - 1);
+	hashwrite(f, base->oid.hash, the_hash_algo->rawsz);
+}
+
 static int commit_compare(const void *_a, const void *_b)
 {
 	const struct object_id *a = (const struct object_id *)_a;
@@ -585,32 +1094,34 @@ static int commit_compare(const void *_a, const void *_b)
 	return oidcmp(a, b);
 }
 
-struct packed_commit_list {
-	struct commit **list;
-	int nr;
-	int alloc;
-};
+static int commit_ptr_compare(const void *_a, const void *_b)
+{
+	const struct commit *a = *(const struct commit **)_a;
+	const struct commit *b = *(const struct commit **)_b;
+	return oidcmp(&a->object.oid, &b->object.oid);
+}
 
-struct packed_oid_list {
-	struct object_id *list;
-	int nr;
-	int alloc;
-	struct progress *progress;
-	int progress_done;
-};
+static int in_existing_graph(struct write_commit_graph_context *ctx,
+			     const struct object_id *oid)
+{
+	uint32_t pos;
+
+	return ctx->existing &&
+	       bsearch_graph(ctx->existing, (struct object_id *)oid, &pos);
+}
 
 static int add_packed_commits(const struct object_id *oid,
 			      struct packed_git *pack,
 			      uint32_t pos,
 			      void *data)
 {
-	struct packed_oid_list *list = (struct packed_oid_list*)data;
+	struct write_commit_graph_context *ctx = (struct write_commit_graph_context*)data;
 	enum object_type type;
 	off_t offset = nth_packed_object_offset(pack, pos);
 	struct object_info oi = OBJECT_INFO_INIT;
 
-	if (list->progress)
-		display_progress(list->progress, ++list->progress_done);
+	if (ctx->progress)
+		display_progress(ctx->progress, ++ctx->progress_done);
 
 	oi.typep = &type;
 	if (packed_object_info(the_repository, pack, offset, &oi) < 0)
@@ -619,59 +1130,64 @@ static int add_packed_commits(const struct object_id *oid,
 	if (type != OBJ_COMMIT)
 		return 0;
 
-	ALLOC_GROW(list->list, list->nr + 1, list->alloc);
-	oidcpy(&(list->list[list->nr]), oid);
-	list->nr++;
+	ALLOC_GROW(ctx->oids.list, ctx->oids.nr + 1, ctx->oids.alloc);
+	oidcpy(&(ctx->oids.list[ctx->oids.nr]), oid);
+	ctx->oids.nr++;
 
 	return 0;
 }
 
-static void add_missing_parents(struct packed_oid_list *oids, struct commit *commit)
+static void add_missing_parents(struct write_commit_graph_context *ctx, struct commit *commit)
 {
 	struct commit_list *parent;
 	for (parent = commit->parents; parent; parent = parent->next) {
 		if (!(parent->item->object.flags & UNINTERESTING)) {
-			ALLOC_GROW(oids->list, oids->nr + 1, oids->alloc);
-			oidcpy(&oids->list[oids->nr], &(parent->item->object.oid));
-			oids->nr++;
+			ALLOC_GROW(ctx->oids.list, ctx->oids.nr + 1, ctx->oids.alloc);
+			oidcpy(&ctx->oids.list[ctx->oids.nr], &(parent->item->object.oid));
+			ctx->oids.nr++;
 			parent->item->object.flags |= UNINTERESTING;
 		}
 	}
 }
 
-static void close_reachable(struct packed_oid_list *oids, int report_progress)
+static void close_reachable(struct write_commit_graph_context *ctx)
 {
 	int i;
 	struct commit *commit;
 	struct progress *progress = NULL;
 	int j = 0;
 
-	if (report_progress)
+	if (ctx->report_progress)
 		progress = start_delayed_progress(
 			_("Annotating commits in commit graph"), 0);
-	for (i = 0; i < oids->nr; i++) {
+	for (i = 0; i < ctx->oids.nr; i++) {
 		display_progress(progress, ++j);
-		commit = lookup_commit(the_repository, &oids->list[i]);
+		commit = lookup_commit(the_repository, &ctx->oids.list[i]);
 		if (commit)
 			commit->object.flags |= UNINTERESTING;
 	}
 
 	/*
-	 * As this loop runs, oids->nr may grow, but not more
+	 * As this loop runs, oids.nr may grow, but not more
 	 * than the number of missing commits in the reachable
-	 * closure.
+	 * closure. When writing a split graph, the commits of
+	 * the existing layers are already closed under reachability,
+	 * so there is no need to walk past them.
 	 */
-	for (i = 0; i < oids->nr; i++) {
+	for (i = 0; i < ctx->oids.nr; i++) {
 		display_progress(progress, ++j);
-		commit = lookup_commit(the_repository, &oids->list[i]);
+		commit = lookup_commit(the_repository, &ctx->oids.list[i]);
 
-		if (commit && !parse_commit(commit))
-			add_missing_parents(oids, commit);
+		if (!commit || parse_commit(commit))
+			continue;
+		if (ctx->split && in_existing_graph(ctx, &commit->object.oid))
+			continue;
+		add_missing_parents(ctx, commit);
 	}
 
-	for (i = 0; i < oids->nr; i++) {
+	for (i = 0; i < ctx->oids.nr; i++) {
 		display_progress(progress, ++j);
-		commit = lookup_commit(the_repository, &oids->list[i]);
+		commit = lookup_commit(the_repository, &ctx->oids.list[i]);
 
 		if (commit)
 			commit->object.flags &= ~UNINTERESTING;
@@ -679,51 +1195,125 @@ static void close_reachable(struct packed_oid_list *oids, int report_progress)
 	stop_progress(&progress);
 }
 
-static void compute_generation_numbers(struct packed_commit_list* commits,
-				       int report_progress)
+/*
+ * Fill 'gen' with the generation numbers of 'c' if they are known: either
+ * computed by this write already, or stored in a layer we build on.
+ */
+static int get_known_generation(struct write_commit_graph_context *ctx,
+				struct commit *c,
+				struct commit_generation *gen)
+{
+	struct commit_generation *slot =
+		commit_generation_slab_at(&ctx->generations, c);
+	struct commit_graph *g;
+	uint32_t pos, lex_index;
+	const unsigned char *commit_data;
+
+	if (slot->topo_level) {
+		*gen = *slot;
+		return 1;
+	}
+
+	if (!ctx->new_base_graph ||
+	    !bsearch_graph(ctx->new_base_graph, &c->object.oid, &pos))
+		return 0;
+
+	g = graph_layer_for_pos(ctx->new_base_graph, pos, &lex_index);
+	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
+	slot->topo_level = load_topo_level(g, commit_data);
+	if (g->read_generation_data)
+		slot->corrected_date = load_generation(g, lex_index);
+	*gen = *slot;
+	return 1;
+}
+
+static void compute_generation_numbers(struct write_commit_graph_context *ctx)
 {
 	int i;
 	struct commit_list *list = NULL;
 	struct progress *progress = NULL;
 
-	if (report_progress)
+	if (ctx->report_progress)
 		progress = start_progress(
 			_("Computing commit graph generation numbers"),
-			commits->nr);
-	for (i = 0; i < commits->nr; i++) {
+			ctx->commits.nr);
+	for (i = 0; i < ctx->commits.nr; i++) {
 		display_progress(progress, i + 1);
-		if (commits->list[i]->generation != GENERATION_NUMBER_INFINITY &&
-		    commits->list[i]->generation != GENERATION_NUMBER_ZERO)
+		if (commit_generation_slab_at(&ctx->generations,
+					      ctx->commits.list[i])->topo_level)
 			continue;
 
-		commit_list_insert(commits->list[i], &list);
+		commit_list_insert(ctx->commits.list[i], &list);
 		while (list) {
 			struct commit *current = list->item;
 			struct commit_list *parent;
+			struct commit_generation *gen;
 			int all_parents_computed = 1;
-			uint32_t max_generation = 0;
+			uint32_t max_level = 0;
+			timestamp_t max_corrected_date = 0;
 
 			for (parent = current->parents; parent; parent = parent->next) {
-				if (parent->item->generation == GENERATION_NUMBER_INFINITY ||
-				    parent->item->generation == GENERATION_NUMBER_ZERO) {
+				struct commit_generation parent_gen;
+
+				if (!get_known_generation(ctx, parent->item, &parent_gen)) {
 					all_parents_computed = 0;
+					parse_commit(parent->item);
 					commit_list_insert(parent->item, &list);
 					break;
-				} else if (parent->item->generation > max_generation) {
-					max_generation = parent->item->generation;
 				}
+
+				if (parent_gen.topo_level > max_level)
+					max_level = parent_gen.topo_level;
+				if (parent_gen.corrected_date > max_corrected_date)
+					max_corrected_date = parent_gen.corrected_date;
 			}
 
 			if (all_parents_computed) {
-				current->generation = max_generation + 1;
-				pop_commit(&list);
+				gen = commit_generation_slab_at(&ctx->generations, current);
+
+				gen->topo_level = max_level + 1;
+				if (gen->topo_level > GENERATION_NUMBER_V1_MAX)
+					gen->topo_level = GENERATION_NUMBER_V1_MAX;
 
-				if (current->generation > GENERATION_NUMBER_MAX)
-					current->generation = GENERATION_NUMBER_MAX;
+				gen->corrected_date = current->date;
+				if (current->parents &&
+				    max_corrected_date + 1 > gen->corrected_date)
+					gen->corrected_date = max_corrected_date + 1;
+
+				pop_commit(&list);
 			}
 		}
 	}
 	stop_progress(&progress);
+
+	for (i = 0; ctx->write_generation_data && i < ctx->commits.nr; i++) {
+		struct commit *c = ctx->commits.list[i];
+
+		if (commit_generation_slab_at(&ctx->generations, c)->corrected_date -
+		    c->date > GENERATION_NUMBER_V2_OFFSET_MAX)
+			ctx->num_generation_data_overflows++;
+	}
+}
+
+static void compute_bloom_filters(struct write_commit_graph_context *ctx)
+{
+	int i;
+	struct progress *progress = NULL;
+
+	init_bloom_filters();
+
+	if (ctx->report_progress)
+		progress = start_progress(
+			_("Computing commit changed paths Bloom filters"),
+			ctx->commits.nr);
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		struct bloom_filter *filter =
+			get_bloom_filter(ctx->r, ctx->commits.list[i]);
+		ctx->total_bloom_filter_data_size += filter->len;
+		display_progress(progress, i + 1);
+	}
+	stop_progress(&progress);
 }
 
 static int add_ref_to_list(const char *refname,
@@ -736,197 +1326,383 @@ static int add_ref_to_list(const char *refname,
 	return 0;
 }
 
-void write_commit_graph_reachable(const char *obj_dir, int append,
-				  int report_progress)
+void write_commit_graph_reachable(const char *obj_dir, unsigned int flags,
+				  const struct split_commit_graph_opts *split_opts)
 {
 	struct string_list list = STRING_LIST_INIT_DUP;
 
 	for_each_ref(add_ref_to_list, &list);
-	write_commit_graph(obj_dir, NULL, &list, append, report_progress);
+	write_commit_graph(obj_dir, NULL, &list, flags, split_opts);
 
 	string_list_clear(&list, 0);
 }
 
-void write_commit_graph(const char *obj_dir,
-			struct string_list *pack_indexes,
-			struct string_list *commit_hex,
-			int append, int report_progress)
+static void fill_oids_from_packs(struct write_commit_graph_context *ctx,
+				 struct string_list *pack_indexes)
 {
-	struct packed_oid_list oids;
-	struct packed_commit_list commits;
-	struct hashfile *f;
-	uint32_t i, count_distinct = 0;
-	char *graph_name;
-	struct lock_file lk = LOCK_INIT;
-	uint32_t chunk_ids[5];
-	uint64_t chunk_offsets[5];
-	int num_chunks;
-	int num_extra_edges;
-	struct commit_list *parent;
+	uint32_t i;
+	struct strbuf packname = STRBUF_INIT;
+	int dirlen;
+
+	strbuf_addf(&packname, "%s/pack/", ctx->obj_dir);
+	dirlen = packname.len;
+	if (ctx->report_progress) {
+		ctx->progress = start_delayed_progress(
+			_("Finding commits for commit graph"), 0);
+		ctx->progress_done = 0;
+	}
+	for (i = 0; i < pack_indexes->nr; i++) {
+		struct packed_git *p;
+		strbuf_setlen(&packname, dirlen);
+		strbuf_addstr(&packname, pack_indexes->items[i].string);
+		p = add_packed_git(packname.buf, packname.len, 1);
+		if (!p)
+			die(_("error adding pack %s"), packname.buf);
+		if (open_pack_index(p))
+			die(_("error opening index for %s"), packname.buf);
+		for_each_object_in_pack(p, add_packed_commits, ctx, 0);
+		close_pack(p);
+		free(p);
+	}
+	stop_progress(&ctx->progress);
+	strbuf_release(&packname);
+}
+
+static void fill_oids_from_commit_hex(struct write_commit_graph_context *ctx,
+				      struct string_list *commit_hex)
+{
+	uint32_t i;
 	struct progress *progress = NULL;
 
-	if (!commit_graph_compatible(the_repository))
-		return;
+	if (ctx->report_progress)
+		progress = start_delayed_progress(
+			_("Finding commits for commit graph"),
+			commit_hex->nr);
+	for (i = 0; i < commit_hex->nr; i++) {
+		const char *end;
+		struct object_id oid;
+		struct commit *result;
 
-	oids.nr = 0;
-	oids.alloc = approximate_object_count() / 32;
-	oids.progress = NULL;
-	oids.progress_done = 0;
+		display_progress(progress, i + 1);
+		if (commit_hex->items[i].string &&
+		    parse_oid_hex(commit_hex->items[i].string, &oid, &end))
+			continue;
 
-	if (append) {
-		prepare_commit_graph_one(the_repository, obj_dir);
-		if (the_repository->objects->commit_graph)
-			oids.alloc += the_repository->objects->commit_graph->num_commits;
+		result = lookup_commit_reference_gently(the_repository, &oid, 1);
+
+		if (result) {
+			ALLOC_GROW(ctx->oids.list, ctx->oids.nr + 1, ctx->oids.alloc);
+			oidcpy(&ctx->oids.list[ctx->oids.nr], &(result->object.oid));
+			ctx->oids.nr++;
+		}
 	}
+	stop_progress(&progress);
+}
 
-	if (oids.alloc < 1024)
-		oids.alloc = 1024;
-	ALLOC_ARRAY(oids.list, oids.alloc);
+static void fill_oids_from_all_packs(struct write_commit_graph_context *ctx)
+{
+	if (ctx->report_progress)
+		ctx->progress = start_delayed_progress(
+			_("Finding commits for commit graph"), 0);
+	for_each_packed_object(add_packed_commits, ctx, 0);
+	stop_progress(&ctx->progress);
+}
 
-	if (append && the_repository->objects->commit_graph) {
-		struct commit_graph *commit_graph =
-			the_repository->objects->commit_graph;
-		for (i = 0; i < commit_graph->num_commits; i++) {
-			const unsigned char *hash = commit_graph->chunk_oid_lookup +
-				commit_graph->hash_len * i;
-			hashcpy(oids.list[oids.nr++].hash, hash);
-		}
+static void copy_oids_to_commits(struct write_commit_graph_context *ctx)
+{
+	uint32_t i;
+
+	QSORT(ctx->oids.list, ctx->oids.nr, commit_compare);
+
+	for (i = 0; i < ctx->oids.nr; i++) {
+		struct commit *c;
+
+		if (i > 0 && oideq(&ctx->oids.list[i - 1], &ctx->oids.list[i]))
+			continue;
+		if (ctx->split && in_existing_graph(ctx, &ctx->oids.list[i]))
+			continue;
+
+		c = lookup_commit(the_repository, &ctx->oids.list[i]);
+		if (!c)
+			continue;
+
+		ALLOC_GROW(ctx->commits.list, ctx->commits.nr + 1, ctx->commits.alloc);
+		ctx->commits.list[ctx->commits.nr++] = c;
 	}
+}
 
-	if (pack_indexes) {
-		struct strbuf packname = STRBUF_INIT;
-		int dirlen;
-		strbuf_addf(&packname, "%s/pack/", obj_dir);
-		dirlen = packname.len;
-		if (report_progress) {
-			oids.progress = start_delayed_progress(
-				_("Finding commits for commit graph"), 0);
-			oids.progress_done = 0;
-		}
-		for (i = 0; i < pack_indexes->nr; i++) {
-			struct packed_git *p;
-			strbuf_setlen(&packname, dirlen);
-			strbuf_addstr(&packname, pack_indexes->items[i].string);
-			p = add_packed_git(packname.buf, packname.len, 1);
-			if (!p)
-				die(_("error adding pack %s"), packname.buf);
-			if (open_pack_index(p))
-				die(_("error opening index for %s"), packname.buf);
-			for_each_object_in_pack(p, add_packed_commits, &oids, 0);
-			close_pack(p);
-			free(p);
-		}
-		stop_progress(&oids.progress);
-		strbuf_release(&packname);
-	}
-
-	if (commit_hex) {
-		if (report_progress)
-			progress = start_delayed_progress(
-				_("Finding commits for commit graph"),
-				commit_hex->nr);
-		for (i = 0; i < commit_hex->nr; i++) {
-			const char *end;
-			struct object_id oid;
-			struct commit *result;
-
-			display_progress(progress, i + 1);
-			if (commit_hex->items[i].string &&
-			    parse_oid_hex(commit_hex->items[i].string, &oid, &end))
-				continue;
-
-			result = lookup_commit_reference_gently(the_repository, &oid, 1);
-
-			if (result) {
-				ALLOC_GROW(oids.list, oids.nr + 1, oids.alloc);
-				oidcpy(&oids.list[oids.nr], &(result->object.oid));
-				oids.nr++;
-			}
-		}
-		stop_progress(&progress);
+static void count_extra_edges(struct write_commit_graph_context *ctx)
+{
+	uint32_t i;
+
+	ctx->num_extra_edges = 0;
+	for (i = 0; i < ctx->commits.nr; i++) {
+		int num_parents = 0;
+		struct commit_list *parent;
+
+		parse_commit(ctx->commits.list[i]);
+
+		for (parent = ctx->commits.list[i]->parents;
+		     parent; parent = parent->next)
+			num_parents++;
+
+		if (num_parents > 2)
+			ctx->num_extra_edges += num_parents - 1;
+	}
+}
+
+/*
+ * Decide which layers of the existing chain the new layer absorbs: keep
+ * merging the layer below as long as it is not much bigger than what we
+ * are about to write (or the new layer is over the commit limit), so
+ * that the layer sizes stay geometric and the chain stays short.
+ */
+static void split_graph_merge_strategy(struct write_commit_graph_context *ctx)
+{
+	struct commit_graph *g = ctx->existing;
+	uint32_t num_commits = ctx->commits.nr;
+	int size_mult = 2;
+	uint32_t max_commits = 0;
+	char *single_name = get_commit_graph_filename(ctx->obj_dir);
+
+	if (ctx->split_opts) {
+		if (ctx->split_opts->size_multiple)
+			size_mult = ctx->split_opts->size_multiple;
+		max_commits = ctx->split_opts->max_commits;
 	}
 
-	if (!pack_indexes && !commit_hex) {
-		if (report_progress)
-			oids.progress = start_delayed_progress(
-				_("Finding commits for commit graph"), 0);
-		for_each_packed_object(add_packed_commits, &oids, 0);
-		stop_progress(&oids.progress);
+	ctx->num_commit_graphs_after = 1;
+	for (; g; g = g->base_graph)
+		ctx->num_commit_graphs_after++;
+
+	g = ctx->existing;
+	while (g && (g->num_commits <= size_mult * num_commits ||
+		     (max_commits && num_commits > max_commits))) {
+		num_commits += g->num_commits;
+		g = g->base_graph;
+		ctx->num_commit_graphs_after--;
 	}
 
-	close_reachable(&oids, report_progress);
+	ctx->new_base_graph = g;
+	if (g)
+		ctx->new_num_commits_in_base = g->num_commits + g->num_commits_in_base;
+
+	/*
+	 * A single-file graph we keep becomes the bottom layer of the
+	 * chain; it is renamed into place once the new layer is written.
+	 */
+	if (g && !strcmp(g->filename, single_name))
+		ctx->base_graph_name = xstrdup(g->filename);
+
+	free(single_name);
+}
+
+static void merge_commit_graph(struct write_commit_graph_context *ctx,
+			       struct commit_graph *g)
+{
+	uint32_t i;
 
-	QSORT(oids.list, oids.nr, commit_compare);
+	ALLOC_GROW(ctx->commits.list, ctx->commits.nr + g->num_commits,
+		   ctx->commits.alloc);
 
-	count_distinct = 1;
-	for (i = 1; i < oids.nr; i++) {
-		if (!oideq(&oids.list[i - 1], &oids.list[i]))
-			count_distinct++;
+	for (i = 0; i < g->num_commits; i++) {
+		struct object_id oid;
+		struct commit *result;
+
+		hashcpy(oid.hash, g->chunk_oid_lookup + g->hash_len * i);
+		result = lookup_commit_reference_gently(the_repository, &oid, 1);
+
+		if (result)
+			ctx->commits.list[ctx->commits.nr++] = result;
 	}
+}
 
-	if (count_distinct >= GRAPH_PARENT_MISSING)
-		die(_("the commit graph format cannot write %d commits"), count_distinct);
+static void merge_commit_graphs(struct write_commit_graph_context *ctx)
+{
+	struct commit_graph *g = ctx->existing;
+	uint32_t i, dedup_i = 0;
 
-	commits.nr = 0;
-	commits.alloc = count_distinct;
-	ALLOC_ARRAY(commits.list, commits.alloc);
+	while (g && g != ctx->new_base_graph) {
+		merge_commit_graph(ctx, g);
+		g = g->base_graph;
+	}
 
-	num_extra_edges = 0;
-	for (i = 0; i < oids.nr; i++) {
-		int num_parents = 0;
-		if (i > 0 && oideq(&oids.list[i - 1], &oids.list[i]))
+	QSORT(ctx->commits.list, ctx->commits.nr, commit_ptr_compare);
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		if (i && oideq(&ctx->commits.list[i - 1]->object.oid,
+			       &ctx->commits.list[i]->object.oid))
 			continue;
+		ctx->commits.list[dedup_i++] = ctx->commits.list[i];
+	}
+	ctx->commits.nr = dedup_i;
+}
 
-		commits.list[commits.nr] = lookup_commit(the_repository, &oids.list[i]);
-		parse_commit(commits.list[commits.nr]);
+/*
+ * Remove the layers in obj_dir/info/commit-graphs that are not listed in
+ * 'keep', unless they were modified after the configured expiry time.
+ */
+static void expire_commit_graphs(struct write_commit_graph_context *ctx,
+				 struct string_list *keep)
+{
+	struct strbuf path = STRBUF_INIT;
+	DIR *dir;
+	struct dirent *de;
+	size_t dirnamelen;
+	timestamp_t expire_time = 0;
+
+	if (ctx->split_opts)
+		expire_time = ctx->split_opts->expire_time;
+
+	strbuf_addf(&path, "%s/info/commit-graphs", ctx->obj_dir);
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
 
-		for (parent = commits.list[commits.nr]->parents;
-		     parent; parent = parent->next)
-			num_parents++;
+	strbuf_addch(&path, '/');
+	dirnamelen = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		const char *hex;
+		struct stat st;
 
-		if (num_parents > 2)
-			num_extra_edges += num_parents - 1;
+		if (!skip_prefix(de->d_name, "graph-", &hex) ||
+		    !ends_with(hex, ".graph"))
+			continue;
+		if (string_list_has_string(keep, de->d_name))
+			continue;
+
+		strbuf_setlen(&path, dirnamelen);
+		strbuf_addstr(&path, de->d_name);
 
-		commits.nr++;
+		if (expire_time &&
+		    (stat(path.buf, &st) || st.st_mtime > expire_time))
+			continue;
+
+		unlink_or_warn(path.buf);
 	}
-	num_chunks = num_extra_edges ? 4 : 3;
 
-	if (commits.nr >= GRAPH_PARENT_MISSING)
-		die(_("too many commits to write graph"));
+	closedir(dir);
+	strbuf_release(&path);
+}
 
-	compute_generation_numbers(&commits, report_progress);
+static void write_commit_graph_file(struct write_commit_graph_context *ctx)
+{
+	uint32_t i;
+	int fd;
+	struct hashfile *f;
+	struct lock_file lk = LOCK_INIT;
+	uint32_t chunk_ids[MAX_NUM_CHUNKS + 1];
+	uint64_t chunk_offsets[MAX_NUM_CHUNKS + 1];
+	int num_chunks = 3;
+	int num_base_graphs = 0;
+	struct object_id file_hash;
+	struct object_id *base_oids = NULL;
+	struct bloom_filter_settings bloom_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	struct string_list keep = STRING_LIST_INIT_DUP;
+	struct commit_graph *g;
+
+	if (ctx->split) {
+		struct strbuf tmp_file = STRBUF_INIT;
+		char *chain_name = get_commit_graph_chain_filename(ctx->obj_dir);
+
+		if (safe_create_leading_directories(chain_name)) {
+			UNLEAK(chain_name);
+			die_errno(_("unable to create leading directories of %s"),
+				  chain_name);
+		}
 
-	graph_name = get_commit_graph_filename(obj_dir);
-	if (safe_create_leading_directories(graph_name)) {
-		UNLEAK(graph_name);
-		die_errno(_("unable to create leading directories of %s"),
-			  graph_name);
+		/* The chain file lock serializes concurrent split writers. */
+		hold_lock_file_for_update(&lk, chain_name, LOCK_DIE_ON_ERROR);
+		free(chain_name);
+
+		strbuf_addf(&tmp_file, "%s/info/commit-graphs/tmp_graph_XXXXXX",
+			    ctx->obj_dir);
+		ctx->graph_name = strbuf_detach(&tmp_file, NULL);
+		fd = git_mkstemp_mode(ctx->graph_name, 0444);
+		if (fd < 0)
+			die_errno(_("unable to create '%s'"), ctx->graph_name);
+
+		num_base_graphs = ctx->num_commit_graphs_after - 1;
+		f = hashfd(fd, ctx->graph_name);
+	} else {
+		ctx->graph_name = get_commit_graph_filename(ctx->obj_dir);
+		if (safe_create_leading_directories(ctx->graph_name)) {
+			UNLEAK(ctx->graph_name);
+			die_errno(_("unable to create leading directories of %s"),
+				  ctx->graph_name);
+		}
+
+		hold_lock_file_for_update(&lk, ctx->graph_name, LOCK_DIE_ON_ERROR);
+		f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
 	}
 
-	hold_lock_file_for_update(&lk, graph_name, LOCK_DIE_ON_ERROR);
-	f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
+	if (ctx->write_generation_data)
+		num_chunks++;
+	if (ctx->num_generation_data_overflows)
+		num_chunks++;
+	if (ctx->num_extra_edges)
+		num_chunks++;
+	if (ctx->changed_paths)
+		num_chunks += 2;
+	if (num_base_graphs)
+		num_chunks++;
 
 	hashwrite_be32(f, GRAPH_SIGNATURE);
 
 	hashwrite_u8(f, GRAPH_VERSION);
 	hashwrite_u8(f, GRAPH_OID_VERSION);
 	hashwrite_u8(f, num_chunks);
-	hashwrite_u8(f, 0); /* unused padding byte */
-
-	chunk_ids[0] = GRAPH_CHUNKID_OIDFANOUT;
-	chunk_ids[1] = GRAPH_CHUNKID_OIDLOOKUP;
-	chunk_ids[2] = GRAPH_CHUNKID_DATA;
-	if (num_extra_edges)
-		chunk_ids[3] = GRAPH_CHUNKID_LARGEEDGES;
-	else
-		chunk_ids[3] = 0;
-	chunk_ids[4] = 0;
+	hashwrite_u8(f, num_base_graphs);
+
+	i = 0;
+	chunk_ids[i] = GRAPH_CHUNKID_OIDFANOUT;
+	chunk_offsets[i + 1] = GRAPH_FANOUT_SIZE;
+	i++;
+	chunk_ids[i] = GRAPH_CHUNKID_OIDLOOKUP;
+	chunk_offsets[i + 1] = GRAPH_OID_LEN * ctx->commits.nr;
+	i++;
+	chunk_ids[i] = GRAPH_CHUNKID_DATA;
+	chunk_offsets[i + 1] = (GRAPH_OID_LEN + 16) * ctx->commits.nr;
+	i++;
+	if (ctx->write_generation_data) {
+		chunk_ids[i] = GRAPH_CHUNKID_GENERATION_DATA;
+		chunk_offsets[i + 1] = sizeof(uint32_t) * ctx->commits.nr;
+		i++;
+	}
+	if (ctx->num_generation_data_overflows) {
+		chunk_ids[i] = GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW;
+		chunk_offsets[i + 1] = 8 * ctx->num_generation_data_overflows;
+		i++;
+	}
+	if (ctx->num_extra_edges) {
+		chunk_ids[i] = GRAPH_CHUNKID_LARGEEDGES;
+		chunk_offsets[i + 1] = 4 * ctx->num_extra_edges;
+		i++;
+	}
+	if (ctx->changed_paths) {
+		chunk_ids[i] = GRAPH_CHUNKID_BLOOMINDEXES;
+		chunk_offsets[i + 1] = 4 * ctx->commits.nr;
+		i++;
+		chunk_ids[i] = GRAPH_CHUNKID_BLOOMDATA;
+		chunk_offsets[i + 1] = BLOOMDATA_CHUNK_HEADER_SIZE +
+				       ctx->total_bloom_filter_data_size;
+		i++;
+	}
+	if (num_base_graphs) {
+		chunk_ids[i] = GRAPH_CHUNKID_BASE;
+		chunk_offsets[i + 1] = GRAPH_OID_LEN * num_base_graphs;
+		i++;
+	}
+	if (i != num_chunks)
+		BUG("incorrect number of chunks: %u != %d", i, num_chunks);
+	chunk_ids[i] = 0;
 
+	/* Turn the chunk sizes into absolute offsets. */
 	chunk_offsets[0] = 8 + (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
-	chunk_offsets[1] = chunk_offsets[0] + GRAPH_FANOUT_SIZE;
-	chunk_offsets[2] = chunk_offsets[1] + GRAPH_OID_LEN * commits.nr;
-	chunk_offsets[3] = chunk_offsets[2] + (GRAPH_OID_LEN + 16) * commits.nr;
-	chunk_offsets[4] = chunk_offsets[3] + 4 * num_extra_edges;
+	for (i = 1; i <= num_chunks; i++)
+		chunk_offsets[i] += chunk_offsets[i - 1];
 
 	for (i = 0; i <= num_chunks; i++) {
 		uint32_t chunk_write[3];
@@ -937,18 +1713,220 @@ void write_commit_graph(const char *obj_dir,
 		hashwrite(f, chunk_write, 12);
 	}
 
-	write_graph_chunk_fanout(f, commits.list, commits.nr);
-	write_graph_chunk_oids(f, GRAPH_OID_LEN, commits.list, commits.nr);
-	write_graph_chunk_data(f, GRAPH_OID_LEN, commits.list, commits.nr);
-	write_graph_chunk_large_edges(f, commits.list, commits.nr);
+	write_graph_chunk_fanout(f, ctx);
+	write_graph_chunk_oids(f, GRAPH_OID_LEN, ctx);
+	write_graph_chunk_data(f, GRAPH_OID_LEN, ctx);
+	if (ctx->write_generation_data)
+		write_graph_chunk_generation_data(f, ctx);
+	if (ctx->num_generation_data_overflows)
+		write_graph_chunk_generation_data_overflow(f, ctx);
+	write_graph_chunk_large_edges(f, ctx);
+	if (ctx->changed_paths) {
+		write_graph_chunk_bloom_indexes(f, ctx);
+		write_graph_chunk_bloom_data(f, ctx, &bloom_settings);
+		deinit_bloom_filters();
+	}
+	write_graph_chunk_base(f, ctx->new_base_graph, num_base_graphs);
+
+	/*
+	 * Remember the layers we keep before the existing graph is closed;
+	 * the chain file lists them bottom layer first.
+	 */
+	ALLOC_ARRAY(base_oids, num_base_graphs + 1);
+	for (i = num_base_graphs, g = ctx->new_base_graph; i && g; g = g->base_graph)
+		oidcpy(&base_oids[--i], &g->oid);
+
+	close_commit_graph(ctx->r);
+
+	if (ctx->split) {
+		char *final_name, *graph_file;
+		struct strbuf layer = STRBUF_INIT;
+		FILE *chain_fp = fdopen_lock_file(&lk, "w");
+
+		if (!chain_fp)
+			die_errno(_("unable to open commit-graph chain file"));
+
+		finalize_hashfile(f, file_hash.hash,
+				  CSUM_HASH_IN_STREAM | CSUM_FSYNC | CSUM_CLOSE);
+		oidcpy(&base_oids[num_base_graphs], &file_hash);
+
+		final_name = get_split_graph_filename(ctx->obj_dir,
+						      oid_to_hex(&file_hash));
+		if (rename(ctx->graph_name, final_name))
+			die_errno(_("failed to rename temporary commit-graph file"));
+		free(final_name);
+
+		if (ctx->base_graph_name) {
+			char *new_base_name =
+				get_split_graph_filename(ctx->obj_dir,
+							 oid_to_hex(&base_oids[0]));
+
+			if (rename(ctx->base_graph_name, new_base_name))
+				die_errno(_("failed to rename base commit-graph file"));
+			free(new_base_name);
+		}
 
-	close_commit_graph(the_repository);
-	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC);
-	commit_lock_file(&lk);
+		for (i = 0; i <= num_base_graphs; i++) {
+			const char *hex = oid_to_hex(&base_oids[i]);
 
-	free(graph_name);
-	free(commits.list);
-	free(oids.list);
+			fprintf(chain_fp, "%s\n", hex);
+			strbuf_reset(&layer);
+			strbuf_addf(&layer, "graph-%s.graph", hex);
+			string_list_insert(&keep, layer.buf);
+		}
+		strbuf_release(&layer);
+		if (commit_lock_file(&lk))
+			die_errno(_("unable to write commit-graph chain file"));
+
+		/* The chain now has every commit; drop any single-file graph. */
+		graph_file = get_commit_graph_filename(ctx->obj_dir);
+		unlink(graph_file);
+		free(graph_file);
+	} else {
+		char *chain_name = get_commit_graph_chain_filename(ctx->obj_dir);
+
+		finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+		commit_lock_file(&lk);
+
+		/* The single file now has every commit; drop any chain. */
+		unlink(chain_name);
+		free(chain_name);
+	}
+
+	expire_commit_graphs(ctx, &keep);
+
+	string_list_clear(&keep, 0);
+	free(base_oids);
+}
+
+void write_commit_graph(const char *obj_dir,
+			struct string_list *pack_indexes,
+			struct string_list *commit_hex,
+			unsigned int flags,
+			const struct split_commit_graph_opts *split_opts)
+{
+	struct write_commit_graph_context *ctx;
+	uint32_t i, count_distinct = 0;
+
+	if (!commit_graph_compatible(the_repository))
+		return;
+
+	ctx = xcalloc(1, sizeof(struct write_commit_graph_context));
+	ctx->r = the_repository;
+	ctx->obj_dir = obj_dir;
+	ctx->append = flags & COMMIT_GRAPH_APPEND ? 1 : 0;
+	ctx->report_progress = flags & COMMIT_GRAPH_PROGRESS ? 1 : 0;
+	ctx->split = flags & COMMIT_GRAPH_SPLIT ? 1 : 0;
+	ctx->changed_paths = flags & COMMIT_GRAPH_CHANGED_PATHS ? 1 : 0;
+	ctx->split_opts = split_opts;
+	ctx->write_generation_data = commit_graph_generation_version(ctx->r) >= 2;
+	init_commit_generation_slab(&ctx->generations);
+
+	ctx->approx_nr_objects = approximate_object_count();
+	ctx->oids.alloc = ctx->approx_nr_objects / 32;
+
+	if (ctx->append || ctx->split) {
+		prepare_commit_graph_one(ctx->r, obj_dir);
+		ctx->existing = ctx->r->objects->commit_graph;
+
+		/* Only ever build on top of a graph of our own object directory. */
+		if (ctx->existing &&
+		    (!ctx->existing->obj_dir ||
+		     strcmp(ctx->existing->obj_dir, obj_dir)))
+			ctx->existing = NULL;
+	}
+
+	if (ctx->append && ctx->existing) {
+		struct commit_graph *g;
+
+		for (g = ctx->existing; g; g = g->base_graph)
+			ctx->oids.alloc += g->num_commits;
+	}
+
+	if (ctx->oids.alloc < 1024)
+		ctx->oids.alloc = 1024;
+	ALLOC_ARRAY(ctx->oids.list, ctx->oids.alloc);
+
+	if (ctx->append && ctx->existing) {
+		struct commit_graph *g;
+
+		for (g = ctx->existing; g; g = g->base_graph) {
+			for (i = 0; i < g->num_commits; i++) {
+				const unsigned char *hash = g->chunk_oid_lookup +
+					g->hash_len * i;
+				hashcpy(ctx->oids.list[ctx->oids.nr++].hash, hash);
+			}
+		}
+	}
+
+	if (pack_indexes)
+		fill_oids_from_packs(ctx, pack_indexes);
+
+	if (commit_hex)
+		fill_oids_from_commit_hex(ctx, commit_hex);
+
+	if (!pack_indexes && !commit_hex)
+		fill_oids_from_all_packs(ctx);
+
+	close_reachable(ctx);
+
+	QSORT(ctx->oids.list, ctx->oids.nr, commit_compare);
+
+	count_distinct = 1;
+	for (i = 1; i < ctx->oids.nr; i++) {
+		if (!oideq(&ctx->oids.list[i - 1], &ctx->oids.list[i]))
+			count_distinct++;
+	}
+
+	if (count_distinct >= GRAPH_PARENT_MISSING)
+		die(_("the commit graph format cannot write %d commits"), count_distinct);
+
+	ctx->commits.alloc = count_distinct;
+	ALLOC_ARRAY(ctx->commits.list, ctx->commits.alloc);
+
+	copy_oids_to_commits(ctx);
+
+	if (ctx->split) {
+		split_graph_merge_strategy(ctx);
+
+		/* Nothing new and nothing to merge: the chain is fine as is. */
+		if (!ctx->commits.nr && ctx->new_base_graph == ctx->existing)
+			goto cleanup;
+
+		merge_commit_graphs(ctx);
+	}
+
+	if (ctx->write_generation_data) {
+		struct commit_graph *g;
+
+		/* Corrected dates are only useful if all layers have them. */
+		for (g = ctx->new_base_graph; g; g = g->base_graph)
+			if (!g->read_generation_data)
+				ctx->write_generation_data = 0;
+	}
+
+	count_extra_edges(ctx);
+
+	if (ctx->commits.nr + ctx->new_num_commits_in_base >= GRAPH_PARENT_MISSING)
+		die(_("too many commits to write graph"));
+
+	compute_generation_numbers(ctx);
+
+	if (ctx->changed_paths) {
+		compute_bloom_filters(ctx);
+		if (ctx->total_bloom_filter_data_size > UINT32_MAX)
+			die(_("changed-path Bloom filters are too large to write"));
+	}
+
+	write_commit_graph_file(ctx);
+
+cleanup:
+	clear_commit_generation_slab(&ctx->generations);
+	free(ctx->graph_name);
+	free(ctx->base_graph_name);
+	free(ctx->commits.list);
+	free(ctx->oids.list);
+	free(ctx);
 }
 
 #define VERIFY_COMMIT_GRAPH_ERROR_HASH 2
@@ -968,7 +1946,8 @@ static void graph_report(const char *fmt, ...)
 #define GENERATION_ZERO_EXISTS 1
 #define GENERATION_NUMBER_EXISTS 2
 
-int verify_commit_graph(struct repository *r, struct commit_graph *g)
+static int verify_one_commit_graph(struct repository *r,
+				   struct commit_graph *g)
 {
 	uint32_t i, cur_fanout_pos = 0;
 	struct object_id prev_oid, cur_oid, checksum;
@@ -977,11 +1956,6 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g)
 	int devnull;
 	struct progress *progress = NULL;
 
-	if (!g) {
-		graph_report("no commit-graph file loaded");
-		return 1;
-	}
-
 	verify_commit_graph_error = 0;
 
 	if (!g->chunk_oid_fanout)
@@ -1048,7 +2022,8 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g)
 	for (i = 0; i < g->num_commits; i++) {
 		struct commit *graph_commit, *odb_commit;
 		struct commit_list *graph_parents, *odb_parents;
-		uint32_t max_generation = 0;
+		uint32_t topo_level, max_level = 0;
+		timestamp_t max_corrected_date = 0;
 
 		display_progress(progress, i + 1);
 		hashcpy(cur_oid.hash, g->chunk_oid_lookup + g->hash_len * i);
@@ -1084,8 +2059,16 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g)
 					     oid_to_hex(&graph_parents->item->object.oid),
 					     oid_to_hex(&odb_parents->item->object.oid));
 
-			if (graph_parents->item->generation > max_generation)
-				max_generation = graph_parents->item->generation;
+			if (graph_parents->item->graph_pos != COMMIT_NOT_FROM_GRAPH) {
+				uint32_t pos = graph_parents->item->graph_pos;
+				uint32_t parent_level = topo_level_at(g, pos);
+				timestamp_t parent_date = generation_at(g, pos);
+
+				if (parent_level > max_level)
+					max_level = parent_level;
+				if (parent_date > max_corrected_date)
+					max_corrected_date = parent_date;
+			}
 
 			graph_parents = graph_parents->next;
 			odb_parents = odb_parents->next;
@@ -1095,7 +2078,22 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g)
 			graph_report("commit-graph parent list for commit %s terminates early",
 				     oid_to_hex(&cur_oid));
 
-		if (!graph_commit->generation) {
+		if (g->read_generation_data) {
+			timestamp_t corrected_date = generation_at(g, graph_commit->graph_pos);
+			timestamp_t expected = odb_commit->date;
+
+			if (graph_commit->parents && max_corrected_date + 1 > expected)
+				expected = max_corrected_date + 1;
+
+			if (corrected_date != expected)
+				graph_report("commit-graph corrected commit date for commit %s is %"PRItime" != %"PRItime,
+					     oid_to_hex(&cur_oid),
+					     corrected_date,
+					     expected);
+		}
+
+		topo_level = topo_level_at(g, graph_commit->graph_pos);
+		if (!topo_level) {
 			if (generation_zero == GENERATION_NUMBER_EXISTS)
 				graph_report("commit-graph has generation number zero for commit %s, but non-zero elsewhere",
 					     oid_to_hex(&cur_oid));
@@ -1108,18 +2106,18 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g)
 			continue;
 
 		/*
-		 * If one of our parents has generation GENERATION_NUMBER_MAX, then
-		 * our generation is also GENERATION_NUMBER_MAX. Decrement to avoid
-		 * extra logic in the following condition.
+		 * If one of our parents has generation GENERATION_NUMBER_V1_MAX,
+		 * then our generation is also GENERATION_NUMBER_V1_MAX. Decrement
+		 * to avoid extra logic in the following condition.
 		 */
-		if (max_generation == GENERATION_NUMBER_MAX)
-			max_generation--;
+		if (max_level == GENERATION_NUMBER_V1_MAX)
+			max_level--;
 
-		if (graph_commit->generation != max_generation + 1)
+		if (topo_level != max_level + 1)
 			graph_report("commit-graph generation for commit %s is %u != %u",
 				     oid_to_hex(&cur_oid),
-				     graph_commit->generation,
-				     max_generation + 1);
+				     topo_level,
+				     max_level + 1);
 
 		if (graph_commit->date != odb_commit->date)
 			graph_report("commit date for commit %s in commit-graph is %"PRItime" != %"PRItime,
@@ -1132,14 +2130,38 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g)
 	return verify_commit_graph_error;
 }
 
+int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags)
+{
+	int local_error = 0;
+
+	if (!g) {
+		graph_report("no commit-graph file loaded");
+		return 1;
+	}
+
+	for (; g; g = g->base_graph) {
+		local_error |= verify_one_commit_graph(r, g);
+		if (flags & VERIFY_COMMIT_GRAPH_SHALLOW)
+			break;
+	}
+
+	return local_error;
+}
+
 void free_commit_graph(struct commit_graph *g)
 {
-	if (!g)
-		return;
-	if (g->graph_fd >= 0) {
-		munmap((void *)g->data, g->data_len);
-		g->data = NULL;
-		close(g->graph_fd);
+	while (g) {
+		struct commit_graph *base = g->base_graph;
+
+		if (g->graph_fd >= 0) {
+			munmap((void *)g->data, g->data_len);
+			g->data = NULL;
+			close(g->graph_fd);
+		}
+		free(g->bloom_filter_settings);
+		free(g->filename);
+		free(g);
+
+		g = base;
 	}
-	free(g);
 }
@@ -9,8 +9,10 @@
 #define GIT_TEST_COMMIT_GRAPH "GIT_TEST_COMMIT_GRAPH"
 
 struct commit;
+struct bloom_filter_settings;
 
 char *get_commit_graph_filename(const char *obj_dir);
+char *get_commit_graph_chain_filename(const char *obj_dir);
 
 /*
  * Given a commit struct, try to fill the commit struct info, including:
@@ -45,29 +47,128 @@ struct commit_graph {
 	unsigned char num_chunks;
 	uint32_t num_commits;
 	struct object_id oid;
+	char *filename;
+	const char *obj_dir;
+
+	/*
+	 * A "split" commit-graph is a chain of layers, each layer holding
+	 * only the commits that are not in the layers below it. Positions
+	 * of commits are global to the chain: the commits of this layer
+	 * start at position num_commits_in_base.
+	 */
+	uint32_t num_commits_in_base;
+	unsigned char num_base_graphs;
+	struct commit_graph *base_graph;
+
+	/*
+	 * Whether generation numbers are read from the corrected commit
+	 * dates of the Generation Data chunk instead of the topological
+	 * levels of the Commit Data chunk. This is the same for all layers
+	 * of a chain: only set if every layer has generation data.
+	 */
+	unsigned read_generation_data:1;
 
 	const uint32_t *chunk_oid_fanout;
 	const unsigned char *chunk_oid_lookup;
 	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_generation_data;
+	const unsigned char *chunk_generation_data_overflow;
 	const unsigned char *chunk_large_edges;
+	const unsigned char *chunk_bloom_indexes;
+	const unsigned char *chunk_bloom_data;
+	size_t bloom_data_size; /* of the chunk, including its header */
+	const unsigned char *chunk_base_graphs;
+
+	struct bloom_filter_settings *bloom_filter_settings;
 };
 
 struct commit_graph *load_commit_graph_one(const char *graph_file);
 
+/*
+ * Load the commit-graph of the given object directory, either from the
+ * single "info/commit-graph" file or from the chain of layers listed in
+ * "info/commit-graphs/commit-graph-chain".
+ */
+struct commit_graph *read_commit_graph_one(const char *obj_dir);
+
+/*
+ * Return the layer of the chain 'g' that stores the commit at (global)
+ * position 'pos', and store the position within that layer in *lex_index.
+ */
+struct commit_graph *graph_layer_for_pos(struct commit_graph *g,
+					 uint32_t pos,
+					 uint32_t *lex_index);
+
+/*
+ * Return the changed-path Bloom filter settings of the topmost layer of
+ * 'g' that has filters, or NULL if no layer has any.
+ */
+struct bloom_filter_settings *get_bloom_filter_settings(struct commit_graph *g);
+
+/*
+ * Return 1 if commit_graph is non-NULL, and 0 otherwise.
+ *
+ * On the first invocation, this function attemps to load the commit
+ * graph if the_repository is configured to have one.
+ */
+int prepare_commit_graph(struct repository *r);
+
 /*
  * Return 1 if and only if the repository has a commit-graph
  * file and generation numbers are computed in that file.
+ *
+ * The generation numbers are corrected commit dates if the commit-graph
+ * stores them (and commitGraph.generationVersion is not set to 1), and
+ * topological levels otherwise. Both kinds only ever increase from a
+ * parent to its child, which is all that the reachability code needs.
  */
 int generation_numbers_enabled(struct repository *r);
 
-void write_commit_graph_reachable(const char *obj_dir, int append,
-				  int report_progress);
+/*
+ * Return 1 if and only if the generation numbers of the repository's
+ * commit-graph are corrected commit dates.
+ */
+int corrected_commit_dates_enabled(struct repository *r);
+
+enum commit_graph_write_flags {
+	COMMIT_GRAPH_APPEND        = (1 << 0),
+	COMMIT_GRAPH_PROGRESS      = (1 << 1),
+	/* Compute and write a changed-path Bloom filter for every commit. */
+	COMMIT_GRAPH_CHANGED_PATHS = (1 << 2),
+	/* Write a new layer on top of the existing commit-graph chain. */
+	COMMIT_GRAPH_SPLIT         = (1 << 3),
+};
+
+struct split_commit_graph_opts {
+	/*
+	 * Merge a layer of the chain into the new layer if it has at most
+	 * 'size_multiple' times as many commits as the new layer
+	 * (default: 2).
+	 */
+	int size_multiple;
+
+	/* Merge layers until the new layer has more than this many commits. */
+	int max_commits;
+
+	/*
+	 * Only delete layers that dropped out of the chain if they were
+	 * last modified before this time (0: delete them right away).
+	 */
+	timestamp_t expire_time;
+};
+
+void write_commit_graph_reachable(const char *obj_dir, unsigned int flags,
+				  const struct split_commit_graph_opts *split_opts);
 void write_commit_graph(const char *obj_dir,
 			struct string_list *pack_indexes,
 			struct string_list *commit_hex,
-			int append, int report_progress);
+			unsigned int flags,
+			const struct split_commit_graph_opts *split_opts);
+
+/* Only verify the topmost layer of a split commit-graph. */
+#define VERIFY_COMMIT_GRAPH_SHALLOW	(1 << 0)
 
-int verify_commit_graph(struct repository *r, struct commit_graph *g);
+int verify_commit_graph(struct repository *r, struct commit_graph *g, int flags);
 
 void close_commit_graph(struct repository *);
 void free_commit_graph(struct commit_graph *);
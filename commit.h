@@ -11,9 +11,10 @@
 #include "commit-slab.h"
 
 #define COMMIT_NOT_FROM_GRAPH 0xFFFFFFFF
-#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
-#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+#define GENERATION_NUMBER_INFINITY ((1ULL << 63) - 1)
+#define GENERATION_NUMBER_V1_MAX 0x3FFFFFFF
 #define GENERATION_NUMBER_ZERO 0
+#define GENERATION_NUMBER_V2_OFFSET_MAX ((1ULL << 31) - 1)
 
 struct commit_list {
 	struct commit *item;
@@ -36,8 +37,15 @@ struct commit {
 	 * or get_commit_tree_oid().
 	 */
 	struct tree *maybe_tree;
+
+	/*
+	 * The generation number of the commit, as read from the
+	 * commit-graph: either its topological level, or its corrected
+	 * commit date if the commit-graph stores those. Either way, a
+	 * commit has a larger generation than all of its parents.
+	 */
+	timestamp_t generation;
 	uint32_t graph_pos;
-	uint32_t generation;
 	unsigned int index;
 };
 
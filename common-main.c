@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "exec-cmd.h"
 #include "attr.h"
+#include "packfile.h"
 
 /*
  * Many parts of Git have subprograms communicate via pipe, expect the
@@ -40,6 +41,8 @@ int main(int argc, const char **argv)
 
 	attr_start();
 
+	init_delta_base_cache();
+
 	restore_sigpipe_to_default();
 
 	return cmd_main(argc, argv);
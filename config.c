@@ -2272,6 +2272,19 @@ int git_config_get_split_index(void)
 	return -1; /* default value */
 }
 
+int git_config_get_sparse_index(void)
+{
+	int val;
+
+	if (git_env_bool("GIT_TEST_SPARSE_INDEX", 0))
+		return 1;
+
+	if (!git_config_get_bool("index.sparse", &val))
+		return val;
+
+	return 0; /* default value */
+}
+
 int git_config_get_max_percent_split_change(void)
 {
 	int val = -1;
@@ -2295,6 +2308,13 @@ int git_config_get_fsmonitor(void)
 	if (core_fsmonitor && !*core_fsmonitor)
 		core_fsmonitor = NULL;
 
+	/*
+	 * A boolean value selects the built-in daemon ("true") or turns
+	 * the monitor off ("false"); anything else names a hook.
+	 */
+	if (core_fsmonitor && !git_parse_maybe_bool(core_fsmonitor))
+		core_fsmonitor = NULL;
+
 	if (core_fsmonitor)
 		return 1;
 
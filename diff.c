@@ -24,6 +24,7 @@
 #include "graph.h"
 #include "packfile.h"
 #include "help.h"
+#include "thread-utils.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
 #define FAST_WORKING_DIRECTORY 0
@@ -51,6 +52,28 @@ static int diff_dirstat_permille_default = 30;
 static struct diff_options default_diff_options;
 static long diff_algorithm;
 static unsigned ws_error_highlight_default = WSEH_NEW;
+static int diff_threads;
+
+/*
+ * While diff_flush() generates patches with worker threads, this lock
+ * serializes what is not thread-safe in the generation of a single
+ * filepair: attribute lookups (and the userdiff drivers found through
+ * them) and object name abbreviation.
+ */
+static pthread_mutex_t diff_worker_mutex;
+static int diff_workers_active;
+
+static inline void diff_worker_lock(void)
+{
+	if (diff_workers_active)
+		pthread_mutex_lock(&diff_worker_mutex);
+}
+
+static inline void diff_worker_unlock(void)
+{
+	if (diff_workers_active)
+		pthread_mutex_unlock(&diff_worker_mutex);
+}
 
 static char diff_colors[][COLOR_MAXLEN] = {
 	GIT_COLOR_RESET,
@@ -426,6 +449,14 @@ int git_diff_basic_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "diff.threads")) {
+		diff_threads = git_config_int(var, value);
+		if (diff_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    diff_threads, var);
+		return 0;
+	}
+
 	if (userdiff_config(var, value) < 0)
 		return -1;
 
@@ -1704,7 +1735,7 @@ static void emit_rewrite_diff(const char *name_a,
 			      struct diff_options *o)
 {
 	int lc_a, lc_b;
-	static struct strbuf a_name = STRBUF_INIT, b_name = STRBUF_INIT;
+	struct strbuf a_name = STRBUF_INIT, b_name = STRBUF_INIT;
 	const char *a_prefix, *b_prefix;
 	char *data_one, *data_two;
 	size_t size_one, size_two;
@@ -1722,8 +1753,6 @@ static void emit_rewrite_diff(const char *name_a,
 	name_a += (*name_a == '/');
 	name_b += (*name_b == '/');
 
-	strbuf_reset(&a_name);
-	strbuf_reset(&b_name);
 	quote_two_c_style(&a_name, a_prefix, name_a, 0);
 	quote_two_c_style(&b_name, b_prefix, name_b, 0);
 
@@ -1732,7 +1761,9 @@ static void emit_rewrite_diff(const char *name_a,
 
 	memset(&ecbdata, 0, sizeof(ecbdata));
 	ecbdata.color_diff = want_color(o->use_color);
+	diff_worker_lock();
 	ecbdata.ws_rule = whitespace_rule(o->repo->index, name_b);
+	diff_worker_unlock();
 	ecbdata.opt = o;
 	if (ecbdata.ws_rule & WS_BLANK_AT_EOF) {
 		mmfile_t mf1, mf2;
@@ -1752,6 +1783,8 @@ static void emit_rewrite_diff(const char *name_a,
 			 a_name.buf, a_name.len, 0);
 	emit_diff_symbol(o, DIFF_SYMBOL_FILEPAIR_PLUS,
 			 b_name.buf, b_name.len, 0);
+	strbuf_release(&a_name);
+	strbuf_release(&b_name);
 
 	strbuf_addstr(&out, "@@ -");
 	if (!o->irreversible_delete)
@@ -2125,8 +2158,11 @@ static void diff_filespec_load_driver(struct diff_filespec *one,
 	if (one->driver)
 		return;
 
-	if (S_ISREG(one->mode))
+	if (S_ISREG(one->mode)) {
+		diff_worker_lock();
 		one->driver = userdiff_find_by_path(istate, one->path);
+		diff_worker_unlock();
+	}
 
 	/* Fallback to default settings */
 	if (!one->driver)
@@ -3503,7 +3539,9 @@ static void builtin_diff(const char *name_a,
 			lbl[0] = NULL;
 		ecbdata.label_path = lbl;
 		ecbdata.color_diff = want_color(o->use_color);
+		diff_worker_lock();
 		ecbdata.ws_rule = whitespace_rule(o->repo->index, name_b);
+		diff_worker_unlock();
 		if (ecbdata.ws_rule & WS_BLANK_AT_EOF)
 			check_blank_at_eof(&mf1, &mf2, &ecbdata);
 		ecbdata.opt = o;
@@ -4230,9 +4268,11 @@ static void fill_metainfo(struct strbuf *msg,
 			     diff_filespec_is_binary(o->repo, two)))
 				abbrev = hexsz;
 		}
+		diff_worker_lock();
 		strbuf_addf(msg, "%s%sindex %s..%s", line_prefix, set,
 			    diff_abbrev_oid(&one->oid, abbrev),
 			    diff_abbrev_oid(&two->oid, abbrev));
+		diff_worker_unlock();
 		if (one->mode == two->mode)
 			strbuf_addf(msg, " %06o", one->mode);
 		strbuf_addf(msg, "%s\n", reset);
@@ -4257,7 +4297,9 @@ static void run_diff_cmd(const char *pgm,
 	if (o->flags.allow_external) {
 		struct userdiff_driver *drv;
 
+		diff_worker_lock();
 		drv = userdiff_find_by_path(o->repo->index, attr_path);
+		diff_worker_unlock();
 		if (drv && drv->external)
 			pgm = drv->external;
 	}
@@ -5846,11 +5888,217 @@ void diff_warn_rename_limit(const char *varname, int needed, int degraded_cc)
 		warning(_(rename_limit_advice), varname, needed);
 }
 
+/*
+ * Producing the patch or diffstat of a filepair is mostly inflating its
+ * blobs and running xdiff on them, which worker threads can do for the
+ * many filepairs of a wide diff. Each worker uses its own copy of the
+ * diff_options and buffers what it would output, and the buffers are
+ * output in queue order, so the result does not depend on the number
+ * of threads.
+ */
+#define DIFF_PARALLEL_MIN_PAIRS 8
+
+struct diff_flush_job {
+	struct diff_filepair *p;
+	struct emitted_diff_symbols symbols;
+	struct diffstat_t diffstat;
+	unsigned found_changes:1;
+	unsigned done:1;
+};
+
+struct diff_flush_pool {
+	struct diff_options *o;
+	int stat; /* diffstat instead of patch */
+	struct diff_flush_job *jobs;
+	int nr, next;
+	pthread_mutex_t mutex;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	int nr_threads;
+};
+
+static int diff_flush_skips_pair(struct diff_filepair *p)
+{
+	/* see diff_flush_patch() and diff_flush_stat() */
+	return !check_pair_status(p) || diff_unmodified_pair(p) ||
+		(DIFF_FILE_VALID(p->one) && S_ISDIR(p->one->mode)) ||
+		(DIFF_FILE_VALID(p->two) && S_ISDIR(p->two->mode));
+}
+
+/*
+ * Whether a worker can handle the filespec: it must be a blob read from
+ * the object store (the working tree and the index are only accessed
+ * by the main thread) and not shared with another filepair, and patches
+ * must not need textconv.
+ */
+static int diff_filespec_parallel_ok(struct diff_options *o,
+				     struct diff_filespec *s, int stat)
+{
+	if (!DIFF_FILE_VALID(s))
+		return 1;
+	if (!s->oid_valid || s->count != 1 || S_ISGITLINK(s->mode))
+		return 0;
+	diff_filespec_load_driver(s, o->repo->index);
+	if (!stat && o->flags.allow_textconv && s->driver->textconv)
+		return 0;
+	return 1;
+}
+
+static int diff_pair_parallel_ok(struct diff_options *o,
+				 struct diff_filepair *p, int stat)
+{
+	if (DIFF_PAIR_UNMERGED(p))
+		return 0;
+	if (!diff_filespec_parallel_ok(o, p->one, stat) ||
+	    !diff_filespec_parallel_ok(o, p->two, stat))
+		return 0;
+	if (!stat && o->flags.allow_external) {
+		struct userdiff_driver *drv;
+
+		drv = userdiff_find_by_path(o->repo->index, p->one->path);
+		if (drv && drv->external)
+			return 0;
+	}
+	return 1;
+}
+
+static void *run_diff_flush_worker(void *data)
+{
+	struct diff_flush_pool *pool = data;
+
+	for (;;) {
+		struct diff_flush_job *job;
+		struct diff_options o;
+
+		pthread_mutex_lock(&pool->mutex);
+		job = pool->next < pool->nr ? &pool->jobs[pool->next++] : NULL;
+		pthread_mutex_unlock(&pool->mutex);
+		if (!job)
+			break;
+
+		o = *pool->o;
+		o.found_changes = 0;
+		if (pool->stat)
+			diff_flush_stat(job->p, &o, &job->diffstat);
+		else {
+			o.emitted_symbols = &job->symbols;
+			diff_flush_patch(job->p, &o);
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+		job->found_changes = o.found_changes;
+		job->done = 1;
+		pthread_cond_broadcast(&pool->done_cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	return NULL;
+}
+
+/*
+ * Start workers on the patches (or with 'stat', the diffstats) of the
+ * queued filepairs. Returns 0 and leaves the pool untouched if this
+ * diff should rather be produced by the main thread alone.
+ */
+static int start_diff_flush_pool(struct diff_flush_pool *pool,
+				 struct diff_options *o, int stat)
+{
+	struct diff_queue_struct *q = &diff_queued_diff;
+	int i, nr = 0, nr_threads = diff_threads;
+
+	if (!HAVE_THREADS || nr_threads == 1 || q->nr < 2 ||
+	    !startup_info->have_repository || o->repo->index->cache ||
+	    o->output_prefix || (!stat && o->word_diff) ||
+	    (!stat && o->flags.allow_external && external_diff()))
+		return 0;
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+
+		if (diff_flush_skips_pair(p))
+			continue;
+		if (!diff_pair_parallel_ok(o, p, stat))
+			return 0;
+		nr++;
+	}
+	if (!nr_threads) {
+		if (nr < DIFF_PARALLEL_MIN_PAIRS)
+			return 0;
+		nr_threads = online_cpus();
+	}
+	if (nr_threads > nr)
+		nr_threads = nr;
+	if (nr_threads < 2)
+		return 0;
+
+	memset(pool, 0, sizeof(*pool));
+	pool->o = o;
+	pool->stat = stat;
+	pool->jobs = xcalloc(nr, sizeof(*pool->jobs));
+	for (i = 0; i < q->nr; i++)
+		if (!diff_flush_skips_pair(q->queue[i]))
+			pool->jobs[pool->nr++].p = q->queue[i];
+
+	/* the workers only see a copy of these */
+	diff_set_mnemonic_prefix(o, "a/", "b/");
+
+	enable_concurrent_object_reads(o->repo);
+	pthread_mutex_init(&diff_worker_mutex, NULL);
+	diff_workers_active = 1;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	ALLOC_ARRAY(pool->threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL,
+				   run_diff_flush_worker, pool))
+			die(_("unable to create thread: %s"), strerror(errno));
+		pool->nr_threads++;
+	}
+	return 1;
+}
+
+static struct diff_flush_job *wait_diff_flush_job(struct diff_flush_pool *pool,
+						  int i)
+{
+	struct diff_flush_job *job = &pool->jobs[i];
+
+	pthread_mutex_lock(&pool->mutex);
+	while (!job->done)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (job->found_changes)
+		pool->o->found_changes = 1;
+	return job;
+}
+
+static void finish_diff_flush_pool(struct diff_flush_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < pool->nr_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+	free(pool->threads);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	diff_workers_active = 0;
+	pthread_mutex_destroy(&diff_worker_mutex);
+	disable_concurrent_object_reads(pool->o->repo);
+
+	for (i = 0; i < pool->nr; i++) {
+		free(pool->jobs[i].symbols.buf);
+		free(pool->jobs[i].diffstat.files);
+	}
+	free(pool->jobs);
+}
+
 static void diff_flush_patch_all_file_pairs(struct diff_options *o)
 {
 	int i;
 	static struct emitted_diff_symbols esm = EMITTED_DIFF_SYMBOLS_INIT;
 	struct diff_queue_struct *q = &diff_queued_diff;
+	struct diff_flush_pool pool;
 
 	if (WSEH_NEW & WS_RULE_MASK)
 		BUG("WS rules bit mask overlaps with diff symbol flags");
@@ -5858,10 +6106,31 @@ static void diff_flush_patch_all_file_pairs(struct diff_options *o)
 	if (o->color_moved)
 		o->emitted_symbols = &esm;
 
-	for (i = 0; i < q->nr; i++) {
-		struct diff_filepair *p = q->queue[i];
-		if (check_pair_status(p))
-			diff_flush_patch(p, o);
+	if (start_diff_flush_pool(&pool, o, 0)) {
+		for (i = 0; i < pool.nr; i++) {
+			struct diff_flush_job *job = wait_diff_flush_job(&pool, i);
+			int j;
+
+			for (j = 0; j < job->symbols.nr; j++) {
+				struct emitted_diff_symbol *e = &job->symbols.buf[j];
+
+				if (o->emitted_symbols) {
+					/* hand the line over */
+					ALLOC_GROW(esm.buf, esm.nr + 1, esm.alloc);
+					esm.buf[esm.nr++] = *e;
+					continue;
+				}
+				emit_diff_symbol_from_struct(o, e);
+				free((void *)e->line);
+			}
+		}
+		finish_diff_flush_pool(&pool);
+	} else {
+		for (i = 0; i < q->nr; i++) {
+			struct diff_filepair *p = q->queue[i];
+			if (check_pair_status(p))
+				diff_flush_patch(p, o);
+		}
 	}
 
 	if (o->emitted_symbols) {
@@ -5896,6 +6165,7 @@ static void diff_flush_patch_all_file_pairs(struct diff_options *o)
 void diff_flush(struct diff_options *options)
 {
 	struct diff_queue_struct *q = &diff_queued_diff;
+	struct diff_flush_pool pool;
 	int i, output_format = options->output_format;
 	int separator = 0;
 	int dirstat_by_line = 0;
@@ -5927,10 +6197,26 @@ void diff_flush(struct diff_options *options)
 		struct diffstat_t diffstat;
 
 		memset(&diffstat, 0, sizeof(struct diffstat_t));
-		for (i = 0; i < q->nr; i++) {
-			struct diff_filepair *p = q->queue[i];
-			if (check_pair_status(p))
-				diff_flush_stat(p, options, &diffstat);
+		if (start_diff_flush_pool(&pool, options, 1)) {
+			for (i = 0; i < pool.nr; i++) {
+				struct diff_flush_job *job;
+				int j;
+
+				job = wait_diff_flush_job(&pool, i);
+				ALLOC_GROW(diffstat.files,
+					   diffstat.nr + job->diffstat.nr,
+					   diffstat.alloc);
+				for (j = 0; j < job->diffstat.nr; j++)
+					diffstat.files[diffstat.nr++] =
+						job->diffstat.files[j];
+			}
+			finish_diff_flush_pool(&pool);
+		} else {
+			for (i = 0; i < q->nr; i++) {
+				struct diff_filepair *p = q->queue[i];
+				if (check_pair_status(p))
+					diff_flush_stat(p, options, &diffstat);
+			}
 		}
 		if (output_format & DIFF_FORMAT_NUMSTAT)
 			show_numstat(&diffstat, options);
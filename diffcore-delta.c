@@ -163,6 +163,43 @@ static struct spanhash_top *hash_chars(struct repository *r,
 	return hash;
 }
 
+void *diffcore_count_spans(struct repository *r, struct diff_filespec *one)
+{
+	return hash_chars(r, one);
+}
+
+/* the finalizer of MurmurHash3, a cheap way to get independent hashes */
+static uint32_t mix32(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+void diffcore_span_minhash(void *span_count, uint32_t *sig, int nr)
+{
+	struct spanhash_top *top = span_count;
+	int sz = 1 << top->alloc_log2;
+	int i, j;
+
+	for (i = 0; i < nr; i++)
+		sig[i] = 0xffffffff;
+
+	/* hash_chars() sorted the used slots first */
+	for (j = 0; j < sz && top->data[j].cnt; j++) {
+		uint32_t hashval = top->data[j].hashval;
+
+		for (i = 0; i < nr; i++) {
+			uint32_t h = mix32(hashval ^ ((i + 1) * 0x9e3779b9));
+			if (h < sig[i])
+				sig[i] = h;
+		}
+	}
+}
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
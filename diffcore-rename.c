@@ -7,6 +7,8 @@
 #include "object-store.h"
 #include "hashmap.h"
 #include "progress.h"
+#include "config.h"
+#include "thread-utils.h"
 
 /* Table of rename/copy destinations */
 
@@ -141,10 +143,143 @@ struct diff_score {
 	short name_score;
 };
 
+/*
+ * The sizes the size check of estimate_similarity() looks at while the
+ * similarity matrix is filled, so that it does not depend on which
+ * contents happen to have been loaded (and converted) already.
+ *
+ * When the matrix is filled by several threads, the span hashes of each
+ * filespec are computed once, by whichever thread needs them first; the
+ * others wait for it.
+ */
+enum span_state {
+	SPAN_UNKNOWN = 0,
+	SPAN_COMPUTING,
+	SPAN_DONE,
+	SPAN_FAILED
+};
+
+struct span_slot {
+	enum span_state state;
+	/*
+	 * Filled in before the matrix: the size from before the contents
+	 * were loaded, or whether it could not be found.
+	 */
+	unsigned long size;
+	int no_size;
+};
+
+struct rename_matrix {
+	struct diff_options *options;
+	int minimum_score;
+	int skip_unmodified;
+	/* NUM_CANDIDATE_PER_DST entries for each row */
+	struct diff_score *mx;
+	/* the index in rename_dst of the destination of each row */
+	int *row_dst;
+	int nr_rows;
+	/* sources already paired up by find_basename_matches() */
+	unsigned char *src_done;
+	/* if not NULL, the only sources worth looking at for each row */
+	struct rename_candidates *candidates;
+
+	/* the sizes of the sources and destinations, see span_slot */
+	struct span_slot *src_slots, *dst_slots;
+
+	/* the rest is only used when filled by several threads */
+	int next_row;
+	struct progress *progress;
+	uint64_t progress_nr;
+};
+
+struct rename_candidates {
+	int *src; /* indices in rename_src, in increasing order */
+	int nr, alloc;
+};
+
+struct rename_worker {
+	pthread_t pthread;
+	struct rename_matrix *rm;
+	/* sources whose span hashes this thread has seen loaded */
+	unsigned char *src_ready;
+	/* the same for the destination of the current row */
+	int dst_ready;
+};
+
+static pthread_mutex_t rename_mutex;
+static pthread_cond_t rename_cond;
+
+/*
+ * Make sure spec->cnt_data is filled in. Reading objects and looking up
+ * attributes are not thread-safe, so only the hashing itself happens
+ * outside of rename_mutex.
+ */
+static int load_span_hashes(struct repository *r, struct diff_filespec *spec,
+			    struct span_slot *slot)
+{
+	void *cnt_data;
+
+	pthread_mutex_lock(&rename_mutex);
+	while (slot->state == SPAN_COMPUTING)
+		pthread_cond_wait(&rename_cond, &rename_mutex);
+	if (slot->state != SPAN_UNKNOWN) {
+		int ret = slot->state == SPAN_FAILED ? -1 : 0;
+		pthread_mutex_unlock(&rename_mutex);
+		return ret;
+	}
+	if (diff_populate_filespec(r, spec, 0)) {
+		slot->state = SPAN_FAILED;
+		pthread_mutex_unlock(&rename_mutex);
+		return -1;
+	}
+	diff_filespec_is_binary(r, spec);
+	slot->state = SPAN_COMPUTING;
+	pthread_mutex_unlock(&rename_mutex);
+
+	cnt_data = diffcore_count_spans(r, spec);
+
+	pthread_mutex_lock(&rename_mutex);
+	spec->cnt_data = cnt_data;
+	diff_free_filespec_blob(spec);
+	slot->state = SPAN_DONE;
+	pthread_cond_broadcast(&rename_cond);
+	pthread_mutex_unlock(&rename_mutex);
+	return 0;
+}
+
+static int worker_load_span_hashes(struct rename_worker *w,
+				   int src_index, int dst_index)
+{
+	struct repository *r = w->rm->options->repo;
+
+	if (!w->src_ready[src_index]) {
+		if (load_span_hashes(r, rename_src[src_index].p->one,
+				     &w->rm->src_slots[src_index]))
+			return -1;
+		w->src_ready[src_index] = 1;
+	}
+	if (!w->dst_ready) {
+		if (load_span_hashes(r, rename_dst[dst_index].two,
+				     &w->rm->dst_slots[dst_index]))
+			return -1;
+		w->dst_ready = 1;
+	}
+	return 0;
+}
+
+/*
+ * Without a matrix, this loads what it needs on demand; with one, the
+ * sizes for the size check come from its span slots, and with a worker,
+ * the contents are loaded through worker_load_span_hashes(). Either way,
+ * the score is computed from the sizes of the loaded contents.
+ */
 static int estimate_similarity(struct repository *r,
 			       struct diff_filespec *src,
 			       struct diff_filespec *dst,
-			       int minimum_score)
+			       int minimum_score,
+			       struct rename_matrix *rm,
+			       struct rename_worker *w,
+			       int src_index, int dst_index)
 {
 	/* src points at a file that existed in the original tree (or
 	 * optionally a file in the destination tree) and dst points
@@ -178,15 +313,27 @@ static int estimate_similarity(struct repository *r,
 	 * is a possible size - we really should have a flag to
 	 * say whether the size is valid or not!)
 	 */
-	if (!src->cnt_data &&
-	    diff_populate_filespec(r, src, CHECK_SIZE_ONLY))
-		return 0;
-	if (!dst->cnt_data &&
-	    diff_populate_filespec(r, dst, CHECK_SIZE_ONLY))
-		return 0;
+	if (rm) {
+		struct span_slot *src_slot = &rm->src_slots[src_index];
+		struct span_slot *dst_slot = &rm->dst_slots[dst_index];
 
-	max_size = ((src->size > dst->size) ? src->size : dst->size);
-	base_size = ((src->size < dst->size) ? src->size : dst->size);
+		if (src_slot->no_size || dst_slot->no_size)
+			return 0;
+		max_size = (src_slot->size > dst_slot->size) ?
+			   src_slot->size : dst_slot->size;
+		base_size = (src_slot->size < dst_slot->size) ?
+			    src_slot->size : dst_slot->size;
+	} else {
+		if (!src->cnt_data &&
+		    diff_populate_filespec(r, src, CHECK_SIZE_ONLY))
+			return 0;
+		if (!dst->cnt_data &&
+		    diff_populate_filespec(r, dst, CHECK_SIZE_ONLY))
+			return 0;
+
+		max_size = ((src->size > dst->size) ? src->size : dst->size);
+		base_size = ((src->size < dst->size) ? src->size : dst->size);
+	}
 	delta_size = max_size - base_size;
 
 	/* We would not consider edits that change the file size so
@@ -200,10 +347,17 @@ static int estimate_similarity(struct repository *r,
 	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
 		return 0;
 
-	if (!src->cnt_data && diff_populate_filespec(r, src, 0))
-		return 0;
-	if (!dst->cnt_data && diff_populate_filespec(r, dst, 0))
-		return 0;
+	if (w) {
+		if (worker_load_span_hashes(w, src_index, dst_index))
+			return 0;
+	} else {
+		if (!src->cnt_data && diff_populate_filespec(r, src, 0))
+			return 0;
+		if (!dst->cnt_data && diff_populate_filespec(r, dst, 0))
+			return 0;
+	}
+	/* the contents may have been converted */
+	max_size = (src->size > dst->size) ? src->size : dst->size;
 
 	if (diffcore_count_changes(r, src, dst,
 				   &src->cnt_data, &dst->cnt_data,
@@ -462,6 +616,442 @@ static int find_renames(struct diff_score *mx, int dst_cnt, int minimum_score, i
 	return count;
 }
 
+static void fill_rename_row(struct rename_matrix *rm, int row,
+			    struct rename_worker *w)
+{
+	int i = rm->row_dst[row], j, k, nr;
+	struct diff_filespec *two = rename_dst[i].two;
+	struct diff_score *m = &rm->mx[row * NUM_CANDIDATE_PER_DST];
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	nr = rm->candidates ? rm->candidates[row].nr : rename_src_nr;
+	for (k = 0; k < nr; k++) {
+		struct diff_filespec *one;
+		struct diff_score this_src;
+
+		j = rm->candidates ? rm->candidates[row].src[k] : k;
+		one = rename_src[j].p->one;
+		if (rm->src_done && rm->src_done[j])
+			continue;
+		if (rm->skip_unmodified &&
+		    diff_unmodified_pair(rename_src[j].p))
+			continue;
+
+		this_src.score = estimate_similarity(rm->options->repo,
+						     one, two,
+						     rm->minimum_score,
+						     rm, w, j, i);
+		this_src.name_score = basename_same(one, two);
+		this_src.dst = i;
+		this_src.src = j;
+		record_if_better(m, &this_src);
+		if (w)
+			continue;
+		/*
+		 * Once we run estimate_similarity,
+		 * We do not need the text anymore.
+		 */
+		diff_free_filespec_blob(one);
+		diff_free_filespec_blob(two);
+	}
+}
+
+static void fill_rename_matrix(struct rename_matrix *rm,
+			       struct progress *progress)
+{
+	int row;
+
+	for (row = 0; row < rm->nr_rows; row++) {
+		fill_rename_row(rm, row, NULL);
+		display_progress(progress, (uint64_t)(rm->row_dst[row] + 1) *
+					   (uint64_t)rename_src_nr);
+	}
+}
+
+/*
+ * Fill in the sizes needed by the size check of estimate_similarity(),
+ * which may need to access objects.
+ */
+static void prepare_span_slot(struct repository *r, struct diff_filespec *spec,
+			      struct span_slot *slot)
+{
+	if (!S_ISREG(spec->mode))
+		return; /* estimate_similarity() looks no further */
+
+	if (!spec->cnt_data &&
+	    diff_populate_filespec(r, spec, CHECK_SIZE_ONLY)) {
+		slot->no_size = 1;
+		return;
+	}
+	slot->size = spec->size;
+	if (spec->cnt_data)
+		slot->state = SPAN_DONE; /* e.g. by diffcore-break */
+}
+
+static void prepare_span_slots(struct rename_matrix *rm)
+{
+	struct repository *r = rm->options->repo;
+	int i;
+
+	rm->src_slots = xcalloc(rename_src_nr, sizeof(*rm->src_slots));
+	rm->dst_slots = xcalloc(rename_dst_nr, sizeof(*rm->dst_slots));
+	for (i = 0; i < rename_src_nr; i++) {
+		if (rm->src_done && rm->src_done[i])
+			continue;
+		if (rm->skip_unmodified &&
+		    diff_unmodified_pair(rename_src[i].p))
+			continue;
+		prepare_span_slot(r, rename_src[i].p->one, &rm->src_slots[i]);
+	}
+	for (i = 0; i < rm->nr_rows; i++) {
+		int dst_index = rm->row_dst[i];
+		prepare_span_slot(r, rename_dst[dst_index].two,
+				  &rm->dst_slots[dst_index]);
+	}
+}
+
+static void *rename_thread(void *data)
+{
+	struct rename_worker *w = data;
+	struct rename_matrix *rm = w->rm;
+	int row = -1;
+
+	for (;;) {
+		pthread_mutex_lock(&rename_mutex);
+		if (row >= 0 && rm->progress) {
+			rm->progress_nr += rename_src_nr;
+			display_progress(rm->progress, rm->progress_nr);
+		}
+		row = rm->next_row++;
+		pthread_mutex_unlock(&rename_mutex);
+
+		if (row >= rm->nr_rows)
+			break;
+		w->dst_ready = 0;
+		fill_rename_row(rm, row, w);
+	}
+	return NULL;
+}
+
+/*
+ * Each row only depends on its destination and on the sources, so rows
+ * can be filled in any order without changing the outcome.
+ */
+static void fill_rename_matrix_threaded(struct rename_matrix *rm, int threads,
+					struct progress *progress)
+{
+	struct rename_worker *workers;
+	int i;
+
+	rm->progress = progress;
+
+	pthread_mutex_init(&rename_mutex, NULL);
+	pthread_cond_init(&rename_cond, NULL);
+
+	workers = xcalloc(threads, sizeof(*workers));
+	for (i = 0; i < threads; i++) {
+		struct rename_worker *w = &workers[i];
+
+		w->rm = rm;
+		w->src_ready = xcalloc(rename_src_nr, 1);
+		if (pthread_create(&w->pthread, NULL, rename_thread, w))
+			die(_("unable to create rename detection thread"));
+	}
+	for (i = 0; i < threads; i++) {
+		if (pthread_join(workers[i].pthread, NULL))
+			die(_("unable to join rename detection thread"));
+		free(workers[i].src_ready);
+	}
+	free(workers);
+
+	pthread_cond_destroy(&rename_cond);
+	pthread_mutex_destroy(&rename_mutex);
+}
+
+/*
+ * Filling the matrix in threads only pays off when it is large enough;
+ * give each thread at least this many pairs to look at.
+ */
+#define RENAME_THREAD_COST 1000
+
+static int rename_threads(struct diff_options *options, uint64_t pairs,
+			  int nr_rows)
+{
+	int threads = 0;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	threads = git_env_ulong("GIT_TEST_RENAME_THREADS", 0);
+	if (threads) {
+		/* no minimum amount of work per thread */
+		pairs = (uint64_t)threads * RENAME_THREAD_COST;
+	} else {
+		repo_config_get_int(options->repo, "diff.renamethreads",
+				    &threads);
+		if (threads <= 0)
+			threads = online_cpus();
+	}
+
+	if (threads > pairs / RENAME_THREAD_COST)
+		threads = pairs / RENAME_THREAD_COST;
+	if (threads > nr_rows)
+		threads = nr_rows;
+	return threads < 1 ? 1 : threads;
+}
+
+static const char *path_basename(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+/*
+ * Sort the basenames of the list and drop those that appear more than
+ * once; the util fields hold the indices of the filespecs.
+ */
+static void keep_unique_basenames(struct string_list *names)
+{
+	int i, nr = 0;
+
+	string_list_sort(names);
+	for (i = 0; i < names->nr; i++) {
+		int j = i;
+
+		while (j + 1 < names->nr &&
+		       !strcmp(names->items[i].string, names->items[j + 1].string))
+			j++;
+		if (i == j)
+			names->items[nr++] = names->items[i];
+		i = j;
+	}
+	names->nr = nr;
+}
+
+/*
+ * A file that keeps its name while its directory is moved or renamed
+ * is the most common kind of rename. Pair up the sources and the
+ * destinations whose basename is unique on both sides, without looking
+ * at any other candidate, if they are similar enough; this takes them
+ * out of the similarity matrix. Only used for renames, as a copy could
+ * come from any source.
+ */
+static int find_basename_matches(struct diff_options *options,
+				 int minimum_score, unsigned char *src_done)
+{
+	struct string_list src_names = STRING_LIST_INIT_NODUP;
+	struct string_list dst_names = STRING_LIST_INIT_NODUP;
+	/* halfway between the minimum score and an exact match */
+	int basename_score = minimum_score + (MAX_SCORE - minimum_score) / 2;
+	int i, renames = 0;
+
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		if (one->rename_used || !S_ISREG(one->mode))
+			continue;
+		string_list_append(&src_names, path_basename(one->path))->util =
+			(void *)(intptr_t)i;
+	}
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].two;
+
+		if (rename_dst[i].pair || !S_ISREG(two->mode))
+			continue;
+		string_list_append(&dst_names, path_basename(two->path))->util =
+			(void *)(intptr_t)i;
+	}
+	keep_unique_basenames(&src_names);
+	keep_unique_basenames(&dst_names);
+
+	for (i = 0; i < dst_names.nr; i++) {
+		struct string_list_item *item;
+		struct diff_filespec *one, *two;
+		int src_index, dst_index, score;
+
+		item = string_list_lookup(&src_names, dst_names.items[i].string);
+		if (!item)
+			continue;
+		src_index = (intptr_t)item->util;
+		dst_index = (intptr_t)dst_names.items[i].util;
+		one = rename_src[src_index].p->one;
+		two = rename_dst[dst_index].two;
+
+		score = estimate_similarity(options->repo, one, two,
+					    minimum_score, NULL, NULL, 0, 0);
+		diff_free_filespec_blob(one);
+		diff_free_filespec_blob(two);
+		if (score < basename_score)
+			continue;
+		record_rename_pair(dst_index, src_index, score);
+		src_done[src_index] = 1;
+		renames++;
+	}
+
+	string_list_clear(&src_names, 0);
+	string_list_clear(&dst_names, 0);
+	return renames;
+}
+
+/*
+ * Beyond the rename limit, comparing every destination with every
+ * source is too expensive. Instead, each file gets a MinHash signature
+ * of MINHASH_SIZE values, cut in bands; only the sources that agree
+ * with a destination on all the values of at least one band are
+ * compared with it. With fewer values per band, files that have less
+ * in common become candidates, at the cost of more comparisons.
+ */
+#define MINHASH_SIZE 64
+#define DEFAULT_LSH_BANDS 16
+
+static int rename_lsh_bands(struct diff_options *options)
+{
+	int bands = DEFAULT_LSH_BANDS;
+
+	repo_config_get_int(options->repo, "diff.renamelshbands", &bands);
+	if (bands < 0 || (bands && MINHASH_SIZE % bands))
+		die(_("diff.renameLshBands must be a divisor of %d"),
+		    MINHASH_SIZE);
+	return bands;
+}
+
+struct band_key {
+	uint32_t key;
+	int src;
+};
+
+static int band_key_cmp(const void *a_, const void *b_)
+{
+	const struct band_key *a = a_, *b = b_;
+
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	return a->src - b->src;
+}
+
+static int src_index_cmp(const void *a_, const void *b_)
+{
+	const int *a = a_, *b = b_;
+	return *a - *b;
+}
+
+static uint32_t band_hash(const uint32_t *values, int nr)
+{
+	uint32_t hash = 0x811c9dc5;
+	int i;
+
+	for (i = 0; i < nr; i++)
+		hash = (hash ^ values[i]) * 0x01000193;
+	return hash;
+}
+
+/* Fills the signature, or returns -1 if the file has none. */
+static int minhash_filespec(struct repository *r, struct diff_filespec *spec,
+			    uint32_t *sig)
+{
+	if (!S_ISREG(spec->mode))
+		return -1; /* estimate_similarity() would not look at it */
+	if (!spec->cnt_data) {
+		if (diff_populate_filespec(r, spec, 0))
+			return -1;
+		spec->cnt_data = diffcore_count_spans(r, spec);
+		diff_free_filespec_blob(spec);
+	}
+	diffcore_span_minhash(spec->cnt_data, sig, MINHASH_SIZE);
+	return 0;
+}
+
+/*
+ * Collect the candidate sources of each row of the matrix into
+ * rm->candidates. Returns the number of candidate pairs, or -1 if there
+ * would be more than max_pairs of them.
+ */
+static int64_t find_lsh_candidates(struct rename_matrix *rm, int bands,
+				   uint64_t max_pairs)
+{
+	struct repository *r = rm->options->repo;
+	int rows_per_band = MINHASH_SIZE / bands;
+	uint32_t *sig;
+	struct band_key *keys;
+	int *seen;
+	int i, b, row, nr_keys = 0;
+	uint64_t pairs = 0;
+
+	ALLOC_ARRAY(sig, MINHASH_SIZE);
+	ALLOC_ARRAY(keys, st_mult(bands, rename_src_nr));
+	for (i = 0; i < rename_src_nr; i++) {
+		if ((rm->src_done && rm->src_done[i]) ||
+		    (rm->skip_unmodified &&
+		     diff_unmodified_pair(rename_src[i].p)) ||
+		    minhash_filespec(r, rename_src[i].p->one, sig))
+			continue;
+		for (b = 0; b < bands; b++) {
+			struct band_key *k = &keys[b * rename_src_nr + nr_keys];
+			k->key = band_hash(sig + b * rows_per_band,
+					   rows_per_band);
+			k->src = i;
+		}
+		nr_keys++;
+	}
+	for (b = 0; b < bands; b++)
+		QSORT(keys + b * rename_src_nr, nr_keys, band_key_cmp);
+
+	rm->candidates = xcalloc(rm->nr_rows, sizeof(*rm->candidates));
+	ALLOC_ARRAY(seen, rename_src_nr);
+	for (i = 0; i < rename_src_nr; i++)
+		seen[i] = -1;
+	for (row = 0; row < rm->nr_rows; row++) {
+		struct rename_candidates *c = &rm->candidates[row];
+
+		if (minhash_filespec(r, rename_dst[rm->row_dst[row]].two, sig))
+			continue;
+		for (b = 0; b < bands; b++) {
+			struct band_key *band = keys + b * rename_src_nr;
+			uint32_t key = band_hash(sig + b * rows_per_band,
+						 rows_per_band);
+			int lo = 0, hi = nr_keys;
+
+			while (lo < hi) {
+				int mid = lo + (hi - lo) / 2;
+				if (band[mid].key < key)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			for (; lo < nr_keys && band[lo].key == key; lo++) {
+				if (seen[band[lo].src] == row)
+					continue;
+				seen[band[lo].src] = row;
+				ALLOC_GROW(c->src, c->nr + 1, c->alloc);
+				c->src[c->nr++] = band[lo].src;
+			}
+		}
+		pairs += c->nr;
+		if (pairs > max_pairs)
+			break;
+		/* the same order as without candidates, for the same ties */
+		QSORT(c->src, c->nr, src_index_cmp);
+	}
+
+	free(seen);
+	free(keys);
+	free(sig);
+	return pairs > max_pairs ? -1 : (int64_t)pairs;
+}
+
+static void free_lsh_candidates(struct rename_matrix *rm)
+{
+	int row;
+
+	if (!rm->candidates)
+		return;
+	for (row = 0; row < rm->nr_rows; row++)
+		free(rm->candidates[row].src);
+	FREE_AND_NULL(rm->candidates);
+}
+
 void diffcore_rename(struct diff_options *options)
 {
 	int detect_rename = options->detect_rename;
@@ -469,8 +1059,11 @@ void diffcore_rename(struct diff_options *options)
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
-	int num_create, dst_cnt;
+	struct rename_matrix rm;
+	int i, rename_count, skip_unmodified = 0, use_lsh = 0;
+	int num_create, dst_cnt, threads;
+	unsigned char *src_done = NULL;
+	uint64_t pairs;
 	struct progress *progress = NULL;
 
 	if (!minimum_score)
@@ -531,6 +1124,12 @@ void diffcore_rename(struct diff_options *options)
 	if (minimum_score == MAX_SCORE)
 		goto cleanup;
 
+	if (detect_rename == DIFF_DETECT_RENAME) {
+		src_done = xcalloc(rename_src_nr, 1);
+		rename_count += find_basename_matches(options, minimum_score,
+						      src_done);
+	}
+
 	/*
 	 * Calculate how many renames are left (but all the source
 	 * files still remain as options for rename/copies!)
@@ -543,7 +1142,10 @@ void diffcore_rename(struct diff_options *options)
 
 	switch (too_many_rename_candidates(num_create, options)) {
 	case 1:
-		goto cleanup;
+		if (!rename_lsh_bands(options))
+			goto cleanup;
+		use_lsh = 1;
+		break;
 	case 2:
 		options->degraded_cc_to_c = 1;
 		skip_unmodified = 1;
@@ -558,44 +1160,50 @@ void diffcore_rename(struct diff_options *options)
 				(uint64_t)rename_dst_nr * (uint64_t)rename_src_nr);
 	}
 
-	mx = xcalloc(st_mult(NUM_CANDIDATE_PER_DST, num_create), sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
+	memset(&rm, 0, sizeof(rm));
+	rm.options = options;
+	rm.minimum_score = minimum_score;
+	rm.skip_unmodified = skip_unmodified;
+	rm.src_done = src_done;
+	ALLOC_ARRAY(rm.row_dst, num_create);
+	for (i = 0; i < rename_dst_nr; i++) {
 		if (rename_dst[i].pair)
 			continue; /* dealt with exact match already. */
+		rm.row_dst[rm.nr_rows++] = i;
+	}
 
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
+	pairs = (uint64_t)rm.nr_rows * (uint64_t)rename_src_nr;
+	if (use_lsh) {
+		/* on average, no more sources than the rename limit per row */
+		uint64_t limit = options->rename_limit > 0 ?
+				 options->rename_limit : 32767;
+		int64_t nr = find_lsh_candidates(&rm, rename_lsh_bands(options),
+						 limit * rm.nr_rows);
+		if (nr < 0) {
+			stop_progress(&progress);
+			free_lsh_candidates(&rm);
+			free(rm.row_dst);
+			goto cleanup;
 		}
-		dst_cnt++;
-		display_progress(progress, (uint64_t)(i+1)*(uint64_t)rename_src_nr);
+		pairs = nr;
+		options->needed_rename_limit = 0;
 	}
+
+	rm.mx = xcalloc(st_mult(NUM_CANDIDATE_PER_DST, num_create), sizeof(*mx));
+	prepare_span_slots(&rm);
+	threads = rename_threads(options, pairs, rm.nr_rows);
+	if (threads > 1)
+		fill_rename_matrix_threaded(&rm, threads, progress);
+	else
+		fill_rename_matrix(&rm, progress);
 	stop_progress(&progress);
+	/* the span hashes stay with the filespecs */
+	free(rm.src_slots);
+	free(rm.dst_slots);
+	mx = rm.mx;
+	dst_cnt = rm.nr_rows;
+	free_lsh_candidates(&rm);
+	free(rm.row_dst);
 
 	/* cost matrix sorted by most to least similar pair */
 	QSORT(mx, dst_cnt * NUM_CANDIDATE_PER_DST, score_compare);
@@ -693,5 +1301,6 @@ void diffcore_rename(struct diff_options *options)
 	rename_dst_nr = rename_dst_alloc = 0;
 	FREE_AND_NULL(rename_src);
 	rename_src_nr = rename_src_alloc = 0;
+	free(src_done);
 	return;
 }
@@ -142,6 +142,21 @@ void diff_debug_queue(const char *, struct diff_queue_struct *);
 #define diff_debug_queue(a,b) do { /* nothing */ } while (0)
 #endif
 
+/*
+ * Hash the spans of the populated "one" the way diffcore_count_changes()
+ * does; the result can be handed to it as *src_count_p or *dst_count_p.
+ * This only reads the filespec once diff_filespec_is_binary() has been
+ * called on it, so it can run in parallel with other threads.
+ */
+void *diffcore_count_spans(struct repository *r, struct diff_filespec *one);
+
+/*
+ * Compute a MinHash signature of 'nr' values over the set of spans
+ * counted by diffcore_count_spans(). Two files agree on each value with
+ * a probability equal to the Jaccard similarity of their span sets.
+ */
+void diffcore_span_minhash(void *span_count, uint32_t *sig, int nr);
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
@@ -0,0 +1,118 @@
+#include "cache.h"
+#include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
+#include "run-command.h"
+#include "strbuf.h"
+
+#ifdef HAVE_FSMONITOR_DAEMON
+
+#include "unix-socket.h"
+
+int fsmonitor_ipc_is_supported(void)
+{
+	return 1;
+}
+
+const char *fsmonitor_ipc_get_path(void)
+{
+	static const char *ipc_path;
+
+	if (!ipc_path)
+		ipc_path = absolute_pathdup(git_path("fsmonitor--daemon.ipc"));
+	return ipc_path;
+}
+
+static int send_request(const char *request, struct strbuf *answer)
+{
+	int fd = unix_stream_connect(fsmonitor_ipc_get_path());
+
+	if (fd < 0)
+		return -1;
+
+	if (write_in_full(fd, request, strlen(request)) < 0) {
+		close(fd);
+		return error_errno(_("unable to write to fsmonitor daemon"));
+	}
+	shutdown(fd, SHUT_WR);
+
+	strbuf_reset(answer);
+	if (strbuf_read(answer, fd, 0) < 0) {
+		close(fd);
+		return error_errno(_("unable to read from fsmonitor daemon"));
+	}
+	close(fd);
+	return 0;
+}
+
+static int spawn_daemon(void)
+{
+	const char *argv[] = { "fsmonitor--daemon", "start", NULL };
+
+	trace_printf_key(&trace_fsmonitor, "starting fsmonitor daemon");
+	return run_command_v_opt(argv, RUN_GIT_CMD | RUN_COMMAND_NO_STDIN);
+}
+
+int fsmonitor_ipc_send_query(uint64_t since, struct strbuf *answer)
+{
+	struct strbuf request = STRBUF_INIT;
+	const char *end;
+	int ret;
+
+	strbuf_addf(&request, "query %"PRIuMAX"\n", (uintmax_t)since);
+	ret = send_request(request.buf, answer);
+	if (ret < 0 && (errno == ENOENT || errno == ECONNREFUSED)) {
+		/* another process may have won the race to start it */
+		spawn_daemon();
+		ret = send_request(request.buf, answer);
+	}
+	strbuf_release(&request);
+	if (ret < 0)
+		return ret;
+
+	/*
+	 * The response starts with the NUL-terminated token of the daemon;
+	 * a connection that dropped early would not have one.
+	 */
+	end = memchr(answer->buf, '\0', answer->len);
+	if (!end)
+		return error(_("fsmonitor daemon sent a truncated response"));
+	trace_printf_key(&trace_fsmonitor, "fsmonitor daemon token '%s'",
+			 answer->buf);
+	strbuf_remove(answer, 0, end - answer->buf + 1);
+	return 0;
+}
+
+int fsmonitor_ipc_send_command(const char *command, struct strbuf *answer)
+{
+	struct strbuf request = STRBUF_INIT;
+	int ret;
+
+	strbuf_addf(&request, "%s\n", command);
+	ret = send_request(request.buf, answer);
+	strbuf_release(&request);
+	return ret;
+}
+
+#else
+
+int fsmonitor_ipc_is_supported(void)
+{
+	return 0;
+}
+
+const char *fsmonitor_ipc_get_path(void)
+{
+	return NULL;
+}
+
+int fsmonitor_ipc_send_query(uint64_t since, struct strbuf *answer)
+{
+	return error(_("the built-in fsmonitor is not supported on this platform"));
+}
+
+int fsmonitor_ipc_send_command(const char *command, struct strbuf *answer)
+{
+	return -1;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef FSMONITOR_IPC_H
+#define FSMONITOR_IPC_H
+
+struct strbuf;
+
+/*
+ * Whether this build of Git has the built-in filesystem monitor daemon
+ * (see git-fsmonitor--daemon(1)).
+ */
+extern int fsmonitor_ipc_is_supported(void);
+
+/*
+ * Return the path of the unix socket on which the daemon of the current
+ * repository listens.
+ */
+extern const char *fsmonitor_ipc_get_path(void);
+
+/*
+ * Ask the daemon for the paths that changed since 'since' (nanoseconds
+ * since the epoch, as stored in the fsmonitor index extension), starting
+ * the daemon if it is not running yet. On success, return 0 and store in
+ * 'answer' the NUL-separated list of changed paths, or "/" if the daemon
+ * cannot tell and everything must be considered changed.
+ */
+extern int fsmonitor_ipc_send_query(uint64_t since, struct strbuf *answer);
+
+/*
+ * Send a single command ("stop", "status") to a running daemon and store
+ * its response in 'answer'. Returns -1 if no daemon is listening.
+ */
+extern int fsmonitor_ipc_send_command(const char *command, struct strbuf *answer);
+
+#endif /* FSMONITOR_IPC_H */
@@ -3,6 +3,7 @@
 #include "dir.h"
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
 #include "run-command.h"
 #include "strbuf.h"
 
@@ -91,8 +92,14 @@ void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
 	trace_printf_key(&trace_fsmonitor, "write fsmonitor extension successful");
 }
 
+int fsmonitor_is_builtin(void)
+{
+	return core_fsmonitor && git_parse_maybe_bool(core_fsmonitor) == 1;
+}
+
 /*
- * Call the query-fsmonitor hook passing the time of the last saved results.
+ * Call the query-fsmonitor hook (or ask the built-in daemon) passing the
+ * time of the last saved results.
  */
 static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *query_result)
 {
@@ -101,6 +108,9 @@ static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *que
 	if (!core_fsmonitor)
 		return -1;
 
+	if (fsmonitor_is_builtin())
+		return fsmonitor_ipc_send_query(last_update, query_result);
+
 	argv_array_push(&cp.args, core_fsmonitor);
 	argv_array_pushf(&cp.args, "%d", version);
 	argv_array_pushf(&cp.args, "%" PRIuMAX, (uintmax_t)last_update);
@@ -110,14 +120,71 @@ static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *que
 	return capture_command(&cp, query_result, 1024);
 }
 
+/*
+ * A change below a submodule (e.g. a new commit, which only touches its
+ * .git) must invalidate the gitlink entry of the submodule, which is not
+ * named by the monitor itself.
+ */
+static void fsmonitor_refresh_gitlink(struct index_state *istate, const char *name)
+{
+	const char *slash;
+
+	for (slash = strchr(name, '/'); slash; slash = strchr(slash + 1, '/')) {
+		int pos = index_name_pos(istate, name, slash - name);
+
+		if (pos >= 0 && S_ISGITLINK(istate->cache[pos]->ce_mode)) {
+			istate->cache[pos]->ce_flags &= ~CE_FSMONITOR_VALID;
+			return;
+		}
+	}
+}
+
+/*
+ * A name ending in a slash stands for a whole directory that was deleted
+ * or renamed away; invalidate every entry below it.
+ */
+static void fsmonitor_refresh_directory(struct index_state *istate, const char *name, int len)
+{
+	struct strbuf dir = STRBUF_INIT;
+	int pos = index_name_pos(istate, name, len);
+
+	if (pos < 0)
+		pos = -pos - 1;
+	for (; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+		if (strncmp(ce->name, name, len))
+			break;
+		ce->ce_flags &= ~CE_FSMONITOR_VALID;
+	}
+	fsmonitor_refresh_gitlink(istate, name);
+
+	trace_printf_key(&trace_fsmonitor, "fsmonitor_refresh_callback '%s'", name);
+
+	/* invalidate both the directory and its entry in the parent */
+	strbuf_add(&dir, name, len - 1);
+	if (verify_path(dir.buf, 0)) {
+		untracked_cache_invalidate_path(istate, dir.buf, 1);
+		untracked_cache_invalidate_path(istate, name, 1);
+	}
+	strbuf_release(&dir);
+}
+
 static void fsmonitor_refresh_callback(struct index_state *istate, const char *name)
 {
-	int pos = index_name_pos(istate, name, strlen(name));
+	int len = strlen(name);
+	int pos;
 
+	if (len > 1 && name[len - 1] == '/') {
+		fsmonitor_refresh_directory(istate, name, len);
+		return;
+	}
+
+	pos = index_name_pos(istate, name, len);
 	if (pos >= 0) {
 		struct cache_entry *ce = istate->cache[pos];
 		ce->ce_flags &= ~CE_FSMONITOR_VALID;
-	}
+	} else
+		fsmonitor_refresh_gitlink(istate, name);
 
 	/*
 	 * Mark the untracked cache dirty even if it wasn't found in the index
@@ -156,9 +223,15 @@ void refresh_fsmonitor(struct index_state *istate)
 	if (istate->fsmonitor_last_update) {
 		query_success = !query_fsmonitor(HOOK_INTERFACE_VERSION,
 			istate->fsmonitor_last_update, &query_result);
-		trace_performance_since(last_update, "fsmonitor process '%s'", core_fsmonitor);
-		trace_printf_key(&trace_fsmonitor, "fsmonitor process '%s' returned %s",
-			core_fsmonitor, query_success ? "success" : "failure");
+		if (fsmonitor_is_builtin()) {
+			trace_performance_since(last_update, "fsmonitor daemon");
+			trace_printf_key(&trace_fsmonitor, "fsmonitor daemon returned %s",
+				query_success ? "success" : "failure");
+		} else {
+			trace_performance_since(last_update, "fsmonitor process '%s'", core_fsmonitor);
+			trace_printf_key(&trace_fsmonitor, "fsmonitor process '%s' returned %s",
+				core_fsmonitor, query_success ? "success" : "failure");
+		}
 	}
 
 	/* a fsmonitor process can return '/' to indicate all entries are invalid */
@@ -6,6 +6,12 @@
 
 extern struct trace_key trace_fsmonitor;
 
+/*
+ * Whether core.fsmonitor selects the built-in fsmonitor daemon rather
+ * than a hook.
+ */
+extern int fsmonitor_is_builtin(void);
+
 /*
  * Read the fsmonitor index extension and (if configured) restore the
  * CE_FSMONITOR_VALID state.
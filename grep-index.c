@@ -0,0 +1,590 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "grep-index.h"
+#include "lockfile.h"
+#include "object-store.h"
+#include "oidset.h"
+#include "progress.h"
+#include "repository.h"
+#include "sha1-array.h"
+#include "sha1-lookup.h"
+#include "tree-walk.h"
+
+#define GREP_INDEX_SIGNATURE 0x47494458 /* "GIDX" */
+#define GREP_INDEX_VERSION 1
+#define GREP_INDEX_OID_VERSION 1 /* SHA-1 */
+
+/*
+ * The file consists of:
+ *
+ *  - a 28-byte header: the signature, the version, the hash version,
+ *    two padding bytes, the Bloom filter hash version, number of
+ *    hashes and bits per entry, and the number of trees and of blobs
+ *    (all 4-byte network order integers except the three versions);
+ *  - a 256-entry fanout table and the sorted names of the trees;
+ *  - a 256-entry fanout table and the sorted names of the blobs;
+ *  - for each blob, the 8-byte offset of the end of its filter;
+ *  - the concatenated filters;
+ *  - a checksum of the above.
+ */
+#define GREP_INDEX_HEADER_SIZE 28
+#define GREP_INDEX_FANOUT_SIZE (4 * 256)
+#define GREP_INDEX_OFFSET_WIDTH 8
+
+/*
+ * A blob with more distinct trigrams than this gets an empty filter,
+ * which answers "maybe" to every query; its filter would be large and
+ * have most bits set anyway.
+ */
+#define GREP_INDEX_MAX_TRIGRAMS (1 << 20)
+
+struct grep_index {
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_trees;
+	uint32_t num_blobs;
+	const uint32_t *tree_fanout;
+	const unsigned char *tree_oids;
+	const uint32_t *blob_fanout;
+	const unsigned char *blob_oids;
+	const unsigned char *blob_offsets;
+	const unsigned char *filter_data;
+	size_t filter_data_len;
+};
+
+static char *get_grep_index_filename(struct repository *r)
+{
+	return xstrfmt("%s/info/grep-index", r->objects->objectdir);
+}
+
+struct grep_index *load_grep_index(struct repository *r)
+{
+	struct bloom_filter_settings settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	const unsigned hashsz = the_hash_algo->rawsz;
+	char *index_file = get_grep_index_filename(r);
+	struct grep_index *gi;
+	const unsigned char *data;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx c;
+	size_t index_size;
+	uint64_t fixed_size;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = git_open(index_file);
+	if (fd < 0) {
+		free(index_file);
+		return NULL;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(index_file);
+		return NULL;
+	}
+	index_size = xsize_t(st.st_size);
+	if (index_size < GREP_INDEX_HEADER_SIZE + 2 * GREP_INDEX_FANOUT_SIZE + hashsz) {
+		close(fd);
+		warning(_("grep index %s is too small"), index_file);
+		free(index_file);
+		return NULL;
+	}
+	map = xmmap(NULL, index_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	data = map;
+
+	gi = xcalloc(1, sizeof(*gi));
+	gi->data = data;
+	gi->data_len = index_size;
+
+	the_hash_algo->init_fn(&c);
+	the_hash_algo->update_fn(&c, data, index_size - hashsz);
+	the_hash_algo->final_fn(hash, &c);
+	if (!hasheq(hash, data + index_size - hashsz)) {
+		warning(_("grep index %s has a bad checksum"), index_file);
+		goto cleanup_fail;
+	}
+
+	if (get_be32(data) != GREP_INDEX_SIGNATURE) {
+		warning(_("grep index signature %X does not match signature %X"),
+			get_be32(data), GREP_INDEX_SIGNATURE);
+		goto cleanup_fail;
+	}
+	if (data[4] != GREP_INDEX_VERSION) {
+		warning(_("grep index version %X does not match version %X"),
+			data[4], GREP_INDEX_VERSION);
+		goto cleanup_fail;
+	}
+	if (data[5] != GREP_INDEX_OID_VERSION) {
+		warning(_("hash version %X does not match version %X"),
+			data[5], GREP_INDEX_OID_VERSION);
+		goto cleanup_fail;
+	}
+	if (get_be32(data + 8) != settings.hash_version ||
+	    get_be32(data + 12) != settings.num_hashes ||
+	    get_be32(data + 16) != settings.bits_per_entry) {
+		warning(_("grep index %s uses unsupported Bloom filter settings"),
+			index_file);
+		goto cleanup_fail;
+	}
+	gi->num_trees = get_be32(data + 20);
+	gi->num_blobs = get_be32(data + 24);
+
+	fixed_size = GREP_INDEX_HEADER_SIZE + 2 * GREP_INDEX_FANOUT_SIZE +
+		(uint64_t)gi->num_trees * hashsz +
+		(uint64_t)gi->num_blobs * (hashsz + GREP_INDEX_OFFSET_WIDTH) +
+		hashsz;
+	if (index_size < fixed_size) {
+		warning(_("grep index %s is truncated"), index_file);
+		goto cleanup_fail;
+	}
+
+	data += GREP_INDEX_HEADER_SIZE;
+	gi->tree_fanout = (const uint32_t *)data;
+	data += GREP_INDEX_FANOUT_SIZE;
+	gi->tree_oids = data;
+	data += (size_t)gi->num_trees * hashsz;
+	gi->blob_fanout = (const uint32_t *)data;
+	data += GREP_INDEX_FANOUT_SIZE;
+	gi->blob_oids = data;
+	data += (size_t)gi->num_blobs * hashsz;
+	gi->blob_offsets = data;
+	data += (size_t)gi->num_blobs * GREP_INDEX_OFFSET_WIDTH;
+	gi->filter_data = data;
+	gi->filter_data_len = index_size - fixed_size;
+
+	if (ntohl(gi->tree_fanout[255]) != gi->num_trees ||
+	    ntohl(gi->blob_fanout[255]) != gi->num_blobs) {
+		warning(_("grep index %s has a corrupt fanout table"), index_file);
+		goto cleanup_fail;
+	}
+
+	free(index_file);
+	return gi;
+
+cleanup_fail:
+	free(index_file);
+	close_grep_index(gi);
+	return NULL;
+}
+
+void close_grep_index(struct grep_index *gi)
+{
+	if (!gi)
+		return;
+	munmap((void *)gi->data, gi->data_len);
+	free(gi);
+}
+
+static int grep_index_has_tree(const struct grep_index *gi,
+			       const struct object_id *oid)
+{
+	return bsearch_hash(oid->hash, gi->tree_fanout, gi->tree_oids,
+			    the_hash_algo->rawsz, NULL);
+}
+
+static int grep_index_find_blob(const struct grep_index *gi,
+				const struct object_id *oid, uint32_t *pos)
+{
+	return bsearch_hash(oid->hash, gi->blob_fanout, gi->blob_oids,
+			    the_hash_algo->rawsz, pos);
+}
+
+/*
+ * Point 'filter' at the filter of the pos-th blob. Returns 0 if its
+ * offsets are out of bounds.
+ */
+static int grep_index_blob_filter(const struct grep_index *gi, uint32_t pos,
+				  struct bloom_filter *filter)
+{
+	uint64_t start, end;
+
+	end = get_be64(gi->blob_offsets + (size_t)pos * GREP_INDEX_OFFSET_WIDTH);
+	start = pos ? get_be64(gi->blob_offsets +
+			       (size_t)(pos - 1) * GREP_INDEX_OFFSET_WIDTH) : 0;
+	if (start > end || end > gi->filter_data_len)
+		return 0;
+
+	filter->data = (unsigned char *)gi->filter_data + start;
+	filter->len = end - start;
+	return 1;
+}
+
+/*
+ * Copy the trigram at 's' to 'out' with ASCII letters folded to
+ * lowercase. Returns 0 if it spans a line break, as no match does.
+ */
+static int fold_trigram(const char *s, char *out)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (s[i] == '\n')
+			return 0;
+		out[i] = tolower(s[i]);
+	}
+	return 1;
+}
+
+void grep_index_query_add_alternative(struct grep_index_query *q)
+{
+	ALLOC_GROW(q->alt, q->nr + 1, q->alloc);
+	memset(&q->alt[q->nr], 0, sizeof(*q->alt));
+	q->nr++;
+}
+
+void grep_index_query_add_literal(struct grep_index_query *q,
+				  const char *s, size_t len)
+{
+	struct bloom_filter_settings settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	struct grep_index_alternative *alt;
+	size_t i;
+
+	if (!q->nr)
+		BUG("grep_index_query_add_literal() without an alternative");
+	alt = &q->alt[q->nr - 1];
+
+	for (i = 0; i + 3 <= len; i++) {
+		char trigram[3];
+
+		if (!fold_trigram(s + i, trigram))
+			continue;
+		ALLOC_GROW(alt->keys, alt->nr + 1, alt->alloc);
+		fill_bloom_key(trigram, 3, &alt->keys[alt->nr++], &settings);
+	}
+}
+
+int grep_index_query_is_useful(const struct grep_index_query *q)
+{
+	size_t i;
+
+	if (!q->nr)
+		return 0;
+	for (i = 0; i < q->nr; i++)
+		if (!q->alt[i].nr)
+			return 0;
+	return 1;
+}
+
+void clear_grep_index_query(struct grep_index_query *q)
+{
+	size_t i, j;
+
+	for (i = 0; i < q->nr; i++) {
+		for (j = 0; j < q->alt[i].nr; j++)
+			clear_bloom_key(&q->alt[i].keys[j]);
+		free(q->alt[i].keys);
+	}
+	FREE_AND_NULL(q->alt);
+	q->nr = q->alloc = 0;
+}
+
+int grep_index_may_match(const struct grep_index *gi,
+			 const struct object_id *oid,
+			 const struct grep_index_query *q)
+{
+	struct bloom_filter_settings settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	struct bloom_filter filter;
+	uint32_t pos;
+	size_t i, j;
+
+	if (!grep_index_find_blob(gi, oid, &pos) ||
+	    !grep_index_blob_filter(gi, pos, &filter))
+		return 1;
+
+	for (i = 0; i < q->nr; i++) {
+		const struct grep_index_alternative *alt = &q->alt[i];
+
+		for (j = 0; j < alt->nr; j++)
+			if (!bloom_filter_contains(&filter, &alt->keys[j],
+						   &settings))
+				break;
+		if (j == alt->nr)
+			return 1;
+	}
+	return 0;
+}
+
+struct grep_index_entry {
+	struct object_id oid;
+	const unsigned char *data;
+	size_t len;
+};
+
+struct write_grep_index_context {
+	struct grep_index *old;
+	struct bloom_filter_settings settings;
+
+	/* trees and blobs that are new to the index */
+	struct oidset seen_trees;
+	struct oidset seen_blobs;
+	struct oid_array trees;
+	struct grep_index_entry *blobs;
+	size_t blobs_nr, blobs_alloc;
+
+	struct progress *progress;
+};
+
+static int trigram_cmp(const void *va, const void *vb)
+{
+	uint32_t a = *(const uint32_t *)va;
+	uint32_t b = *(const uint32_t *)vb;
+
+	return a < b ? -1 : a > b;
+}
+
+static void compute_blob_filter(struct write_grep_index_context *ctx,
+				struct grep_index_entry *e)
+{
+	enum object_type type;
+	unsigned long size, i;
+	uint32_t *trigrams = NULL;
+	size_t nr = 0, alloc = 0, distinct = 0;
+	struct bloom_filter filter;
+	char *buf;
+
+	buf = read_object_file(&e->oid, &type, &size);
+	if (!buf || type != OBJ_BLOB)
+		die(_("unable to read blob %s"), oid_to_hex(&e->oid));
+
+	for (i = 0; i + 3 <= size; i++) {
+		unsigned char t[3];
+
+		if (!fold_trigram(buf + i, (char *)t))
+			continue;
+		ALLOC_GROW(trigrams, nr + 1, alloc);
+		trigrams[nr++] = (t[0] << 16) | (t[1] << 8) | t[2];
+	}
+	free(buf);
+
+	QSORT(trigrams, nr, trigram_cmp);
+	for (i = 0; i < nr; i++)
+		if (!distinct || trigrams[i] != trigrams[distinct - 1])
+			trigrams[distinct++] = trigrams[i];
+
+	if (distinct > GREP_INDEX_MAX_TRIGRAMS) {
+		e->data = NULL;
+		e->len = 0;
+		free(trigrams);
+		return;
+	}
+
+	/*
+	 * As with changed-path filters, an empty blob still gets a
+	 * one-word filter, so that it is known to match nothing.
+	 */
+	filter.len = (distinct * ctx->settings.bits_per_entry +
+		      BITS_PER_WORD - 1) / BITS_PER_WORD;
+	if (!filter.len)
+		filter.len = 1;
+	filter.data = xcalloc(filter.len, sizeof(unsigned char));
+
+	for (i = 0; i < distinct; i++) {
+		struct bloom_key key;
+		char t[3];
+
+		t[0] = trigrams[i] >> 16;
+		t[1] = trigrams[i] >> 8;
+		t[2] = trigrams[i];
+		fill_bloom_key(t, 3, &key, &ctx->settings);
+		add_key_to_filter(&key, &filter, &ctx->settings);
+		clear_bloom_key(&key);
+	}
+	free(trigrams);
+
+	e->data = filter.data;
+	e->len = filter.len;
+}
+
+static void index_blob(struct write_grep_index_context *ctx,
+		       const struct object_id *oid)
+{
+	struct grep_index_entry *e;
+	uint32_t pos;
+
+	if ((ctx->old && grep_index_find_blob(ctx->old, oid, &pos)) ||
+	    oidset_insert(&ctx->seen_blobs, oid))
+		return;
+
+	ALLOC_GROW(ctx->blobs, ctx->blobs_nr + 1, ctx->blobs_alloc);
+	e = &ctx->blobs[ctx->blobs_nr++];
+	oidcpy(&e->oid, oid);
+	compute_blob_filter(ctx, e);
+	display_progress(ctx->progress, ctx->blobs_nr);
+}
+
+static void index_tree(struct write_grep_index_context *ctx,
+		       const struct object_id *oid)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+
+	if ((ctx->old && grep_index_has_tree(ctx->old, oid)) ||
+	    oidset_insert(&ctx->seen_trees, oid))
+		return;
+
+	buf = read_object_file(oid, &type, &size);
+	if (!buf || type != OBJ_TREE)
+		die(_("unable to read tree %s"), oid_to_hex(oid));
+
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		if (S_ISDIR(entry.mode))
+			index_tree(ctx, entry.oid);
+		else if (S_ISREG(entry.mode))
+			index_blob(ctx, entry.oid);
+	}
+	free(buf);
+
+	/* only list the tree once everything below it is indexed */
+	oid_array_append(&ctx->trees, oid);
+}
+
+static int oid_cmp(const void *va, const void *vb)
+{
+	return oidcmp((const struct object_id *)va,
+		      (const struct object_id *)vb);
+}
+
+static int grep_index_entry_cmp(const void *va, const void *vb)
+{
+	const struct grep_index_entry *a = va, *b = vb;
+
+	return oidcmp(&a->oid, &b->oid);
+}
+
+/*
+ * Write the fanout of 'nr' sorted object names, which start 'list' and
+ * are 'stride' bytes apart.
+ */
+static void write_oid_fanout(struct hashfile *f, const void *list,
+			     size_t nr, size_t stride)
+{
+	const unsigned char *p = list;
+	uint32_t count = 0;
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		while (count < nr &&
+		       ((const struct object_id *)(p + count * stride))->hash[0] <= i)
+			count++;
+		hashwrite_be32(f, count);
+	}
+}
+
+void write_grep_index(struct repository *r,
+		      const struct object_id *trees, size_t nr,
+		      unsigned flags)
+{
+	struct write_grep_index_context ctx = { NULL };
+	struct bloom_filter_settings settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	const unsigned hashsz = the_hash_algo->rawsz;
+	struct grep_index_entry *all;
+	size_t all_nr, i;
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	char *index_file;
+	uint64_t offset;
+
+	ctx.old = load_grep_index(r);
+	ctx.settings = settings;
+	oidset_init(&ctx.seen_trees, 0);
+	oidset_init(&ctx.seen_blobs, 0);
+
+	if (flags & GREP_INDEX_PROGRESS)
+		ctx.progress = start_delayed_progress(
+			_("Indexing blob trigrams"), 0);
+	for (i = 0; i < nr; i++)
+		index_tree(&ctx, &trees[i]);
+	stop_progress(&ctx.progress);
+
+	/* Merge the new trees and blobs with those of the old index. */
+	if (ctx.old) {
+		for (i = 0; i < ctx.old->num_trees; i++) {
+			struct object_id oid;
+
+			hashcpy(oid.hash, ctx.old->tree_oids + i * hashsz);
+			oid_array_append(&ctx.trees, &oid);
+		}
+		for (i = 0; i < ctx.old->num_blobs; i++) {
+			struct grep_index_entry *e;
+			struct bloom_filter filter;
+
+			ALLOC_GROW(ctx.blobs, ctx.blobs_nr + 1, ctx.blobs_alloc);
+			e = &ctx.blobs[ctx.blobs_nr++];
+			hashcpy(e->oid.hash, ctx.old->blob_oids + i * hashsz);
+			if (grep_index_blob_filter(ctx.old, i, &filter)) {
+				e->data = filter.data;
+				e->len = filter.len;
+			} else {
+				e->data = NULL;
+				e->len = 0;
+			}
+		}
+	}
+	QSORT(ctx.trees.oid, ctx.trees.nr, oid_cmp);
+	all = ctx.blobs;
+	all_nr = ctx.blobs_nr;
+	QSORT(all, all_nr, grep_index_entry_cmp);
+
+	index_file = get_grep_index_filename(r);
+	if (safe_create_leading_directories(index_file))
+		die_errno(_("unable to create leading directories of %s"),
+			  index_file);
+	hold_lock_file_for_update(&lk, index_file, LOCK_DIE_ON_ERROR);
+	f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
+
+	hashwrite_be32(f, GREP_INDEX_SIGNATURE);
+	hashwrite_u8(f, GREP_INDEX_VERSION);
+	hashwrite_u8(f, GREP_INDEX_OID_VERSION);
+	hashwrite_u8(f, 0); /* unused padding byte */
+	hashwrite_u8(f, 0); /* unused padding byte */
+	hashwrite_be32(f, settings.hash_version);
+	hashwrite_be32(f, settings.num_hashes);
+	hashwrite_be32(f, settings.bits_per_entry);
+	hashwrite_be32(f, ctx.trees.nr);
+	hashwrite_be32(f, all_nr);
+
+	write_oid_fanout(f, ctx.trees.oid, ctx.trees.nr,
+			 sizeof(struct object_id));
+	for (i = 0; i < ctx.trees.nr; i++)
+		hashwrite(f, ctx.trees.oid[i].hash, hashsz);
+
+	write_oid_fanout(f, all, all_nr, sizeof(*all));
+	for (i = 0; i < all_nr; i++)
+		hashwrite(f, all[i].oid.hash, hashsz);
+
+	offset = 0;
+	for (i = 0; i < all_nr; i++) {
+		unsigned char buf[GREP_INDEX_OFFSET_WIDTH];
+
+		offset += all[i].len;
+		put_be64(buf, offset);
+		hashwrite(f, buf, sizeof(buf));
+	}
+	for (i = 0; i < all_nr; i++)
+		if (all[i].len)
+			hashwrite(f, all[i].data, all[i].len);
+
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+	commit_lock_file(&lk);
+	free(index_file);
+
+	/*
+	 * The filters of the new blobs are owned by us, those of the old
+	 * ones borrowed from the old index.
+	 */
+	for (i = 0; i < all_nr; i++)
+		if (!ctx.old || !grep_index_find_blob(ctx.old, &all[i].oid, NULL))
+			free((void *)all[i].data);
+
+	free(ctx.blobs);
+	oid_array_clear(&ctx.trees);
+	oidset_clear(&ctx.seen_trees);
+	oidset_clear(&ctx.seen_blobs);
+	close_grep_index(ctx.old);
+}
@@ -0,0 +1,80 @@
+#ifndef GREP_INDEX_H
+#define GREP_INDEX_H
+
+#include "bloom.h"
+
+struct object_id;
+struct repository;
+
+/*
+ * An optional index of the byte trigrams in blobs, kept in
+ * "$GIT_OBJECT_DIRECTORY/info/grep-index" and written by
+ * "git grep --build-index".
+ *
+ * Each indexed blob has a Bloom filter of the trigrams of its lines,
+ * with ASCII letters folded to lowercase. The index also lists the
+ * trees whose blobs are all indexed; adding a tree to the index only
+ * descends into the subtrees that are not listed yet, so indexing a
+ * new commit costs about as much as the blobs it changed.
+ *
+ * Blobs are immutable, so the index never goes stale; blobs missing
+ * from it are simply not pruned.
+ */
+struct grep_index;
+
+/*
+ * Return the grep index of 'r', or NULL if there is none (or it cannot
+ * be used, in which case a warning is issued).
+ */
+struct grep_index *load_grep_index(struct repository *r);
+void close_grep_index(struct grep_index *gi);
+
+/*
+ * A query against the index is a disjunction of alternatives, each of
+ * which is a conjunction of trigrams: a blob can only match if it has
+ * all the trigrams of at least one alternative.
+ */
+struct grep_index_alternative {
+	struct bloom_key *keys;
+	size_t nr, alloc;
+};
+
+struct grep_index_query {
+	struct grep_index_alternative *alt;
+	size_t nr, alloc;
+};
+
+/*
+ * Start a new alternative, to which the trigrams of the literal strings
+ * passed to grep_index_query_add_literal() are then added.
+ */
+void grep_index_query_add_alternative(struct grep_index_query *q);
+void grep_index_query_add_literal(struct grep_index_query *q,
+				  const char *s, size_t len);
+
+/*
+ * Return 1 if every alternative has at least one trigram, i.e. if the
+ * query can prune anything at all.
+ */
+int grep_index_query_is_useful(const struct grep_index_query *q);
+void clear_grep_index_query(struct grep_index_query *q);
+
+/*
+ * Return 0 if the blob 'oid' is indexed and cannot match 'q', and 1
+ * otherwise. Safe to call from several threads at once.
+ */
+int grep_index_may_match(const struct grep_index *gi,
+			 const struct object_id *oid,
+			 const struct grep_index_query *q);
+
+#define GREP_INDEX_PROGRESS (1 << 0)
+
+/*
+ * Add the blobs reachable from the trees 'trees' to the grep index of
+ * 'r', creating it if needed.
+ */
+void write_grep_index(struct repository *r,
+		      const struct object_id *trees, size_t nr,
+		      unsigned flags);
+
+#endif /* GREP_INDEX_H */
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "config.h"
 #include "grep.h"
+#include "grep-index.h"
 #include "object-store.h"
 #include "userdiff.h"
 #include "xdiff-interface.h"
@@ -1025,6 +1026,178 @@ void compile_grep_patterns(struct grep_opt *opt)
 		dump_grep_expression(opt);
 }
 
+/*
+ * Add the literal runs that every match of the BRE or ERE 'p' must
+ * contain to the last alternative of 'q'. Returns -1 if the pattern
+ * uses alternation or groups, which this does not try to understand.
+ */
+static int add_regexp_literals(struct grep_index_query *q,
+			       const struct grep_pat *p, int extended)
+{
+	struct strbuf run = STRBUF_INIT;
+	const char *s = p->pattern, *end = p->pattern + p->patternlen;
+	int ret = 0;
+
+	while (s < end) {
+		const char *atom = s;
+		int literal = 1;
+
+		if (*s == '\\' && s + 1 < end) {
+			char c = s[1];
+
+			if (!extended && (c == '(' || c == '|')) {
+				ret = -1;
+				break;
+			}
+			s += 2;
+			if (!extended && c == '{') {
+				/* skip the interval "\{m,n\}" */
+				while (s + 1 < end && !(s[0] == '\\' && s[1] == '}'))
+					s++;
+				s += 2;
+				literal = 0;
+			} else if ((!extended && strchr(")}+?", c)) ||
+				   isalnum(c) || strchr("<>`'", c)) {
+				/* operators, anchors, classes and backreferences */
+				literal = 0;
+			} else {
+				atom++;
+				while (s < end && ((unsigned char)*s & 0xc0) == 0x80)
+					s++;
+			}
+		} else if (*s == '[') {
+			/* skip the bracket expression; "]" may come first */
+			s++;
+			if (s < end && *s == '^')
+				s++;
+			if (s < end && *s == ']')
+				s++;
+			while (s < end && *s != ']') {
+				if (*s == '[' && s + 1 < end &&
+				    strchr(":.=", s[1])) {
+					const char *close = s + 2;
+					while (close + 1 < end &&
+					       !(close[0] == s[1] && close[1] == ']'))
+						close++;
+					s = close + 1;
+				}
+				s++;
+			}
+			s++;
+			literal = 0;
+		} else if (extended && *s == '{') {
+			/* skip the interval "{m,n}" */
+			while (s < end && *s != '}')
+				s++;
+			s++;
+			literal = 0;
+		} else if (*s == '.' || *s == '^' || *s == '$' || *s == '*' ||
+			   (extended && strchr("+?)", *s))) {
+			s++;
+			literal = 0;
+		} else if (extended && (*s == '(' || *s == '|')) {
+			ret = -1;
+			break;
+		} else if ((unsigned char)*s >= 0xc0) {
+			/* a multi-byte character is a single atom */
+			s++;
+			while (s < end && ((unsigned char)*s & 0xc0) == 0x80)
+				s++;
+		} else {
+			s++;
+		}
+
+		if (s > end)
+			s = end;
+		if (!literal) {
+			grep_index_query_add_literal(q, run.buf, run.len);
+			strbuf_reset(&run);
+			continue;
+		}
+
+		/* an atom that may repeat or be left out ends the run */
+		if (s < end && (*s == '*' ||
+				(extended && strchr("?{", *s)) ||
+				(!extended && *s == '\\' && s + 1 < end &&
+				 strchr("{?", s[1])))) {
+			grep_index_query_add_literal(q, run.buf, run.len);
+			strbuf_reset(&run);
+			continue;
+		}
+		strbuf_add(&run, atom, s - atom);
+		if (s < end && ((extended && *s == '+') ||
+				(!extended && *s == '\\' && s + 1 < end &&
+				 s[1] == '+'))) {
+			grep_index_query_add_literal(q, run.buf, run.len);
+			strbuf_reset(&run);
+		}
+	}
+	if (!ret)
+		grep_index_query_add_literal(q, run.buf, run.len);
+	strbuf_release(&run);
+	return ret;
+}
+
+int compile_grep_index_query(const struct grep_opt *opt,
+			     struct grep_index_query *q)
+{
+	struct grep_pat *p;
+
+	/*
+	 * Only queries for which every match has to contain some of the
+	 * pattern's literal bytes can use the index to skip blobs.
+	 */
+	if (opt->invert || opt->unmatch_name_only || opt->allow_textconv ||
+	    opt->header_list)
+		return -1;
+
+	for (p = opt->pattern_list; p; p = p->next) {
+		int fixed;
+
+		switch (p->token) {
+		case GREP_PATTERN:
+		case GREP_PATTERN_BODY:
+			break;
+		case GREP_AND:
+		case GREP_OR:
+		case GREP_OPEN_PAREN:
+		case GREP_CLOSE_PAREN:
+			/*
+			 * A blob matching "A --and B" also matches
+			 * "A --or B", which is what the query checks.
+			 */
+			continue;
+		default:
+			goto fail;
+		}
+
+		if (memchr(p->pattern, '\n', p->patternlen))
+			goto fail;
+
+		/* see compile_regexp() */
+		fixed = opt->fixed ||
+			has_null(p->pattern, p->patternlen) ||
+			is_fixed(p->pattern, p->patternlen);
+		if (fixed && opt->ignore_case && has_non_ascii(p->pattern))
+			fixed = 0;
+
+		grep_index_query_add_alternative(q);
+		if (fixed)
+			grep_index_query_add_literal(q, p->pattern,
+						     p->patternlen);
+		else if (opt->fixed || opt->ignore_case ||
+			 opt->pcre1 || opt->pcre2 ||
+			 add_regexp_literals(q, p, opt->extended_regexp_option))
+			goto fail;
+	}
+
+	if (grep_index_query_is_useful(q))
+		return 0;
+fail:
+	clear_grep_index_query(q);
+	return -1;
+}
+
 static void free_pattern_expr(struct grep_expr *x)
 {
 	switch (x->node) {
@@ -2021,6 +2194,10 @@ static int chk_hit_marker(struct grep_expr *x)
 
 int grep_source(struct grep_opt *opt, struct grep_source *gs)
 {
+	if (opt->index_query && gs->type == GREP_SOURCE_OID &&
+	    !grep_index_may_match(opt->index, gs->identifier, opt->index_query))
+		return 0;
+
 	/*
 	 * we do not have to do the two-pass grep when we do not check
 	 * buffer-wide "all-match".
@@ -2105,9 +2282,17 @@ static int grep_source_load_oid(struct grep_source *gs)
 {
 	enum object_type type;
 
-	grep_read_lock();
-	gs->buf = read_object_file(gs->identifier, &type, &gs->size);
-	grep_read_unlock();
+	/*
+	 * No need to serialize on grep_read_mutex when the object store
+	 * allows concurrent reads.
+	 */
+	if (the_repository->objects->concurrent_reads)
+		gs->buf = read_object_file(gs->identifier, &type, &gs->size);
+	else {
+		grep_read_lock();
+		gs->buf = read_object_file(gs->identifier, &type, &gs->size);
+		grep_read_unlock();
+	}
 
 	if (!gs->buf)
 		return error(_("'%s': unable to read %s"),
@@ -36,6 +36,8 @@ typedef int pcre2_jit_stack;
 #include "thread-utils.h"
 #include "userdiff.h"
 
+struct grep_index;
+struct grep_index_query;
 struct repository;
 
 enum grep_pat_token {
@@ -182,6 +184,13 @@ struct grep_opt {
 	int heading;
 	void *priv;
 
+	/*
+	 * When set, blobs that the grep index knows cannot match the
+	 * query are skipped without being read.
+	 */
+	struct grep_index *index;
+	struct grep_index_query *index_query;
+
 	void (*output)(struct grep_opt *opt, const void *data, size_t size);
 	void *output_priv;
 };
@@ -196,6 +205,14 @@ extern void append_grep_pattern(struct grep_opt *opt, const char *pat, const cha
 extern void append_header_grep_pattern(struct grep_opt *, enum grep_header_field, const char *);
 extern void compile_grep_patterns(struct grep_opt *opt);
 extern void free_grep_patterns(struct grep_opt *opt);
+
+/*
+ * Fill 'q' with the trigrams that blobs must contain to match the
+ * patterns of 'opt'. Returns -1, leaving 'q' empty, if the patterns
+ * cannot be turned into a query that prunes anything.
+ */
+extern int compile_grep_index_query(const struct grep_opt *opt,
+				    struct grep_index_query *q);
 extern int grep_buffer(struct grep_opt *opt, char *buf, unsigned long size);
 
 struct grep_source {
@@ -15,6 +15,7 @@
 #include "userdiff.h"
 #include "line-log.h"
 #include "argv-array.h"
+#include "bloom.h"
 
 static void range_set_grow(struct range_set *rs, size_t extra)
 {
@@ -1110,6 +1111,19 @@ int line_log_print(struct rev_info *rev, struct commit *commit)
 	return 1;
 }
 
+/*
+ * Ask the changed-path filters whether any of the files we are tracking
+ * may differ between 'commit' and its first parent.
+ */
+static int line_log_maybe_changed(struct rev_info *rev, struct commit *commit,
+				  struct line_log_data *range)
+{
+	for (; range; range = range->next)
+		if (bloom_filter_maybe_changed_path(rev->repo, commit, range->path))
+			return 1;
+	return 0;
+}
+
 static int process_ranges_ordinary_commit(struct rev_info *rev, struct commit *commit,
 					  struct line_log_data *range)
 {
@@ -1121,6 +1135,11 @@ static int process_ranges_ordinary_commit(struct rev_info *rev, struct commit *c
 	if (commit->parents)
 		parent = commit->parents->item;
 
+	if (parent && !line_log_maybe_changed(rev, commit, range)) {
+		add_line_range(rev, parent, range);
+		return 0;
+	}
+
 	queue_diffs(range, &rev->diffopt, &queue, commit, parent);
 	changed = process_all_files(&parent_range, rev, &queue, range);
 	if (parent)
@@ -0,0 +1,1268 @@
+/*
+ * A three-way merge of trees that works in memory.
+ *
+ * merge-recursive runs unpack_trees() into the index first and then
+ * fixes the entries up one by one, updating the working tree as it
+ * goes. Here, the three trees are walked once to collect the versions
+ * of every path that differs between them, renames are detected and
+ * applied to that table, each path is resolved, and the result is
+ * written as a tree; the index and the working tree are only touched
+ * by merge_switch_to_result(), in one unpack_trees() call.
+ */
+#include "cache.h"
+#include "merge-ort.h"
+#include "alloc.h"
+#include "attr.h"
+#include "blob.h"
+#include "commit.h"
+#include "commit-reach.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "dir.h"
+#include "ll-merge.h"
+#include "object-store.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "unpack-trees.h"
+#include "xdiff-interface.h"
+
+struct version_info {
+	struct object_id oid;
+	unsigned short mode; /* 0 if there is no such version */
+};
+
+/* Everything known about a path whose versions differ */
+struct merge_entry {
+	struct hashmap_entry ent;
+	/* in the merge base, on side1 and on side2 */
+	struct version_info stages[3];
+	/* where each version comes from, if it was renamed */
+	const char *pathnames[3];
+	struct version_info result;
+	/* the path in the result, if it had to be moved out of the way */
+	char *moved_to;
+	/* a subtree that is the same on all sides, taken as is */
+	unsigned is_tree:1;
+	/* resolved while applying the renames */
+	unsigned processed:1;
+	unsigned conflicted:1;
+	/* the versions to record in the index for a conflict */
+	struct version_info conflict_stages[3];
+	char path[FLEX_ARRAY];
+};
+
+struct merge_state {
+	struct merge_options *opt;
+	struct hashmap paths;
+	struct merge_entry **entries;
+	int nr, alloc;
+	int conflicts;
+	/* holds the merged .gitattributes, see init_attr_index() */
+	struct index_state attr_index;
+};
+
+static void flush_output(struct merge_options *opt)
+{
+	if (opt->buffer_output < 2 && opt->obuf.len) {
+		fputs(opt->obuf.buf, stdout);
+		strbuf_reset(&opt->obuf);
+	}
+}
+
+static int show(struct merge_options *opt, int v)
+{
+	return (!opt->call_depth && opt->verbosity >= v) || opt->verbosity >= 5;
+}
+
+__attribute__((format (printf, 3, 4)))
+static void output(struct merge_options *opt, int v, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!show(opt, v))
+		return;
+
+	strbuf_addchars(&opt->obuf, ' ', opt->call_depth * 2);
+
+	va_start(ap, fmt);
+	strbuf_vaddf(&opt->obuf, fmt, ap);
+	va_end(ap);
+
+	strbuf_addch(&opt->obuf, '\n');
+	if (!opt->buffer_output)
+		flush_output(opt);
+}
+
+static int merge_entry_cmp(const void *unused_cmp_data,
+			   const void *entry, const void *entry_or_key,
+			   const void *keydata)
+{
+	const struct merge_entry *a = entry, *b = entry_or_key;
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static struct merge_entry *find_entry(struct merge_state *state,
+				      const char *path)
+{
+	return hashmap_get_from_hash(&state->paths, strhash(path), path);
+}
+
+static struct merge_entry *add_entry(struct merge_state *state,
+				     const char *path, size_t len)
+{
+	struct merge_entry *e;
+
+	FLEX_ALLOC_MEM(e, path, path, len);
+	hashmap_entry_init(e, strhash(e->path));
+	hashmap_add(&state->paths, e);
+	ALLOC_GROW(state->entries, state->nr + 1, state->alloc);
+	state->entries[state->nr++] = e;
+	return e;
+}
+
+static int same_version(const struct version_info *a,
+			const struct version_info *b)
+{
+	if (!a->mode || !b->mode)
+		return a->mode == b->mode;
+	return a->mode == b->mode && oideq(&a->oid, &b->oid);
+}
+
+static void set_version(struct version_info *v, const struct object_id *oid,
+			unsigned mode)
+{
+	oidcpy(&v->oid, oid);
+	v->mode = mode;
+}
+
+static void clear_version(struct version_info *v)
+{
+	oidclr(&v->oid);
+	v->mode = 0;
+}
+
+static void mark_conflict(struct merge_state *state, struct merge_entry *e)
+{
+	if (e->conflicted)
+		return;
+	e->conflicted = 1;
+	memcpy(e->conflict_stages, e->stages, sizeof(e->stages));
+	state->conflicts++;
+}
+
+/*
+ * Collecting the versions of the paths
+ */
+
+static int collect_merge_info_callback(int n, unsigned long mask,
+				       unsigned long dirmask,
+				       struct name_entry *names,
+				       struct traverse_info *info)
+{
+	struct merge_state *state = info->data;
+	unsigned long filemask = mask & ~dirmask;
+	struct name_entry *p = names;
+	char *path;
+	size_t len;
+	int i;
+
+	while (!p->mode)
+		p++;
+	len = traverse_path_len(info, p);
+	path = xmallocz(len);
+	make_traverse_path(path, info, p);
+
+	/*
+	 * A subtree that did not change on either side has nothing to
+	 * merge; none of its files can be the source or the destination
+	 * of a rename either.
+	 */
+	if (dirmask == 7 && oideq(names[0].oid, names[1].oid) &&
+	    oideq(names[0].oid, names[2].oid)) {
+		struct merge_entry *e = add_entry(state, path, len);
+		e->is_tree = 1;
+		set_version(&e->result, names[0].oid, names[0].mode);
+		free(path);
+		return mask;
+	}
+
+	if (filemask) {
+		struct merge_entry *e = add_entry(state, path, len);
+		for (i = 0; i < 3; i++) {
+			if (filemask & (1ul << i))
+				set_version(&e->stages[i], names[i].oid,
+					    names[i].mode);
+			e->pathnames[i] = e->path;
+		}
+	}
+	free(path);
+
+	if (dirmask) {
+		struct traverse_info newinfo = *info;
+		struct tree_desc t[3];
+		void *buf[3];
+		int ret;
+
+		newinfo.prev = info;
+		newinfo.name = *p;
+		newinfo.pathlen += tree_entry_len(p) + 1;
+		for (i = 0; i < 3; i++) {
+			const struct object_id *oid = NULL;
+			if (dirmask & (1ul << i))
+				oid = names[i].oid;
+			buf[i] = fill_tree_descriptor(t + i, oid);
+		}
+		ret = traverse_trees(3, t, &newinfo);
+		for (i = 0; i < 3; i++)
+			free(buf[i]);
+		if (ret < 0)
+			return -1;
+	}
+
+	return mask;
+}
+
+static int collect_merge_info(struct merge_state *state,
+			      struct tree *merge_base,
+			      struct tree *side1,
+			      struct tree *side2)
+{
+	struct traverse_info info;
+	struct tree_desc t[3];
+
+	if (parse_tree(merge_base) < 0 || parse_tree(side1) < 0 ||
+	    parse_tree(side2) < 0)
+		return -1;
+	init_tree_desc(t + 0, merge_base->buffer, merge_base->size);
+	init_tree_desc(t + 1, side1->buffer, side1->size);
+	init_tree_desc(t + 2, side2->buffer, side2->size);
+
+	setup_traverse_info(&info, "");
+	info.fn = collect_merge_info_callback;
+	info.data = state;
+	return traverse_trees(3, t, &info);
+}
+
+/*
+ * Renames
+ *
+ * The renames between two trees are kept for the rest of the process:
+ * a recursive merge, or a series of merges like a rebase, often asks
+ * for the same pairs of trees again.
+ */
+
+struct rename {
+	char *old_path, *new_path;
+	struct version_info old;
+};
+
+struct rename_cache_entry {
+	struct hashmap_entry ent;
+	struct object_id base, side;
+	int detect_rename, rename_limit, rename_score;
+	struct rename *renames;
+	int nr;
+};
+
+static struct hashmap rename_cache;
+
+/* a bound on the memory used by the cache, which is then emptied */
+#define RENAME_CACHE_MAX 256
+
+static int rename_cache_cmp(const void *unused_cmp_data,
+			    const void *entry, const void *entry_or_key,
+			    const void *unused_keydata)
+{
+	const struct rename_cache_entry *a = entry, *b = entry_or_key;
+
+	return !oideq(&a->base, &b->base) || !oideq(&a->side, &b->side) ||
+		a->detect_rename != b->detect_rename ||
+		a->rename_limit != b->rename_limit ||
+		a->rename_score != b->rename_score;
+}
+
+static void free_rename_cache(void)
+{
+	struct hashmap_iter iter;
+	struct rename_cache_entry *e;
+	int i;
+
+	hashmap_iter_init(&rename_cache, &iter);
+	while ((e = hashmap_iter_next(&iter))) {
+		for (i = 0; i < e->nr; i++) {
+			free(e->renames[i].old_path);
+			free(e->renames[i].new_path);
+		}
+		free(e->renames);
+	}
+	hashmap_free(&rename_cache, 1);
+}
+
+static int rename_cmp(const void *a_, const void *b_)
+{
+	const struct rename *a = a_, *b = b_;
+	return strcmp(a->old_path, b->old_path);
+}
+
+static struct rename_cache_entry *get_renames(struct merge_options *opt,
+					      struct tree *base,
+					      struct tree *side)
+{
+	struct rename_cache_entry key, *e;
+	struct diff_options diff_opts;
+	int i, alloc = 0;
+
+	memset(&key, 0, sizeof(key));
+	oidcpy(&key.base, &base->object.oid);
+	oidcpy(&key.side, &side->object.oid);
+	key.detect_rename = merge_detect_rename(opt);
+	key.rename_limit = opt->merge_rename_limit >= 0 ? opt->merge_rename_limit :
+			   opt->diff_rename_limit >= 0 ? opt->diff_rename_limit :
+			   1000;
+	key.rename_score = opt->rename_score;
+	hashmap_entry_init(&key, sha1hash(key.base.hash) ^ sha1hash(key.side.hash));
+	e = hashmap_get(&rename_cache, &key, NULL);
+	if (e)
+		return e;
+
+	e = xmalloc(sizeof(*e));
+	*e = key;
+	hashmap_add(&rename_cache, e);
+	if (!key.detect_rename)
+		return e;
+
+	repo_diff_setup(the_repository, &diff_opts);
+	diff_opts.flags.recursive = 1;
+	diff_opts.flags.rename_empty = 0;
+	/* copies are not handled, as in merge-recursive */
+	diff_opts.detect_rename = DIFF_DETECT_RENAME;
+	diff_opts.rename_limit = key.rename_limit;
+	diff_opts.rename_score = key.rename_score;
+	diff_opts.show_rename_progress = opt->show_rename_progress;
+	diff_opts.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&diff_opts);
+	diff_tree_oid(&base->object.oid, &side->object.oid, "", &diff_opts);
+	diffcore_std(&diff_opts);
+	if (diff_opts.needed_rename_limit > opt->needed_rename_limit)
+		opt->needed_rename_limit = diff_opts.needed_rename_limit;
+
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *pair = diff_queued_diff.queue[i];
+		struct rename *r;
+
+		if (pair->status != 'R')
+			continue;
+		ALLOC_GROW(e->renames, e->nr + 1, alloc);
+		r = &e->renames[e->nr++];
+		r->old_path = xstrdup(pair->one->path);
+		r->new_path = xstrdup(pair->two->path);
+		set_version(&r->old, &pair->one->oid, pair->one->mode);
+	}
+	QSORT(e->renames, e->nr, rename_cmp);
+	diff_flush(&diff_opts);
+	return e;
+}
+
+static struct rename *find_rename(struct rename_cache_entry *renames,
+				  const char *old_path)
+{
+	struct rename key;
+
+	if (!renames->nr)
+		return NULL;
+	key.old_path = (char *)old_path;
+	return bsearch(&key, renames->renames, renames->nr,
+		       sizeof(key), rename_cmp);
+}
+
+static int merge_blobs(struct merge_state *state, const char *path,
+		       const struct version_info *o,
+		       const struct version_info *a,
+		       const struct version_info *b,
+		       const char *pathnames[3],
+		       struct version_info *result);
+
+static const char *branch_name(struct merge_options *opt, int side)
+{
+	return side == 1 ? opt->branch1 : opt->branch2;
+}
+
+/*
+ * Move the versions of a renamed file to its new path, so that the
+ * changes made on the other side to the old path follow it.
+ */
+static int apply_rename(struct merge_state *state, int side,
+			struct rename *r, struct rename_cache_entry *other)
+{
+	struct merge_options *opt = state->opt;
+	int other_side = 3 - side;
+	struct merge_entry *src = find_entry(state, r->old_path);
+	struct merge_entry *dst = find_entry(state, r->new_path);
+	struct rename *r2 = find_rename(other, r->old_path);
+
+	if (!dst || dst->processed)
+		return 0;
+
+	if (r2 && !strcmp(r2->new_path, r->new_path)) {
+		/* renamed the same way on both sides */
+		dst->stages[0] = r->old;
+		dst->pathnames[0] = r->old_path;
+	} else if (r2) {
+		struct merge_entry *dst2 = find_entry(state, r2->new_path);
+		struct version_info merged;
+		const char *pathnames[3];
+
+		if (!dst2)
+			return 0;
+		output(opt, 1, _("CONFLICT (rename/rename): "
+				 "Rename \"%s\"->\"%s\" in branch \"%s\" "
+				 "rename \"%s\"->\"%s\" in \"%s\"%s"),
+		       r->old_path, r->new_path, branch_name(opt, side),
+		       r2->old_path, r2->new_path,
+		       branch_name(opt, other_side),
+		       opt->call_depth ? _(" (left unresolved)") : "");
+
+		pathnames[0] = r->old_path;
+		pathnames[side] = r->new_path;
+		pathnames[other_side] = r2->new_path;
+		if (S_ISREG(dst->stages[side].mode) &&
+		    S_ISREG(dst2->stages[other_side].mode)) {
+			const struct version_info *a = &dst->stages[side];
+			const struct version_info *b = &dst2->stages[other_side];
+			if (side == 2)
+				SWAP(a, b);
+			if (merge_blobs(state, r->new_path, &r->old, a, b,
+					pathnames, &merged) < 0)
+				return -1;
+		} else {
+			merged = dst->stages[side];
+		}
+
+		dst->stages[0] = r->old;
+		dst2->stages[0] = r->old;
+		mark_conflict(state, dst);
+		mark_conflict(state, dst2);
+		dst->result = merged;
+		dst2->result = merged;
+		dst->processed = dst2->processed = 1;
+	} else if (!src || !src->stages[other_side].mode) {
+		output(opt, 1, _("CONFLICT (rename/delete): %s deleted in %s "
+				 "and renamed to %s in %s. Version %s of %s "
+				 "left in tree."),
+		       r->old_path, branch_name(opt, other_side),
+		       r->new_path, branch_name(opt, side),
+		       branch_name(opt, side), r->new_path);
+		/* like a modify/delete, minus the base at the new path */
+		mark_conflict(state, dst);
+		dst->result = opt->call_depth ? r->old : dst->stages[side];
+		dst->processed = 1;
+	} else if (dst->stages[other_side].mode) {
+		/*
+		 * The other side added a file of its own there: merge
+		 * the changes to the renamed file first, then treat
+		 * the two as an add/add conflict.
+		 */
+		struct version_info renamed = dst->stages[side], merged;
+		const char *pathnames[3];
+		struct version_info none;
+
+		pathnames[0] = pathnames[other_side] = r->old_path;
+		pathnames[side] = r->new_path;
+		if (S_ISREG(renamed.mode) &&
+		    S_ISREG(src->stages[other_side].mode)) {
+			const struct version_info *a = &renamed;
+			const struct version_info *b = &src->stages[other_side];
+			if (side == 2)
+				SWAP(a, b);
+			if (merge_blobs(state, r->new_path, &r->old, a, b,
+					pathnames, &renamed) < 0)
+				return -1;
+		}
+
+		if (same_version(&renamed, &dst->stages[other_side])) {
+			/* both ended up with the same file there */
+			dst->result = renamed;
+			dst->processed = 1;
+			clear_version(&src->stages[other_side]);
+			goto done;
+		}
+
+		output(opt, 1, _("CONFLICT (rename/add): Rename %s->%s in %s. "
+				 "%s added in %s"),
+		       r->old_path, r->new_path, branch_name(opt, side),
+		       r->new_path, branch_name(opt, other_side));
+		clear_version(&none);
+		pathnames[0] = pathnames[1] = pathnames[2] = r->new_path;
+		merged = renamed;
+		if (S_ISREG(renamed.mode) &&
+		    S_ISREG(dst->stages[other_side].mode)) {
+			const struct version_info *a = &renamed;
+			const struct version_info *b = &dst->stages[other_side];
+			if (side == 2)
+				SWAP(a, b);
+			if (merge_blobs(state, r->new_path, &none, a, b,
+					pathnames, &merged) < 0)
+				return -1;
+		}
+		mark_conflict(state, dst);
+		dst->result = merged;
+		dst->processed = 1;
+		clear_version(&src->stages[other_side]);
+	} else {
+		dst->stages[0] = r->old;
+		dst->stages[other_side] = src->stages[other_side];
+		dst->pathnames[0] = dst->pathnames[other_side] = r->old_path;
+		clear_version(&src->stages[other_side]);
+	}
+
+done:
+	/* the content of the old path has moved away */
+	if (src)
+		clear_version(&src->stages[0]);
+	return 0;
+}
+
+static int detect_and_apply_renames(struct merge_state *state,
+				    struct tree *merge_base,
+				    struct tree *side1,
+				    struct tree *side2)
+{
+	struct rename_cache_entry *renames1, *renames2;
+	int i;
+
+	/* make room for both sides before looking either up */
+	if (rename_cache.tablesize &&
+	    hashmap_get_size(&rename_cache) + 2 > RENAME_CACHE_MAX)
+		free_rename_cache();
+	if (!rename_cache.tablesize)
+		hashmap_init(&rename_cache, rename_cache_cmp, NULL, 0);
+
+	renames1 = get_renames(state->opt, merge_base, side1);
+	renames2 = get_renames(state->opt, merge_base, side2);
+
+	for (i = 0; i < renames1->nr; i++)
+		if (apply_rename(state, 1, &renames1->renames[i], renames2))
+			return -1;
+	for (i = 0; i < renames2->nr; i++) {
+		struct rename *r = &renames2->renames[i];
+		/* both sides renamed it: done above */
+		if (find_rename(renames1, r->old_path))
+			continue;
+		if (apply_rename(state, 2, r, renames1))
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Resolving the paths
+ */
+
+/* Returns 1 if clean, 0 if conflicted and -1 on error. */
+static int merge_blobs(struct merge_state *state, const char *path,
+		       const struct version_info *o,
+		       const struct version_info *a,
+		       const struct version_info *b,
+		       const char *pathnames[3],
+		       struct version_info *result)
+{
+	struct merge_options *opt = state->opt;
+	struct ll_merge_options ll_opts = { 0 };
+	mmfile_t orig, src1, src2;
+	mmbuffer_t result_buf;
+	char *base_name, *name1, *name2;
+	int merge_status, clean = 1;
+
+	ll_opts.renormalize = opt->renormalize;
+	ll_opts.xdl_opts = opt->xdl_opts;
+	if (opt->call_depth) {
+		ll_opts.virtual_ancestor = 1;
+	} else if (opt->recursive_variant == MERGE_RECURSIVE_OURS) {
+		ll_opts.variant = XDL_MERGE_FAVOR_OURS;
+	} else if (opt->recursive_variant == MERGE_RECURSIVE_THEIRS) {
+		ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
+	}
+
+	if (strcmp(pathnames[1], pathnames[2]) ||
+	    strcmp(pathnames[0], pathnames[1])) {
+		base_name = opt->ancestor == NULL ? NULL :
+			mkpathdup("%s:%s", opt->ancestor, pathnames[0]);
+		name1 = mkpathdup("%s:%s", opt->branch1, pathnames[1]);
+		name2 = mkpathdup("%s:%s", opt->branch2, pathnames[2]);
+	} else {
+		base_name = opt->ancestor == NULL ? NULL :
+			mkpathdup("%s", opt->ancestor);
+		name1 = mkpathdup("%s", opt->branch1);
+		name2 = mkpathdup("%s", opt->branch2);
+	}
+
+	read_mmblob(&orig, S_ISREG(o->mode) ? &o->oid : &null_oid);
+	read_mmblob(&src1, &a->oid);
+	read_mmblob(&src2, &b->oid);
+
+	merge_status = ll_merge(&result_buf, path, &orig, base_name,
+				&src1, name1, &src2, name2,
+				&state->attr_index, &ll_opts);
+
+	free(base_name);
+	free(name1);
+	free(name2);
+	free(orig.ptr);
+	free(src1.ptr);
+	free(src2.ptr);
+
+	if (merge_status < 0)
+		return error(_("failed to execute internal merge"));
+	if (merge_status > 0)
+		clean = 0;
+	if (write_object_file(result_buf.ptr, result_buf.size, blob_type,
+			      &result->oid)) {
+		free(result_buf.ptr);
+		return error(_("unable to add %s to database"), path);
+	}
+	free(result_buf.ptr);
+
+	if (a->mode == b->mode || a->mode == o->mode) {
+		result->mode = b->mode;
+	} else if (b->mode == o->mode) {
+		result->mode = a->mode;
+	} else {
+		result->mode = a->mode;
+		clean = 0;
+	}
+	return clean;
+}
+
+/*
+ * Whether 'a' differs from 'o' only by its line endings, with
+ * merge.renormalize set.
+ */
+static int blob_unchanged_but_normalized(struct merge_state *state,
+					 const char *path,
+					 const struct version_info *o,
+					 const struct version_info *a)
+{
+	struct strbuf obuf = STRBUF_INIT, abuf = STRBUF_INIT;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+	int ret = 0;
+
+	if (!state->opt->renormalize || o->mode != a->mode ||
+	    !S_ISREG(o->mode))
+		return 0;
+
+	buf = read_object_file(&o->oid, &type, &size);
+	if (!buf)
+		return 0;
+	strbuf_attach(&obuf, buf, size, size + 1);
+	buf = read_object_file(&a->oid, &type, &size);
+	if (!buf)
+		goto out;
+	strbuf_attach(&abuf, buf, size, size + 1);
+
+	/* binary | so that both sides are renormalized */
+	if (renormalize_buffer(&state->attr_index, path,
+			       obuf.buf, obuf.len, &obuf) |
+	    renormalize_buffer(&state->attr_index, path,
+			       abuf.buf, abuf.len, &abuf))
+		ret = obuf.len == abuf.len &&
+		      !memcmp(obuf.buf, abuf.buf, obuf.len);
+out:
+	strbuf_release(&obuf);
+	strbuf_release(&abuf);
+	return ret;
+}
+
+static int process_entry(struct merge_state *state, struct merge_entry *e)
+{
+	struct merge_options *opt = state->opt;
+	struct version_info *o = &e->stages[0];
+	struct version_info *a = &e->stages[1];
+	struct version_info *b = &e->stages[2];
+	int clean;
+
+	if (same_version(a, b)) {
+		e->result = *a;
+		return 0;
+	}
+	if (same_version(o, a)) {
+		e->result = *b;
+		return 0;
+	}
+	if (same_version(o, b)) {
+		e->result = *a;
+		return 0;
+	}
+
+	if (!a->mode || !b->mode) {
+		int side = a->mode ? 1 : 2;
+
+		if (blob_unchanged_but_normalized(state, e->path, o,
+						  &e->stages[side])) {
+			clear_version(&e->result);
+			return 0;
+		}
+
+		output(opt, 1, _("CONFLICT (modify/delete): %s deleted in %s "
+				 "and modified in %s. Version %s of %s left "
+				 "in tree."),
+		       e->path, branch_name(opt, 3 - side),
+		       branch_name(opt, side), branch_name(opt, side),
+		       e->path);
+		mark_conflict(state, e);
+		/* a virtual ancestor keeps the original version */
+		e->result = opt->call_depth ? *o : e->stages[side];
+		return 0;
+	}
+
+	if (S_ISREG(a->mode) && S_ISREG(b->mode)) {
+		output(opt, 2, _("Auto-merging %s"), e->path);
+		clean = merge_blobs(state, e->path, o, a, b, e->pathnames,
+				    &e->result);
+		if (clean < 0)
+			return -1;
+		if (clean && same_version(&e->result, a))
+			output(opt, 3, _("Skipped %s (merged same as existing)"),
+			       e->path);
+		if (!clean) {
+			output(opt, 1, _("CONFLICT (%s): Merge conflict in %s"),
+			       o->mode ? _("content") : _("add/add"), e->path);
+			mark_conflict(state, e);
+		}
+		return 0;
+	}
+
+	if (S_ISLNK(a->mode) && S_ISLNK(b->mode) && !opt->call_depth &&
+	    opt->recursive_variant != MERGE_RECURSIVE_NORMAL) {
+		e->result = opt->recursive_variant == MERGE_RECURSIVE_OURS ?
+			    *a : *b;
+		return 0;
+	}
+
+	/* symlinks, submodules, or a change of type on both sides */
+	output(opt, 1, _("CONFLICT (%s): Merge conflict in %s"),
+	       S_ISGITLINK(a->mode) || S_ISGITLINK(b->mode) ?
+	       _("submodule") : _("content"), e->path);
+	mark_conflict(state, e);
+	e->result = opt->call_depth && o->mode ? *o : *a;
+	return 0;
+}
+
+/*
+ * The attributes used to merge the contents, e.g. to pick a merge
+ * driver or to renormalize, are those of the merged .gitattributes and
+ * not those of the working tree, which may not even exist. Resolve it
+ * first and put it alone in an index to read the attributes from.
+ */
+static int init_attr_index(struct merge_state *state, struct tree *side1)
+{
+	struct merge_entry *e = find_entry(state, GITATTRIBUTES_FILE);
+	struct version_info v = { { { 0 } } };
+	struct cache_entry *ce;
+
+	if (e && !e->is_tree) {
+		if (!e->processed && process_entry(state, e) < 0)
+			return -1;
+		e->processed = 1;
+		v = e->result;
+	} else if (!e) {
+		unsigned mode;
+
+		if (!get_tree_entry(&side1->object.oid, GITATTRIBUTES_FILE,
+				    &v.oid, &mode))
+			v.mode = mode;
+	}
+
+	state->attr_index.initialized = 1;
+	if (!S_ISREG(v.mode))
+		return 0;
+	ce = make_cache_entry(&state->attr_index, v.mode, &v.oid,
+			      GITATTRIBUTES_FILE, 0, 0);
+	if (!ce)
+		return -1;
+	return add_index_entry(&state->attr_index, ce, ADD_CACHE_OK_TO_ADD);
+}
+
+static char *unique_path(struct hashmap *taken, const char *path,
+			 const char *branch)
+{
+	struct strbuf newpath = STRBUF_INIT;
+	size_t base_len;
+	int suffix = 0;
+
+	strbuf_addf(&newpath, "%s~", path);
+	base_len = newpath.len;
+	strbuf_addstr(&newpath, branch);
+	for (; base_len < newpath.len; base_len++)
+		if (newpath.buf[base_len] == '/')
+			newpath.buf[base_len] = '_';
+
+	base_len = newpath.len;
+	while (hashmap_get_from_hash(taken, strhash(newpath.buf), newpath.buf)) {
+		strbuf_setlen(&newpath, base_len);
+		strbuf_addf(&newpath, "_%d", suffix++);
+	}
+	return strbuf_detach(&newpath, NULL);
+}
+
+struct path_entry {
+	struct hashmap_entry ent;
+	char path[FLEX_ARRAY];
+};
+
+static int path_entry_cmp(const void *unused_cmp_data,
+			  const void *entry, const void *entry_or_key,
+			  const void *keydata)
+{
+	const struct path_entry *a = entry, *b = entry_or_key;
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static void add_path(struct hashmap *map, const char *path, size_t len)
+{
+	struct path_entry *p;
+	unsigned int hash = memhash(path, len);
+
+	FLEX_ALLOC_MEM(p, path, path, len);
+	if (hashmap_get_from_hash(map, hash, p->path)) {
+		free(p);
+		return;
+	}
+	hashmap_entry_init(p, hash);
+	hashmap_add(map, p);
+}
+
+/*
+ * A file that is left in the result where the result also has a
+ * directory is moved aside, as merge-recursive does.
+ */
+static void resolve_df_conflicts(struct merge_state *state)
+{
+	struct merge_options *opt = state->opt;
+	struct hashmap dirs, files;
+	int i;
+
+	hashmap_init(&dirs, path_entry_cmp, NULL, 0);
+	hashmap_init(&files, path_entry_cmp, NULL, 0);
+	for (i = 0; i < state->nr; i++) {
+		struct merge_entry *e = state->entries[i];
+		const char *slash;
+
+		if (!e->result.mode)
+			continue;
+		add_path(&files, e->path, strlen(e->path));
+		for (slash = strchr(e->path, '/'); slash;
+		     slash = strchr(slash + 1, '/'))
+			add_path(&dirs, e->path, slash - e->path);
+		if (e->is_tree)
+			add_path(&dirs, e->path, strlen(e->path));
+	}
+
+	for (i = 0; i < state->nr; i++) {
+		struct merge_entry *e = state->entries[i];
+		int side;
+
+		if (!e->result.mode || e->is_tree ||
+		    !hashmap_get_from_hash(&dirs, strhash(e->path), e->path))
+			continue;
+
+		side = same_version(&e->result, &e->stages[2]) &&
+		       !same_version(&e->result, &e->stages[1]) ? 2 : 1;
+		e->moved_to = unique_path(&files, e->path,
+					  branch_name(opt, side));
+		add_path(&files, e->moved_to, strlen(e->moved_to));
+		output(opt, 1, _("CONFLICT (file/directory): There is a "
+				 "directory with name %s in %s. Adding %s as %s"),
+		       e->path, branch_name(opt, 3 - side), e->path,
+		       e->moved_to);
+		mark_conflict(state, e);
+	}
+
+	hashmap_free(&dirs, 1);
+	hashmap_free(&files, 1);
+}
+
+/*
+ * Writing the result
+ */
+
+struct result_entry {
+	/* the path, with a trailing slash for subtrees taken as is */
+	char *key;
+	struct version_info v;
+};
+
+static int result_entry_cmp(const void *a_, const void *b_)
+{
+	const struct result_entry *a = a_, *b = b_;
+	return strcmp(a->key, b->key);
+}
+
+/*
+ * Sorting the full paths, with a slash after the names of subtrees,
+ * puts the entries of each tree in the order of base_name_compare().
+ */
+static void write_tree(struct result_entry *entries, int nr, int *pos,
+		       const char *prefix, size_t prefix_len,
+		       struct object_id *oid)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	while (*pos < nr && !strncmp(entries[*pos].key, prefix, prefix_len)) {
+		struct result_entry *e = &entries[*pos];
+		const char *name = e->key + prefix_len;
+		const char *slash = strchr(name, '/');
+
+		if (slash && slash[1]) {
+			struct object_id subtree;
+			char *subprefix = xmemdupz(e->key, slash + 1 - e->key);
+
+			write_tree(entries, nr, pos, subprefix,
+				   slash + 1 - e->key, &subtree);
+			free(subprefix);
+			strbuf_addf(&buf, "%o %.*s%c", S_IFDIR,
+				    (int)(slash - name), name, '\0');
+			strbuf_add(&buf, subtree.hash, the_hash_algo->rawsz);
+			continue;
+		}
+
+		strbuf_addf(&buf, "%o %.*s%c", e->v.mode,
+			    slash ? (int)(slash - name) : (int)strlen(name),
+			    name, '\0');
+		strbuf_add(&buf, e->v.oid.hash, the_hash_algo->rawsz);
+		(*pos)++;
+	}
+
+	if (write_object_file(buf.buf, buf.len, tree_type, oid))
+		die(_("unable to write tree object"));
+	strbuf_release(&buf);
+}
+
+static struct tree *write_result_tree(struct merge_state *state)
+{
+	struct result_entry *entries;
+	struct object_id oid;
+	int i, nr = 0, pos = 0;
+
+	ALLOC_ARRAY(entries, state->nr);
+	for (i = 0; i < state->nr; i++) {
+		struct merge_entry *e = state->entries[i];
+
+		if (!e->result.mode)
+			continue;
+		if (e->is_tree)
+			entries[nr].key = xstrfmt("%s/", e->path);
+		else
+			entries[nr].key = xstrdup(e->moved_to ? e->moved_to
+							      : e->path);
+		entries[nr++].v = e->result;
+	}
+	QSORT(entries, nr, result_entry_cmp);
+	write_tree(entries, nr, &pos, "", 0, &oid);
+
+	for (i = 0; i < nr; i++)
+		free(entries[i].key);
+	free(entries);
+	return lookup_tree(the_repository, &oid);
+}
+
+static int merge_entry_path_cmp(const void *a_, const void *b_)
+{
+	const struct merge_entry *a = *(const struct merge_entry **)a_;
+	const struct merge_entry *b = *(const struct merge_entry **)b_;
+	return strcmp(a->path, b->path);
+}
+
+static void record_conflicts(struct merge_state *state,
+			     struct merge_result *result)
+{
+	int i, j;
+
+	for (i = 0; i < state->nr; i++) {
+		struct merge_entry *e = state->entries[i];
+		struct merge_conflict *c;
+
+		if (!e->conflicted)
+			continue;
+		c = xcalloc(1, sizeof(*c));
+		for (j = 0; j < 3; j++) {
+			oidcpy(&c->stages[j].oid, &e->conflict_stages[j].oid);
+			c->stages[j].mode = e->conflict_stages[j].mode;
+		}
+		c->moved_to = e->moved_to;
+		e->moved_to = NULL;
+		string_list_append(&result->conflicts, e->path)->util = c;
+	}
+}
+
+void merge_incore_nonrecursive(struct merge_options *opt,
+			       struct tree *merge_base,
+			       struct tree *side1,
+			       struct tree *side2,
+			       struct merge_result *result)
+{
+	struct merge_state state;
+	int i;
+
+	memset(result, 0, sizeof(*result));
+	string_list_init(&result->conflicts, 1);
+
+	if (opt->subtree_shift)
+		BUG("merge-ort does not shift subtrees");
+
+	if (oideq(&merge_base->object.oid, &side2->object.oid)) {
+		output(opt, 0, _("Already up to date!"));
+		result->tree = side1;
+		result->clean = 1;
+		return;
+	}
+
+	trace_performance_enter();
+	memset(&state, 0, sizeof(state));
+	state.opt = opt;
+	hashmap_init(&state.paths, merge_entry_cmp, NULL, 0);
+
+	if (collect_merge_info(&state, merge_base, side1, side2) < 0) {
+		error(_("collecting merge info failed for trees %s, %s, %s"),
+		      oid_to_hex(&merge_base->object.oid),
+		      oid_to_hex(&side1->object.oid),
+		      oid_to_hex(&side2->object.oid));
+		result->clean = -1;
+		goto cleanup;
+	}
+
+	/* renames merge contents, too: they need the attributes */
+	git_attr_set_direction(GIT_ATTR_INDEX);
+	if (init_attr_index(&state, side1) < 0) {
+		result->clean = -1;
+		goto cleanup;
+	}
+
+	if (detect_and_apply_renames(&state, merge_base, side1, side2)) {
+		result->clean = -1;
+		goto cleanup;
+	}
+
+	/* in the order of the paths, for the messages */
+	QSORT(state.entries, state.nr, merge_entry_path_cmp);
+	for (i = 0; i < state.nr; i++) {
+		struct merge_entry *e = state.entries[i];
+
+		if (e->is_tree || e->processed)
+			continue;
+		if (process_entry(&state, e) < 0) {
+			result->clean = -1;
+			goto cleanup;
+		}
+	}
+	resolve_df_conflicts(&state);
+
+	result->tree = write_result_tree(&state);
+	record_conflicts(&state, result);
+	result->clean = !state.conflicts;
+
+cleanup:
+	for (i = 0; i < state.nr; i++)
+		free(state.entries[i]->moved_to);
+	free(state.entries);
+	hashmap_free(&state.paths, 1);
+	discard_index(&state.attr_index);
+	if (!is_bare_repository())
+		git_attr_set_direction(GIT_ATTR_CHECKIN);
+	trace_performance_leave("merge-ort: %d paths", state.nr);
+}
+
+static struct commit *make_virtual_commit(struct tree *tree, const char *comment)
+{
+	struct commit *commit = alloc_commit_node(the_repository);
+
+	set_merge_remote_desc(commit, comment, (struct object *)commit);
+	commit->maybe_tree = tree;
+	commit->object.parsed = 1;
+	return commit;
+}
+
+static struct commit_list *reverse_commit_list(struct commit_list *list)
+{
+	struct commit_list *next = NULL, *current, *backup;
+	for (current = list; current; current = backup) {
+		backup = current->next;
+		current->next = next;
+		next = current;
+	}
+	return next;
+}
+
+void merge_incore_recursive(struct merge_options *opt,
+			    struct commit_list *merge_bases,
+			    struct commit *side1,
+			    struct commit *side2,
+			    struct merge_result *result)
+{
+	struct commit_list *iter;
+	struct commit *ancestor;
+
+	if (!merge_bases) {
+		merge_bases = get_merge_bases(side1, side2);
+		merge_bases = reverse_commit_list(merge_bases);
+	}
+
+	ancestor = pop_commit(&merge_bases);
+	if (!ancestor) {
+		/* if there is no common ancestor, use an empty tree */
+		struct tree *tree;
+
+		tree = lookup_tree(the_repository,
+				   the_repository->hash_algo->empty_tree);
+		ancestor = make_virtual_commit(tree, "ancestor");
+	}
+
+	for (iter = merge_bases; iter; iter = iter->next) {
+		const char *saved_b1 = opt->branch1, *saved_b2 = opt->branch2;
+		struct merge_result inner;
+		struct commit *prev = ancestor;
+
+		/*
+		 * The conflicts of the virtual ancestor stay in it, with
+		 * their conflict markers.
+		 */
+		opt->call_depth++;
+		opt->branch1 = "Temporary merge branch 1";
+		opt->branch2 = "Temporary merge branch 2";
+		merge_incore_recursive(opt, NULL, prev, iter->item, &inner);
+		opt->branch1 = saved_b1;
+		opt->branch2 = saved_b2;
+		opt->call_depth--;
+
+		if (inner.clean < 0) {
+			merge_finalize(opt, &inner);
+			memset(result, 0, sizeof(*result));
+			string_list_init(&result->conflicts, 1);
+			result->clean = -1;
+			return;
+		}
+		ancestor = make_virtual_commit(inner.tree, "merged tree");
+		commit_list_insert(prev, &ancestor->parents);
+		commit_list_insert(iter->item, &ancestor->parents->next);
+		merge_finalize(opt, &inner);
+	}
+
+	opt->ancestor = "merged common ancestors";
+	merge_incore_nonrecursive(opt, get_commit_tree(ancestor),
+				  get_commit_tree(side1),
+				  get_commit_tree(side2), result);
+}
+
+/*
+ * Switching to the result
+ */
+
+static int checkout(struct merge_options *opt, struct tree *prev,
+		    struct tree *next)
+{
+	struct unpack_trees_options unpack_opts;
+	struct tree_desc trees[2];
+	struct dir_struct dir;
+	int ret;
+
+	memset(&unpack_opts, 0, sizeof(unpack_opts));
+	unpack_opts.head_idx = -1;
+	unpack_opts.src_index = &the_index;
+	unpack_opts.dst_index = &the_index;
+	setup_unpack_trees_porcelain(&unpack_opts, "merge");
+	unpack_opts.initial_checkout = is_index_unborn(&the_index);
+	unpack_opts.update = 1;
+	unpack_opts.merge = 1;
+	unpack_opts.verbose_update = (opt->verbosity > 2);
+	unpack_opts.fn = twoway_merge;
+
+	/* ignored files in the way are overwritten, as by merge-recursive */
+	memset(&dir, 0, sizeof(dir));
+	dir.flags |= DIR_SHOW_IGNORED;
+	setup_standard_excludes(&dir);
+	unpack_opts.dir = &dir;
+
+	if (parse_tree(prev) < 0 || parse_tree(next) < 0)
+		return -1;
+	init_tree_desc(&trees[0], prev->buffer, prev->size);
+	init_tree_desc(&trees[1], next->buffer, next->size);
+
+	ret = unpack_trees(2, trees, &unpack_opts);
+	clear_unpack_trees_porcelain(&unpack_opts);
+	clear_directory(&dir);
+	return ret;
+}
+
+static int record_conflicted_index_entries(struct merge_options *opt,
+					   struct merge_result *result)
+{
+	struct string_list_item *item;
+	int i;
+
+	for_each_string_list_item(item, &result->conflicts) {
+		struct merge_conflict *c = item->util;
+
+		/*
+		 * The working tree keeps the file with the conflict
+		 * markers, or the one put aside; the index gets the
+		 * versions of each side instead.
+		 */
+		remove_file_from_index(&the_index,
+				       c->moved_to ? c->moved_to : item->string);
+		for (i = 0; i < 3; i++) {
+			struct cache_entry *ce;
+
+			if (!c->stages[i].mode)
+				continue;
+			ce = make_cache_entry(&the_index, c->stages[i].mode,
+					      &c->stages[i].oid, item->string,
+					      i + 1, 0);
+			if (!ce || add_index_entry(&the_index, ce,
+						   ADD_CACHE_OK_TO_ADD |
+						   ADD_CACHE_OK_TO_REPLACE))
+				return error(_("unable to record the conflict "
+					       "of '%s' in the index"),
+					     item->string);
+		}
+	}
+	return 0;
+}
+
+int merge_switch_to_result(struct merge_options *opt,
+			   struct tree *head,
+			   struct merge_result *result,
+			   int update_worktree_and_index,
+			   int display_update_msgs)
+{
+	int ret = 0;
+
+	if (result->clean >= 0 && update_worktree_and_index) {
+		if (checkout(opt, head, result->tree) ||
+		    record_conflicted_index_entries(opt, result)) {
+			result->clean = -1;
+			ret = -1;
+		}
+	}
+
+	if (display_update_msgs)
+		flush_output(opt);
+	return ret;
+}
+
+void merge_finalize(struct merge_options *opt, struct merge_result *result)
+{
+	struct string_list_item *item;
+
+	for_each_string_list_item(item, &result->conflicts) {
+		struct merge_conflict *c = item->util;
+		free(c->moved_to);
+	}
+	string_list_clear(&result->conflicts, 1);
+}
+
+int merge_ort_by_default(void)
+{
+	const char *algo = getenv("GIT_TEST_MERGE_ALGORITHM");
+	return algo && !strcmp(algo, "ort");
+}
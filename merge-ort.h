@@ -0,0 +1,97 @@
+#ifndef MERGE_ORT_H
+#define MERGE_ORT_H
+
+#include "merge-recursive.h"
+
+struct commit;
+struct tree;
+
+/*
+ * merge-ort merges trees entirely in memory: it reads the trees and
+ * writes the merged blobs and trees to the object store, but leaves
+ * the index and the working tree alone until merge_switch_to_result()
+ * is called. It takes the same merge_options as merge-recursive, minus
+ * subtree shifting and directory rename detection.
+ */
+
+struct merge_result {
+	/*
+	 * 1 if the merge is clean, 0 if there were conflicts, or a
+	 * negative value if the merge could not be done at all.
+	 */
+	int clean;
+
+	/*
+	 * The merged tree, with conflict markers in the files whose
+	 * contents could not be merged.
+	 */
+	struct tree *tree;
+
+	/*
+	 * The conflicted paths, sorted; the util of each item is a
+	 * struct merge_conflict.
+	 */
+	struct string_list conflicts;
+};
+
+struct merge_conflict {
+	/*
+	 * The versions of the path in the merge base and on each side,
+	 * as they should appear in stages 1, 2 and 3 of the index. A mode
+	 * of 0 means that there is no such version.
+	 */
+	struct {
+		struct object_id oid;
+		unsigned short mode;
+	} stages[3];
+
+	/* where the file was put aside because of a directory, or NULL */
+	char *moved_to;
+};
+
+/*
+ * Merge side1 and side2, whose common ancestor is merge_base, without
+ * recursion. The labels of the sides and of the ancestor are taken
+ * from opt->branch1, opt->branch2 and opt->ancestor.
+ */
+void merge_incore_nonrecursive(struct merge_options *opt,
+			       struct tree *merge_base,
+			       struct tree *side1,
+			       struct tree *side2,
+			       struct merge_result *result);
+
+/*
+ * Merge the commits side1 and side2, first merging their merge bases
+ * into a virtual ancestor if there are several. merge_bases is in the
+ * order used by merge_recursive(); if NULL, it is computed.
+ */
+void merge_incore_recursive(struct merge_options *opt,
+			    struct commit_list *merge_bases,
+			    struct commit *side1,
+			    struct commit *side2,
+			    struct merge_result *result);
+
+/*
+ * Update the_index and the working tree from 'head', which they are
+ * expected to match, to the result of the merge, recording the
+ * conflicts in the higher stages of the index; then show the messages
+ * of the merge if asked to. The caller writes the index out. Returns
+ * 0 on success, or -1 (also setting result->clean) if the working tree
+ * could not be updated, e.g. because of local changes.
+ */
+int merge_switch_to_result(struct merge_options *opt,
+			   struct tree *head,
+			   struct merge_result *result,
+			   int update_worktree_and_index,
+			   int display_update_msgs);
+
+/* Free the data of the result, but not the tree. */
+void merge_finalize(struct merge_options *opt, struct merge_result *result);
+
+/*
+ * Whether the default merge strategy should use merge-ort instead of
+ * merge-recursive; only for the test suite, see GIT_TEST_MERGE_ALGORITHM.
+ */
+int merge_ort_by_default(void);
+
+#endif
@@ -8,6 +8,15 @@
 #include "sha1-lookup.h"
 #include "midx.h"
 #include "progress.h"
+#include "pack-bitmap.h"
+#include "pack-objects.h"
+#include "revision.h"
+#include "run-command.h"
+#include "string-list.h"
+#include "oidset.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "thread-utils.h"
 
 #define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
 #define MIDX_VERSION 1
@@ -33,6 +42,8 @@
 #define MIDX_CHUNK_LARGE_OFFSET_WIDTH (sizeof(uint64_t))
 #define MIDX_LARGE_OFFSET_NEEDED 0x80000000
 
+#define PACK_EXPIRED UINT_MAX
+
 static char *get_midx_filename(const char *object_dir)
 {
 	return xstrfmt("%s/pack/multi-pack-index", object_dir);
@@ -195,6 +206,8 @@ void close_midx(struct multi_pack_index *m)
 	}
 	FREE_AND_NULL(m->packs);
 	FREE_AND_NULL(m->pack_names);
+	FREE_AND_NULL(m->pack_order);
+	FREE_AND_NULL(m->pack_order_inv);
 }
 
 int prepare_midx_pack(struct multi_pack_index *m, uint32_t pack_int_id)
@@ -208,11 +221,15 @@ int prepare_midx_pack(struct multi_pack_index *m, uint32_t pack_int_id)
 	if (m->packs[pack_int_id])
 		return 0;
 
-	strbuf_addf(&pack_name, "%s/pack/%s", m->object_dir,
-		    m->pack_names[pack_int_id]);
-
-	m->packs[pack_int_id] = add_packed_git(pack_name.buf, pack_name.len, m->local);
-	strbuf_release(&pack_name);
+	pack_access_lock();
+	if (!m->packs[pack_int_id]) {
+		strbuf_addf(&pack_name, "%s/pack/%s", m->object_dir,
+			    m->pack_names[pack_int_id]);
+		m->packs[pack_int_id] = add_packed_git(pack_name.buf,
+						       pack_name.len, m->local);
+		strbuf_release(&pack_name);
+	}
+	pack_access_unlock();
 	return !m->packs[pack_int_id];
 }
 
@@ -233,7 +250,7 @@ struct object_id *nth_midxed_object_oid(struct object_id *oid,
 	return oid;
 }
 
-static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 {
 	const unsigned char *offset_data;
 	uint32_t offset32;
@@ -252,7 +269,7 @@ static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 	return offset32;
 }
 
-static uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
 {
 	return get_be32(m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH);
 }
@@ -330,6 +347,61 @@ int midx_contains_pack(struct multi_pack_index *m, const char *idx_name)
 	return 0;
 }
 
+struct midx_pack_order_data {
+	uint32_t nr;
+	uint32_t pack_int_id;
+	off_t offset;
+};
+
+static int midx_pack_order_cmp(const void *_a, const void *_b)
+{
+	const struct midx_pack_order_data *a = _a, *b = _b;
+
+	if (a->pack_int_id != b->pack_int_id)
+		return a->pack_int_id < b->pack_int_id ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return 0;
+}
+
+void load_midx_pack_order(struct multi_pack_index *m)
+{
+	struct midx_pack_order_data *data;
+	uint32_t i;
+
+	if (m->pack_order)
+		return;
+
+	ALLOC_ARRAY(data, m->num_objects);
+	for (i = 0; i < m->num_objects; i++) {
+		data[i].nr = i;
+		data[i].pack_int_id = nth_midxed_pack_int_id(m, i);
+		data[i].offset = nth_midxed_offset(m, i);
+	}
+
+	QSORT(data, m->num_objects, midx_pack_order_cmp);
+
+	ALLOC_ARRAY(m->pack_order, m->num_objects);
+	ALLOC_ARRAY(m->pack_order_inv, m->num_objects);
+	for (i = 0; i < m->num_objects; i++) {
+		m->pack_order[i] = data[i].nr;
+		m->pack_order_inv[data[i].nr] = i;
+	}
+
+	free(data);
+}
+
+const unsigned char *get_midx_checksum(struct multi_pack_index *m)
+{
+	return m->data + m->data_len - m->hash_len;
+}
+
+char *get_midx_bitmap_filename(struct multi_pack_index *m)
+{
+	return xstrfmt("%s/pack/multi-pack-index-%s.bitmap", m->object_dir,
+		       sha1_to_hex(get_midx_checksum(m)));
+}
+
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local)
 {
 	struct multi_pack_index *m;
@@ -353,7 +425,8 @@ int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, i
 
 	if (m) {
 		m->next = r->objects->multi_pack_index;
-		r->objects->multi_pack_index = m;
+		/* walked without a lock by find_pack_entry() */
+		store_release_ptr(&r->objects->multi_pack_index, m);
 		return 1;
 	}
 
@@ -560,6 +633,9 @@ static struct pack_midx_entry *get_sorted_entries(struct multi_pack_index *m,
 			end = ntohl(m->chunk_oid_fanout[cur_fanout]);
 
 			for (cur_object = start; cur_object < end; cur_object++) {
+				if (perm[nth_midxed_pack_int_id(m, cur_object)] == PACK_EXPIRED)
+					continue;
+
 				ALLOC_GROW(entries_by_fanout, nr_fanout + 1, alloc_fanout);
 				nth_midxed_pack_midx_entry(m, perm,
 							   &entries_by_fanout[nr_fanout],
@@ -747,7 +823,308 @@ static size_t write_midx_large_offsets(struct hashfile *f, uint32_t nr_large_off
 	return written;
 }
 
-int write_midx_file(const char *object_dir)
+struct clear_midx_bitmap_data {
+	const char *keep;
+};
+
+static void clear_midx_bitmap(const char *full_path, size_t full_path_len,
+			      const char *file_name, void *_data)
+{
+	struct clear_midx_bitmap_data *data = _data;
+
+	if (!starts_with(file_name, "multi-pack-index-") ||
+	    !ends_with(file_name, ".bitmap"))
+		return;
+	if (data->keep && !strcmp(data->keep, file_name))
+		return;
+
+	if (unlink(full_path))
+		die_errno(_("failed to remove %s"), full_path);
+}
+
+/*
+ * Remove the multi-pack bitmaps in 'object_dir' that do not belong to
+ * the multi-pack-index 'm' (all of them, if 'm' is NULL).
+ */
+static void clear_stale_midx_bitmaps(const char *object_dir,
+				     struct multi_pack_index *m)
+{
+	struct clear_midx_bitmap_data data = { NULL };
+	char *keep = NULL;
+
+	if (m) {
+		keep = get_midx_bitmap_filename(m);
+		data.keep = strrchr(keep, '/') + 1;
+	}
+
+	for_each_file_in_pack_dir(object_dir, clear_midx_bitmap, &data);
+
+	free(keep);
+}
+
+/*
+ * Write a reachability bitmap for the multi-pack-index 'm', covering the
+ * commits reachable from the refs of the repository. The bit positions
+ * are given by the pseudo-pack order of 'm', and the commit positions
+ * and name-hashes of the bitmap file refer to the (lexicographic) midx
+ * order, just like they refer to the .idx order of a single packfile.
+ */
+/*
+ * Queue the tips of the repository owning "object_dir" in "revs": ours,
+ * or the one whose "objects" directory it is, whose objects are then
+ * made available to us as an alternate.
+ */
+static int add_repository_tips(struct rev_info *revs, const char *object_dir)
+{
+	char *ours = real_pathdup(get_object_directory(), 1);
+	char *theirs = real_pathdup(object_dir, 1);
+	struct strbuf gitdir = STRBUF_INIT;
+	struct strbuf out = STRBUF_INIT;
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	const char *p;
+	int ret = 0;
+
+	if (!fspathcmp(ours, theirs)) {
+		const char *argv[] = { NULL, "--all", NULL };
+		setup_revisions(2, argv, revs, NULL);
+		goto out;
+	}
+
+	strbuf_addstr(&gitdir, theirs);
+	if (!strbuf_strip_suffix(&gitdir, "/objects") ||
+	    !is_git_directory(gitdir.buf)) {
+		ret = error(_("cannot find the repository owning '%s'"),
+			    object_dir);
+		goto out;
+	}
+	add_to_alternates_memory(theirs);
+
+	argv_array_pushv(&cmd.env_array, (const char **)local_repo_env);
+	argv_array_pushf(&cmd.args, "--git-dir=%s", gitdir.buf);
+	argv_array_pushl(&cmd.args, "rev-list", "--no-walk", "--all", NULL);
+	cmd.git_cmd = 1;
+	if (capture_command(&cmd, &out, GIT_MAX_HEXSZ + 1)) {
+		ret = error(_("could not list the refs of '%s'"), gitdir.buf);
+		goto out;
+	}
+
+	for (p = out.buf; *p; ) {
+		struct object_id oid;
+		struct object *o;
+
+		if (parse_oid_hex(p, &oid, &p) || *p++ != '\n') {
+			ret = error(_("unexpected rev-list output: %s"), p);
+			goto out;
+		}
+		o = parse_object(the_repository, &oid);
+		if (o)
+			add_pending_object(revs, o, "");
+	}
+
+out:
+	strbuf_release(&out);
+	strbuf_release(&gitdir);
+	free(theirs);
+	free(ours);
+	return ret;
+}
+
+/*
+ * Is everything reachable from "tree" in the multi-pack-index? The
+ * trees already checked are remembered in "closed" or "open".
+ */
+static int tree_in_midx(struct multi_pack_index *m, struct tree *tree,
+			struct oidset *closed, struct oidset *open)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	uint32_t pos;
+	int ret = 1;
+
+	if (oidset_contains(closed, &tree->object.oid))
+		return 1;
+	if (oidset_contains(open, &tree->object.oid))
+		return 0;
+
+	if (!bsearch_midx(&tree->object.oid, m, &pos) || parse_tree(tree)) {
+		oidset_insert(open, &tree->object.oid);
+		return 0;
+	}
+
+	init_tree_desc(&desc, tree->buffer, tree->size);
+	while (ret && tree_entry(&desc, &entry)) {
+		if (S_ISGITLINK(entry.mode))
+			continue;
+		if (S_ISDIR(entry.mode))
+			ret = tree_in_midx(m, lookup_tree(the_repository,
+							  entry.oid),
+					   closed, open);
+		else
+			ret = bsearch_midx(entry.oid, m, &pos);
+	}
+	free_tree_buffer(tree);
+
+	oidset_insert(ret ? closed : open, &tree->object.oid);
+	return ret;
+}
+
+static int write_midx_bitmap(const char *object_dir,
+			     struct multi_pack_index *m)
+{
+	struct packing_data pdata;
+	struct pack_idx_entry **index;
+	struct commit **walked = NULL, **commits = NULL;
+	uint32_t walked_nr = 0, walked_alloc = 0;
+	uint32_t commits_nr = 0, commits_alloc = 0;
+	struct oidset closed_trees, open_trees, closed_commits;
+	struct rev_info revs;
+	struct commit *c;
+	char *bitmap_name = get_midx_bitmap_filename(m);
+	uint32_t i;
+	int ret = 0;
+
+	if (file_exists(bitmap_name))
+		goto cleanup;
+
+	repo_init_revisions(the_repository, &revs, NULL);
+	revs.topo_order = 1;
+	if (add_repository_tips(&revs, object_dir)) {
+		ret = -1;
+		goto cleanup;
+	}
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+
+	while ((c = get_revision(&revs))) {
+		ALLOC_GROW(walked, walked_nr + 1, walked_alloc);
+		walked[walked_nr++] = c;
+	}
+
+	/*
+	 * A commit can only get a bitmap if all of the objects it
+	 * reaches are in the multi-pack-index, e.g. not if it or its
+	 * history was created after the last repack. Look at the
+	 * parents before their children to find those commits.
+	 */
+	oidset_init(&closed_trees, 0);
+	oidset_init(&open_trees, 0);
+	oidset_init(&closed_commits, 0);
+	for (i = walked_nr; i > 0; i--) {
+		struct commit_list *parent;
+		uint32_t pos;
+
+		c = walked[i - 1];
+		if (!bsearch_midx(&c->object.oid, m, &pos) ||
+		    !tree_in_midx(m, get_commit_tree(c),
+				  &closed_trees, &open_trees))
+			continue;
+		for (parent = c->parents; parent; parent = parent->next)
+			if (!oidset_contains(&closed_commits,
+					     &parent->item->object.oid))
+				break;
+		if (parent)
+			continue;
+
+		oidset_insert(&closed_commits, &c->object.oid);
+		ALLOC_GROW(commits, commits_nr + 1, commits_alloc);
+		commits[commits_nr++] = c;
+	}
+	oidset_clear(&closed_trees);
+	oidset_clear(&open_trees);
+	oidset_clear(&closed_commits);
+
+	if (!commits_nr) {
+		ret = error(_("cannot write a multi-pack bitmap: "
+			      "no reachable commit is in the multi-pack-index"));
+		goto cleanup;
+	}
+	if (commits_nr < walked_nr)
+		warning(Q_("%"PRIu32" reachable commit is not fully in the "
+			   "multi-pack-index and gets no bitmap",
+			   "%"PRIu32" reachable commits are not fully in the "
+			   "multi-pack-index and get no bitmap",
+			   walked_nr - commits_nr),
+			walked_nr - commits_nr);
+
+	load_midx_pack_order(m);
+
+	memset(&pdata, 0, sizeof(pdata));
+	prepare_packing_data(&pdata);
+	for (i = 0; i < m->num_objects; i++) {
+		struct object_id oid;
+		uint32_t index_pos;
+
+		nth_midxed_object_oid(&oid, m, m->pack_order[i]);
+		packlist_find(&pdata, oid.hash, &index_pos);
+		packlist_alloc(&pdata, oid.hash, index_pos);
+	}
+
+	ALLOC_ARRAY(index, pdata.nr_objects);
+	for (i = 0; i < pdata.nr_objects; i++)
+		index[i] = &pdata.objects[i].idx;
+
+	bitmap_writer_show_progress(0);
+	bitmap_writer_set_checksum((unsigned char *)get_midx_checksum(m));
+	bitmap_writer_build_type_index(&pdata, index, pdata.nr_objects);
+	bitmap_writer_reuse_bitmaps(&pdata);
+	bitmap_writer_select_commits(commits, commits_nr, -1);
+	bitmap_writer_build(&pdata);
+
+	for (i = 0; i < pdata.nr_objects; i++)
+		index[i] = &pdata.objects[m->pack_order_inv[i]].idx;
+	bitmap_writer_finish(index, pdata.nr_objects, bitmap_name, 0);
+
+	free(index);
+	free(pdata.objects);
+	free(pdata.index);
+	free(pdata.in_pack_pos);
+	free(pdata.in_pack_by_idx);
+	free(pdata.in_pack);
+
+cleanup:
+	free(commits);
+	free(walked);
+	free(bitmap_name);
+	return ret;
+}
+
+/*
+ * Drop the packs named in "packs_to_drop" from the sorted "pack_names",
+ * and fix up "pack_perm" so that it maps to the remaining packs (or to
+ * PACK_EXPIRED). Returns the number of remaining packs.
+ */
+static uint32_t drop_packs_from_list(struct pack_list *packs,
+				     uint32_t *pack_perm,
+				     struct string_list *packs_to_drop)
+{
+	uint32_t i, nr = 0;
+	uint32_t *new_id;
+
+	ALLOC_ARRAY(new_id, packs->nr);
+	for (i = 0; i < packs->nr; i++) {
+		if (string_list_has_string(packs_to_drop, packs->names[i])) {
+			new_id[i] = PACK_EXPIRED;
+			packs->pack_name_concat_len -= strlen(packs->names[i]) + 1;
+			FREE_AND_NULL(packs->names[i]);
+			continue;
+		}
+
+		new_id[i] = nr;
+		packs->names[nr++] = packs->names[i];
+	}
+	for (i = nr; i < packs->nr; i++)
+		packs->names[i] = NULL;
+
+	for (i = 0; i < packs->nr; i++)
+		pack_perm[i] = new_id[pack_perm[i]];
+
+	free(new_id);
+	return nr;
+}
+
+static int write_midx_internal(const char *object_dir,
+			       struct string_list *packs_to_drop,
+			       unsigned flags)
 {
 	unsigned char cur_chunk, num_chunks = 0;
 	char *midx_name;
@@ -756,12 +1133,14 @@ int write_midx_file(const char *object_dir)
 	struct lock_file lk;
 	struct pack_list packs;
 	uint32_t *pack_perm = NULL;
+	uint32_t num_packs;
 	uint64_t written = 0;
 	uint32_t chunk_ids[MIDX_MAX_CHUNKS + 1];
 	uint64_t chunk_offsets[MIDX_MAX_CHUNKS + 1];
 	uint32_t nr_entries, num_large_offsets = 0;
 	struct pack_midx_entry *entries = NULL;
 	int large_offsets_needed = 0;
+	int result = 0;
 
 	midx_name = get_midx_filename(object_dir);
 	if (safe_create_leading_directories(midx_name)) {
@@ -795,16 +1174,21 @@ int write_midx_file(const char *object_dir)
 
 	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &packs);
 
-	if (packs.m && packs.nr == packs.m->num_packs)
+	if (packs.m && packs.nr == packs.m->num_packs &&
+	    !(packs_to_drop && packs_to_drop->nr))
 		goto cleanup;
 
+	ALLOC_ARRAY(pack_perm, packs.nr);
+	sort_packs_by_name(packs.names, packs.nr, pack_perm);
+
+	num_packs = packs.nr;
+	if (packs_to_drop && packs_to_drop->nr)
+		num_packs = drop_packs_from_list(&packs, pack_perm, packs_to_drop);
+
 	if (packs.pack_name_concat_len % MIDX_CHUNK_ALIGNMENT)
 		packs.pack_name_concat_len += MIDX_CHUNK_ALIGNMENT -
 					      (packs.pack_name_concat_len % MIDX_CHUNK_ALIGNMENT);
 
-	ALLOC_ARRAY(pack_perm, packs.nr);
-	sort_packs_by_name(packs.names, packs.nr, pack_perm);
-
 	entries = get_sorted_entries(packs.m, packs.list, pack_perm, packs.nr, &nr_entries);
 
 	for (i = 0; i < nr_entries; i++) {
@@ -818,13 +1202,15 @@ int write_midx_file(const char *object_dir)
 	f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
 	FREE_AND_NULL(midx_name);
 
-	if (packs.m)
+	if (packs.m) {
 		close_midx(packs.m);
+		FREE_AND_NULL(packs.m);
+	}
 
 	cur_chunk = 0;
 	num_chunks = large_offsets_needed ? 5 : 4;
 
-	written = write_midx_header(f, num_chunks, packs.nr);
+	written = write_midx_header(f, num_chunks, num_packs);
 
 	chunk_ids[cur_chunk] = MIDX_CHUNKID_PACKNAMES;
 	chunk_offsets[cur_chunk] = written + (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
@@ -879,7 +1265,7 @@ int write_midx_file(const char *object_dir)
 
 		switch (chunk_ids[i]) {
 			case MIDX_CHUNKID_PACKNAMES:
-				written += write_midx_pack_names(f, packs.names, packs.nr);
+				written += write_midx_pack_names(f, packs.names, num_packs);
 				break;
 
 			case MIDX_CHUNKID_OIDFANOUT:
@@ -913,6 +1299,20 @@ int write_midx_file(const char *object_dir)
 	commit_lock_file(&lk);
 
 cleanup:
+	if (packs.m) {
+		close_midx(packs.m);
+		free(packs.m);
+	}
+
+	packs.m = load_multi_pack_index(object_dir, 1);
+	if (packs.m && (flags & MIDX_WRITE_BITMAP))
+		result = write_midx_bitmap(object_dir, packs.m);
+	clear_stale_midx_bitmaps(object_dir, packs.m);
+	if (packs.m) {
+		close_midx(packs.m);
+		free(packs.m);
+	}
+
 	for (i = 0; i < packs.nr; i++) {
 		if (packs.list[i]) {
 			close_pack(packs.list[i]);
@@ -926,9 +1326,219 @@ int write_midx_file(const char *object_dir)
 	free(entries);
 	free(pack_perm);
 	free(midx_name);
+	return result;
+}
+
+int write_midx_file(const char *object_dir, unsigned flags)
+{
+	return write_midx_internal(object_dir, NULL, flags);
+}
+
+int expire_midx_packs(const char *object_dir, unsigned flags)
+{
+	uint32_t i, *count;
+	struct string_list packs_to_drop = STRING_LIST_INIT_DUP;
+	struct string_list pack_paths = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+	int result = 0;
+
+	if (!m)
+		return 0;
+
+	count = xcalloc(m->num_packs, sizeof(uint32_t));
+	for (i = 0; i < m->num_objects; i++)
+		count[nth_midxed_pack_int_id(m, i)]++;
+
+	for (i = 0; i < m->num_packs; i++) {
+		if (count[i])
+			continue;
+		if (prepare_midx_pack(m, i))
+			continue;
+		if (m->packs[i]->pack_keep)
+			continue;
+
+		string_list_insert(&packs_to_drop, m->pack_names[i]);
+		string_list_append(&pack_paths, m->packs[i]->pack_name);
+	}
+
+	free(count);
+	close_midx(m);
+	free(m);
+
+	if (packs_to_drop.nr) {
+		/*
+		 * Write the multi-pack-index without the expired packs
+		 * first, so that it never names a pack that is gone.
+		 */
+		result = write_midx_internal(object_dir, &packs_to_drop, flags);
+		if (!result)
+			for_each_string_list_item(item, &pack_paths)
+				unlink_pack_path(item->string, 0);
+	}
+
+	string_list_clear(&packs_to_drop, 0);
+	string_list_clear(&pack_paths, 0);
+	return result;
+}
+
+struct repack_info {
+	time_t mtime;
+	uint32_t referenced_objects;
+	uint32_t pack_int_id;
+};
+
+static int compare_by_mtime(const void *a_, const void *b_)
+{
+	const struct repack_info *a, *b;
+
+	a = (const struct repack_info *)a_;
+	b = (const struct repack_info *)b_;
+
+	if (a->mtime < b->mtime)
+		return -1;
+	if (a->mtime > b->mtime)
+		return 1;
 	return 0;
 }
 
+static int fill_included_packs_all(struct multi_pack_index *m,
+				   unsigned char *include_pack)
+{
+	uint32_t i, nr = 0;
+
+	for (i = 0; i < m->num_packs; i++) {
+		if (prepare_midx_pack(m, i) || m->packs[i]->pack_keep)
+			continue;
+
+		include_pack[i] = 1;
+		nr++;
+	}
+
+	return nr < 2;
+}
+
+/*
+ * Select the oldest packs whose objects (counting only those for which
+ * the multi-pack-index points into the pack) are expected to take less
+ * than "batch_size" bytes, until their total reaches "batch_size".
+ * Returns non-zero if there are not at least two packs to combine.
+ */
+static int fill_included_packs_batch(struct multi_pack_index *m,
+				     unsigned char *include_pack,
+				     size_t batch_size)
+{
+	uint32_t i, packs_to_repack;
+	size_t total_size;
+	struct repack_info *pack_info = xcalloc(m->num_packs, sizeof(struct repack_info));
+
+	for (i = 0; i < m->num_packs; i++) {
+		pack_info[i].pack_int_id = i;
+
+		if (prepare_midx_pack(m, i))
+			continue;
+
+		pack_info[i].mtime = m->packs[i]->mtime;
+	}
+
+	for (i = 0; i < m->num_objects; i++) {
+		uint32_t pack_int_id = nth_midxed_pack_int_id(m, i);
+		pack_info[pack_int_id].referenced_objects++;
+	}
+
+	QSORT(pack_info, m->num_packs, compare_by_mtime);
+
+	total_size = 0;
+	packs_to_repack = 0;
+	for (i = 0; total_size < batch_size && i < m->num_packs; i++) {
+		int pack_int_id = pack_info[i].pack_int_id;
+		struct packed_git *p = m->packs[pack_int_id];
+		size_t expected_size;
+
+		if (!p || p->pack_keep)
+			continue;
+		if (open_pack_index(p) || !p->num_objects)
+			continue;
+
+		expected_size = (size_t)(p->pack_size
+					 * pack_info[i].referenced_objects);
+		expected_size /= p->num_objects;
+
+		if (expected_size >= batch_size)
+			continue;
+
+		packs_to_repack++;
+		total_size += expected_size;
+		include_pack[pack_int_id] = 1;
+	}
+
+	free(pack_info);
+
+	return packs_to_repack < 2;
+}
+
+int midx_repack(const char *object_dir, size_t batch_size, unsigned flags)
+{
+	int result = 0;
+	uint32_t i;
+	unsigned char *include_pack;
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	FILE *cmd_in;
+	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+
+	if (!m)
+		return 0;
+
+	include_pack = xcalloc(m->num_packs, sizeof(unsigned char));
+
+	if (batch_size) {
+		if (fill_included_packs_batch(m, include_pack, batch_size))
+			goto cleanup;
+	} else if (fill_included_packs_all(m, include_pack))
+		goto cleanup;
+
+	argv_array_push(&cmd.args, "pack-objects");
+	argv_array_pushf(&cmd.args, "%s/pack/pack", object_dir);
+	cmd.git_cmd = 1;
+	cmd.in = -1;
+	cmd.no_stdout = 1;
+
+	if (start_command(&cmd)) {
+		result = error(_("could not start pack-objects"));
+		goto cleanup;
+	}
+
+	cmd_in = xfdopen(cmd.in, "w");
+	for (i = 0; i < m->num_objects; i++) {
+		struct object_id oid;
+		uint32_t pack_int_id = nth_midxed_pack_int_id(m, i);
+
+		if (!include_pack[pack_int_id])
+			continue;
+
+		nth_midxed_object_oid(&oid, m, i);
+		fprintf(cmd_in, "%s\n", oid_to_hex(&oid));
+	}
+	fclose(cmd_in);
+
+	if (finish_command(&cmd)) {
+		result = error(_("could not finish pack-objects"));
+		goto cleanup;
+	}
+
+	close_midx(m);
+	FREE_AND_NULL(m);
+	result = write_midx_internal(object_dir, NULL, flags);
+
+cleanup:
+	if (m) {
+		close_midx(m);
+		free(m);
+	}
+	free(include_pack);
+	return result;
+}
+
 void clear_midx_file(struct repository *r)
 {
 	char *midx = get_midx_filename(r->objects->objectdir);
@@ -943,6 +1553,8 @@ void clear_midx_file(struct repository *r)
 		die(_("failed to clear multi-pack-index at %s"), midx);
 	}
 
+	clear_stale_midx_bitmaps(r->objects->objectdir, NULL);
+
 	free(midx);
 }
 
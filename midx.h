@@ -33,20 +33,54 @@ struct multi_pack_index {
 
 	const char **pack_names;
 	struct packed_git **packs;
+
+	/*
+	 * The objects in "pseudo-pack" order, i.e. as if all packs were
+	 * concatenated in pack-int-id order: pack_order[i] is the midx
+	 * position of the i-th object, and pack_order_inv[] maps a midx
+	 * position back. Only loaded by load_midx_pack_order().
+	 */
+	uint32_t *pack_order;
+	uint32_t *pack_order_inv;
+
 	char object_dir[FLEX_ARRAY];
 };
 
+/* Also write a reachability bitmap for the new multi-pack-index. */
+#define MIDX_WRITE_BITMAP (1 << 0)
+
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
 int prepare_midx_pack(struct multi_pack_index *m, uint32_t pack_int_id);
 int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m, uint32_t *result);
 struct object_id *nth_midxed_object_oid(struct object_id *oid,
 					struct multi_pack_index *m,
 					uint32_t n);
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos);
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos);
 int fill_midx_entry(const struct object_id *oid, struct pack_entry *e, struct multi_pack_index *m);
 int midx_contains_pack(struct multi_pack_index *m, const char *idx_name);
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local);
 
-int write_midx_file(const char *object_dir);
+void load_midx_pack_order(struct multi_pack_index *m);
+const unsigned char *get_midx_checksum(struct multi_pack_index *m);
+char *get_midx_bitmap_filename(struct multi_pack_index *m);
+
+int write_midx_file(const char *object_dir, unsigned flags);
+
+/*
+ * Delete the packs that no object of the multi-pack-index points into
+ * any more, and write a multi-pack-index without them.
+ */
+int expire_midx_packs(const char *object_dir, unsigned flags);
+
+/*
+ * Write the objects of a batch of packs of the multi-pack-index into a
+ * single new pack, and add it to the multi-pack-index. The batch is
+ * made of the oldest packs that fit in "batch_size" bytes, or of all
+ * packs if "batch_size" is 0. The old packs are left for
+ * expire_midx_packs().
+ */
+int midx_repack(const char *object_dir, size_t batch_size, unsigned flags);
 void clear_midx_file(struct repository *r);
 int verify_midx_file(const char *object_dir);
 
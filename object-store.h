@@ -81,9 +81,22 @@ struct packed_git {
 		 pack_keep_in_core:1,
 		 freshened:1,
 		 do_not_close:1,
-		 pack_promisor:1;
+		 pack_promisor:1,
+		 is_cruft:1;
 	unsigned char sha1[20];
 	struct revindex_entry *revindex;
+	/*
+	 * The mmapped .rev file of the pack, if any; in that case
+	 * "revindex" stays NULL and revindex_data points to the .idx
+	 * positions in pack order. See load_pack_revindex().
+	 */
+	const void *revindex_map;
+	size_t revindex_size;
+	const uint32_t *revindex_data;
+	/* The mmapped .mtimes file of a cruft pack; see pack-mtimes.h. */
+	const void *mtimes_map;
+	size_t mtimes_size;
+	const uint32_t *mtimes_data;
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
 };
@@ -148,11 +161,41 @@ struct raw_object_store {
 	 * packs.
 	 */
 	unsigned packed_git_initialized : 1;
+
+	/*
+	 * How many enable_concurrent_object_reads() calls are in effect.
+	 */
+	unsigned concurrent_reads;
 };
 
 struct raw_object_store *raw_object_store_new(void);
 void raw_object_store_clear(struct raw_object_store *o);
 
+/*
+ * Between these two calls, any number of threads may read objects from
+ * the repository at once with oid_object_info_extended(),
+ * read_object_file() and friends, without a lock of their own:
+ *
+ *  - object lookups in the pack indexes and in the list of packs take
+ *    no lock; the list of packs is only prepended to meanwhile, and its
+ *    most-recently-used order is left alone;
+ *
+ *  - opening packs and indexes, mapping and releasing pack windows and
+ *    rescanning the pack directories are serialized by a lock held only
+ *    for that bookkeeping, never while inflating or applying deltas
+ *    (see pack_access_lock());
+ *
+ *  - each reader inflates with a zlib stream of its own, loose object
+ *    paths are built in per-call buffers, and the delta base cache is
+ *    sharded.
+ *
+ * The object store must not be written to, nor alternates added or
+ * objects pretended, while reads are concurrent. Calls nest; threads
+ * must have been joined before the last disable call.
+ */
+void enable_concurrent_object_reads(struct repository *r);
+void disable_concurrent_object_reads(struct repository *r);
+
 /*
  * Put in `buf` the name of the file in the local object database that
  * would be used to store a loose object with the specified sha1.
@@ -12,6 +12,7 @@
 #include "packfile.h"
 #include "repository.h"
 #include "object-store.h"
+#include "midx.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -31,17 +32,18 @@ struct stored_bitmap {
  *
  * If there is more than one bitmap index available (e.g. because of alternates),
  * the active bitmap index is the largest one.
+ *
+ * A bitmap index may also belong to the multi-pack-index of the repository.
+ * Its bit positions then follow the "pseudo-pack" order of the midx (see
+ * load_midx_pack_order()), and it takes precedence over any pack bitmap.
  */
 struct bitmap_index {
-	/* Packfile to which this bitmap index belongs to */
-	struct packed_git *pack;
-
 	/*
-	 * Mark the first `reuse_objects` in the packfile as reused:
-	 * they will be sent as-is without using them for repacking
-	 * calculations
+	 * Packfile or multi-pack-index to which this bitmap index belongs
+	 * to; exactly one of them is set.
 	 */
-	uint32_t reuse_objects;
+	struct packed_git *pack;
+	struct multi_pack_index *midx;
 
 	/* mmapped buffer of the whole bitmap index */
 	unsigned char *map;
@@ -93,6 +95,34 @@ struct bitmap_index {
 	unsigned int version;
 };
 
+static uint32_t bitmap_num_objects(struct bitmap_index *index)
+{
+	if (index->midx)
+		return index->midx->num_objects;
+	return index->pack->num_objects;
+}
+
+/*
+ * Return the position in the .idx (or midx) order of the object at the
+ * given bit position.
+ */
+static uint32_t bitmap_index_pos(struct bitmap_index *index, uint32_t pos)
+{
+	if (index->midx)
+		return index->midx->pack_order[pos];
+	return pack_pos_to_index(index->pack, pos);
+}
+
+static void nth_bitmap_object_oid(struct bitmap_index *index,
+				  struct object_id *oid,
+				  uint32_t index_pos)
+{
+	if (index->midx)
+		nth_midxed_object_oid(oid, index->midx, index_pos);
+	else
+		nth_packed_object_oid(oid, index->pack, index_pos);
+}
+
 static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 {
 	struct ewah_bitmap *parent;
@@ -158,7 +188,7 @@ static int load_bitmap_header(struct bitmap_index *index)
 
 		if (flags & BITMAP_OPT_HASH_CACHE) {
 			unsigned char *end = index->map + index->map_size - 20;
-			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
+			index->hashes = ((uint32_t *)end) - bitmap_num_objects(index);
 		}
 	}
 
@@ -221,13 +251,15 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		struct ewah_bitmap *bitmap = NULL;
 		struct stored_bitmap *xor_bitmap = NULL;
 		uint32_t commit_idx_pos;
-		const unsigned char *sha1;
+		struct object_id oid;
 
 		commit_idx_pos = read_be32(index->map, &index->map_pos);
 		xor_offset = read_u8(index->map, &index->map_pos);
 		flags = read_u8(index->map, &index->map_pos);
 
-		sha1 = nth_packed_object_sha1(index->pack, commit_idx_pos);
+		if (commit_idx_pos >= bitmap_num_objects(index))
+			return error("Corrupted bitmap index (commit position out of range)");
+		nth_bitmap_object_oid(index, &oid, commit_idx_pos);
 
 		bitmap = read_bitmap_1(index);
 		if (!bitmap)
@@ -244,7 +276,7 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		}
 
 		recent_bitmaps[i % MAX_XOR_OFFSET] = store_bitmap(
-			index, bitmap, sha1, xor_bitmap, flags);
+			index, bitmap, oid.hash, xor_bitmap, flags);
 	}
 
 	return 0;
@@ -280,7 +312,7 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 		return -1;
 	}
 
-	if (bitmap_git->pack) {
+	if (bitmap_git->pack || bitmap_git->midx) {
 		warning("ignoring extra bitmap file: %s", packfile->pack_name);
 		close(fd);
 		return -1;
@@ -302,13 +334,61 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 	return 0;
 }
 
+static int open_midx_bitmap_1(struct bitmap_index *bitmap_git,
+			      struct multi_pack_index *midx)
+{
+	int fd;
+	struct stat st;
+	char *bitmap_name;
+	struct bitmap_disk_header *header;
+
+	bitmap_name = get_midx_bitmap_filename(midx);
+	fd = git_open(bitmap_name);
+	free(bitmap_name);
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	bitmap_git->midx = midx;
+	bitmap_git->map_size = xsize_t(st.st_size);
+	bitmap_git->map = xmmap(NULL, bitmap_git->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	bitmap_git->map_pos = 0;
+	close(fd);
+
+	if (load_bitmap_header(bitmap_git) < 0)
+		goto cleanup;
+
+	header = (void *)bitmap_git->map;
+	if (!hasheq(header->checksum, get_midx_checksum(midx))) {
+		error("Checksum mismatch between multi-pack-index and its bitmap");
+		goto cleanup;
+	}
+
+	return 0;
+
+cleanup:
+	munmap(bitmap_git->map, bitmap_git->map_size);
+	bitmap_git->map = NULL;
+	bitmap_git->map_size = 0;
+	bitmap_git->midx = NULL;
+	return -1;
+}
+
 static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 {
 	assert(bitmap_git->map);
 
 	bitmap_git->bitmaps = kh_init_sha1();
 	bitmap_git->ext_index.positions = kh_init_sha1_pos();
-	load_pack_revindex(bitmap_git->pack);
+	if (bitmap_git->midx)
+		load_midx_pack_order(bitmap_git->midx);
+	else
+		load_pack_revindex(bitmap_git->pack);
 
 	if (!(bitmap_git->commits = read_bitmap_1(bitmap_git)) ||
 		!(bitmap_git->trees = read_bitmap_1(bitmap_git)) ||
@@ -343,11 +423,25 @@ static int open_pack_bitmap(struct bitmap_index *bitmap_git)
 	return ret;
 }
 
+static int open_bitmap(struct bitmap_index *bitmap_git)
+{
+	struct multi_pack_index *m;
+
+	assert(!bitmap_git->map);
+
+	for (m = get_multi_pack_index(the_repository); m; m = m->next) {
+		if (m->local && !open_midx_bitmap_1(bitmap_git, m))
+			return 0;
+	}
+
+	return open_pack_bitmap(bitmap_git);
+}
+
 struct bitmap_index *prepare_bitmap_git(void)
 {
 	struct bitmap_index *bitmap_git = xcalloc(1, sizeof(*bitmap_git));
 
-	if (!open_pack_bitmap(bitmap_git) && !load_pack_bitmap(bitmap_git))
+	if (!open_bitmap(bitmap_git) && !load_pack_bitmap(bitmap_git))
 		return bitmap_git;
 
 	free_bitmap_index(bitmap_git);
@@ -368,20 +462,41 @@ static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 
 	if (pos < kh_end(positions)) {
 		int bitmap_pos = kh_value(positions, pos);
-		return bitmap_pos + bitmap_git->pack->num_objects;
+		return bitmap_pos + bitmap_num_objects(bitmap_git);
 	}
 
 	return -1;
 }
 
+static inline int bitmap_position_midx(struct bitmap_index *bitmap_git,
+				       const unsigned char *sha1)
+{
+	struct object_id oid;
+	uint32_t pos;
+
+	hashcpy(oid.hash, sha1);
+	if (!bsearch_midx(&oid, bitmap_git->midx, &pos))
+		return -1;
+
+	return bitmap_git->midx->pack_order_inv[pos];
+}
+
 static inline int bitmap_position_packfile(struct bitmap_index *bitmap_git,
 					   const unsigned char *sha1)
 {
-	off_t offset = find_pack_entry_one(sha1, bitmap_git->pack);
+	uint32_t pos;
+	off_t offset;
+
+	if (bitmap_git->midx)
+		return bitmap_position_midx(bitmap_git, sha1);
+
+	offset = find_pack_entry_one(sha1, bitmap_git->pack);
 	if (!offset)
 		return -1;
 
-	return find_revindex_position(bitmap_git->pack, offset);
+	if (offset_to_pack_pos(bitmap_git->pack, offset, &pos) < 0)
+		return -1;
+	return pos;
 }
 
 static int bitmap_position(struct bitmap_index *bitmap_git,
@@ -417,7 +532,7 @@ static int ext_index_add_object(struct bitmap_index *bitmap_git,
 		bitmap_pos = kh_value(eindex->positions, hash_pos);
 	}
 
-	return bitmap_pos + bitmap_git->pack->num_objects;
+	return bitmap_pos + bitmap_num_objects(bitmap_git);
 }
 
 struct bitmap_show_data {
@@ -606,7 +721,7 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	for (i = 0; i < eindex->count; ++i) {
 		struct object *obj;
 
-		if (!bitmap_get(objects, bitmap_git->pack->num_objects + i))
+		if (!bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			continue;
 
 		obj = eindex->objects[i];
@@ -628,9 +743,6 @@ static void show_objects_for_type(
 
 	struct bitmap *objects = bitmap_git->result;
 
-	if (bitmap_git->reuse_objects == bitmap_git->pack->num_objects)
-		return;
-
 	ewah_iterator_init(&it, type_filter);
 
 	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
@@ -638,7 +750,9 @@ static void show_objects_for_type(
 
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			struct object_id oid;
-			struct revindex_entry *entry;
+			struct packed_git *found_pack;
+			off_t found_offset;
+			uint32_t index_pos;
 			uint32_t hash = 0;
 
 			if ((word >> offset) == 0)
@@ -646,16 +760,28 @@ static void show_objects_for_type(
 
 			offset += ewah_bit_ctz64(word >> offset);
 
-			if (pos + offset < bitmap_git->reuse_objects)
-				continue;
-
-			entry = &bitmap_git->pack->revindex[pos + offset];
-			nth_packed_object_oid(&oid, bitmap_git->pack, entry->nr);
+			index_pos = bitmap_index_pos(bitmap_git, pos + offset);
+			nth_bitmap_object_oid(bitmap_git, &oid, index_pos);
+
+			if (bitmap_git->midx) {
+				struct multi_pack_index *m = bitmap_git->midx;
+				uint32_t pack_int_id = nth_midxed_pack_int_id(m, index_pos);
+
+				if (prepare_midx_pack(m, pack_int_id))
+					die("failed to load pack %s from multi-pack-index",
+					    m->pack_names[pack_int_id]);
+				found_pack = m->packs[pack_int_id];
+				found_offset = nth_midxed_offset(m, index_pos);
+			} else {
+				found_pack = bitmap_git->pack;
+				found_offset = pack_pos_to_offset(bitmap_git->pack,
+								  pos + offset);
+			}
 
 			if (bitmap_git->hashes)
-				hash = get_be32(bitmap_git->hashes + entry->nr);
+				hash = get_be32(bitmap_git->hashes + index_pos);
 
-			show_reach(&oid, object_type, 0, hash, bitmap_git->pack, entry->offset);
+			show_reach(&oid, object_type, 0, hash, found_pack, found_offset);
 		}
 
 		pos += BITS_IN_EWORD;
@@ -670,7 +796,11 @@ static int in_bitmapped_pack(struct bitmap_index *bitmap_git,
 		struct object *object = roots->item;
 		roots = roots->next;
 
-		if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
+		if (bitmap_git->midx) {
+			uint32_t pos;
+			if (bsearch_midx(&object->oid, bitmap_git->midx, &pos))
+				return 1;
+		} else if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
 			return 1;
 	}
 
@@ -690,7 +820,7 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
 	struct bitmap_index *bitmap_git = xcalloc(1, sizeof(*bitmap_git));
 	/* try to open a bitmapped pack, but don't parse it yet
 	 * because we may not need to use it */
-	if (open_pack_bitmap(bitmap_git) < 0)
+	if (open_bitmap(bitmap_git) < 0)
 		goto cleanup;
 
 	for (i = 0; i < revs->pending.nr; ++i) {
@@ -768,65 +898,218 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
 	return NULL;
 }
 
+off_t bitmap_pos_to_offset(struct bitmap_index *bitmap_git, uint32_t pos)
+{
+	if (bitmap_git->midx)
+		return nth_midxed_offset(bitmap_git->midx,
+					 bitmap_git->midx->pack_order[pos]);
+	return pack_pos_to_offset(bitmap_git->pack, pos);
+}
+
+/*
+ * Return the bit position of the object at "offset" in "pack", or -1 if
+ * the bitmap does not refer to that copy of the object (with a
+ * multi-pack bitmap, the multi-pack-index may have picked the copy of
+ * another pack).
+ */
+static int pack_offset_to_bitmap_pos(struct bitmap_index *bitmap_git,
+				     struct bitmapped_pack *pack,
+				     off_t offset)
+{
+	struct multi_pack_index *m = bitmap_git->midx;
+	struct object_id oid;
+	uint32_t pack_pos, midx_pos;
+
+	if (offset_to_pack_pos(pack->p, offset, &pack_pos) < 0)
+		return -1;
+	if (!m)
+		return pack_pos;
+	if (pack->bitmap_nr == pack->p->num_objects)
+		return pack->bitmap_pos + pack_pos;
+
+	nth_packed_object_oid(&oid, pack->p, pack_pos_to_index(pack->p, pack_pos));
+	if (!bsearch_midx(&oid, m, &midx_pos) ||
+	    nth_midxed_pack_int_id(m, midx_pos) != pack->pack_int_id ||
+	    nth_midxed_offset(m, midx_pos) != offset)
+		return -1;
+	return m->pack_order_inv[midx_pos];
+}
+
+static void try_partial_reuse(struct bitmap_index *bitmap_git,
+			      struct bitmapped_pack *pack,
+			      uint32_t pos,
+			      struct bitmap *reuse,
+			      struct pack_window **w_curs)
+{
+	off_t offset, delta_obj_offset;
+	enum object_type type;
+	unsigned long size;
+
+	offset = delta_obj_offset = bitmap_pos_to_offset(bitmap_git, pos);
+	type = unpack_object_header(pack->p, w_curs, &offset, &size);
+	if (type < 0)
+		return; /* broken packfile, punt */
+
+	if (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA) {
+		off_t base_offset;
+		int base_pos;
+
+		/*
+		 * Find the bit position of the base object. If there is
+		 * none, the pack is corrupt or the multi-pack-index picked
+		 * the base from another pack; either way, leave the object
+		 * to the normal code path.
+		 */
+		base_offset = get_delta_base(pack->p, w_curs, &offset, type,
+					     delta_obj_offset);
+		if (!base_offset)
+			return;
+		base_pos = pack_offset_to_bitmap_pos(bitmap_git, pack,
+						     base_offset);
+		if (base_pos < 0)
+			return;
+
+		/*
+		 * We assume delta dependencies always point backwards,
+		 * which is always true of OFS_DELTA, and lets us decide
+		 * in a single pass. And if we are not reusing the base,
+		 * we would have to convert the delta to REF_DELTA on the
+		 * fly; let the normal code path handle it.
+		 */
+		if (base_pos >= pos || !bitmap_get(reuse, base_pos))
+			return;
+	}
+
+	bitmap_set(reuse, pos);
+}
+
+/*
+ * Fill "packs" with the packfiles of the bitmap, skipping those we
+ * cannot read from. Returns the number of packs.
+ */
+static size_t prepare_bitmapped_packs(struct bitmap_index *bitmap_git,
+				      struct bitmapped_pack **packs)
+{
+	struct multi_pack_index *m = bitmap_git->midx;
+	size_t nr = 0;
+	uint32_t i, pos = 0;
+
+	if (!m) {
+		ALLOC_ARRAY(*packs, 1);
+		(*packs)->p = bitmap_git->pack;
+		(*packs)->pack_int_id = 0;
+		(*packs)->bitmap_pos = 0;
+		(*packs)->bitmap_nr = bitmap_git->pack->num_objects;
+		return 1;
+	}
+
+	ALLOC_ARRAY(*packs, m->num_packs);
+	for (i = 0; i < m->num_packs; i++) {
+		struct bitmapped_pack *pack = &(*packs)[nr];
+		uint32_t start = pos;
+
+		while (pos < m->num_objects &&
+		       nth_midxed_pack_int_id(m, m->pack_order[pos]) == i)
+			pos++;
+
+		if (start == pos || prepare_midx_pack(m, i) ||
+		    open_pack_index(m->packs[i]) || !is_pack_valid(m->packs[i]))
+			continue;
+
+		load_pack_revindex(m->packs[i]);
+		pack->p = m->packs[i];
+		pack->pack_int_id = i;
+		pack->bitmap_pos = start;
+		pack->bitmap_nr = pos - start;
+		nr++;
+	}
+
+	return nr;
+}
+
 int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
-				       struct packed_git **packfile,
+				       struct bitmapped_pack **packs_out,
+				       size_t *packs_nr_out,
 				       uint32_t *entries,
-				       off_t *up_to)
+				       struct bitmap **reuse_out)
 {
-	/*
-	 * Reuse the packfile content if we need more than
-	 * 90% of its objects
-	 */
-	static const double REUSE_PERCENT = 0.9;
-
 	struct bitmap *result = bitmap_git->result;
-	uint32_t reuse_threshold;
-	uint32_t i, reuse_objects = 0;
+	struct bitmap *reuse;
+	struct bitmapped_pack *packs, *pack;
+	struct pack_window *w_curs = NULL;
+	size_t packs_nr, i = 0;
+	uint32_t objects_nr = bitmap_num_objects(bitmap_git);
+	uint32_t offset;
 
 	assert(result);
 
-	for (i = 0; i < result->word_alloc; ++i) {
-		if (result->words[i] != (eword_t)~0) {
-			reuse_objects += ewah_bit_ctz64(~result->words[i]);
-			break;
-		}
+	packs_nr = prepare_bitmapped_packs(bitmap_git, &packs);
+	if (!packs_nr) {
+		free(packs);
+		return -1;
+	}
+	pack = packs;
+
+	/*
+	 * If we want all the leading objects of a whole pack, there is no
+	 * need to look at them: any delta base comes before its delta,
+	 * and is wanted, too.
+	 */
+	if (!pack->bitmap_pos && pack->bitmap_nr == pack->p->num_objects) {
+		while (i < result->word_alloc && result->words[i] == (eword_t)~0)
+			i++;
 
-		reuse_objects += BITS_IN_EWORD;
+		/* Don't mark objects not in the packfile */
+		if (i > pack->bitmap_nr / BITS_IN_EWORD)
+			i = pack->bitmap_nr / BITS_IN_EWORD;
 	}
 
-#ifdef GIT_BITMAP_DEBUG
-	{
-		const unsigned char *sha1;
-		struct revindex_entry *entry;
+	reuse = bitmap_word_alloc(i);
+	memset(reuse->words, 0xFF, i * sizeof(eword_t));
 
-		entry = &bitmap_git->reverse_index->revindex[reuse_objects];
-		sha1 = nth_packed_object_sha1(bitmap_git->pack, entry->nr);
+	for (; i < result->word_alloc; ++i) {
+		eword_t word = result->words[i];
+		size_t pos = (i * BITS_IN_EWORD);
 
-		fprintf(stderr, "Failed to reuse at %d (%016llx)\n",
-			reuse_objects, result->words[i]);
-		fprintf(stderr, " %s\n", sha1_to_hex(sha1));
-	}
-#endif
+		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
+			if ((word >> offset) == 0)
+				break;
 
-	if (!reuse_objects)
-		return -1;
+			offset += ewah_bit_ctz64(word >> offset);
+			if (pos + offset >= objects_nr)
+				goto done;
 
-	if (reuse_objects >= bitmap_git->pack->num_objects) {
-		bitmap_git->reuse_objects = *entries = bitmap_git->pack->num_objects;
-		*up_to = -1; /* reuse the full pack */
-		*packfile = bitmap_git->pack;
-		return 0;
+			while (pos + offset >= pack->bitmap_pos + pack->bitmap_nr) {
+				unuse_pack(&w_curs);
+				if (++pack == packs + packs_nr)
+					goto done;
+			}
+			if (pos + offset < pack->bitmap_pos)
+				continue; /* in a pack we skipped */
+
+			try_partial_reuse(bitmap_git, pack, pos + offset,
+					  reuse, &w_curs);
+		}
 	}
 
-	reuse_threshold = bitmap_popcount(bitmap_git->result) * REUSE_PERCENT;
+done:
+	unuse_pack(&w_curs);
 
-	if (reuse_objects < reuse_threshold)
+	*entries = bitmap_popcount(reuse);
+	if (!*entries) {
+		bitmap_free(reuse);
+		free(packs);
 		return -1;
+	}
 
-	bitmap_git->reuse_objects = *entries = reuse_objects;
-	*up_to = bitmap_git->pack->revindex[reuse_objects].offset;
-	*packfile = bitmap_git->pack;
-
+	/*
+	 * Drop any reused objects from the result, since they will not
+	 * need to be handled separately.
+	 */
+	bitmap_and_not(result, reuse);
+	*packs_out = packs;
+	*packs_nr_out = packs_nr;
+	*reuse_out = reuse;
 	return 0;
 }
 
@@ -885,7 +1168,7 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
-			bitmap_get(objects, bitmap_git->pack->num_objects + i))
+			bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			count++;
 	}
 
@@ -1051,17 +1334,16 @@ int rebuild_existing_bitmaps(struct bitmap_index *bitmap_git,
 	khiter_t hash_pos;
 	int hash_ret;
 
-	num_objects = bitmap_git->pack->num_objects;
+	num_objects = bitmap_num_objects(bitmap_git);
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
-		const unsigned char *sha1;
-		struct revindex_entry *entry;
+		struct object_id oid;
 		struct object_entry *oe;
 
-		entry = &bitmap_git->pack->revindex[i];
-		sha1 = nth_packed_object_sha1(bitmap_git->pack, entry->nr);
-		oe = packlist_find(mapping, sha1, NULL);
+		nth_bitmap_object_oid(bitmap_git, &oid,
+				      bitmap_index_pos(bitmap_git, i));
+		oe = packlist_find(mapping, oid.hash, NULL);
 
 		if (oe)
 			reposition[i] = oe_in_pack_pos(mapping, oe) + 1;
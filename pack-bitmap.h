@@ -39,6 +39,20 @@ typedef int (*show_reachable_fn)(
 
 struct bitmap_index;
 
+/*
+ * A packfile whose objects may be sent verbatim by pack-objects: the
+ * bit positions [bitmap_pos, bitmap_pos + bitmap_nr) of the bitmap
+ * index belong to objects of "p", in the order they appear in "p".
+ * If bitmap_nr is p->num_objects, the pack is "whole", and bit
+ * bitmap_pos + i is the i-th object of the pack.
+ */
+struct bitmapped_pack {
+	struct packed_git *p;
+	uint32_t pack_int_id; /* for a multi-pack bitmap */
+	uint32_t bitmap_pos;
+	uint32_t bitmap_nr;
+};
+
 struct bitmap_index *prepare_bitmap_git(void);
 void count_bitmap_commit_list(struct bitmap_index *, uint32_t *commits,
 			      uint32_t *trees, uint32_t *blobs, uint32_t *tags);
@@ -46,9 +60,26 @@ void traverse_bitmap_commit_list(struct bitmap_index *,
 				 show_reachable_fn show_reachable);
 void test_bitmap_walk(struct rev_info *revs);
 struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs);
+
+/*
+ * After a walk by prepare_bitmap_walk(), find the objects of the result
+ * that can be copied verbatim from their packfile: those whose delta
+ * base, if any, is in the same packfile and is reused as well. With a
+ * multi-pack bitmap, this covers every packfile of the multi-pack-index.
+ *
+ * On success, return 0, the packfiles to copy from in "packs_out" (in
+ * bitmap order), the number of reused objects in "entries", and their
+ * bit positions in "reuse_out". The reused objects are dropped from the
+ * result, so that traverse_bitmap_commit_list() does not show them.
+ */
 int reuse_partial_packfile_from_bitmap(struct bitmap_index *,
-				       struct packed_git **packfile,
-				       uint32_t *entries, off_t *up_to);
+				       struct bitmapped_pack **packs_out,
+				       size_t *packs_nr_out,
+				       uint32_t *entries,
+				       struct bitmap **reuse_out);
+
+/* Return the offset in its packfile of the object at bit position "pos". */
+off_t bitmap_pos_to_offset(struct bitmap_index *, uint32_t pos);
 int rebuild_existing_bitmaps(struct bitmap_index *, struct packing_data *mapping,
 			     khash_sha1 *reused_bitmaps, int show_progress);
 void free_bitmap_index(struct bitmap_index *);
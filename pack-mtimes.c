@@ -0,0 +1,106 @@
+#include "cache.h"
+#include "pack.h"
+#include "pack-mtimes.h"
+#include "object-store.h"
+#include "packfile.h"
+
+static char *pack_mtimes_filename(struct packed_git *p)
+{
+	size_t len;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.mtimes", (int)len, p->pack_name);
+}
+
+int load_pack_mtimes(struct packed_git *p)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	char *mtimes_name;
+	const unsigned char *data;
+	size_t mtimes_size;
+	struct stat st;
+	int fd, ret = -1;
+
+	if (p->mtimes_data)
+		return 0;
+	if (!p->is_cruft)
+		return error(_("pack %s is not a cruft pack"), p->pack_name);
+	if (open_pack_index(p))
+		return -1;
+
+	mtimes_name = pack_mtimes_filename(p);
+	fd = git_open(mtimes_name);
+	if (fd < 0) {
+		error_errno(_("unable to open %s"), mtimes_name);
+		goto cleanup;
+	}
+	if (fstat(fd, &st)) {
+		error_errno(_("unable to stat %s"), mtimes_name);
+		close(fd);
+		goto cleanup;
+	}
+
+	mtimes_size = xsize_t(st.st_size);
+	if (mtimes_size != MTIMES_HEADER_SIZE + st_mult(p->num_objects, 4) + 2 * hashsz) {
+		error(_("mtimes file %s has the wrong size"), mtimes_name);
+		close(fd);
+		goto cleanup;
+	}
+
+	data = xmmap(NULL, mtimes_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(data) != MTIMES_SIGNATURE ||
+	    get_be32(data + 4) != MTIMES_VERSION ||
+	    get_be32(data + 8) != MTIMES_HASH_VERSION) {
+		error(_("mtimes file %s has an unknown header"), mtimes_name);
+		munmap((void *)data, mtimes_size);
+		goto cleanup;
+	}
+
+	/* the .mtimes and .idx files both end with the pack checksum */
+	if (!hasheq(data + mtimes_size - 2 * hashsz,
+		    (const unsigned char *)p->index_data + p->index_size - 2 * hashsz)) {
+		error(_("mtimes file %s does not match its pack"), mtimes_name);
+		munmap((void *)data, mtimes_size);
+		goto cleanup;
+	}
+
+	p->mtimes_map = data;
+	p->mtimes_size = mtimes_size;
+	p->mtimes_data = (const uint32_t *)(data + MTIMES_HEADER_SIZE);
+	ret = 0;
+
+cleanup:
+	free(mtimes_name);
+	return ret;
+}
+
+void close_pack_mtimes(struct packed_git *p)
+{
+	if (!p->mtimes_map)
+		return;
+
+	munmap((void *)p->mtimes_map, p->mtimes_size);
+	p->mtimes_map = NULL;
+	p->mtimes_data = NULL;
+	p->mtimes_size = 0;
+}
+
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos)
+{
+	if (!p->mtimes_data)
+		BUG("pack .mtimes file not loaded for %s", p->pack_name);
+	if (pos >= p->num_objects)
+		BUG("pack .mtimes out-of-bounds (%"PRIu32" vs %"PRIu32")",
+		    pos, p->num_objects);
+	return get_be32(p->mtimes_data + pos);
+}
+
+time_t packed_object_mtime(struct packed_git *p, uint32_t pos)
+{
+	if (p->is_cruft && !load_pack_mtimes(p))
+		return nth_packed_mtime(p, pos);
+	return p->mtime;
+}
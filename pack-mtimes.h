@@ -0,0 +1,34 @@
+#ifndef PACK_MTIMES_H
+#define PACK_MTIMES_H
+
+struct packed_git;
+
+/*
+ * A "cruft pack" holds unreachable objects. Its .mtimes file records
+ * for each of them the time at which it was last written or used, so
+ * that unreachable objects can be kept in a single pack instead of as
+ * loose files while still expiring individually.
+ */
+
+/*
+ * Map the .mtimes file of a cruft pack. The pack index must already
+ * be open. Returns 0 on success, and -1 (with an error) if the file
+ * is missing or does not match its pack.
+ */
+int load_pack_mtimes(struct packed_git *p);
+void close_pack_mtimes(struct packed_git *p);
+
+/*
+ * Return the mtime of the object at position 'pos' of the .idx of a
+ * cruft pack. Requires load_pack_mtimes().
+ */
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos);
+
+/*
+ * Return the mtime of the object at position 'pos' of the .idx of any
+ * pack: its own for a cruft pack whose .mtimes can be loaded, and that
+ * of the packfile otherwise.
+ */
+time_t packed_object_mtime(struct packed_git *p, uint32_t pos);
+
+#endif
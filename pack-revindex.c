@@ -1,6 +1,10 @@
 #include "cache.h"
 #include "pack-revindex.h"
+#include "config.h"
 #include "object-store.h"
+#include "packfile.h"
+#include "pack.h"
+#include "thread-utils.h"
 
 /*
  * Pack index for existing packs give us easy access to the offsets into
@@ -123,8 +127,9 @@ static void create_pack_revindex(struct packed_git *p)
 	unsigned i;
 	const char *index = p->index_data;
 	const unsigned hashsz = the_hash_algo->rawsz;
+	struct revindex_entry *revindex;
 
-	ALLOC_ARRAY(p->revindex, num_ent + 1);
+	ALLOC_ARRAY(revindex, num_ent + 1);
 	index += 4 * 256;
 
 	if (p->index_version > 1) {
@@ -134,18 +139,18 @@ static void create_pack_revindex(struct packed_git *p)
 		for (i = 0; i < num_ent; i++) {
 			uint32_t off = ntohl(*off_32++);
 			if (!(off & 0x80000000)) {
-				p->revindex[i].offset = off;
+				revindex[i].offset = off;
 			} else {
-				p->revindex[i].offset = get_be64(off_64);
+				revindex[i].offset = get_be64(off_64);
 				off_64 += 2;
 			}
-			p->revindex[i].nr = i;
+			revindex[i].nr = i;
 		}
 	} else {
 		for (i = 0; i < num_ent; i++) {
 			uint32_t hl = *((uint32_t *)(index + (hashsz + 4) * i));
-			p->revindex[i].offset = ntohl(hl);
-			p->revindex[i].nr = i;
+			revindex[i].offset = ntohl(hl);
+			revindex[i].nr = i;
 		}
 	}
 
@@ -153,46 +158,166 @@ static void create_pack_revindex(struct packed_git *p)
 	 * This knows the pack format -- the hash trailer
 	 * follows immediately after the last object data.
 	 */
-	p->revindex[num_ent].offset = p->pack_size - hashsz;
-	p->revindex[num_ent].nr = -1;
-	sort_revindex(p->revindex, num_ent, p->pack_size);
+	revindex[num_ent].offset = p->pack_size - hashsz;
+	revindex[num_ent].nr = -1;
+	sort_revindex(revindex, num_ent, p->pack_size);
+
+	/* publish it only once complete; see load_pack_revindex() */
+	store_release_ptr(&p->revindex, revindex);
+}
+
+static char *pack_revindex_filename(struct packed_git *p)
+{
+	size_t len;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.rev", (int)len, p->pack_name);
+}
+
+/*
+ * Map the .rev file of the pack, if there is one. A .rev file that does
+ * not match its pack is ignored with a warning, and the caller falls back
+ * to computing the reverse index in memory.
+ */
+static int load_pack_revindex_from_disk(struct packed_git *p)
+{
+	const unsigned hashsz = the_hash_algo->rawsz;
+	char *rev_name = pack_revindex_filename(p);
+	const unsigned char *data;
+	size_t rev_size;
+	struct stat st;
+	int fd, ret = -1;
+
+	fd = git_open(rev_name);
+	if (fd < 0)
+		goto cleanup;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto cleanup;
+	}
+
+	rev_size = xsize_t(st.st_size);
+	if (rev_size != RIDX_HEADER_SIZE + st_mult(p->num_objects, 4) + 2 * hashsz) {
+		warning(_("reverse-index file %s has the wrong size"), rev_name);
+		close(fd);
+		goto cleanup;
+	}
+
+	data = xmmap(NULL, rev_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(data) != RIDX_SIGNATURE ||
+	    get_be32(data + 4) != RIDX_VERSION ||
+	    get_be32(data + 8) != RIDX_HASH_VERSION) {
+		warning(_("reverse-index file %s has an unknown header"), rev_name);
+		munmap((void *)data, rev_size);
+		goto cleanup;
+	}
+
+	/* the .rev and .idx files both end with the pack checksum */
+	if (!hasheq(data + rev_size - 2 * hashsz,
+		    (const unsigned char *)p->index_data + p->index_size - 2 * hashsz)) {
+		warning(_("reverse-index file %s does not match its pack"), rev_name);
+		munmap((void *)data, rev_size);
+		goto cleanup;
+	}
+
+	p->revindex_map = data;
+	p->revindex_size = rev_size;
+	/* publish it only once complete; see load_pack_revindex() */
+	store_release_ptr(&p->revindex_data,
+			  (const uint32_t *)(data + RIDX_HEADER_SIZE));
+	ret = 0;
+
+cleanup:
+	free(rev_name);
+	return ret;
 }
 
 void load_pack_revindex(struct packed_git *p)
 {
-	if (!p->revindex)
-		create_pack_revindex(p);
+	/*
+	 * Concurrent readers only take the lock while the reverse index
+	 * is not loaded yet; whoever gets it first loads it. The acquire
+	 * loads pair with the release stores that publish it.
+	 */
+	if (load_acquire_ptr(&p->revindex) ||
+	    load_acquire_ptr(&p->revindex_data))
+		return;
+
+	pack_access_lock();
+	if (p->revindex || p->revindex_data)
+		goto out;
+
+	if (!load_pack_revindex_from_disk(p))
+		goto out;
+
+	if (git_env_bool(GIT_TEST_REV_INDEX_DIE_IN_MEMORY, 0))
+		die("dying as requested by '%s'",
+		    GIT_TEST_REV_INDEX_DIE_IN_MEMORY);
+
+	create_pack_revindex(p);
+out:
+	pack_access_unlock();
 }
 
-int find_revindex_position(struct packed_git *p, off_t ofs)
+void close_pack_revindex(struct packed_git *p)
 {
-	int lo = 0;
-	int hi = p->num_objects + 1;
-	struct revindex_entry *revindex = p->revindex;
+	if (!p->revindex_map)
+		return;
+
+	munmap((void *)p->revindex_map, p->revindex_size);
+	p->revindex_map = NULL;
+	p->revindex_data = NULL;
+	p->revindex_size = 0;
+}
+
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos)
+{
+	uint32_t lo = 0;
+	uint32_t hi = p->num_objects + 1;
+
+	load_pack_revindex(p);
 
 	do {
-		unsigned mi = lo + (hi - lo) / 2;
-		if (revindex[mi].offset == ofs) {
-			return mi;
-		} else if (ofs < revindex[mi].offset)
+		uint32_t mi = lo + (hi - lo) / 2;
+		off_t mi_ofs = pack_pos_to_offset(p, mi);
+
+		if (mi_ofs == ofs) {
+			*pos = mi;
+			return 0;
+		} else if (ofs < mi_ofs)
 			hi = mi;
 		else
 			lo = mi + 1;
 	} while (lo < hi);
 
-	error("bad offset for revindex");
-	return -1;
+	return error("bad offset for revindex");
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos)
 {
-	int pos;
+	if (!p->revindex && !p->revindex_data)
+		BUG("pack_pos_to_index: reverse index not yet loaded");
+	if (p->num_objects <= pos)
+		BUG("pack_pos_to_index: out-of-bounds object at %"PRIu32, pos);
 
-	load_pack_revindex(p);
-	pos = find_revindex_position(p, ofs);
+	if (p->revindex)
+		return p->revindex[pos].nr;
+	return get_be32(p->revindex_data + pos);
+}
 
-	if (pos < 0)
-		return NULL;
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos)
+{
+	if (!p->revindex && !p->revindex_data)
+		BUG("pack_pos_to_offset: reverse index not yet loaded");
+	if (p->num_objects < pos)
+		BUG("pack_pos_to_offset: out-of-bounds object at %"PRIu32, pos);
 
-	return p->revindex + pos;
+	if (p->revindex)
+		return p->revindex[pos].offset;
+	if (pos == p->num_objects)
+		return p->pack_size - the_hash_algo->rawsz;
+	return nth_packed_object_offset(p, pack_pos_to_index(p, pos));
 }
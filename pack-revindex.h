@@ -8,9 +8,39 @@ struct revindex_entry {
 	unsigned int nr;
 };
 
+#define GIT_TEST_WRITE_REV_INDEX "GIT_TEST_WRITE_REV_INDEX"
+#define GIT_TEST_REV_INDEX_DIE_IN_MEMORY "GIT_TEST_REV_INDEX_DIE_IN_MEMORY"
+
+/*
+ * Load the reverse index of the pack, which maps the "pack order" of its
+ * objects (the order in which they appear in the packfile) to their
+ * position in the .idx and back. The pack index must already be open.
+ *
+ * If the pack has a valid .rev file, it is mmapped; otherwise the reverse
+ * index is computed in memory by sorting the offsets of the .idx.
+ */
 void load_pack_revindex(struct packed_git *p);
-int find_revindex_position(struct packed_git *p, off_t ofs);
+void close_pack_revindex(struct packed_git *p);
+
+/*
+ * Store in *pos the position in pack order of the object starting at
+ * offset 'ofs', loading the reverse index if needed. Returns 0 on
+ * success, or -1 (with an error) if there is no object at that offset.
+ */
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos);
+
+/*
+ * Return the .idx position of the object at position 'pos' in pack
+ * order. Requires load_pack_revindex().
+ */
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos);
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+/*
+ * Return the offset of the object at position 'pos' in pack order. For
+ * pos == p->num_objects, return the offset of the trailing pack checksum,
+ * so that the on-disk size of an object is always the difference between
+ * the offsets of 'pos + 1' and 'pos'. Requires load_pack_revindex().
+ */
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos);
 
 #endif
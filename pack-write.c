@@ -176,6 +176,106 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 	return index_name;
 }
 
+static int pack_order_cmp(const void *va, const void *vb, void *ctx)
+{
+	struct pack_idx_entry **objects = ctx;
+
+	off_t oa = objects[*(uint32_t *)va]->offset;
+	off_t ob = objects[*(uint32_t *)vb]->offset;
+
+	if (oa < ob)
+		return -1;
+	if (oa > ob)
+		return 1;
+	return 0;
+}
+
+/*
+ * Write the reverse index of a pack, i.e. the positions in the .idx of
+ * its objects in the order they appear in the pack. The objects array
+ * must already be sorted by object name, as write_idx_file() leaves it.
+ */
+const char *write_rev_file(const char *rev_name,
+			   struct pack_idx_entry **objects,
+			   uint32_t nr_objects,
+			   const unsigned char *hash,
+			   unsigned flags)
+{
+	struct hashfile *f;
+	uint32_t *pack_order;
+	uint32_t i;
+	int fd;
+
+	if ((flags & WRITE_REV) && (flags & WRITE_REV_VERIFY))
+		die("cannot both write and verify reverse index");
+
+	if (flags & WRITE_REV_VERIFY) {
+		if (!rev_name)
+			BUG("cannot verify reverse index file without name");
+		f = hashfd_check(rev_name);
+	} else if (flags & WRITE_REV) {
+		if (!rev_name) {
+			struct strbuf tmp_file = STRBUF_INIT;
+			fd = odb_mkstemp(&tmp_file, "pack/tmp_rev_XXXXXX");
+			rev_name = strbuf_detach(&tmp_file, NULL);
+		} else {
+			unlink(rev_name);
+			fd = open(rev_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+			if (fd < 0)
+				die_errno("unable to create '%s'", rev_name);
+		}
+		f = hashfd(fd, rev_name);
+	} else
+		return NULL;
+
+	ALLOC_ARRAY(pack_order, nr_objects);
+	for (i = 0; i < nr_objects; i++)
+		pack_order[i] = i;
+	QSORT_S(pack_order, nr_objects, pack_order_cmp, objects);
+
+	hashwrite_be32(f, RIDX_SIGNATURE);
+	hashwrite_be32(f, RIDX_VERSION);
+	hashwrite_be32(f, RIDX_HASH_VERSION);
+	for (i = 0; i < nr_objects; i++)
+		hashwrite_be32(f, pack_order[i]);
+	hashwrite(f, hash, the_hash_algo->rawsz);
+
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_CLOSE |
+				    ((flags & WRITE_REV_VERIFY) ? 0 : CSUM_FSYNC));
+
+	free(pack_order);
+	return rev_name;
+}
+
+const char *write_mtimes_file(struct pack_idx_entry **objects,
+			      uint32_t nr_objects,
+			      const uint32_t *mtimes,
+			      const unsigned char *hash)
+{
+	struct strbuf tmp_file = STRBUF_INIT;
+	const char *mtimes_name;
+	struct hashfile *f;
+	uint32_t i;
+	int fd;
+
+	fd = odb_mkstemp(&tmp_file, "pack/tmp_mtimes_XXXXXX");
+	mtimes_name = strbuf_detach(&tmp_file, NULL);
+	f = hashfd(fd, mtimes_name);
+
+	hashwrite_be32(f, MTIMES_SIGNATURE);
+	hashwrite_be32(f, MTIMES_VERSION);
+	hashwrite_be32(f, MTIMES_HASH_VERSION);
+	for (i = 0; i < nr_objects; i++) {
+		if (i && oidcmp(&objects[i - 1]->oid, &objects[i]->oid) >= 0)
+			BUG("cruft pack objects are not sorted");
+		hashwrite_be32(f, mtimes[i]);
+	}
+	hashwrite(f, hash, the_hash_algo->rawsz);
+
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_CLOSE | CSUM_FSYNC);
+	return mtimes_name;
+}
+
 off_t write_pack_header(struct hashfile *f, uint32_t nr_entries)
 {
 	struct pack_header hdr;
@@ -348,10 +448,11 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 			 const char *pack_tmp_name,
 			 struct pack_idx_entry **written_list,
 			 uint32_t nr_written,
+			 const uint32_t *mtimes,
 			 struct pack_idx_option *pack_idx_opts,
 			 unsigned char sha1[])
 {
-	const char *idx_tmp_name;
+	const char *idx_tmp_name, *rev_tmp_name, *mtimes_tmp_name = NULL;
 	int basename_len = name_buffer->len;
 
 	if (adjust_shared_perm(pack_tmp_name))
@@ -362,6 +463,28 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 	if (adjust_shared_perm(idx_tmp_name))
 		die_errno("unable to make temporary index file readable");
 
+	rev_tmp_name = write_rev_file(NULL, written_list, nr_written, sha1,
+				      pack_idx_opts->flags);
+	if (rev_tmp_name && adjust_shared_perm(rev_tmp_name))
+		die_errno("unable to make temporary reverse index file readable");
+
+	if (mtimes) {
+		mtimes_tmp_name = write_mtimes_file(written_list, nr_written,
+						    mtimes, sha1);
+		if (adjust_shared_perm(mtimes_tmp_name))
+			die_errno("unable to make temporary mtimes file readable");
+
+		/*
+		 * Put the .mtimes file in place first, so that the pack
+		 * is never seen as a regular one.
+		 */
+		strbuf_addf(name_buffer, "%s.mtimes", sha1_to_hex(sha1));
+		if (rename(mtimes_tmp_name, name_buffer->buf))
+			die_errno("unable to rename temporary mtimes file");
+
+		strbuf_setlen(name_buffer, basename_len);
+	}
+
 	strbuf_addf(name_buffer, "%s.pack", sha1_to_hex(sha1));
 
 	if (rename(pack_tmp_name, name_buffer->buf))
@@ -369,6 +492,14 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 
 	strbuf_setlen(name_buffer, basename_len);
 
+	if (rev_tmp_name) {
+		strbuf_addf(name_buffer, "%s.rev", sha1_to_hex(sha1));
+		if (rename(rev_tmp_name, name_buffer->buf))
+			die_errno("unable to rename temporary reverse index file");
+
+		strbuf_setlen(name_buffer, basename_len);
+	}
+
 	strbuf_addf(name_buffer, "%s.idx", sha1_to_hex(sha1));
 	if (rename(idx_tmp_name, name_buffer->buf))
 		die_errno("unable to rename temporary index file");
@@ -376,4 +507,6 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 	strbuf_setlen(name_buffer, basename_len);
 
 	free((void *)idx_tmp_name);
+	free((void *)rev_tmp_name);
+	free((void *)mtimes_tmp_name);
 }
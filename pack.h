@@ -35,11 +35,33 @@ struct pack_header {
  */
 #define PACK_IDX_SIGNATURE 0xff744f63	/* "\377tOc" */
 
+/*
+ * The reverse index (.rev) of a pack: a header, the .idx positions of
+ * the objects in pack order (4 bytes each), the pack checksum and the
+ * checksum of the .rev file itself.
+ */
+#define RIDX_SIGNATURE 0x52494458	/* "RIDX" */
+#define RIDX_VERSION 1
+#define RIDX_HASH_VERSION 1
+#define RIDX_HEADER_SIZE 12
+
+/*
+ * The .mtimes file of a cruft pack: a header, the mtimes of the objects
+ * in .idx order (4 bytes each), the pack checksum and the checksum of
+ * the .mtimes file itself.
+ */
+#define MTIMES_SIGNATURE 0x4d544d45	/* "MTME" */
+#define MTIMES_VERSION 1
+#define MTIMES_HASH_VERSION 1
+#define MTIMES_HEADER_SIZE 12
+
 struct pack_idx_option {
 	unsigned flags;
 	/* flag bits */
 #define WRITE_IDX_VERIFY 01 /* verify only, do not write the idx file */
 #define WRITE_IDX_STRICT 02
+#define WRITE_REV 04 /* also write a .rev file, see write_rev_file() */
+#define WRITE_REV_VERIFY 010 /* verify only, do not write the rev file */
 
 	uint32_t version;
 	uint32_t off32_limit;
@@ -78,6 +100,8 @@ struct progress;
 typedef int (*verify_fn)(const struct object_id *, enum object_type, unsigned long, void*, int*);
 
 extern const char *write_idx_file(const char *index_name, struct pack_idx_entry **objects, int nr_objects, const struct pack_idx_option *, const unsigned char *sha1);
+extern const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects, uint32_t nr_objects, const unsigned char *hash, unsigned flags);
+extern const char *write_mtimes_file(struct pack_idx_entry **objects, uint32_t nr_objects, const uint32_t *mtimes, const unsigned char *hash);
 extern int check_pack_crc(struct packed_git *p, struct pack_window **w_curs, off_t offset, off_t len, unsigned int nr);
 extern int verify_pack_index(struct packed_git *);
 extern int verify_pack(struct packed_git *, verify_fn fn, struct progress *, uint32_t);
@@ -99,6 +123,13 @@ extern int encode_in_pack_object_header(unsigned char *hdr, int hdr_len,
 extern int read_pack_header(int fd, struct pack_header *);
 
 extern struct hashfile *create_tmp_packfile(char **pack_tmp_name);
-extern void finish_tmp_packfile(struct strbuf *name_buffer, const char *pack_tmp_name, struct pack_idx_entry **written_list, uint32_t nr_written, struct pack_idx_option *pack_idx_opts, unsigned char sha1[]);
+/*
+ * Write the .idx (and .rev) file of a temporary pack and rename all of
+ * them to their final names. If "mtimes" is non-NULL, it gives the
+ * mtimes of a cruft pack, in the order of "written_list" which must
+ * then be sorted by object name already, and a .mtimes file is written
+ * as well.
+ */
+extern void finish_tmp_packfile(struct strbuf *name_buffer, const char *pack_tmp_name, struct pack_idx_entry **written_list, uint32_t nr_written, const uint32_t *mtimes, struct pack_idx_option *pack_idx_opts, unsigned char sha1[]);
 
 #endif
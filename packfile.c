@@ -16,6 +16,9 @@
 #include "tree.h"
 #include "object-store.h"
 #include "midx.h"
+#include "pack-revindex.h"
+#include "pack-mtimes.h"
+#include "thread-utils.h"
 
 char *odb_pack_name(struct strbuf *buf,
 		    const unsigned char *sha1,
@@ -48,6 +51,26 @@ static unsigned int pack_max_fds;
 static size_t peak_pack_mapped;
 static size_t pack_mapped;
 
+/*
+ * While object reads are concurrent (see enable_concurrent_object_reads()),
+ * everything above, the windows and descriptors of each pack, and the
+ * list of packs itself are only modified with this lock held.
+ */
+static pthread_mutex_t pack_access_mutex;
+static int pack_access_users;
+
+void pack_access_lock(void)
+{
+	if (pack_access_users)
+		pthread_mutex_lock(&pack_access_mutex);
+}
+
+void pack_access_unlock(void)
+{
+	if (pack_access_users)
+		pthread_mutex_unlock(&pack_access_mutex);
+}
+
 #define SZ_FMT PRIuMAX
 static inline uintmax_t sz_fmt(size_t s) { return s; }
 
@@ -179,10 +202,15 @@ int load_idx(const char *path, const unsigned int hashsz, void *idx_map,
 			return error("pack too large for current definition of off_t in %s", path);
 	}
 
+	/*
+	 * Concurrent readers only take the lock if index_data is still
+	 * NULL; publish it with a release store so that they also see
+	 * the fields above once they see it.
+	 */
 	p->index_version = version;
-	p->index_data = idx_map;
 	p->index_size = idx_size;
 	p->num_objects = nr;
+	store_release_ptr(&p->index_data, idx_map);
 	return 0;
 }
 
@@ -192,20 +220,26 @@ int open_pack_index(struct packed_git *p)
 	size_t len;
 	int ret;
 
-	if (p->index_data)
+	if (load_acquire_ptr(&p->index_data))
 		return 0;
 
+	pack_access_lock();
+	if (p->index_data) {
+		pack_access_unlock();
+		return 0;
+	}
 	if (!strip_suffix(p->pack_name, ".pack", &len))
 		BUG("pack_name does not end in .pack");
 	idx_name = xstrfmt("%.*s.idx", (int)len, p->pack_name);
 	ret = check_packed_git_idx(idx_name, p);
 	free(idx_name);
+	pack_access_unlock();
 	return ret;
 }
 
 uint32_t get_pack_fanout(struct packed_git *p, uint32_t value)
 {
-	const uint32_t *level1_ofs = p->index_data;
+	const uint32_t *level1_ofs = load_acquire_ptr(&p->index_data);
 
 	if (!level1_ofs) {
 		if (open_pack_index(p))
@@ -288,9 +322,13 @@ static int unuse_one_window(struct packed_git *current)
 
 void release_pack_memory(size_t need)
 {
-	size_t cur = pack_mapped;
+	size_t cur;
+
+	pack_access_lock();
+	cur = pack_mapped;
 	while (need >= (cur - pack_mapped) && unuse_one_window(NULL))
 		; /* nothing */
+	pack_access_unlock();
 }
 
 void close_pack_windows(struct packed_git *p)
@@ -334,6 +372,36 @@ void close_pack(struct packed_git *p)
 	close_pack_windows(p);
 	close_pack_fd(p);
 	close_pack_index(p);
+	close_pack_revindex(p);
+	close_pack_mtimes(p);
+}
+
+void unlink_pack_path(const char *pack_name, int force_delete)
+{
+	static const char *exts[] = {".pack", ".idx", ".rev", ".mtimes", ".keep", ".bitmap", ".promisor"};
+	int i;
+	struct strbuf buf = STRBUF_INIT;
+	size_t plen;
+
+	strbuf_addstr(&buf, pack_name);
+	strip_suffix_mem(buf.buf, &buf.len, ".pack");
+	plen = buf.len;
+
+	if (!force_delete) {
+		strbuf_addstr(&buf, ".keep");
+		if (!access(buf.buf, F_OK)) {
+			strbuf_release(&buf);
+			return;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(exts); i++) {
+		strbuf_setlen(&buf, plen);
+		strbuf_addstr(&buf, exts[i]);
+		unlink(buf.buf);
+	}
+
+	strbuf_release(&buf);
 }
 
 void close_all_packs(struct raw_object_store *o)
@@ -594,19 +662,25 @@ unsigned char *use_pack(struct packed_git *p,
 {
 	struct pack_window *win = *w_cursor;
 
-	/* Since packfiles end in a hash of their content and it's
-	 * pointless to ask for an offset into the middle of that
-	 * hash, and the in_window function above wouldn't match
-	 * don't allow an offset too close to the end of the file.
+	/*
+	 * The window under the cursor is in use, hence stays mapped;
+	 * only switching to another one needs the pack access lock.
 	 */
-	if (!p->pack_size && p->pack_fd == -1 && open_packed_git(p))
-		die("packfile %s cannot be accessed", p->pack_name);
-	if (offset > (p->pack_size - the_hash_algo->rawsz))
-		die("offset beyond end of packfile (truncated pack?)");
-	if (offset < 0)
-		die(_("offset before end of packfile (broken .idx?)"));
-
 	if (!win || !in_window(win, offset)) {
+		pack_access_lock();
+
+		/* Since packfiles end in a hash of their content and it's
+		 * pointless to ask for an offset into the middle of that
+		 * hash, and the in_window function above wouldn't match
+		 * don't allow an offset too close to the end of the file.
+		 */
+		if (!p->pack_size && p->pack_fd == -1 && open_packed_git(p))
+			die("packfile %s cannot be accessed", p->pack_name);
+		if (offset > (p->pack_size - the_hash_algo->rawsz))
+			die("offset beyond end of packfile (truncated pack?)");
+		if (offset < 0)
+			die(_("offset before end of packfile (broken .idx?)"));
+
 		if (win)
 			win->inuse_cnt--;
 		for (win = p->windows; win; win = win->next) {
@@ -648,11 +722,11 @@ unsigned char *use_pack(struct packed_git *p,
 			win->next = p->windows;
 			p->windows = win;
 		}
-	}
-	if (win != *w_cursor) {
 		win->last_used = pack_used_ctr++;
 		win->inuse_cnt++;
 		*w_cursor = win;
+
+		pack_access_unlock();
 	}
 	offset -= win->offset;
 	if (left)
@@ -664,7 +738,9 @@ void unuse_pack(struct pack_window **w_cursor)
 {
 	struct pack_window *w = *w_cursor;
 	if (w) {
+		pack_access_lock();
 		w->inuse_cnt--;
+		pack_access_unlock();
 		*w_cursor = NULL;
 	}
 }
@@ -709,6 +785,10 @@ struct packed_git *add_packed_git(const char *path, size_t path_len, int local)
 	if (!access(p->pack_name, F_OK))
 		p->pack_promisor = 1;
 
+	xsnprintf(p->pack_name + path_len, alloc - path_len, ".mtimes");
+	if (!access(p->pack_name, F_OK))
+		p->is_cruft = 1;
+
 	xsnprintf(p->pack_name + path_len, alloc - path_len, ".pack");
 	if (stat(p->pack_name, &st) || !S_ISREG(st.st_mode)) {
 		free(p);
@@ -732,8 +812,12 @@ void install_packed_git(struct repository *r, struct packed_git *pack)
 	if (pack->pack_fd != -1)
 		pack_open_fds++;
 
+	/*
+	 * Concurrent readers may walk the list without a lock; see
+	 * find_pack_entry().
+	 */
 	pack->next = r->objects->packed_git;
-	r->objects->packed_git = pack;
+	store_release_ptr(&r->objects->packed_git, pack);
 }
 
 void (*report_garbage)(unsigned seen_bits, const char *path);
@@ -854,8 +938,13 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 
 	if (!strcmp(file_name, "multi-pack-index"))
 		return;
+	if (starts_with(file_name, "multi-pack-index-") &&
+	    ends_with(file_name, ".bitmap"))
+		return;
 	if (ends_with(file_name, ".idx") ||
 	    ends_with(file_name, ".pack") ||
+	    ends_with(file_name, ".rev") ||
+	    ends_with(file_name, ".mtimes") ||
 	    ends_with(file_name, ".bitmap") ||
 	    ends_with(file_name, ".keep") ||
 	    ends_with(file_name, ".promisor"))
@@ -969,12 +1058,10 @@ static void prepare_packed_git_mru(struct repository *r)
 		list_add_tail(&p->mru, &r->objects->packed_git_mru);
 }
 
-static void prepare_packed_git(struct repository *r)
+static void prepare_packed_git_1(struct repository *r)
 {
 	struct alternate_object_database *alt;
 
-	if (r->objects->packed_git_initialized)
-		return;
 	prepare_multi_pack_index_one(r, r->objects->objectdir, 1);
 	prepare_packed_git_one(r, r->objects->objectdir, 1);
 	prepare_alt_odb(r);
@@ -982,19 +1069,53 @@ static void prepare_packed_git(struct repository *r)
 		prepare_multi_pack_index_one(r, alt->path, 0);
 		prepare_packed_git_one(r, alt->path, 0);
 	}
-	rearrange_packed_git(r);
-
-	r->objects->all_packs = NULL;
 
-	prepare_packed_git_mru(r);
+	/*
+	 * Concurrent readers may be walking the list; new packs have
+	 * been prepended to it, and end_concurrent_pack_access() sorts
+	 * it out.
+	 */
+	if (!r->objects->concurrent_reads) {
+		rearrange_packed_git(r);
+		r->objects->all_packs = NULL;
+		prepare_packed_git_mru(r);
+	}
 	r->objects->packed_git_initialized = 1;
 }
 
+static void prepare_packed_git(struct repository *r)
+{
+	if (r->objects->packed_git_initialized)
+		return;
+	pack_access_lock();
+	if (!r->objects->packed_git_initialized)
+		prepare_packed_git_1(r);
+	pack_access_unlock();
+}
+
 void reprepare_packed_git(struct repository *r)
 {
+	pack_access_lock();
 	r->objects->approximate_object_count_valid = 0;
-	r->objects->packed_git_initialized = 0;
+	prepare_packed_git_1(r);
+	pack_access_unlock();
+}
+
+void begin_concurrent_pack_access(struct repository *r)
+{
 	prepare_packed_git(r);
+	init_delta_base_cache();
+	if (!pack_access_users++)
+		init_recursive_mutex(&pack_access_mutex);
+}
+
+void end_concurrent_pack_access(struct repository *r)
+{
+	if (!--pack_access_users)
+		pthread_mutex_destroy(&pack_access_mutex);
+	rearrange_packed_git(r);
+	r->objects->all_packs = NULL;
+	prepare_packed_git_mru(r);
 }
 
 struct packed_git *get_packed_git(struct repository *r)
@@ -1133,14 +1254,18 @@ void mark_bad_packed_object(struct packed_git *p, const unsigned char *sha1)
 {
 	unsigned i;
 	const unsigned hashsz = the_hash_algo->rawsz;
+
+	pack_access_lock();
 	for (i = 0; i < p->num_bad_objects; i++)
 		if (hasheq(sha1, p->bad_object_sha1 + hashsz * i))
-			return;
+			goto out;
 	p->bad_object_sha1 = xrealloc(p->bad_object_sha1,
 				      st_mult(GIT_MAX_RAWSZ,
 					      st_add(p->num_bad_objects, 1)));
 	hashcpy(p->bad_object_sha1 + hashsz * p->num_bad_objects, sha1);
 	p->num_bad_objects++;
+out:
+	pack_access_unlock();
 }
 
 const struct packed_git *has_packed_and_bad(const unsigned char *sha1)
@@ -1148,19 +1273,22 @@ const struct packed_git *has_packed_and_bad(const unsigned char *sha1)
 	struct packed_git *p;
 	unsigned i;
 
+	pack_access_lock();
 	for (p = the_repository->objects->packed_git; p; p = p->next)
 		for (i = 0; i < p->num_bad_objects; i++)
 			if (hasheq(sha1,
 				   p->bad_object_sha1 + the_hash_algo->rawsz * i))
-				return p;
-	return NULL;
+				goto out;
+out:
+	pack_access_unlock();
+	return p;
 }
 
-static off_t get_delta_base(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t *curpos,
-				    enum object_type type,
-				    off_t delta_obj_offset)
+off_t get_delta_base(struct packed_git *p,
+		     struct pack_window **w_curs,
+		     off_t *curpos,
+		     enum object_type type,
+		     off_t delta_obj_offset)
 {
 	unsigned char *base_info = use_pack(p, w_curs, *curpos, NULL);
 	off_t base_offset;
@@ -1211,18 +1339,17 @@ static const unsigned char *get_delta_base_sha1(struct packed_git *p,
 		unsigned char *base = use_pack(p, w_curs, curpos, NULL);
 		return base;
 	} else if (type == OBJ_OFS_DELTA) {
-		struct revindex_entry *revidx;
+		uint32_t base_pos;
 		off_t base_offset = get_delta_base(p, w_curs, &curpos,
 						   type, delta_obj_offset);
 
 		if (!base_offset)
 			return NULL;
 
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (offset_to_pack_pos(p, base_offset, &base_pos) < 0)
 			return NULL;
 
-		return nth_packed_object_sha1(p, revidx->nr);
+		return nth_packed_object_sha1(p, pack_pos_to_index(p, base_pos));
 	} else
 		return NULL;
 }
@@ -1232,12 +1359,11 @@ static int retry_bad_packed_offset(struct repository *r,
 				   off_t obj_offset)
 {
 	int type;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	struct object_id oid;
-	revidx = find_pack_revindex(p, obj_offset);
-	if (!revidx)
+	if (offset_to_pack_pos(p, obj_offset, &pos) < 0)
 		return OBJ_BAD;
-	nth_packed_object_oid(&oid, p, revidx->nr);
+	nth_packed_object_oid(&oid, p, pack_pos_to_index(p, pos));
 	mark_bad_packed_object(p, oid.hash);
 	type = oid_object_info(r, &oid, NULL);
 	if (type <= OBJ_NONE)
@@ -1315,10 +1441,20 @@ static enum object_type packed_to_object_type(struct repository *r,
 	goto out;
 }
 
-static struct hashmap delta_base_cache;
-static size_t delta_base_cached;
-
-static LIST_HEAD(delta_base_cache_lru);
+/*
+ * The cache of recently used delta bases is split into shards, each
+ * with its own lock, hashmap and LRU list, so that threads reading
+ * objects at the same time only contend when their bases fall into the
+ * same shard. The shards share delta_base_cache_limit: a shard making
+ * room for a new base evicts its own oldest entries first, then those
+ * of the other shards, so that a single shard may hold a base as large
+ * as the whole limit.
+ *
+ * A base that unpack_entry() is still applying a delta to is pinned:
+ * if it gets evicted meanwhile, it leaves the cache but its data is
+ * only freed once unpinned.
+ */
+#define DELTA_BASE_CACHE_SHARDS 16
 
 struct delta_base_cache_key {
 	struct packed_git *p;
@@ -1332,8 +1468,67 @@ struct delta_base_cache_entry {
 	void *data;
 	unsigned long size;
 	enum object_type type;
+	unsigned pinned;
+	unsigned in_cache:1;
+};
+
+struct delta_base_cache_shard {
+	pthread_mutex_t mutex;
+	struct hashmap map;
+	struct list_head lru;
 };
 
+static struct delta_base_cache_shard delta_base_cache[DELTA_BASE_CACHE_SHARDS];
+static int delta_base_cache_initialized;
+
+/*
+ * The size of the bases in all shards. It is only changed with the
+ * shard of the base locked, then this mutex; never take a shard lock
+ * while holding it.
+ */
+static pthread_mutex_t delta_base_cached_mutex;
+static size_t delta_base_cached;
+
+static int delta_base_cache_hash_cmp(const void *unused_cmp_data,
+				     const void *va, const void *vb,
+				     const void *vkey);
+
+void init_delta_base_cache(void)
+{
+	int i;
+
+	if (delta_base_cache_initialized)
+		return;
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *shard = &delta_base_cache[i];
+
+		pthread_mutex_init(&shard->mutex, NULL);
+		hashmap_init(&shard->map, delta_base_cache_hash_cmp, NULL, 0);
+		INIT_LIST_HEAD(&shard->lru);
+	}
+	pthread_mutex_init(&delta_base_cached_mutex, NULL);
+	delta_base_cache_initialized = 1;
+}
+
+/* Account for bytes added to and removed from the cache; return the total. */
+static size_t update_delta_base_cached(size_t added, size_t removed)
+{
+	size_t total;
+
+	pthread_mutex_lock(&delta_base_cached_mutex);
+	delta_base_cached += added;
+	delta_base_cached -= removed;
+	total = delta_base_cached;
+	pthread_mutex_unlock(&delta_base_cached_mutex);
+	return total;
+}
+
+size_t delta_base_cache_size(void)
+{
+	return delta_base_cache_initialized ?
+		update_delta_base_cached(0, 0) : 0;
+}
+
 static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 {
 	unsigned int hash;
@@ -1343,19 +1538,29 @@ static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 	return hash;
 }
 
+/*
+ * The low bits of the hash pick the bucket within a shard; use the
+ * high bits of a multiplicative hash to pick the shard, so that the
+ * entries of a shard still spread over its buckets.
+ */
+static struct delta_base_cache_shard *delta_base_cache_shard(unsigned int hash)
+{
+	if (!delta_base_cache_initialized)
+		BUG("the delta base cache is used before init_delta_base_cache()");
+	return &delta_base_cache[(hash * 2654435761u) >> 28];
+}
+
 static struct delta_base_cache_entry *
-get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
+get_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+			   struct packed_git *p, off_t base_offset)
 {
 	struct hashmap_entry entry;
 	struct delta_base_cache_key key;
 
-	if (!delta_base_cache.cmpfn)
-		return NULL;
-
 	hashmap_entry_init(&entry, pack_entry_hash(p, base_offset));
 	key.p = p;
 	key.base_offset = base_offset;
-	return hashmap_get(&delta_base_cache, &entry, &key);
+	return hashmap_get(&shard->map, &entry, &key);
 }
 
 static int delta_base_cache_key_eq(const struct delta_base_cache_key *a,
@@ -1376,84 +1581,195 @@ static int delta_base_cache_hash_cmp(const void *unused_cmp_data,
 		return !delta_base_cache_key_eq(&a->key, &b->key);
 }
 
-static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
+int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	return !!get_delta_base_cache_entry(p, base_offset);
+	struct delta_base_cache_shard *shard =
+		delta_base_cache_shard(pack_entry_hash(p, base_offset));
+	int ret;
+
+	pthread_mutex_lock(&shard->mutex);
+	ret = !!get_delta_base_cache_entry(shard, p, base_offset);
+	pthread_mutex_unlock(&shard->mutex);
+	return ret;
 }
 
 /*
- * Remove the entry from the cache, but do _not_ free the associated
- * entry data. The caller takes ownership of the "data" buffer, and
- * should copy out any fields it wants before detaching.
+ * Remove the entry from the cache, with the shard locked. Its data is
+ * freed too, unless somebody still has it pinned.
  */
-static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+static void release_delta_base_cache(struct delta_base_cache_shard *shard,
+				     struct delta_base_cache_entry *ent)
 {
-	hashmap_remove(&delta_base_cache, ent, &ent->key);
+	hashmap_remove(&shard->map, ent, &ent->key);
 	list_del(&ent->lru);
-	delta_base_cached -= ent->size;
-	free(ent);
+	update_delta_base_cached(0, ent->size);
+	ent->in_cache = 0;
+	if (!ent->pinned) {
+		free(ent->data);
+		free(ent);
+	}
+}
+
+/*
+ * Return the data of the cached base at base_offset, or NULL if it is
+ * not cached. The caller owns the returned buffer: the entry is taken
+ * out of the cache if nobody else uses it, and copied otherwise.
+ */
+static void *take_delta_base_cache_entry(struct packed_git *p,
+					 off_t base_offset,
+					 unsigned long *size,
+					 enum object_type *type)
+{
+	struct delta_base_cache_shard *shard =
+		delta_base_cache_shard(pack_entry_hash(p, base_offset));
+	struct delta_base_cache_entry *ent;
+	void *data = NULL;
+
+	pthread_mutex_lock(&shard->mutex);
+	ent = get_delta_base_cache_entry(shard, p, base_offset);
+	if (ent) {
+		*type = ent->type;
+		*size = ent->size;
+		if (ent->pinned) {
+			data = xmemdupz(ent->data, ent->size);
+		} else {
+			data = ent->data;
+			ent->data = NULL;
+			release_delta_base_cache(shard, ent);
+		}
+	}
+	pthread_mutex_unlock(&shard->mutex);
+	return data;
 }
 
 static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 				   off_t base_offset, unsigned long *base_size,
 				   enum object_type *type)
 {
+	struct delta_base_cache_shard *shard =
+		delta_base_cache_shard(pack_entry_hash(p, base_offset));
 	struct delta_base_cache_entry *ent;
+	void *data;
 
-	ent = get_delta_base_cache_entry(p, base_offset);
-	if (!ent)
+	pthread_mutex_lock(&shard->mutex);
+	ent = get_delta_base_cache_entry(shard, p, base_offset);
+	if (!ent) {
+		pthread_mutex_unlock(&shard->mutex);
 		return unpack_entry(r, p, base_offset, type, base_size);
+	}
 
 	if (type)
 		*type = ent->type;
 	if (base_size)
 		*base_size = ent->size;
-	return xmemdupz(ent->data, ent->size);
+	data = xmemdupz(ent->data, ent->size);
+	pthread_mutex_unlock(&shard->mutex);
+	return data;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+void clear_delta_base_cache(void)
 {
-	free(ent->data);
-	detach_delta_base_cache_entry(ent);
+	int i;
+
+	if (!delta_base_cache_initialized)
+		return;
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *shard = &delta_base_cache[i];
+		struct list_head *lru, *tmp;
+
+		pthread_mutex_lock(&shard->mutex);
+		list_for_each_safe(lru, tmp, &shard->lru) {
+			struct delta_base_cache_entry *entry =
+				list_entry(lru, struct delta_base_cache_entry, lru);
+			release_delta_base_cache(shard, entry);
+		}
+		pthread_mutex_unlock(&shard->mutex);
+	}
 }
 
-void clear_delta_base_cache(void)
+/*
+ * Evict the oldest bases of the shard, which must be locked, until the
+ * cache fits delta_base_cache_limit or the shard is empty. Returns
+ * whether the cache fits.
+ */
+static int shrink_delta_base_cache_shard(struct delta_base_cache_shard *shard)
 {
 	struct list_head *lru, *tmp;
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *entry =
+
+	list_for_each_safe(lru, tmp, &shard->lru) {
+		struct delta_base_cache_entry *f =
 			list_entry(lru, struct delta_base_cache_entry, lru);
-		release_delta_base_cache(entry);
+		if (update_delta_base_cached(0, 0) <= delta_base_cache_limit)
+			return 1;
+		release_delta_base_cache(shard, f);
 	}
+	return update_delta_base_cached(0, 0) <= delta_base_cache_limit;
 }
 
-static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
-	void *base, unsigned long base_size, enum object_type type)
+/*
+ * Hand the base over to the cache and return its entry, pinned; the
+ * caller may keep using "base" until it calls unpin_delta_base_cache().
+ * Returns NULL, leaving "base" to the caller, if another thread cached
+ * the same base in the meantime.
+ */
+static struct delta_base_cache_entry *
+add_delta_base_cache(struct packed_git *p, off_t base_offset,
+		     void *base, unsigned long base_size, enum object_type type)
 {
-	struct delta_base_cache_entry *ent = xmalloc(sizeof(*ent));
-	struct list_head *lru, *tmp;
-
-	delta_base_cached += base_size;
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = delta_base_cache_shard(hash);
+	struct delta_base_cache_entry *ent;
+	int fits, i;
 
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *f =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
-			break;
-		release_delta_base_cache(f);
+	pthread_mutex_lock(&shard->mutex);
+	if (get_delta_base_cache_entry(shard, p, base_offset)) {
+		pthread_mutex_unlock(&shard->mutex);
+		return NULL;
 	}
 
+	/* make room in our own shard first */
+	update_delta_base_cached(base_size, 0);
+	fits = shrink_delta_base_cache_shard(shard);
+
+	ent = xmalloc(sizeof(*ent));
 	ent->key.p = p;
 	ent->key.base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	list_add_tail(&ent->lru, &delta_base_cache_lru);
+	ent->pinned = 1;
+	ent->in_cache = 1;
+	list_add_tail(&ent->lru, &shard->lru);
+
+	hashmap_entry_init(ent, hash);
+	hashmap_add(&shard->map, ent);
+	pthread_mutex_unlock(&shard->mutex);
+
+	/* then borrow from the others, one lock at a time */
+	for (i = 0; !fits && i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *other = &delta_base_cache[i];
+
+		if (other == shard)
+			continue;
+		pthread_mutex_lock(&other->mutex);
+		fits = shrink_delta_base_cache_shard(other);
+		pthread_mutex_unlock(&other->mutex);
+	}
+	return ent;
+}
+
+static void unpin_delta_base_cache(struct delta_base_cache_entry *ent)
+{
+	struct delta_base_cache_shard *shard =
+		delta_base_cache_shard(pack_entry_hash(ent->key.p,
+						       ent->key.base_offset));
 
-	if (!delta_base_cache.cmpfn)
-		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
-	hashmap_entry_init(ent, pack_entry_hash(p, base_offset));
-	hashmap_add(&delta_base_cache, ent);
+	pthread_mutex_lock(&shard->mutex);
+	if (!--ent->pinned && !ent->in_cache) {
+		free(ent->data);
+		free(ent);
+	}
+	pthread_mutex_unlock(&shard->mutex);
 }
 
 int packed_object_info(struct repository *r, struct packed_git *p,
@@ -1497,8 +1813,14 @@ int packed_object_info(struct repository *r, struct packed_git *p,
 	}
 
 	if (oi->disk_sizep) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		*oi->disk_sizep = revidx[1].offset - obj_offset;
+		uint32_t pos;
+		if (offset_to_pack_pos(p, obj_offset, &pos) < 0) {
+			error("could not find object at offset %"PRIuMAX" "
+			      "in pack %s", (uintmax_t)obj_offset, p->pack_name);
+			type = OBJ_BAD;
+			goto out;
+		}
+		*oi->disk_sizep = pack_pos_to_offset(p, pos + 1) - obj_offset;
 	}
 
 	if (oi->typep || oi->type_name) {
@@ -1630,24 +1952,29 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	for (;;) {
 		off_t base_offset;
 		int i;
-		struct delta_base_cache_entry *ent;
 
-		ent = get_delta_base_cache_entry(p, curpos);
-		if (ent) {
-			type = ent->type;
-			data = ent->data;
-			size = ent->size;
-			detach_delta_base_cache_entry(ent);
+		data = take_delta_base_cache_entry(p, curpos, &size, &type);
+		if (data) {
 			base_from_cache = 1;
 			break;
 		}
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
-			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-			off_t len = revidx[1].offset - obj_offset;
-			if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+			uint32_t pack_pos, index_pos;
+			off_t len;
+
+			if (offset_to_pack_pos(p, obj_offset, &pack_pos) < 0) {
+				error("could not find object at offset %"PRIuMAX" in pack %s",
+				      (uintmax_t)obj_offset, p->pack_name);
+				data = NULL;
+				goto out;
+			}
+
+			len = pack_pos_to_offset(p, pack_pos + 1) - obj_offset;
+			index_pos = pack_pos_to_index(p, pack_pos);
+			if (check_pack_crc(p, &w_curs, obj_offset, len, index_pos)) {
 				struct object_id oid;
-				nth_packed_object_oid(&oid, p, revidx->nr);
+				nth_packed_object_oid(&oid, p, index_pos);
 				error("bad packed object CRC for %s",
 				      oid_to_hex(&oid));
 				mark_bad_packed_object(p, oid.hash);
@@ -1717,13 +2044,18 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		void *delta_data;
 		void *base = data;
 		void *external_base = NULL;
+		struct delta_base_cache_entry *cached_base = NULL;
 		unsigned long delta_size, base_size = size;
 		int i;
 
 		data = NULL;
 
-		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
+		if (base) {
+			cached_base = add_delta_base_cache(p, obj_offset, base,
+							   base_size, type);
+			if (!cached_base)
+				external_base = base;
+		}
 
 		if (!base) {
 			/*
@@ -1732,11 +2064,11 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			 * This is costly but should happen only in the presence
 			 * of a corrupted pack, and is better than failing outright.
 			 */
-			struct revindex_entry *revidx;
+			uint32_t pos;
 			struct object_id base_oid;
-			revidx = find_pack_revindex(p, obj_offset);
-			if (revidx) {
-				nth_packed_object_oid(&base_oid, p, revidx->nr);
+			if (!(offset_to_pack_pos(p, obj_offset, &pos))) {
+				nth_packed_object_oid(&base_oid, p,
+						      pack_pos_to_index(p, pos));
 				error("failed to read delta base object %s"
 				      " at offset %"PRIuMAX" from %s",
 				      oid_to_hex(&base_oid), (uintmax_t)obj_offset,
@@ -1762,6 +2094,8 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			      "at offset %"PRIuMAX" from %s",
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
+			if (cached_base)
+				unpin_delta_base_cache(cached_base);
 			free(external_base);
 			continue;
 		}
@@ -1782,6 +2116,8 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			error("failed to apply delta");
 
 		free(delta_data);
+		if (cached_base)
+			unpin_delta_base_cache(cached_base);
 		free(external_base);
 	}
 
@@ -1826,7 +2162,7 @@ int bsearch_pack(const struct object_id *oid, const struct packed_git *p, uint32
 const unsigned char *nth_packed_object_sha1(struct packed_git *p,
 					    uint32_t n)
 {
-	const unsigned char *index = p->index_data;
+	const unsigned char *index = load_acquire_ptr(&p->index_data);
 	const unsigned int hashsz = the_hash_algo->rawsz;
 	if (!index) {
 		if (open_pack_index(p))
@@ -1891,7 +2227,7 @@ off_t nth_packed_object_offset(const struct packed_git *p, uint32_t n)
 off_t find_pack_entry_one(const unsigned char *sha1,
 				  struct packed_git *p)
 {
-	const unsigned char *index = p->index_data;
+	const unsigned char *index = load_acquire_ptr(&p->index_data);
 	struct object_id oid;
 	uint32_t result;
 
@@ -1908,10 +2244,16 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 
 int is_pack_valid(struct packed_git *p)
 {
+	int ret = 1;
+
 	/* An already open pack is known to be valid. */
 	if (p->pack_fd != -1)
 		return 1;
 
+	pack_access_lock();
+	if (p->pack_fd != -1)
+		goto out;
+
 	/* If the pack has one window completely covering the
 	 * file size, the pack is known to be valid even if
 	 * the descriptor is not currently open.
@@ -1920,11 +2262,14 @@ int is_pack_valid(struct packed_git *p)
 		struct pack_window *w = p->windows;
 
 		if (!w->offset && w->len == p->pack_size)
-			return 1;
+			goto out;
 	}
 
 	/* Force the pack to open to prove its valid. */
-	return !open_packed_git(p);
+	ret = !open_packed_git(p);
+out:
+	pack_access_unlock();
+	return ret;
 }
 
 struct packed_git *find_sha1_pack(const unsigned char *sha1,
@@ -1948,10 +2293,15 @@ static int fill_pack_entry(const struct object_id *oid,
 
 	if (p->num_bad_objects) {
 		unsigned i;
-		for (i = 0; i < p->num_bad_objects; i++)
-			if (hasheq(oid->hash,
-				   p->bad_object_sha1 + the_hash_algo->rawsz * i))
-				return 0;
+		int bad = 0;
+
+		pack_access_lock();
+		for (i = 0; i < p->num_bad_objects && !bad; i++)
+			bad = hasheq(oid->hash,
+				     p->bad_object_sha1 + the_hash_algo->rawsz * i);
+		pack_access_unlock();
+		if (bad)
+			return 0;
 	}
 
 	offset = find_pack_entry_one(oid->hash, p);
@@ -1976,16 +2326,39 @@ int find_pack_entry(struct repository *r, const struct object_id *oid, struct pa
 {
 	struct list_head *pos;
 	struct multi_pack_index *m;
+	struct packed_git *packs;
 
 	prepare_packed_git(r);
-	if (!r->objects->packed_git && !r->objects->multi_pack_index)
+	/*
+	 * Another thread may prepend to either list while we walk them
+	 * (see reprepare_packed_git()); the acquire loads pair with the
+	 * release stores that publish a new head, so that its next
+	 * pointer and contents are visible here too.
+	 */
+	m = load_acquire_ptr(&r->objects->multi_pack_index);
+	packs = load_acquire_ptr(&r->objects->packed_git);
+	if (!packs && !m)
 		return 0;
 
-	for (m = r->objects->multi_pack_index; m; m = m->next) {
+	for (; m; m = m->next) {
 		if (fill_midx_entry(oid, e, m))
 			return 1;
 	}
 
+	/*
+	 * Concurrent readers leave the MRU list alone; the list of packs
+	 * is only ever prepended to meanwhile, so it can be walked without
+	 * a lock.
+	 */
+	if (r->objects->concurrent_reads) {
+		struct packed_git *p;
+
+		for (p = packs; p; p = p->next)
+			if (fill_pack_entry(oid, e, p))
+				return 1;
+		return 0;
+	}
+
 	list_for_each(pos, &r->objects->packed_git_mru) {
 		struct packed_git *p = list_entry(pos, struct packed_git, mru);
 		if (fill_pack_entry(oid, e, p)) {
@@ -2025,7 +2398,7 @@ int for_each_object_in_pack(struct packed_git *p,
 		struct object_id oid;
 
 		if (flags & FOR_EACH_OBJECT_PACK_ORDER)
-			pos = p->revindex[i].nr;
+			pos = pack_pos_to_index(p, i);
 		else
 			pos = i;
 
@@ -82,8 +82,44 @@ extern unsigned char *use_pack(struct packed_git *, struct pack_window **, off_t
 extern void close_pack_windows(struct packed_git *);
 extern void close_pack(struct packed_git *);
 extern void close_all_packs(struct raw_object_store *o);
+
+/*
+ * Remove the files of the pack "pack_name" (ending in ".pack"), the
+ * .idx and all of its other companions. Unless "force_delete" is set,
+ * a pack with a .keep file is left alone.
+ */
+extern void unlink_pack_path(const char *pack_name, int force_delete);
 extern void unuse_pack(struct pack_window **);
 extern void clear_delta_base_cache(void);
+
+/*
+ * Set up the delta base cache. main() does so before anything else,
+ * so that threads never race to initialize it.
+ */
+extern void init_delta_base_cache(void);
+
+/*
+ * Whether the delta base cache holds the object at "offset" in "p", and
+ * the size of all the bases it holds; mostly for tests.
+ */
+extern int in_delta_base_cache(struct packed_git *p, off_t offset);
+extern size_t delta_base_cache_size(void);
+
+/*
+ * The packfile.c side of enable_concurrent_object_reads() and
+ * disable_concurrent_object_reads(); do not call them directly.
+ */
+extern void begin_concurrent_pack_access(struct repository *r);
+extern void end_concurrent_pack_access(struct repository *r);
+
+/*
+ * While object reads are concurrent, this lock serializes opening
+ * packs and their indexes, managing pack windows and descriptors, and
+ * rescanning the pack directories. It is recursive, and a no-op when
+ * reads are not concurrent.
+ */
+extern void pack_access_lock(void);
+extern void pack_access_unlock(void);
 extern struct packed_git *add_packed_git(const char *path, size_t path_len, int local);
 
 /*
@@ -136,6 +172,15 @@ extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsig
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
 extern int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
 
+/*
+ * Return the offset of the base of the delta object at "delta_obj_offset"
+ * of type "type" in "p", reading the base reference at "*curpos" and
+ * advancing it past. Returns 0 if the base cannot be found in "p".
+ */
+extern off_t get_delta_base(struct packed_git *p, struct pack_window **w_curs,
+			    off_t *curpos, enum object_type type,
+			    off_t delta_obj_offset);
+
 extern void release_pack_memory(size_t);
 
 /* global flag to enable extra checks when accessing packed objects */
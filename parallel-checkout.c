@@ -0,0 +1,548 @@
+#include "cache.h"
+#include "config.h"
+#include "parallel-checkout.h"
+#include "pkt-line.h"
+#include "progress.h"
+#include "run-command.h"
+#include "streaming.h"
+#include "thread-utils.h"
+
+struct parallel_checkout {
+	enum pc_status status;
+	struct parallel_checkout_item *items; /* The parallel checkout queue. */
+	size_t nr, alloc;
+	struct progress *progress;
+	unsigned int *progress_cnt;
+};
+
+static struct parallel_checkout parallel_checkout;
+
+enum pc_status parallel_checkout_status(void)
+{
+	return parallel_checkout.status;
+}
+
+static const int DEFAULT_THRESHOLD_FOR_PARALLELISM = 100;
+static const int DEFAULT_NUM_WORKERS = 1;
+
+void get_parallel_checkout_configs(int *num_workers, int *threshold)
+{
+	const char *env_workers = getenv("GIT_TEST_CHECKOUT_WORKERS");
+
+	if (env_workers && *env_workers) {
+		if (strtol_i(env_workers, 10, num_workers))
+			die(_("invalid value for '%s': '%s'"),
+			    "GIT_TEST_CHECKOUT_WORKERS", env_workers);
+		if (*num_workers < 1)
+			*num_workers = online_cpus();
+		*threshold = 0;
+		return;
+	}
+
+	if (git_config_get_int("checkout.workers", num_workers))
+		*num_workers = DEFAULT_NUM_WORKERS;
+	else if (*num_workers < 1)
+		*num_workers = online_cpus();
+
+	if (git_config_get_int("checkout.thresholdForParallelism", threshold))
+		*threshold = DEFAULT_THRESHOLD_FOR_PARALLELISM;
+}
+
+void init_parallel_checkout(void)
+{
+	if (parallel_checkout.status != PC_UNINITIALIZED)
+		BUG("parallel checkout already initialized");
+
+	parallel_checkout.status = PC_ACCEPTING_ENTRIES;
+}
+
+static void finish_parallel_checkout(void)
+{
+	size_t i;
+
+	if (parallel_checkout.status == PC_UNINITIALIZED)
+		BUG("cannot finish parallel checkout: not initialized yet");
+
+	for (i = 0; i < parallel_checkout.nr; i++)
+		free((char *)parallel_checkout.items[i].ca.working_tree_encoding);
+	free(parallel_checkout.items);
+	memset(&parallel_checkout, 0, sizeof(parallel_checkout));
+}
+
+static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
+					     const struct conv_attrs *ca,
+					     const struct checkout *state)
+{
+	size_t packed_item_size;
+
+	/* the workers write paths relative to the top of the worktree */
+	if (state->base_dir_len)
+		return 0;
+
+	/*
+	 * Smudge and process filters run in the main process, where they
+	 * can also delay the entry.
+	 */
+	if (ca->drv)
+		return 0;
+
+	switch (ce->ce_mode & S_IFMT) {
+	case S_IFREG:
+	case S_IFLNK:
+		break;
+	default:
+		return 0;
+	}
+
+	/* the whole item has to fit in one packet */
+	packed_item_size = sizeof(struct pc_item_fixed_portion) + ce->ce_namelen +
+		(ca->working_tree_encoding ? strlen(ca->working_tree_encoding) : 0);
+	return packed_item_size <= LARGE_PACKET_DATA_MAX;
+}
+
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state)
+{
+	struct parallel_checkout_item *pc_item;
+	struct conv_attrs ca;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES)
+		return -1;
+
+	convert_attrs(state->istate, &ca, ce->name);
+	if (!is_eligible_for_parallel_checkout(ce, &ca, state))
+		return -1;
+
+	ALLOC_GROW(parallel_checkout.items, parallel_checkout.nr + 1,
+		   parallel_checkout.alloc);
+
+	pc_item = &parallel_checkout.items[parallel_checkout.nr];
+	memset(pc_item, 0, sizeof(*pc_item));
+	pc_item->id = parallel_checkout.nr++;
+	pc_item->ce = ce;
+	pc_item->ca = ca;
+	/* the attribute value would not survive the attr stack */
+	pc_item->ca.working_tree_encoding = xstrdup_or_null(ca.working_tree_encoding);
+	pc_item->status = PC_ITEM_PENDING;
+	return 0;
+}
+
+size_t pc_queue_size(void)
+{
+	return parallel_checkout.nr;
+}
+
+static void advance_progress_meter(void)
+{
+	if (parallel_checkout.progress) {
+		(*parallel_checkout.progress_cnt)++;
+		display_progress(parallel_checkout.progress,
+				 *parallel_checkout.progress_cnt);
+	}
+}
+
+static int handle_results(struct checkout *state)
+{
+	int ret = 0;
+	size_t i;
+	int have_pending = 0;
+
+	/*
+	 * Record the stat data of the written entries first, so that
+	 * mark_colliding_entries() can find them when the colliding ones
+	 * are retried below.
+	 */
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+		if (pc_item->status == PC_ITEM_WRITTEN)
+			update_ce_after_write(state, pc_item->ce, &pc_item->st);
+	}
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+		switch (pc_item->status) {
+		case PC_ITEM_WRITTEN:
+			break;
+		case PC_ITEM_COLLIDED:
+			/*
+			 * Another entry was written to the same path, or to
+			 * one of its leading directories (e.g. on a
+			 * case-insensitive filesystem). Now that the others
+			 * are in place, write it the usual way, which also
+			 * reports the collision when cloning.
+			 */
+			ret |= checkout_entry(pc_item->ce, state, NULL);
+			advance_progress_meter();
+			break;
+		case PC_ITEM_PENDING:
+			have_pending = 1;
+			/* fall through */
+		case PC_ITEM_FAILED:
+			ret = -1;
+			break;
+		}
+	}
+
+	if (have_pending)
+		error(_("parallel checkout finished with pending entries"));
+
+	return ret;
+}
+
+static int reset_fd(int fd, const char *path)
+{
+	if (lseek(fd, 0, SEEK_SET) != 0)
+		return error_errno("failed to rewind descriptor of '%s'", path);
+	if (ftruncate(fd, 0))
+		return error_errno("failed to truncate file '%s'", path);
+	return 0;
+}
+
+static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
+			       const char *path)
+{
+	const struct cache_entry *ce = pc_item->ce;
+	int ret;
+	void *blob;
+	size_t size;
+	unsigned long blob_size;
+	struct stream_filter *filter;
+	struct strbuf buf = STRBUF_INIT;
+
+	if (S_ISREG(ce->ce_mode)) {
+		filter = get_stream_filter_ca(&pc_item->ca, &ce->oid);
+		if (filter) {
+			if (!stream_blob_to_fd(fd, &ce->oid, filter, 1))
+				return 0;
+			/* try again without streaming */
+			if (reset_fd(fd, path))
+				return -1;
+		}
+	}
+
+	blob = read_blob_entry(ce, &blob_size);
+	if (!blob)
+		return error("unable to read sha1 file of %s (%s)",
+			     path, oid_to_hex(&ce->oid));
+	size = blob_size;
+
+	if (S_ISREG(ce->ce_mode) &&
+	    convert_to_working_tree_ca(&pc_item->ca, ce->name, blob, size, &buf)) {
+		free(blob);
+		blob = strbuf_detach(&buf, &size);
+	}
+
+	ret = write_in_full(fd, blob, size);
+	free(blob);
+	if (ret < 0)
+		return error("unable to write file %s", path);
+
+	return 0;
+}
+
+static int close_and_clear(int *fd)
+{
+	int ret = 0;
+
+	if (*fd >= 0) {
+		ret = close(*fd);
+		*fd = -1;
+	}
+
+	return ret;
+}
+
+void write_pc_item(struct parallel_checkout_item *pc_item,
+		   struct checkout *state)
+{
+	unsigned int mode = (pc_item->ce->ce_mode & 0100) ? 0777 : 0666;
+	int fd = -1, fstat_done = 0;
+	struct strbuf path = STRBUF_INIT;
+	const char *dir_sep;
+
+	strbuf_add(&path, state->base_dir, state->base_dir_len);
+	strbuf_add(&path, pc_item->ce->name, pc_item->ce->ce_namelen);
+
+	/*
+	 * checkout_entry() created the leading directories, but another
+	 * entry may have been written over one of them since, e.g. as a
+	 * symlink on a case-insensitive filesystem. Let it sort that out.
+	 */
+	dir_sep = find_last_dir_sep(path.buf);
+	if (dir_sep && !has_dirs_only_path(path.buf, dir_sep - path.buf,
+					   state->base_dir_len)) {
+		pc_item->status = PC_ITEM_COLLIDED;
+		goto out;
+	}
+
+	if (S_ISLNK(pc_item->ce->ce_mode) && has_symlinks) {
+		unsigned long size;
+		char *target = read_blob_entry(pc_item->ce, &size);
+
+		if (!target) {
+			error("unable to read sha1 file of %s (%s)",
+			      path.buf, oid_to_hex(&pc_item->ce->oid));
+			pc_item->status = PC_ITEM_FAILED;
+			goto out;
+		}
+		if (symlink(target, path.buf)) {
+			if (errno == EEXIST)
+				pc_item->status = PC_ITEM_COLLIDED;
+			else {
+				error_errno("unable to create symlink %s", path.buf);
+				pc_item->status = PC_ITEM_FAILED;
+			}
+			free(target);
+			goto out;
+		}
+		free(target);
+	} else {
+		fd = open(path.buf, O_WRONLY | O_CREAT | O_EXCL, mode);
+		if (fd < 0) {
+			if (errno == EEXIST || errno == EISDIR ||
+			    errno == ENOENT || errno == ENOTDIR) {
+				pc_item->status = PC_ITEM_COLLIDED;
+			} else {
+				error_errno("unable to create file %s", path.buf);
+				pc_item->status = PC_ITEM_FAILED;
+			}
+			goto out;
+		}
+
+		if (write_pc_item_to_fd(pc_item, fd, path.buf)) {
+			/* Error was already reported. */
+			pc_item->status = PC_ITEM_FAILED;
+			close_and_clear(&fd);
+			unlink(path.buf);
+			goto out;
+		}
+
+		fstat_done = fstat_checkout_output(fd, state, &pc_item->st);
+
+		if (close_and_clear(&fd)) {
+			error_errno("unable to close file %s", path.buf);
+			pc_item->status = PC_ITEM_FAILED;
+			goto out;
+		}
+	}
+
+	if (state->refresh_cache && !fstat_done &&
+	    lstat(path.buf, &pc_item->st) < 0) {
+		error_errno("unable to stat just-written file %s", path.buf);
+		pc_item->status = PC_ITEM_FAILED;
+		goto out;
+	}
+
+	pc_item->status = PC_ITEM_WRITTEN;
+
+out:
+	strbuf_release(&path);
+}
+
+static void write_items_sequentially(struct checkout *state)
+{
+	size_t i;
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+		write_pc_item(pc_item, state);
+		if (pc_item->status != PC_ITEM_COLLIDED)
+			advance_progress_meter();
+	}
+}
+
+/*
+ * Items are handed out to the workers in round-robin chunks of this
+ * size: chunks keep entries of the same directory together, while
+ * interleaving them spreads the large files of a subtree.
+ */
+#define ASSIGNMENT_SIZE 10
+
+static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
+{
+	size_t len_data;
+	char *data, *variant;
+	struct pc_item_fixed_portion *fixed_portion;
+	const char *working_tree_encoding = pc_item->ca.working_tree_encoding;
+	size_t name_len = pc_item->ce->ce_namelen;
+	size_t working_tree_encoding_len = working_tree_encoding ?
+					   strlen(working_tree_encoding) : 0;
+
+	len_data = sizeof(struct pc_item_fixed_portion) + name_len +
+		   working_tree_encoding_len;
+
+	/* zeroed, so that the padding of the structure is deterministic */
+	data = xcalloc(1, len_data);
+
+	fixed_portion = (struct pc_item_fixed_portion *)data;
+	fixed_portion->id = pc_item->id;
+	fixed_portion->ce_mode = pc_item->ce->ce_mode;
+	fixed_portion->crlf_action = pc_item->ca.crlf_action;
+	fixed_portion->ident = pc_item->ca.ident;
+	fixed_portion->name_len = name_len;
+	fixed_portion->working_tree_encoding_len = working_tree_encoding_len;
+	oidcpy(&fixed_portion->oid, &pc_item->ce->oid);
+
+	variant = data + sizeof(*fixed_portion);
+	if (working_tree_encoding_len) {
+		memcpy(variant, working_tree_encoding, working_tree_encoding_len);
+		variant += working_tree_encoding_len;
+	}
+	memcpy(variant, pc_item->ce->name, name_len);
+
+	packet_write(fd, data, len_data);
+
+	free(data);
+}
+
+static void parse_and_save_result(const char *buffer, int len)
+{
+	struct pc_item_result res;
+	struct parallel_checkout_item *pc_item;
+
+	if (len != sizeof(res))
+		BUG("checkout worker sent a result of %d bytes, expected %d",
+		    len, (int)sizeof(res));
+	memcpy(&res, buffer, sizeof(res));
+
+	if (res.id >= parallel_checkout.nr)
+		BUG("checkout worker sent unknown item id");
+	pc_item = &parallel_checkout.items[res.id];
+	if (pc_item->status != PC_ITEM_PENDING)
+		BUG("checkout worker sent a result for item %"PRIuMAX" twice",
+		    (uintmax_t)res.id);
+
+	pc_item->status = res.status;
+	if (res.status == PC_ITEM_WRITTEN)
+		pc_item->st = res.st;
+
+	if (res.status != PC_ITEM_COLLIDED)
+		advance_progress_meter();
+}
+
+static void gather_results_from_workers(struct child_process *workers,
+					int num_workers)
+{
+	int i, active_workers = num_workers;
+	struct pollfd *pfds;
+
+	ALLOC_ARRAY(pfds, num_workers);
+	for (i = 0; i < num_workers; i++) {
+		pfds[i].fd = workers[i].out;
+		pfds[i].events = POLLIN;
+	}
+
+	while (active_workers) {
+		int nr = poll(pfds, num_workers, -1);
+
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			die_errno("failed to poll checkout workers");
+		}
+
+		for (i = 0; i < num_workers && nr > 0; i++) {
+			struct pollfd *pfd = &pfds[i];
+			int len;
+
+			if (!pfd->revents)
+				continue;
+			nr--;
+
+			len = packet_read(pfd->fd, NULL, NULL, packet_buffer,
+					  sizeof(packet_buffer),
+					  PACKET_READ_GENTLE_ON_EOF);
+			if (len > 0) {
+				parse_and_save_result(packet_buffer, len);
+				continue;
+			}
+
+			/*
+			 * A flush packet ends the results of a worker; a
+			 * worker that died may have left items pending,
+			 * which handle_results() reports.
+			 */
+			pfd->fd = -1;
+			active_workers--;
+		}
+	}
+
+	free(pfds);
+}
+
+static void run_workers(int num_workers)
+{
+	struct child_process *workers;
+	size_t i;
+	int w;
+
+	ALLOC_ARRAY(workers, num_workers);
+	for (w = 0; w < num_workers; w++) {
+		struct child_process *cp = &workers[w];
+
+		child_process_init(cp);
+		cp->git_cmd = 1;
+		cp->in = -1;
+		cp->out = -1;
+		cp->clean_on_exit = 1;
+		argv_array_push(&cp->args, "checkout--worker");
+		if (start_command(cp))
+			die(_("failed to spawn checkout worker"));
+	}
+
+	/*
+	 * The workers read all their items before writing anything back,
+	 * so sending them all up front cannot deadlock.
+	 */
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		w = (i / ASSIGNMENT_SIZE) % num_workers;
+		send_one_item(workers[w].in, &parallel_checkout.items[i]);
+	}
+	for (w = 0; w < num_workers; w++) {
+		packet_flush(workers[w].in);
+		close(workers[w].in);
+	}
+
+	gather_results_from_workers(workers, num_workers);
+
+	for (w = 0; w < num_workers; w++) {
+		close(workers[w].out);
+		if (finish_command(&workers[w]))
+			error(_("checkout worker %d finished with error"), w);
+	}
+
+	free(workers);
+}
+
+int run_parallel_checkout(struct checkout *state, int num_workers,
+			  int threshold, struct progress *progress,
+			  unsigned int *progress_cnt)
+{
+	int ret;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES)
+		BUG("cannot run parallel checkout: uninitialized or already running");
+
+	trace_performance_enter();
+	parallel_checkout.status = PC_RUNNING;
+	parallel_checkout.progress = progress;
+	parallel_checkout.progress_cnt = progress_cnt;
+
+	if (parallel_checkout.nr < num_workers)
+		num_workers = parallel_checkout.nr;
+
+	if (num_workers <= 1 || parallel_checkout.nr < threshold)
+		write_items_sequentially(state);
+	else
+		run_workers(num_workers);
+
+	/* Flush cached lstat in fscache after writing to disk. */
+	flush_fscache();
+
+	ret = handle_results(state);
+
+	trace_performance_leave("parallel checkout of %"PRIuMAX" entries",
+				(uintmax_t)parallel_checkout.nr);
+	finish_parallel_checkout();
+	return ret;
+}
@@ -0,0 +1,109 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+#include "convert.h"
+
+struct cache_entry;
+struct checkout;
+struct progress;
+
+/****************************************************************
+ * Users of parallel checkout
+ ****************************************************************/
+
+enum pc_status {
+	PC_UNINITIALIZED = 0,
+	PC_ACCEPTING_ENTRIES,
+	PC_RUNNING,
+};
+
+enum pc_status parallel_checkout_status(void);
+
+/*
+ * Read checkout.workers and checkout.thresholdForParallelism. A
+ * number of workers of 1 disables parallel checkout.
+ */
+void get_parallel_checkout_configs(int *num_workers, int *threshold);
+
+/*
+ * Put parallel checkout into the PC_ACCEPTING_ENTRIES state. Should be
+ * used only when num_workers > 1.
+ */
+void init_parallel_checkout(void);
+
+/*
+ * Return -1 if parallel checkout is currently not accepting entries or
+ * if the entry cannot be checked out in parallel (e.g. it is subject to
+ * a smudge filter, or is a submodule). Otherwise, queue the entry for
+ * run_parallel_checkout() and return 0. The entry's leading directories
+ * must already exist and no file may be in its way.
+ */
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state);
+size_t pc_queue_size(void);
+
+/*
+ * Write the queued entries, using up to 'num_workers' worker processes
+ * when there are at least 'threshold' of them, update their stat data
+ * and leave parallel checkout. Entries that turn out to collide with
+ * each other on the filesystem are written sequentially at the end.
+ * Returns 0 on success, or -1 if any entry could not be written.
+ */
+int run_parallel_checkout(struct checkout *state, int num_workers,
+			  int threshold, struct progress *progress,
+			  unsigned int *progress_cnt);
+
+/****************************************************************
+ * Interface with checkout--worker
+ ****************************************************************/
+
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	/*
+	 * The entry could not be written because there was another file
+	 * already present in its path or leading directories.
+	 */
+	PC_ITEM_COLLIDED,
+	PC_ITEM_FAILED,
+};
+
+struct parallel_checkout_item {
+	/* position in the queue, used to match the workers' results */
+	size_t id;
+	struct cache_entry *ce;
+	struct conv_attrs ca;
+	struct stat st;
+	enum pc_item_status status;
+};
+
+/*
+ * The fixed-size portion of an item as sent to a worker; it is followed
+ * by the working tree encoding and the path of the entry, without
+ * terminating NULs. Workers run from the same binary, so the structure
+ * is sent as is.
+ */
+struct pc_item_fixed_portion {
+	size_t id;
+	struct object_id oid;
+	unsigned int ce_mode;
+	enum crlf_action crlf_action;
+	int ident;
+	size_t working_tree_encoding_len;
+	size_t name_len;
+};
+
+/* What a worker sends back for each item. */
+struct pc_item_result {
+	size_t id;
+	enum pc_item_status status;
+	struct stat st;
+};
+
+/*
+ * Write the item to the working tree, setting its status and, when the
+ * state asks for it, its stat data.
+ */
+void write_pc_item(struct parallel_checkout_item *pc_item,
+		   struct checkout *state);
+
+#endif /* PARALLEL_CHECKOUT_H */
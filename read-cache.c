@@ -21,6 +21,7 @@
 #include "strbuf.h"
 #include "varint.h"
 #include "split-index.h"
+#include "sparse-index.h"
 #include "utf8.h"
 #include "fsmonitor.h"
 #include "thread-utils.h"
@@ -47,6 +48,7 @@
 #define CACHE_EXT_FSMONITOR 0x46534D4E	  /* "FSMN" */
 #define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
 #define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
+#define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
@@ -979,8 +981,11 @@ int verify_path(const char *path, unsigned mode)
 			}
 
 			c = *path++;
+			/* only sparse directory entries end with a slash */
+			if (c == '\0')
+				return S_ISSPARSEDIR(mode);
 			if ((c == '.' && !verify_dotfile(path, mode)) ||
-			    is_dir_sep(c) || c == '\0')
+			    is_dir_sep(c))
 				return 0;
 		}
 		c = *path++;
@@ -1279,6 +1284,17 @@ static int add_index_entry_with_check(struct index_state *istate, struct cache_e
 	}
 	pos = -pos-1;
 
+	/*
+	 * A path inside a sparse directory entry needs the entries of
+	 * that directory in the index.
+	 */
+	if (pos && istate->sparse_index &&
+	    S_ISSPARSEDIR(istate->cache[pos - 1]->ce_mode) &&
+	    starts_with(ce->name, istate->cache[pos - 1]->name)) {
+		ensure_full_index(istate);
+		return add_index_entry_with_check(istate, ce, option);
+	}
+
 	if (!(option & ADD_CACHE_KEEP_CACHE_TREE))
 		untracked_cache_add_to_index(istate, ce->name);
 
@@ -1720,6 +1736,10 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_FSMONITOR:
 		read_fsmonitor_extension(istate, data, sz);
 		break;
+	case CACHE_EXT_SPARSE_DIRECTORIES:
+		/* no content, only an indication that this is a sparse index */
+		istate->sparse_index = 1;
+		break;
 	case CACHE_EXT_ENDOFINDEXENTRIES:
 	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
 		/* already handled in do_read_index() */
@@ -1890,12 +1910,23 @@ static void tweak_split_index(struct index_state *istate)
 	}
 }
 
+static void tweak_sparse_index(struct index_state *istate)
+{
+	if (!istate->sparse_index)
+		return;
+	if (command_requires_full_index ||
+	    !is_sparse_index_allowed(istate) ||
+	    sparse_directories_present(istate))
+		ensure_full_index(istate);
+}
+
 static void post_read_index_from(struct index_state *istate)
 {
 	check_ce_order(istate);
 	tweak_untracked_cache(istate);
 	tweak_split_index(istate);
 	tweak_fsmonitor(istate);
+	tweak_sparse_index(istate);
 }
 
 static size_t estimate_cache_size_from_compressed(unsigned int entries)
@@ -2320,6 +2351,7 @@ int discard_index(struct index_state *istate)
 	free_name_hash(istate);
 	cache_tree_free(&(istate->cache_tree));
 	istate->initialized = 0;
+	istate->sparse_index = 0;
 	FREE_AND_NULL(istate->cache);
 	istate->cache_alloc = 0;
 	discard_split_index(istate);
@@ -2960,6 +2992,15 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		if (err)
 			return -1;
 	}
+	/*
+	 * Written even when stripping extensions: a reader that does not
+	 * know about sparse directory entries must not accept the index.
+	 */
+	if (istate->sparse_index) {
+		if (write_index_ext_header(&c, &eoie_c, newfd,
+					   CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0)
+			return -1;
+	}
 
 	/*
 	 * CACHE_EXT_ENDOFINDEXENTRIES must be written as the last entry before the SHA1
@@ -3146,6 +3187,7 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 {
 	int new_shared_index, ret;
 	struct split_index *si = istate->split_index;
+	struct full_index full;
 
 	if (git_env_bool("GIT_TEST_CHECK_CACHE_TREE", 0))
 		cache_tree_verify(istate);
@@ -3156,6 +3198,19 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 		return 0;
 	}
 
+	/*
+	 * Write the index in its sparse form if we can. A command that
+	 * needs the full index gets its own entries back afterwards; one
+	 * that does not keeps working on the sparse index.
+	 */
+	memset(&full, 0, sizeof(full));
+	if (!is_sparse_index_allowed(istate))
+		ensure_full_index(istate);
+	else if (command_requires_full_index)
+		convert_to_sparse_temporarily(istate, &full);
+	else
+		convert_to_sparse(istate);
+
 	if (istate->fsmonitor_last_update)
 		fill_fsmonitor_bitmap(istate);
 
@@ -3211,6 +3266,7 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 out:
 	if (flags & COMMIT_LOCK)
 		rollback_lock_file(lock);
+	restore_full_index(istate, &full);
 	return ret;
 }
 
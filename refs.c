@@ -1724,16 +1724,19 @@ static struct ref_store *lookup_ref_store_map(struct hashmap *map,
 }
 
 /*
- * Create, record, and return a ref_store instance for the specified
- * gitdir.
+ * Create a ref store for the repository at `gitdir`, whose refs are
+ * stored by the backend `be_name` (NULL for the default "files").
  */
 static struct ref_store *ref_store_init(const char *gitdir,
+					const char *be_name,
 					unsigned int flags)
 {
-	const char *be_name = "files";
-	struct ref_storage_be *be = find_ref_storage_backend(be_name);
+	struct ref_storage_be *be;
 	struct ref_store *refs;
 
+	if (!be_name)
+		be_name = "files";
+	be = find_ref_storage_backend(be_name);
 	if (!be)
 		BUG("reference backend %s is unknown", be_name);
 
@@ -1749,7 +1752,8 @@ struct ref_store *get_main_ref_store(struct repository *r)
 	if (!r->gitdir)
 		BUG("attempting to get main_ref_store outside of repository");
 
-	r->refs = ref_store_init(r->gitdir, REF_STORE_ALL_CAPS);
+	r->refs = ref_store_init(r->gitdir, r->ref_storage_format,
+				 REF_STORE_ALL_CAPS);
 	return r->refs;
 }
 
@@ -1769,11 +1773,31 @@ static void register_ref_store_map(struct hashmap *map,
 		BUG("%s ref_store '%s' initialized twice", type, name);
 }
 
+/*
+ * Return the ref storage format recorded in the config of the
+ * repository at `gitdir`, or NULL for the default one.
+ */
+static char *read_ref_storage_format(const char *gitdir)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct repository_format format;
+	char *ret;
+
+	get_common_dir_noenv(&sb, gitdir);
+	strbuf_addstr(&sb, "/config");
+	read_repository_format(&format, sb.buf);
+	strbuf_release(&sb);
+
+	ret = xstrdup_or_null(format.ref_storage);
+	clear_repository_format(&format);
+	return ret;
+}
+
 struct ref_store *get_submodule_ref_store(const char *submodule)
 {
 	struct strbuf submodule_sb = STRBUF_INIT;
 	struct ref_store *refs;
-	char *to_free = NULL;
+	char *to_free = NULL, *format;
 	size_t len;
 
 	if (!submodule)
@@ -1801,8 +1825,10 @@ struct ref_store *get_submodule_ref_store(const char *submodule)
 		goto done;
 
 	/* assume that add_submodule_odb() has been called */
-	refs = ref_store_init(submodule_sb.buf,
+	format = read_ref_storage_format(submodule_sb.buf);
+	refs = ref_store_init(submodule_sb.buf, format,
 			      REF_STORE_READ | REF_STORE_ODB);
+	free(format);
 	register_ref_store_map(&submodule_ref_stores, "submodule",
 			       refs, submodule);
 
@@ -1828,9 +1854,11 @@ struct ref_store *get_worktree_ref_store(const struct worktree *wt)
 
 	if (wt->id)
 		refs = ref_store_init(git_common_path("worktrees/%s", wt->id),
+				      the_repository->ref_storage_format,
 				      REF_STORE_ALL_CAPS);
 	else
 		refs = ref_store_init(get_git_common_dir(),
+				      the_repository->ref_storage_format,
 				      REF_STORE_ALL_CAPS);
 
 	if (refs)
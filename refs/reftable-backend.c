@@ -0,0 +1,1914 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "reftable.h"
+#include "../iterator.h"
+#include "../lockfile.h"
+#include "../object.h"
+#include "../dir.h"
+#include "../chdir-notify.h"
+#include "../worktree.h"
+
+/*
+ * Flag values for ref_update::flags, as in files-backend.c. These
+ * numerical values must not conflict with REF_NO_DEREF,
+ * REF_FORCE_CREATE_REFLOG, REF_HAVE_NEW or REF_HAVE_OLD.
+ */
+
+/* The reference is being deleted. */
+#define REF_DELETING (1 << 5)
+
+/* The reference must be written by ref_transaction_finish(). */
+#define REF_NEEDS_COMMIT (1 << 6)
+
+/*
+ * Only the reflog of the reference is updated; this is used for
+ * symbolic references and for HEAD when its referent is updated.
+ */
+#define REF_LOG_ONLY (1 << 7)
+
+/* The update was split off of an update of HEAD. */
+#define REF_UPDATE_VIA_HEAD (1 << 8)
+
+/*
+ * Reflogs are created without an entry by writing this marker: a log
+ * record with null object names at update index 0, which no actual
+ * update uses. It is never shown to the callers.
+ */
+#define REFLOG_MARKER_INDEX 0
+
+struct reftable_ref_store {
+	struct ref_store base;
+	unsigned int store_flags;
+
+	char *gitdir;
+	char *gitcommondir;
+
+	/* The refs shared by all worktrees, and those of the main worktree */
+	struct reftable_stack main_stack;
+
+	/* The per-worktree refs of a linked worktree */
+	struct reftable_stack worktree_stack;
+	int has_worktree_stack;
+
+	/*
+	 * The stacks of other linked worktrees, opened for their HEAD,
+	 * keyed by the name of the worktree.
+	 */
+	struct string_list other_stacks;
+};
+
+static void configure_stack(struct reftable_stack *st)
+{
+	int value;
+
+	if (!git_config_get_int("reftable.blocksize", &value)) {
+		if (value < 256 || value > 0xffffff)
+			die(_("invalid value for reftable.blockSize: %d"), value);
+		st->block_size = value;
+	}
+	if (!git_config_get_bool("reftable.autocompaction", &value))
+		st->auto_compact = value;
+}
+
+static void init_stack(struct reftable_stack *st, const char *dir)
+{
+	reftable_stack_init(st, dir);
+	configure_stack(st);
+	chdir_notify_reparent("reftable-backend stack", &st->dir);
+	chdir_notify_reparent("reftable-backend stack list", &st->list_file);
+}
+
+static struct ref_store *reftable_ref_store_create(const char *gitdir,
+						   unsigned int flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct ref_store *ref_store = (struct ref_store *)refs;
+	struct strbuf sb = STRBUF_INIT;
+
+	base_ref_store_init(ref_store, &refs_be_reftable);
+	refs->store_flags = flags;
+
+	refs->gitdir = xstrdup(gitdir);
+	get_common_dir_noenv(&sb, gitdir);
+	refs->gitcommondir = strbuf_detach(&sb, NULL);
+
+	strbuf_addf(&sb, "%s/reftable", refs->gitcommondir);
+	init_stack(&refs->main_stack, sb.buf);
+	if (strcmp(refs->gitdir, refs->gitcommondir)) {
+		strbuf_reset(&sb);
+		strbuf_addf(&sb, "%s/reftable", refs->gitdir);
+		init_stack(&refs->worktree_stack, sb.buf);
+		refs->has_worktree_stack = 1;
+	}
+	string_list_init(&refs->other_stacks, 1);
+	strbuf_release(&sb);
+
+	chdir_notify_reparent("reftable-backend $GIT_DIR",
+			      &refs->gitdir);
+	chdir_notify_reparent("reftable-backend $GIT_COMMONDIR",
+			      &refs->gitcommondir);
+
+	return ref_store;
+}
+
+/*
+ * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
+ * reftable_ref_store or if it doesn't have all of the capabilities in
+ * required_flags. caller is used in any necessary error messages.
+ */
+static struct reftable_ref_store *reftable_downcast(struct ref_store *ref_store,
+						    unsigned int required_flags,
+						    const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		BUG("ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		BUG("operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+static struct reftable_stack *per_worktree_stack(struct reftable_ref_store *refs)
+{
+	return refs->has_worktree_stack ? &refs->worktree_stack : &refs->main_stack;
+}
+
+static struct reftable_stack *other_worktree_stack(struct reftable_ref_store *refs,
+						   const char *name, int len)
+{
+	struct string_list_item *item;
+	char *id = xmemdupz(name, len);
+
+	item = string_list_insert(&refs->other_stacks, id);
+	if (!item->util) {
+		struct reftable_stack *st = xmalloc(sizeof(*st));
+		char *dir = xstrfmt("%s/worktrees/%s/reftable",
+				    refs->gitcommondir, id);
+
+		init_stack(st, dir);
+		item->util = st;
+		free(dir);
+	}
+	free(id);
+	return item->util;
+}
+
+/*
+ * Return the stack holding `refname`, and set `*name` to the name of
+ * the ref within that stack. Return NULL for pseudorefs, which are
+ * stored in files as with the "files" backend.
+ */
+static struct reftable_stack *stack_for(struct reftable_ref_store *refs,
+					const char *refname,
+					const char **name)
+{
+	const char *worktree_name, *real_ref;
+	int length;
+
+	*name = refname;
+	switch (ref_type(refname)) {
+	case REF_TYPE_PER_WORKTREE:
+		return per_worktree_stack(refs);
+	case REF_TYPE_PSEUDOREF:
+		return NULL;
+	case REF_TYPE_MAIN_PSEUDOREF:
+	case REF_TYPE_OTHER_PSEUDOREF:
+		if (parse_worktree_ref(refname, &worktree_name, &length,
+				       &real_ref))
+			BUG("refname %s is not a other-worktree ref", refname);
+		if (strcmp(real_ref, "HEAD"))
+			return NULL;
+		*name = real_ref;
+		if (!worktree_name)
+			return &refs->main_stack;
+		return other_worktree_stack(refs, worktree_name, length);
+	case REF_TYPE_NORMAL:
+		return &refs->main_stack;
+	default:
+		BUG("unknown ref type %d of ref %s",
+		    ref_type(refname), refname);
+	}
+}
+
+/* The path of a pseudoref, as in files-backend.c. */
+static void pseudoref_path(struct reftable_ref_store *refs,
+			   struct strbuf *sb, const char *refname)
+{
+	if (ref_type(refname) == REF_TYPE_PSEUDOREF)
+		strbuf_addf(sb, "%s/%s", refs->gitdir, refname);
+	else if (skip_prefix(refname, "main-worktree/", &refname))
+		strbuf_addf(sb, "%s/%s", refs->gitcommondir, refname);
+	else
+		strbuf_addf(sb, "%s/%s", refs->gitcommondir, refname);
+}
+
+static int reftable_init_db(struct ref_store *ref_store, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct strbuf sb = STRBUF_INIT;
+
+	if (reftable_stack_init_db(&refs->main_stack, err))
+		return -1;
+
+	/*
+	 * Older versions of Git recognize a repository by its HEAD
+	 * file; give them one pointing at an invalid branch name, so
+	 * that they do not mistake the repository for an unborn
+	 * "files" one.
+	 */
+	strbuf_addf(&sb, "%s/HEAD", refs->gitdir);
+	if (!file_exists(sb.buf))
+		write_file(sb.buf, "ref: refs/heads/.invalid");
+	strbuf_release(&sb);
+	return 0;
+}
+
+static int read_pseudoref(struct reftable_ref_store *refs,
+			  const char *refname, struct object_id *oid,
+			  struct strbuf *referent, unsigned int *type)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf contents = STRBUF_INIT;
+	const char *p;
+	int ret = -1;
+
+	pseudoref_path(refs, &path, refname);
+	if (strbuf_read_file(&contents, path.buf, 0) < 0) {
+		if (errno == EISDIR)
+			errno = ENOENT;
+		goto out;
+	}
+	strbuf_rtrim(&contents);
+	if (skip_prefix(contents.buf, "ref:", &p)) {
+		while (isspace(*p))
+			p++;
+		strbuf_reset(referent);
+		strbuf_addstr(referent, p);
+		*type |= REF_ISSYMREF;
+		ret = 0;
+	} else if (parse_oid_hex(contents.buf, oid, &p) ||
+		   (*p && !isspace(*p))) {
+		*type |= REF_ISBROKEN;
+		errno = EINVAL;
+	} else {
+		ret = 0;
+	}
+out:
+	strbuf_release(&path);
+	strbuf_release(&contents);
+	return ret;
+}
+
+static int reftable_read_raw_ref(struct ref_store *ref_store,
+				 const char *refname, struct object_id *oid,
+				 struct strbuf *referent, unsigned int *type)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_ref_record rec;
+	struct reftable_stack *st;
+	const char *name;
+
+	*type = 0;
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return read_pseudoref(refs, refname, oid, referent, type);
+
+	if (reftable_stack_read_ref(st, name, &rec)) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (rec.type == REFTABLE_REF_SYMREF) {
+		/* refname might point into referent */
+		strbuf_reset(referent);
+		strbuf_addstr(referent, rec.target);
+		*type |= REF_ISSYMREF;
+	} else {
+		oidcpy(oid, &rec.value);
+	}
+	return 0;
+}
+
+/* Fill in `rec` for `oid`, recording what it peels to. */
+static void fill_ref_value(struct reftable_ref_record *rec,
+			   const struct object_id *oid)
+{
+	oidcpy(&rec->value, oid);
+	if (peel_object(oid, &rec->peeled) == PEEL_PEELED)
+		rec->type = REFTABLE_REF_VAL2;
+	else
+		rec->type = REFTABLE_REF_VAL1;
+}
+
+/*
+ * The records of a change of one stack. Strings referenced by the
+ * records are owned by `strings`.
+ */
+struct stack_update {
+	struct reftable_stack *stack;
+	uint64_t update_index;
+
+	struct reftable_ref_record *refs;
+	size_t refs_nr, refs_alloc;
+	struct reftable_log_record *logs;
+	size_t logs_nr, logs_alloc;
+
+	struct string_list strings;
+	char *ident;
+	timestamp_t timestamp;
+	int tz;
+};
+
+static void stack_update_init(struct stack_update *u, struct reftable_stack *st)
+{
+	memset(u, 0, sizeof(*u));
+	u->stack = st;
+	u->update_index = reftable_stack_next_update_index(st);
+	string_list_init(&u->strings, 1);
+}
+
+static void stack_update_release(struct stack_update *u)
+{
+	free(u->refs);
+	free(u->logs);
+	free(u->ident);
+	string_list_clear(&u->strings, 0);
+}
+
+static const char *stack_update_intern(struct stack_update *u, const char *s)
+{
+	return string_list_append(&u->strings, s)->string;
+}
+
+static struct reftable_ref_record *add_ref_record(struct stack_update *u,
+						  const char *refname)
+{
+	struct reftable_ref_record *rec;
+
+	ALLOC_GROW(u->refs, u->refs_nr + 1, u->refs_alloc);
+	rec = &u->refs[u->refs_nr++];
+	memset(rec, 0, sizeof(*rec));
+	rec->refname = stack_update_intern(u, refname);
+	rec->update_index = u->update_index;
+	return rec;
+}
+
+static struct reftable_log_record *add_log_record(struct stack_update *u,
+						  const char *refname,
+						  uint64_t update_index)
+{
+	struct reftable_log_record *rec;
+
+	ALLOC_GROW(u->logs, u->logs_nr + 1, u->logs_alloc);
+	rec = &u->logs[u->logs_nr++];
+	memset(rec, 0, sizeof(*rec));
+	rec->refname = stack_update_intern(u, refname);
+	rec->update_index = update_index;
+	rec->type = REFTABLE_LOG_DELETION;
+	return rec;
+}
+
+/* Add a reflog entry for the committer to the update. */
+static void add_log_entry(struct stack_update *u, const char *refname,
+			  const struct object_id *old_oid,
+			  const struct object_id *new_oid, const char *msg)
+{
+	struct reftable_log_record *rec;
+	struct strbuf sb = STRBUF_INIT;
+
+	if (!u->ident) {
+		const char *committer = git_committer_info(0);
+		struct ident_split ident;
+
+		if (split_ident_line(&ident, committer, strlen(committer)) ||
+		    !ident.date_begin || !ident.tz_begin)
+			BUG("unable to parse committer ident '%s'", committer);
+		u->ident = xmemdupz(ident.name_begin,
+				    ident.mail_end + 1 - ident.name_begin);
+		u->timestamp = parse_timestamp(ident.date_begin, NULL, 10);
+		u->tz = strtol(ident.tz_begin, NULL, 10);
+	}
+
+	rec = add_log_record(u, refname, u->update_index);
+	rec->type = REFTABLE_LOG_UPDATE;
+	oidcpy(&rec->old_oid, old_oid ? old_oid : &null_oid);
+	oidcpy(&rec->new_oid, new_oid ? new_oid : &null_oid);
+	rec->ident = u->ident;
+	rec->timestamp = u->timestamp;
+	rec->tz = u->tz;
+	if (msg && *msg)
+		copy_reflog_msg(&sb, msg);
+	/* skip the tab that copy_reflog_msg() begins with */
+	rec->message = stack_update_intern(u, sb.len ? sb.buf + 1 : "");
+	strbuf_release(&sb);
+}
+
+/* Add deletions of all reflog entries of `refname` to the update. */
+static void add_reflog_deletion(struct stack_update *u, const char *refname)
+{
+	struct reftable_iterator *it = reftable_stack_seek_log(u->stack, refname);
+	struct reftable_log_record log;
+
+	while (!reftable_iterator_next_log(it, &log))
+		add_log_record(u, refname, log.update_index);
+	reftable_iterator_free(it);
+}
+
+static int stack_reflog_exists(struct reftable_stack *st, const char *refname)
+{
+	struct reftable_iterator *it = reftable_stack_seek_log(st, refname);
+	struct reftable_log_record log;
+	int ret = !reftable_iterator_next_log(it, &log);
+
+	reftable_iterator_free(it);
+	return ret;
+}
+
+/*
+ * Whether an update of `refname` is logged, following the same rules
+ * as the "files" backend.
+ */
+static int should_write_log(struct reftable_stack *st, const char *refname,
+			    unsigned int flags)
+{
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	return (flags & REF_FORCE_CREATE_REFLOG) ||
+		should_autocreate_reflog(refname) ||
+		stack_reflog_exists(st, refname);
+}
+
+/*
+ * The state of a transaction. Every stack it touches is locked, and
+ * collects its records in a stack_update.
+ */
+struct reftable_transaction_data {
+	struct stack_update *stacks;
+	size_t stacks_nr, stacks_alloc;
+};
+
+/* The state of one update in a transaction. */
+struct reftable_update_data {
+	struct stack_update *stack; /* NULL for a pseudoref */
+	const char *name; /* the name of the ref within the stack */
+	struct object_id old_oid;
+	int exists;
+
+	/* for a pseudoref */
+	struct lock_file lock;
+};
+
+static struct stack_update *lock_stack(struct reftable_transaction_data *data,
+				       struct reftable_stack *st,
+				       struct strbuf *err)
+{
+	size_t i;
+
+	for (i = 0; i < data->stacks_nr; i++)
+		if (data->stacks[i].stack == st)
+			return &data->stacks[i];
+
+	if (reftable_stack_lock(st, err))
+		return NULL;
+	ALLOC_GROW(data->stacks, data->stacks_nr + 1, data->stacks_alloc);
+	stack_update_init(&data->stacks[data->stacks_nr], st);
+	return &data->stacks[data->stacks_nr++];
+}
+
+static void reftable_transaction_cleanup(struct ref_transaction *transaction)
+{
+	struct reftable_transaction_data *data = transaction->backend_data;
+	size_t i;
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_update_data *u = update->backend_data;
+
+		if (!u)
+			continue;
+		if (is_lock_file_locked(&u->lock))
+			rollback_lock_file(&u->lock);
+		free(u);
+		update->backend_data = NULL;
+	}
+
+	if (data) {
+		for (i = 0; i < data->stacks_nr; i++) {
+			if (is_lock_file_locked(&data->stacks[i].stack->lock))
+				reftable_stack_unlock(data->stacks[i].stack);
+			stack_update_release(&data->stacks[i]);
+		}
+		free(data->stacks);
+		free(data);
+		transaction->backend_data = NULL;
+	}
+
+	transaction->state = REF_TRANSACTION_CLOSED;
+}
+
+/*
+ * If update is a direct update of head_ref (the reference pointed to
+ * by HEAD), then add an extra REF_LOG_ONLY update for HEAD.
+ */
+static int split_head_update(struct ref_update *update,
+			     struct ref_transaction *transaction,
+			     const char *head_ref,
+			     struct string_list *affected_refnames,
+			     struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+
+	if ((update->flags & REF_LOG_ONLY) ||
+	    (update->flags & REF_UPDATE_VIA_HEAD))
+		return 0;
+
+	if (strcmp(update->refname, head_ref))
+		return 0;
+
+	if (string_list_has_string(affected_refnames, "HEAD")) {
+		strbuf_addf(err,
+			    "multiple updates for 'HEAD' (including one "
+			    "via its referent '%s') are not allowed",
+			    update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_update = ref_transaction_add_update(
+			transaction, "HEAD",
+			update->flags | REF_LOG_ONLY | REF_NO_DEREF,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * update is for a symref that points at referent and doesn't have
+ * REF_NO_DEREF set. Split it into a REF_LOG_ONLY update of the symref
+ * and a separate update of the referent, as in files-backend.c.
+ */
+static int split_symref_update(struct ref_update *update,
+			       const char *referent,
+			       struct ref_transaction *transaction,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+	unsigned int new_flags;
+
+	if (string_list_has_string(affected_refnames, referent)) {
+		strbuf_addf(err,
+			    "multiple updates for '%s' (including one "
+			    "via symref '%s') are not allowed",
+			    referent, update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_flags = update->flags;
+	if (!strcmp(update->refname, "HEAD"))
+		new_flags |= REF_UPDATE_VIA_HEAD;
+
+	new_update = ref_transaction_add_update(
+			transaction, referent, new_flags,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	new_update->parent_update = update;
+
+	update->flags |= REF_LOG_ONLY | REF_NO_DEREF;
+	update->flags &= ~REF_HAVE_OLD;
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	if (item->util)
+		BUG("%s unexpectedly found in affected_refnames",
+		    new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * Return the refname under which update was originally requested.
+ */
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+
+	return update->refname;
+}
+
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+		   oideq(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+/*
+ * Lock the stack (or the file) holding the reference of `update`,
+ * read its current value and check it, and split symref and HEAD
+ * updates, as lock_ref_for_update() does in files-backend.c.
+ */
+static int prepare_update(struct reftable_ref_store *refs,
+			  struct reftable_transaction_data *data,
+			  struct ref_update *update,
+			  struct ref_transaction *transaction,
+			  const char *head_ref,
+			  struct string_list *affected_refnames,
+			  struct strbuf *err)
+{
+	struct strbuf referent = STRBUF_INIT;
+	struct reftable_update_data *u;
+	struct reftable_stack *st;
+	int mustexist = (update->flags & REF_HAVE_OLD) &&
+		!is_null_oid(&update->old_oid);
+	int ret = 0;
+
+	if ((update->flags & REF_HAVE_NEW) && is_null_oid(&update->new_oid))
+		update->flags |= REF_DELETING;
+
+	if (head_ref) {
+		ret = split_head_update(update, transaction, head_ref,
+					affected_refnames, err);
+		if (ret)
+			goto out;
+	}
+
+	u = xcalloc(1, sizeof(*u));
+	update->backend_data = u;
+	st = stack_for(refs, update->refname, &u->name);
+	if (st) {
+		u->stack = lock_stack(data, st, err);
+		if (!u->stack) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+	} else {
+		struct strbuf path = STRBUF_INIT;
+
+		pseudoref_path(refs, &path, update->refname);
+		if (hold_lock_file_for_update_timeout(
+				&u->lock, path.buf, 0,
+				get_files_ref_lock_timeout_ms()) < 0) {
+			unable_to_lock_message(path.buf, errno, err);
+			strbuf_release(&path);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+		strbuf_release(&path);
+	}
+
+	if (refs_read_raw_ref(&refs->base, update->refname, &u->old_oid,
+			      &referent, &update->type)) {
+		if (errno != ENOENT || (update->type & REF_ISBROKEN)) {
+			strbuf_addf(err, "cannot lock ref '%s': "
+				    "unable to resolve reference '%s'",
+				    original_update_refname(update),
+				    update->refname);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+		if (mustexist) {
+			strbuf_addf(err, "cannot lock ref '%s': "
+				    "unable to resolve reference '%s'",
+				    original_update_refname(update),
+				    update->refname);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+		oidclr(&u->old_oid);
+		if (refs_verify_refname_available(&refs->base, update->refname,
+						  affected_refnames, NULL, err)) {
+			char *reason = strbuf_detach(err, NULL);
+
+			strbuf_addf(err, "cannot lock ref '%s': %s",
+				    original_update_refname(update), reason);
+			free(reason);
+			ret = TRANSACTION_NAME_CONFLICT;
+			goto out;
+		}
+	} else {
+		u->exists = 1;
+	}
+
+	if (update->type & REF_ISSYMREF) {
+		if (update->flags & REF_NO_DEREF) {
+			if (refs_read_ref_full(&refs->base, referent.buf, 0,
+					       &u->old_oid, NULL)) {
+				oidclr(&u->old_oid);
+				if (update->flags & REF_HAVE_OLD) {
+					strbuf_addf(err, "cannot lock ref '%s': "
+						    "error reading reference",
+						    original_update_refname(update));
+					ret = TRANSACTION_GENERIC_ERROR;
+					goto out;
+				}
+			} else if (check_old_oid(update, &u->old_oid, err)) {
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto out;
+			}
+		} else {
+			ret = split_symref_update(update, referent.buf,
+						  transaction,
+						  affected_refnames, err);
+			if (ret)
+				goto out;
+		}
+	} else {
+		struct ref_update *parent_update;
+
+		if (check_old_oid(update, &u->old_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+
+		/*
+		 * If this update is happening indirectly because of a
+		 * symref update, record the old OID in the parent
+		 * update:
+		 */
+		for (parent_update = update->parent_update;
+		     parent_update;
+		     parent_update = parent_update->parent_update) {
+			struct reftable_update_data *parent_u =
+				parent_update->backend_data;
+			oidcpy(&parent_u->old_oid, &u->old_oid);
+		}
+	}
+
+	if ((update->flags & REF_HAVE_NEW) &&
+	    !(update->flags & REF_DELETING) &&
+	    !(update->flags & REF_LOG_ONLY)) {
+		struct object *o;
+
+		if (!(update->type & REF_ISSYMREF) &&
+		    oideq(&u->old_oid, &update->new_oid)) {
+			/*
+			 * The reference already has the desired
+			 * value, so we don't need to write it.
+			 */
+			goto out;
+		}
+
+		o = parse_object(the_repository, &update->new_oid);
+		if (!o) {
+			strbuf_addf(err, "cannot update ref '%s': "
+				    "trying to write ref '%s' with nonexistent object %s",
+				    update->refname, update->refname,
+				    oid_to_hex(&update->new_oid));
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+		if (o->type != OBJ_COMMIT && is_branch(update->refname)) {
+			strbuf_addf(err, "cannot update ref '%s': "
+				    "trying to write non-commit object %s to branch '%s'",
+				    update->refname, oid_to_hex(&update->new_oid),
+				    update->refname);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+		update->flags |= REF_NEEDS_COMMIT;
+	}
+
+out:
+	strbuf_release(&referent);
+	return ret;
+}
+
+static int reftable_transaction_prepare(struct ref_store *ref_store,
+					struct ref_transaction *transaction,
+					struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "ref_transaction_prepare");
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	struct reftable_transaction_data *data;
+	char *head_ref = NULL;
+	int head_type;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	data = xcalloc(1, sizeof(*data));
+	transaction->backend_data = data;
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct string_list_item *item =
+			string_list_append(&affected_refnames, update->refname);
+
+		item->util = update;
+	}
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/*
+	 * If HEAD is a symbolic reference, record the name of the
+	 * reference that it points to, so that a direct update of
+	 * that reference updates the reflog of HEAD, too.
+	 */
+	head_ref = refs_resolve_refdup(ref_store, "HEAD",
+				       RESOLVE_REF_NO_RECURSE,
+				       NULL, &head_type);
+	if (head_ref && !(head_type & REF_ISSYMREF))
+		FREE_AND_NULL(head_ref);
+
+	/* prepare_update() might append more updates to the transaction */
+	for (i = 0; i < transaction->nr; i++) {
+		ret = prepare_update(refs, data, transaction->updates[i],
+				     transaction, head_ref,
+				     &affected_refnames, err);
+		if (ret)
+			goto cleanup;
+	}
+
+cleanup:
+	free(head_ref);
+	string_list_clear(&affected_refnames, 0);
+
+	if (ret)
+		reftable_transaction_cleanup(transaction);
+	else
+		transaction->state = REF_TRANSACTION_PREPARED;
+
+	return ret;
+}
+
+static int reftable_transaction_abort(struct ref_store *ref_store,
+				      struct ref_transaction *transaction,
+				      struct strbuf *err)
+{
+	reftable_downcast(ref_store, 0, "ref_transaction_abort");
+	reftable_transaction_cleanup(transaction);
+	return 0;
+}
+
+static int commit_pseudoref(struct ref_update *update, struct strbuf *err)
+{
+	struct reftable_update_data *u = update->backend_data;
+	const char *path = get_lock_file_path(&u->lock);
+
+	if (update->flags & REF_NEEDS_COMMIT) {
+		int fd = get_lock_file_fd(&u->lock);
+
+		if (write_in_full(fd, oid_to_hex(&update->new_oid),
+				  the_hash_algo->hexsz) < 0 ||
+		    write_str_in_full(fd, "\n") < 0 ||
+		    commit_lock_file(&u->lock) < 0) {
+			strbuf_addf(err, "couldn't set '%s'", update->refname);
+			return -1;
+		}
+	} else if ((update->flags & REF_DELETING) &&
+		   !(update->flags & REF_LOG_ONLY) && u->exists) {
+		struct strbuf sb = STRBUF_INIT;
+
+		/* the path of the lock, without ".lock" */
+		strbuf_add(&sb, path, strlen(path) - LOCK_SUFFIX_LEN);
+		if (unlink(sb.buf) && errno != ENOENT) {
+			strbuf_addf(err, "couldn't delete '%s'", update->refname);
+			strbuf_release(&sb);
+			return -1;
+		}
+		strbuf_release(&sb);
+	}
+	return 0;
+}
+
+static int reftable_transaction_finish(struct ref_store *ref_store,
+				       struct ref_transaction *transaction,
+				       struct strbuf *err)
+{
+	struct reftable_transaction_data *data;
+	size_t i;
+	int ret = 0;
+
+	reftable_downcast(ref_store, 0, "ref_transaction_finish");
+	assert(err);
+
+	data = transaction->backend_data;
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_update_data *u = update->backend_data;
+		struct stack_update *su = u->stack;
+
+		/* pseudorefs are committed below, after the tables */
+		if (!su)
+			continue;
+
+		if ((update->flags & REF_NEEDS_COMMIT) ||
+		    (update->flags & REF_LOG_ONLY)) {
+			if (should_write_log(su->stack, u->name, update->flags))
+				add_log_entry(su, u->name, &u->old_oid,
+					      &update->new_oid, update->msg);
+		}
+		if (update->flags & REF_NEEDS_COMMIT) {
+			struct reftable_ref_record *rec =
+				add_ref_record(su, u->name);
+
+			fill_ref_value(rec, &update->new_oid);
+		}
+		if ((update->flags & REF_DELETING) &&
+		    !(update->flags & REF_LOG_ONLY) && u->exists) {
+			add_ref_record(su, u->name)->type = REFTABLE_REF_DELETION;
+			add_reflog_deletion(su, u->name);
+		}
+	}
+
+	for (i = 0; i < data->stacks_nr; i++) {
+		struct stack_update *su = &data->stacks[i];
+
+		/* this unlocks the stack, even on errors */
+		if (reftable_stack_add(su->stack, su->refs, su->refs_nr,
+				       su->logs, su->logs_nr, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+	}
+
+	/*
+	 * Pseudorefs are written as files, without a reflog. Do so only
+	 * once the tables are in, so that a failure to add those leaves
+	 * the pseudorefs untouched, too.
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_update_data *u = update->backend_data;
+
+		if (u->stack)
+			continue;
+		if (commit_pseudoref(update, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	reftable_transaction_cleanup(transaction);
+	return ret;
+}
+
+static int reftable_initial_transaction_commit(struct ref_store *ref_store,
+					       struct ref_transaction *transaction,
+					       struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "initial_ref_transaction_commit");
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	struct reftable_transaction_data *data;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	if (transaction->state != REF_TRANSACTION_OPEN)
+		BUG("commit called for transaction that is not open");
+
+	data = xcalloc(1, sizeof(*data));
+	transaction->backend_data = data;
+
+	for (i = 0; i < transaction->nr; i++)
+		string_list_append(&affected_refnames,
+				   transaction->updates[i]->refname);
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/*
+	 * It's really undefined to call this function in an active
+	 * repository or when there are existing references: we are
+	 * only locking and changing the stacks, without checking the
+	 * references' old values. Reflogs are not written.
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct reftable_stack *st;
+		struct stack_update *su;
+		const char *name;
+
+		if ((update->flags & REF_HAVE_OLD) &&
+		    !is_null_oid(&update->old_oid))
+			BUG("initial ref transaction with old_sha1 set");
+		if (refs_verify_refname_available(&refs->base, update->refname,
+						  &affected_refnames, NULL,
+						  err)) {
+			ret = TRANSACTION_NAME_CONFLICT;
+			goto cleanup;
+		}
+
+		st = stack_for(refs, update->refname, &name);
+		if (!st)
+			BUG("initial ref transaction with pseudoref %s",
+			    update->refname);
+		su = lock_stack(data, st, err);
+		if (!su) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+		if ((update->flags & REF_HAVE_NEW) &&
+		    !is_null_oid(&update->new_oid))
+			fill_ref_value(add_ref_record(su, name),
+				       &update->new_oid);
+	}
+
+	for (i = 0; i < data->stacks_nr; i++) {
+		struct stack_update *su = &data->stacks[i];
+
+		if (reftable_stack_add(su->stack, su->refs, su->refs_nr,
+				       su->logs, su->logs_nr, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	reftable_transaction_cleanup(transaction);
+	string_list_clear(&affected_refnames, 0);
+	return ret;
+}
+
+static int reftable_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				  "pack_refs");
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	/* all refs are "packed"; compact the stacks instead */
+	if (reftable_stack_compact_all(&refs->main_stack, &err) ||
+	    (refs->has_worktree_stack &&
+	     reftable_stack_compact_all(&refs->worktree_stack, &err)))
+		ret = error("%s", err.buf);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_create_symref(struct ref_store *ref_store,
+				  const char *refname, const char *target,
+				  const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	struct strbuf err = STRBUF_INIT;
+	struct object_id old_oid, new_oid;
+	struct reftable_ref_record *rec;
+	struct reftable_stack *st;
+	struct stack_update su;
+	const char *name;
+	int ret;
+
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return error("unable to create symref %s: "
+			     "pseudorefs cannot be symbolic", refname);
+
+	if (reftable_stack_lock(st, &err)) {
+		ret = error("%s", err.buf);
+		strbuf_release(&err);
+		return ret;
+	}
+
+	stack_update_init(&su, st);
+	if (logmsg &&
+	    !refs_read_ref_full(ref_store, target, RESOLVE_REF_READING,
+				&new_oid, NULL) &&
+	    should_write_log(st, name, 0)) {
+		if (refs_read_ref_full(ref_store, refname, RESOLVE_REF_READING,
+				       &old_oid, NULL))
+			oidclr(&old_oid);
+		add_log_entry(&su, name, &old_oid, &new_oid, logmsg);
+	}
+	rec = add_ref_record(&su, name);
+	rec->type = REFTABLE_REF_SYMREF;
+	rec->target = stack_update_intern(&su, target);
+
+	ret = reftable_stack_add(st, su.refs, su.refs_nr, su.logs, su.logs_nr,
+				 &err);
+	if (ret)
+		ret = error("unable to write symref for %s: %s", refname,
+			    err.buf);
+	stack_update_release(&su);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_delete_refs(struct ref_store *ref_store, const char *msg,
+				struct string_list *refnames, unsigned int flags)
+{
+	struct strbuf err = STRBUF_INIT;
+	struct ref_transaction *transaction;
+	struct string_list_item *item;
+	int ret;
+
+	reftable_downcast(ref_store, REF_STORE_WRITE, "delete_refs");
+
+	if (!refnames->nr)
+		return 0;
+
+	/*
+	 * Since we don't check the references' old_oids, the
+	 * individual updates can't fail, so we can pack all of the
+	 * updates into a single transaction.
+	 */
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		return -1;
+
+	for_each_string_list_item(item, refnames) {
+		if (ref_transaction_delete(transaction, item->string, NULL,
+					   flags, msg, &err)) {
+			warning(_("could not delete reference %s: %s"),
+				item->string, err.buf);
+			strbuf_reset(&err);
+		}
+	}
+
+	ret = ref_transaction_commit(transaction, &err);
+
+	if (ret) {
+		if (refnames->nr == 1)
+			error(_("could not delete reference %s: %s"),
+			      refnames->items[0].string, err.buf);
+		else
+			error(_("could not delete references: %s"), err.buf);
+	}
+
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int log_record_cmp(const void *va, const void *vb)
+{
+	const struct reftable_log_record *a = va, *b = vb;
+	int cmp = strcmp(a->refname, b->refname);
+
+	if (cmp)
+		return cmp;
+	if (a->update_index != b->update_index)
+		return a->update_index < b->update_index ? 1 : -1;
+	/* entries before deletions */
+	return (int)b->type - (int)a->type;
+}
+
+/*
+ * Drop the log records with the same key as the preceding one, which
+ * come after the entry for that key once sorted.
+ */
+static void dedup_log_records(struct stack_update *su)
+{
+	size_t i, j;
+
+	QSORT(su->logs, su->logs_nr, log_record_cmp);
+	for (i = j = 0; i < su->logs_nr; i++) {
+		if (j && !strcmp(su->logs[j - 1].refname, su->logs[i].refname) &&
+		    su->logs[j - 1].update_index == su->logs[i].update_index)
+			continue;
+		su->logs[j++] = su->logs[i];
+	}
+	su->logs_nr = j;
+}
+
+static int reftable_copy_or_rename_ref(struct ref_store *ref_store,
+				       const char *oldrefname,
+				       const char *newrefname,
+				       const char *logmsg, int copy)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "rename_ref");
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_stack *st, *new_st;
+	struct reftable_iterator *it;
+	struct reftable_log_record log;
+	struct object_id orig_oid;
+	const char *old_name, *new_name;
+	struct stack_update su;
+	int flag = 0, ret;
+
+	if (!refs_resolve_ref_unsafe(ref_store, oldrefname,
+				     RESOLVE_REF_READING | RESOLVE_REF_NO_RECURSE,
+				     &orig_oid, &flag))
+		return error("refname %s not found", oldrefname);
+
+	if (flag & REF_ISSYMREF) {
+		if (copy)
+			return error("refname %s is a symbolic ref, copying it is not supported",
+				     oldrefname);
+		else
+			return error("refname %s is a symbolic ref, renaming it is not supported",
+				     oldrefname);
+	}
+	if (!refs_rename_ref_available(ref_store, oldrefname, newrefname))
+		return 1;
+
+	st = stack_for(refs, oldrefname, &old_name);
+	new_st = stack_for(refs, newrefname, &new_name);
+	if (!st || st != new_st) {
+		if (copy)
+			return error("unable to copy '%s' to '%s': the refs are stored apart",
+				     oldrefname, newrefname);
+		return error("unable to rename '%s' to '%s': the refs are stored apart",
+			     oldrefname, newrefname);
+	}
+
+	if (reftable_stack_lock(st, &err)) {
+		ret = error("%s", err.buf);
+		strbuf_release(&err);
+		return ret;
+	}
+
+	/*
+	 * Write the ref and its reflog under the new name, replacing
+	 * those of any ref there, and delete them under the old name
+	 * unless copying, all in one table.
+	 */
+	stack_update_init(&su, st);
+	add_reflog_deletion(&su, new_name);
+	it = reftable_stack_seek_log(st, old_name);
+	while (!reftable_iterator_next_log(it, &log)) {
+		struct reftable_log_record *rec =
+			add_log_record(&su, new_name, log.update_index);
+
+		rec->type = log.type;
+		oidcpy(&rec->old_oid, &log.old_oid);
+		oidcpy(&rec->new_oid, &log.new_oid);
+		rec->ident = stack_update_intern(&su, log.ident);
+		rec->timestamp = log.timestamp;
+		rec->tz = log.tz;
+		rec->message = stack_update_intern(&su, log.message);
+		if (!copy)
+			add_log_record(&su, old_name, log.update_index);
+	}
+	reftable_iterator_free(it);
+	dedup_log_records(&su);
+
+	if (should_write_log(st, new_name, 0))
+		add_log_entry(&su, new_name, &orig_oid, &orig_oid, logmsg);
+	if (!copy)
+		add_ref_record(&su, old_name)->type = REFTABLE_REF_DELETION;
+	fill_ref_value(add_ref_record(&su, new_name), &orig_oid);
+
+	ret = reftable_stack_add(st, su.refs, su.refs_nr, su.logs, su.logs_nr,
+				 &err);
+	if (ret) {
+		if (copy)
+			ret = error("unable to copy '%s' to '%s': %s",
+				    oldrefname, newrefname, err.buf);
+		else
+			ret = error("unable to rename '%s' to '%s': %s",
+				    oldrefname, newrefname, err.buf);
+	}
+	stack_update_release(&su);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_rename_ref(struct ref_store *ref_store,
+			       const char *oldrefname, const char *newrefname,
+			       const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname, newrefname,
+					   logmsg, 0);
+}
+
+static int reftable_copy_ref(struct ref_store *ref_store,
+			     const char *oldrefname, const char *newrefname,
+			     const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname, newrefname,
+					   logmsg, 1);
+}
+
+/* Which refs of a stack an iterator shows */
+enum stack_refs {
+	ALL_REFS,
+	SHARED_REFS,
+	PER_WORKTREE_REFS
+};
+
+static int stack_shows(enum stack_refs which, const char *refname)
+{
+	switch (which) {
+	case SHARED_REFS:
+		return ref_type(refname) != REF_TYPE_PER_WORKTREE;
+	case PER_WORKTREE_REFS:
+		return ref_type(refname) == REF_TYPE_PER_WORKTREE;
+	default:
+		return 1;
+	}
+}
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+
+	struct ref_store *ref_store;
+	struct reftable_iterator *iter;
+	enum stack_refs which;
+	char *prefix;
+	unsigned int flags;
+
+	struct reftable_ref_record rec;
+	struct object_id oid;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	int ok = ITER_DONE;
+
+	while (!reftable_iterator_next_ref(iter->iter, &iter->rec)) {
+		const char *refname = iter->rec.refname;
+		int flags = 0;
+
+		if (!starts_with(refname, iter->prefix))
+			break;
+		if (!stack_shows(iter->which, refname))
+			continue;
+		if (iter->flags & DO_FOR_EACH_PER_WORKTREE_ONLY &&
+		    ref_type(refname) != REF_TYPE_PER_WORKTREE)
+			continue;
+
+		if (iter->rec.type == REFTABLE_REF_SYMREF) {
+			if (!refs_resolve_ref_unsafe(iter->ref_store, refname,
+						     RESOLVE_REF_READING,
+						     &iter->oid, &flags))
+				oidclr(&iter->oid);
+			flags |= REF_ISSYMREF;
+		} else {
+			oidcpy(&iter->oid, &iter->rec.value);
+		}
+		if (is_null_oid(&iter->oid))
+			flags |= REF_ISBROKEN;
+		if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+			if (!refname_is_safe(refname))
+				die("reftable contains unsafe refname '%s'",
+				    refname);
+			flags |= REF_BAD_NAME | REF_ISBROKEN;
+		}
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(refname, &iter->oid, flags))
+			continue;
+
+		iter->base.refname = refname;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+		ok = ITER_ERROR;
+	return ok;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	/* the value of a ref is peeled when it is written */
+	if (iter->rec.type == REFTABLE_REF_VAL2) {
+		oidcpy(peeled, &iter->rec.peeled);
+		return 0;
+	}
+	return -1;
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	reftable_iterator_free(iter->iter);
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	reftable_ref_iterator_advance,
+	reftable_ref_iterator_peel,
+	reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *stack_ref_iterator_begin(struct ref_store *ref_store,
+						     struct reftable_stack *st,
+						     enum stack_refs which,
+						     const char *prefix,
+						     unsigned int flags)
+{
+	struct reftable_ref_iterator *iter = xcalloc(1, sizeof(*iter));
+	struct ref_iterator *ref_iterator = &iter->base;
+
+	base_ref_iterator_init(ref_iterator, &reftable_ref_iterator_vtable, 1);
+	iter->ref_store = ref_store;
+	/* only the refs under "refs/" are iterated over */
+	iter->prefix = xstrdup(starts_with(prefix, "refs/") ? prefix : "refs/");
+	iter->iter = reftable_stack_seek_ref(st, iter->prefix);
+	iter->which = which;
+	iter->flags = flags;
+	return ref_iterator;
+}
+
+static struct ref_iterator *reftable_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_store *refs;
+	struct ref_iterator *iter;
+	unsigned int required_flags = REF_STORE_READ;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+	refs = reftable_downcast(ref_store, required_flags,
+				 "ref_iterator_begin");
+
+	if (!prefix)
+		prefix = "";
+	if (*prefix && !starts_with(prefix, "refs/") &&
+	    !starts_with("refs/", prefix))
+		return empty_ref_iterator_begin();
+
+	iter = stack_ref_iterator_begin(ref_store, &refs->main_stack,
+					refs->has_worktree_stack ?
+					SHARED_REFS : ALL_REFS,
+					prefix, flags);
+	if (refs->has_worktree_stack)
+		iter = overlay_ref_iterator_begin(
+			stack_ref_iterator_begin(ref_store,
+						 &refs->worktree_stack,
+						 PER_WORKTREE_REFS,
+						 prefix, flags),
+			iter);
+	return iter;
+}
+
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+
+	struct ref_store *ref_store;
+	struct reftable_iterator *iter;
+	enum stack_refs which;
+	struct strbuf last;
+	struct object_id oid;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+	struct reftable_log_record log;
+	int ok = ITER_DONE;
+
+	while (!reftable_iterator_next_log(iter->iter, &log)) {
+		int flags;
+
+		if (!strcmp(log.refname, iter->last.buf))
+			continue;
+		strbuf_reset(&iter->last);
+		strbuf_addstr(&iter->last, log.refname);
+		if (!stack_shows(iter->which, iter->last.buf))
+			continue;
+
+		if (refs_read_ref_full(iter->ref_store, iter->last.buf, 0,
+				       &iter->oid, &flags)) {
+			error("bad ref for %s", iter->last.buf);
+			continue;
+		}
+
+		iter->base.refname = iter->last.buf;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+		ok = ITER_ERROR;
+	return ok;
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator,
+					 struct object_id *peeled)
+{
+	BUG("ref_iterator_peel() called for reflog_iterator");
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	reftable_iterator_free(iter->iter);
+	strbuf_release(&iter->last);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	reftable_reflog_iterator_advance,
+	reftable_reflog_iterator_peel,
+	reftable_reflog_iterator_abort
+};
+
+static struct ref_iterator *stack_reflog_iterator_begin(struct ref_store *ref_store,
+							struct reftable_stack *st,
+							enum stack_refs which)
+{
+	struct reftable_reflog_iterator *iter = xcalloc(1, sizeof(*iter));
+	struct ref_iterator *ref_iterator = &iter->base;
+
+	base_ref_iterator_init(ref_iterator, &reftable_reflog_iterator_vtable, 1);
+	iter->ref_store = ref_store;
+	iter->iter = reftable_stack_seek_log(st, "");
+	iter->which = which;
+	strbuf_init(&iter->last, 0);
+	return ref_iterator;
+}
+
+static struct ref_iterator *reftable_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "reflog_iterator_begin");
+
+	if (!refs->has_worktree_stack)
+		return stack_reflog_iterator_begin(ref_store, &refs->main_stack,
+						   ALL_REFS);
+	return overlay_ref_iterator_begin(
+		stack_reflog_iterator_begin(ref_store, &refs->worktree_stack,
+					    PER_WORKTREE_REFS),
+		stack_reflog_iterator_begin(ref_store, &refs->main_stack,
+					    SHARED_REFS));
+}
+
+/*
+ * The entries of a reflog, newest first. The strings are owned by
+ * `strings`.
+ */
+struct reflog_entries {
+	struct reftable_log_record *entries;
+	size_t nr, alloc;
+	struct string_list strings;
+};
+
+static void read_reflog(struct reftable_stack *st, const char *refname,
+			struct reflog_entries *log)
+{
+	struct reftable_iterator *it = reftable_stack_seek_log(st, refname);
+	struct reftable_log_record rec;
+
+	memset(log, 0, sizeof(*log));
+	string_list_init(&log->strings, 1);
+	while (!reftable_iterator_next_log(it, &rec)) {
+		struct reftable_log_record *e;
+
+		if (rec.update_index == REFLOG_MARKER_INDEX)
+			continue;
+		ALLOC_GROW(log->entries, log->nr + 1, log->alloc);
+		e = &log->entries[log->nr++];
+		*e = rec;
+		e->refname = refname;
+		e->ident = string_list_append(&log->strings, rec.ident)->string;
+		/* callers expect the message to end with a newline */
+		e->message = string_list_append_nodup(&log->strings,
+						      xstrfmt("%s\n", rec.message))->string;
+	}
+	reftable_iterator_free(it);
+}
+
+static void release_reflog(struct reflog_entries *log)
+{
+	free(log->entries);
+	string_list_clear(&log->strings, 0);
+}
+
+static int show_reflog_entry(struct reftable_log_record *e,
+			     each_reflog_ent_fn fn, void *cb_data)
+{
+	struct object_id old_oid, new_oid;
+
+	oidcpy(&old_oid, &e->old_oid);
+	oidcpy(&new_oid, &e->new_oid);
+	return fn(&old_oid, &new_oid, e->ident, e->timestamp, e->tz,
+		  e->message, cb_data);
+}
+
+static int for_each_reflog_ent_order(struct ref_store *ref_store,
+				     const char *refname,
+				     each_reflog_ent_fn fn, void *cb_data,
+				     int reverse)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent");
+	struct reflog_entries log;
+	struct reftable_stack *st;
+	const char *name;
+	size_t i;
+	int ret = 0;
+
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return 0;
+
+	read_reflog(st, name, &log);
+	for (i = 0; !ret && i < log.nr; i++)
+		ret = show_reflog_entry(&log.entries[reverse ? i : log.nr - 1 - i],
+					fn, cb_data);
+	release_reflog(&log);
+	return ret;
+}
+
+static int reftable_for_each_reflog_ent(struct ref_store *ref_store,
+					const char *refname,
+					each_reflog_ent_fn fn, void *cb_data)
+{
+	return for_each_reflog_ent_order(ref_store, refname, fn, cb_data, 0);
+}
+
+static int reftable_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						const char *refname,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	return for_each_reflog_ent_order(ref_store, refname, fn, cb_data, 1);
+}
+
+static int reftable_reflog_exists(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+	struct reftable_stack *st;
+	const char *name;
+
+	st = stack_for(refs, refname, &name);
+	return st && stack_reflog_exists(st, name);
+}
+
+static int reftable_create_reflog(struct ref_store *ref_store,
+				  const char *refname, int force_create,
+				  struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+	struct reftable_log_record *rec;
+	struct reftable_stack *st;
+	struct stack_update su;
+	const char *name;
+
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	st = stack_for(refs, refname, &name);
+	if (!st || !(force_create || should_autocreate_reflog(refname)) ||
+	    stack_reflog_exists(st, name))
+		return 0;
+
+	if (reftable_stack_lock(st, err))
+		return -1;
+	stack_update_init(&su, st);
+	rec = add_log_record(&su, name, REFLOG_MARKER_INDEX);
+	rec->type = REFTABLE_LOG_UPDATE;
+	rec->ident = rec->message = "";
+	if (reftable_stack_add(st, NULL, 0, su.logs, su.logs_nr, err)) {
+		stack_update_release(&su);
+		return -1;
+	}
+	stack_update_release(&su);
+	return 0;
+}
+
+static int reftable_delete_reflog(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_stack *st;
+	struct stack_update su;
+	const char *name;
+	int ret = 0;
+
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return 0;
+
+	if (reftable_stack_lock(st, &err)) {
+		ret = error("%s", err.buf);
+		strbuf_release(&err);
+		return ret;
+	}
+	stack_update_init(&su, st);
+	add_reflog_deletion(&su, name);
+	if (reftable_stack_add(st, NULL, 0, su.logs, su.logs_nr, &err))
+		ret = error("%s", err.buf);
+	stack_update_release(&su);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_reflog_expire(struct ref_store *ref_store,
+				  const char *refname, const struct object_id *oid,
+				  unsigned int flags,
+				  reflog_expiry_prepare_fn prepare_fn,
+				  reflog_expiry_should_prune_fn should_prune_fn,
+				  reflog_expiry_cleanup_fn cleanup_fn,
+				  void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	struct strbuf err = STRBUF_INIT;
+	struct strbuf referent = STRBUF_INIT;
+	struct object_id last_kept_oid, current_oid;
+	struct reflog_entries log;
+	struct reftable_stack *st;
+	struct stack_update su;
+	unsigned int type = 0;
+	const char *name;
+	size_t i, kept = 0;
+	int ret = 0;
+
+	st = stack_for(refs, refname, &name);
+	if (!st)
+		return 0;
+
+	/*
+	 * Lock the stack, which holds both the reflog and the reference
+	 * we might need to update.
+	 */
+	if (reftable_stack_lock(st, &err)) {
+		ret = error("cannot lock ref '%s': %s", refname, err.buf);
+		strbuf_release(&err);
+		return ret;
+	}
+	if (!stack_reflog_exists(st, name)) {
+		reftable_stack_unlock(st);
+		return 0;
+	}
+	if (refs_read_raw_ref(ref_store, refname, &current_oid, &referent,
+			      &type))
+		oidclr(&current_oid);
+	if (oid && !(type & REF_ISSYMREF) && !oideq(oid, &current_oid)) {
+		reftable_stack_unlock(st);
+		strbuf_release(&referent);
+		return error("cannot lock ref '%s': is at %s but expected %s",
+			     refname, oid_to_hex(&current_oid),
+			     oid_to_hex(oid));
+	}
+
+	stack_update_init(&su, st);
+	read_reflog(st, name, &log);
+	oidclr(&last_kept_oid);
+
+	(*prepare_fn)(refname, oid, policy_cb_data);
+	for (i = log.nr; i-- > 0; ) {
+		struct reftable_log_record *e = &log.entries[i];
+		struct object_id old_oid, new_oid;
+
+		oidcpy(&old_oid, (flags & EXPIRE_REFLOGS_REWRITE) ?
+		       &last_kept_oid : &e->old_oid);
+		oidcpy(&new_oid, &e->new_oid);
+		if ((*should_prune_fn)(&old_oid, &new_oid, e->ident,
+				       e->timestamp, e->tz, e->message,
+				       policy_cb_data)) {
+			if (flags & EXPIRE_REFLOGS_DRY_RUN)
+				printf("would prune %s", e->message);
+			else if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("prune %s", e->message);
+			add_log_record(&su, name, e->update_index);
+		} else {
+			if (!oideq(&old_oid, &e->old_oid)) {
+				struct reftable_log_record *rec =
+					add_log_record(&su, name, e->update_index);
+
+				char *message = xstrdup(e->message);
+
+				/* the message is stored without the newline */
+				*strchrnul(message, '\n') = '\0';
+				*rec = *e;
+				rec->refname = name;
+				oidcpy(&rec->old_oid, &old_oid);
+				rec->message = string_list_append_nodup(&su.strings,
+									message)->string;
+			}
+			oidcpy(&last_kept_oid, &new_oid);
+			kept++;
+			if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("keep %s", e->message);
+		}
+	}
+	(*cleanup_fn)(policy_cb_data);
+
+	if (flags & EXPIRE_REFLOGS_DRY_RUN) {
+		reftable_stack_unlock(st);
+		goto out;
+	}
+
+	/* the reflog still exists, even if all its entries are pruned */
+	if (!kept) {
+		struct reftable_log_record *rec =
+			add_log_record(&su, name, REFLOG_MARKER_INDEX);
+
+		rec->type = REFTABLE_LOG_UPDATE;
+		rec->ident = rec->message = "";
+	}
+
+	/*
+	 * It doesn't make sense to adjust a reference pointed to by a
+	 * symbolic ref based on expiring entries in the symbolic
+	 * reference's reflog. Nor can we update a reference if there
+	 * are no remaining reflog entries.
+	 */
+	if ((flags & EXPIRE_REFLOGS_UPDATE_REF) &&
+	    !(type & REF_ISSYMREF) &&
+	    !is_null_oid(&last_kept_oid) &&
+	    !oideq(&last_kept_oid, &current_oid))
+		fill_ref_value(add_ref_record(&su, name), &last_kept_oid);
+
+	if (reftable_stack_add(st, su.refs, su.refs_nr, su.logs, su.logs_nr,
+			       &err))
+		ret = error("unable to write reflog '%s' (%s)", refname,
+			    err.buf);
+
+out:
+	release_reflog(&log);
+	stack_update_release(&su);
+	strbuf_release(&referent);
+	strbuf_release(&err);
+	return ret;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	NULL,
+	"reftable",
+	reftable_ref_store_create,
+	reftable_init_db,
+	reftable_transaction_prepare,
+	reftable_transaction_finish,
+	reftable_transaction_abort,
+	reftable_initial_transaction_commit,
+
+	reftable_pack_refs,
+	reftable_create_symref,
+	reftable_delete_refs,
+	reftable_rename_ref,
+	reftable_copy_ref,
+
+	reftable_ref_iterator_begin,
+	reftable_read_raw_ref,
+
+	reftable_reflog_iterator_begin,
+	reftable_for_each_reflog_ent,
+	reftable_for_each_reflog_ent_reverse,
+	reftable_reflog_exists,
+	reftable_create_reflog,
+	reftable_delete_reflog,
+	reftable_reflog_expire
+};
@@ -0,0 +1,1460 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../lockfile.h"
+#include "../tempfile.h"
+#include "../string-list.h"
+#include "../varint.h"
+#include "reftable.h"
+
+#define REFTABLE_SIGNATURE 0x52454654 /* "REFT" */
+#define REFTABLE_VERSION 1
+
+/*
+ * A table consists of:
+ *
+ *  - a 28-byte header: the signature, the version, the hash version,
+ *    two padding bytes, the block size used when writing it, and the
+ *    smallest and largest update index of its records (all integers in
+ *    network byte order);
+ *  - the ref blocks, followed by an index block if there are several;
+ *  - the log blocks, followed by an index block if there are several;
+ *  - a footer: a copy of the header, the offsets of the ref index, of
+ *    the first log block and of the log index (zero for a missing
+ *    index) as 8-byte integers, and the CRC-32 of the footer.
+ *
+ * A block is a type byte, its 4-byte length, its records, the 4-byte
+ * offsets of its restart points within the block and their 4-byte
+ * count. A record is the varint length of the prefix it shares with
+ * the key of the preceding record (zero at restart points), a varint
+ * holding the length of the rest of the key shifted left by three bits
+ * and ORed with the type of the record, the rest of the key, and the
+ * varint length of the value followed by the value:
+ *
+ *  - for a ref, whose key is the refname, the varint difference of its
+ *    update index from the smallest one of the table, followed by the
+ *    object name (and the peeled object name) or the symref target;
+ *  - for a log, whose key is the refname, a NUL and the 8-byte
+ *    complement of the update index, the old and new object names, the
+ *    varint timestamp, the 2-byte time zone, the varint length of the
+ *    identity, the identity and the message;
+ *  - for an index record, whose key is the last key of a block, the
+ *    varint offset of that block.
+ */
+#define REFTABLE_HEADER_SIZE 28
+#define REFTABLE_FOOTER_SIZE (REFTABLE_HEADER_SIZE + 28)
+#define BLOCK_HEADER_SIZE 5
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_LOG 'g'
+#define BLOCK_TYPE_INDEX 'i'
+
+#define REFTABLE_DEFAULT_BLOCK_SIZE 4096
+#define REFTABLE_RESTART_INTERVAL 16
+
+#define SECTION_REFS 0
+#define SECTION_LOGS 1
+
+struct reftable_table {
+	char *path;
+	const char *name;
+	int refcount;
+
+	const unsigned char *map;
+	size_t size;
+
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+
+	/* The blocks of each section, and the offset of its index or 0 */
+	size_t ref_start, ref_end, ref_index;
+	size_t log_start, log_end, log_index;
+};
+
+static int hash_version(void)
+{
+	return the_hash_algo - hash_algos;
+}
+
+static NORETURN void die_corrupt(const struct reftable_table *t)
+{
+	die(_("corrupt reftable '%s'"), t->path);
+}
+
+static void put_varint(struct strbuf *sb, uint64_t value)
+{
+	unsigned char buf[16];
+	int len = encode_varint(value, buf);
+
+	strbuf_add(sb, buf, len);
+}
+
+/*
+ * Decode a varint from the bytes at '*p' that end at 'end'. Return -1
+ * if it is truncated or overflows.
+ */
+static int get_varint(const unsigned char **p, const unsigned char *end,
+		      uint64_t *value)
+{
+	const unsigned char *buf = *p;
+	uint64_t val;
+	unsigned char c;
+
+	if (buf >= end)
+		return -1;
+	c = *buf++;
+	val = c & 127;
+	while (c & 128) {
+		val += 1;
+		if (!val || MSB(val, 7) || buf >= end)
+			return -1;
+		c = *buf++;
+		val = (val << 7) + (c & 127);
+	}
+	*p = buf;
+	*value = val;
+	return 0;
+}
+
+static int key_cmp(const struct strbuf *a, const char *b, size_t b_len)
+{
+	int cmp = memcmp(a->buf, b, a->len < b_len ? a->len : b_len);
+
+	if (cmp)
+		return cmp;
+	return a->len < b_len ? -1 : a->len != b_len;
+}
+
+static void fill_header(unsigned char *buf, unsigned int block_size,
+			uint64_t min_update_index, uint64_t max_update_index)
+{
+	put_be32(buf, REFTABLE_SIGNATURE);
+	buf[4] = REFTABLE_VERSION;
+	buf[5] = hash_version();
+	buf[6] = buf[7] = 0;
+	put_be32(buf + 8, block_size);
+	put_be64(buf + 12, min_update_index);
+	put_be64(buf + 20, max_update_index);
+}
+
+/*
+ * Open the table "name" in "dir". Return NULL and set errno if it
+ * cannot be opened. Die if it is corrupt.
+ */
+static struct reftable_table *open_table(const char *dir, const char *name)
+{
+	struct reftable_table *t = xcalloc(1, sizeof(*t));
+	const unsigned char *header, *footer;
+	struct stat st;
+	uint32_t crc;
+	int fd;
+
+	t->path = xstrfmt("%s/%s", dir, name);
+	t->name = t->path + strlen(dir) + 1;
+	t->refcount = 1;
+
+	fd = open(t->path, O_RDONLY);
+	if (fd < 0) {
+		int save_errno = errno;
+
+		free(t->path);
+		free(t);
+		errno = save_errno;
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0)
+		die_errno(_("couldn't stat '%s'"), t->path);
+	t->size = xsize_t(st.st_size);
+	if (t->size < REFTABLE_HEADER_SIZE + REFTABLE_FOOTER_SIZE)
+		die_corrupt(t);
+	t->map = xmmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	header = t->map;
+	footer = t->map + t->size - REFTABLE_FOOTER_SIZE;
+	crc = crc32(0, NULL, 0);
+	crc = crc32(crc, footer, REFTABLE_FOOTER_SIZE - 4);
+	if (get_be32(header) != REFTABLE_SIGNATURE ||
+	    header[4] != REFTABLE_VERSION ||
+	    memcmp(header, footer, REFTABLE_HEADER_SIZE) ||
+	    crc != get_be32(footer + REFTABLE_FOOTER_SIZE - 4))
+		die_corrupt(t);
+	if (header[5] != hash_version())
+		die(_("reftable '%s' uses another hash algorithm"), t->path);
+
+	t->min_update_index = get_be64(header + 12);
+	t->max_update_index = get_be64(header + 20);
+	t->ref_index = get_be64(footer + REFTABLE_HEADER_SIZE);
+	t->log_start = get_be64(footer + REFTABLE_HEADER_SIZE + 8);
+	t->log_index = get_be64(footer + REFTABLE_HEADER_SIZE + 16);
+
+	t->ref_start = REFTABLE_HEADER_SIZE;
+	t->ref_end = t->ref_index ? t->ref_index : t->log_start;
+	t->log_end = t->log_index ? t->log_index : footer - t->map;
+	if (t->ref_end < t->ref_start || t->log_start < t->ref_end ||
+	    t->log_end < t->log_start || footer - t->map < t->log_end ||
+	    t->min_update_index > t->max_update_index)
+		die_corrupt(t);
+
+	return t;
+}
+
+static void release_table(struct reftable_table *t)
+{
+	if (--t->refcount)
+		return;
+	if (munmap((void *)t->map, t->size))
+		die_errno("error ummapping reftable");
+	free(t->path);
+	free(t);
+}
+
+struct block {
+	const unsigned char *data;
+	size_t len;
+	/* the records end where the restart offsets begin */
+	size_t records_end;
+	uint32_t restarts_nr;
+};
+
+static void read_block(const struct reftable_table *t, size_t off, size_t end,
+		       int type, struct block *b)
+{
+	const unsigned char *p = t->map + off;
+
+	if (end < off || end - off < BLOCK_HEADER_SIZE + 4 || *p != type)
+		die_corrupt(t);
+	b->data = p;
+	b->len = get_be32(p + 1);
+	if (b->len < BLOCK_HEADER_SIZE + 4 || b->len > end - off)
+		die_corrupt(t);
+	b->restarts_nr = get_be32(p + b->len - 4);
+	if (!b->restarts_nr ||
+	    b->restarts_nr > (b->len - BLOCK_HEADER_SIZE - 4) / 4)
+		die_corrupt(t);
+	b->records_end = b->len - 4 - 4 * (size_t)b->restarts_nr;
+}
+
+static size_t restart_offset(const struct reftable_table *t,
+			     const struct block *b, uint32_t i)
+{
+	size_t off = get_be32(b->data + b->records_end + 4 * (size_t)i);
+
+	if (off < BLOCK_HEADER_SIZE || off >= b->records_end)
+		die_corrupt(t);
+	return off;
+}
+
+/*
+ * Decode the record at offset '*pos' of a block, whose key is
+ * prefix-compressed against 'key', and advance '*pos' past it.
+ */
+static void decode_record(const struct reftable_table *t,
+			  const struct block *b, size_t *pos,
+			  struct strbuf *key, unsigned int *type,
+			  const unsigned char **value, size_t *value_len)
+{
+	const unsigned char *p = b->data + *pos;
+	const unsigned char *end = b->data + b->records_end;
+	uint64_t prefix_len, suffix_type, suffix_len, len;
+
+	if (get_varint(&p, end, &prefix_len) ||
+	    get_varint(&p, end, &suffix_type))
+		die_corrupt(t);
+	suffix_len = suffix_type >> 3;
+	if (prefix_len > key->len || suffix_len > end - p)
+		die_corrupt(t);
+	strbuf_setlen(key, prefix_len);
+	strbuf_add(key, p, suffix_len);
+	p += suffix_len;
+	*type = suffix_type & 7;
+
+	if (get_varint(&p, end, &len) || len > end - p)
+		die_corrupt(t);
+	*value = p;
+	*value_len = len;
+	*pos = p + len - b->data;
+}
+
+/*
+ * Return the offset of the restart point to scan the block from to
+ * find the first record whose key is at least 'key'.
+ */
+static size_t block_seek(const struct reftable_table *t, const struct block *b,
+			 const char *key, size_t key_len, struct strbuf *scratch)
+{
+	uint32_t lo = 0, hi = b->restarts_nr;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		size_t pos = restart_offset(t, b, mid);
+		const unsigned char *value;
+		size_t value_len;
+		unsigned int type;
+
+		strbuf_reset(scratch);
+		decode_record(t, b, &pos, scratch, &type, &value, &value_len);
+		if (key_cmp(scratch, key, key_len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? restart_offset(t, b, lo - 1) : BLOCK_HEADER_SIZE;
+}
+
+/* An iterator over the records of one section of a table. */
+struct table_iter {
+	struct reftable_table *t;
+	int block_type;
+	size_t section_end;
+	int done;
+
+	size_t block_off;
+	struct block block;
+	size_t pos;
+
+	/* the current record */
+	struct strbuf key;
+	unsigned int type;
+	const unsigned char *value;
+	size_t value_len;
+};
+
+static void table_iter_load_block(struct table_iter *ti, size_t off)
+{
+	if (off >= ti->section_end) {
+		ti->done = 1;
+		return;
+	}
+	read_block(ti->t, off, ti->section_end, ti->block_type, &ti->block);
+	ti->block_off = off;
+	ti->pos = BLOCK_HEADER_SIZE;
+	strbuf_reset(&ti->key);
+}
+
+static void table_iter_next(struct table_iter *ti)
+{
+	if (ti->done)
+		return;
+	if (ti->pos >= ti->block.records_end) {
+		table_iter_load_block(ti, ti->block_off + ti->block.len);
+		if (ti->done)
+			return;
+	}
+	decode_record(ti->t, &ti->block, &ti->pos, &ti->key, &ti->type,
+		      &ti->value, &ti->value_len);
+}
+
+/*
+ * Position the iterator on the first record of the section whose key
+ * is at least 'key'.
+ */
+static void table_iter_seek(struct table_iter *ti, struct reftable_table *t,
+			    int section, const char *key, size_t key_len)
+{
+	size_t start, index, index_end;
+
+	ti->t = t;
+	ti->done = 0;
+	if (section == SECTION_REFS) {
+		ti->block_type = BLOCK_TYPE_REF;
+		start = t->ref_start;
+		ti->section_end = t->ref_end;
+		index = t->ref_index;
+		index_end = t->log_start;
+	} else {
+		ti->block_type = BLOCK_TYPE_LOG;
+		start = t->log_start;
+		ti->section_end = t->log_end;
+		index = t->log_index;
+		index_end = t->size - REFTABLE_FOOTER_SIZE;
+	}
+
+	if (index) {
+		const unsigned char *p, *end;
+		struct block b;
+		uint64_t off;
+		size_t pos;
+
+		/* find the first block whose last key is at least 'key' */
+		read_block(t, index, index_end, BLOCK_TYPE_INDEX, &b);
+		pos = block_seek(t, &b, key, key_len, &ti->key);
+		strbuf_reset(&ti->key);
+		do {
+			if (pos >= b.records_end) {
+				ti->done = 1;
+				return;
+			}
+			decode_record(t, &b, &pos, &ti->key, &ti->type,
+				      &ti->value, &ti->value_len);
+		} while (key_cmp(&ti->key, key, key_len) < 0);
+
+		p = ti->value;
+		end = p + ti->value_len;
+		if (get_varint(&p, end, &off) || p != end ||
+		    off < start || off >= ti->section_end)
+			die_corrupt(t);
+		start = off;
+	}
+
+	table_iter_load_block(ti, start);
+	if (ti->done)
+		return;
+	ti->pos = block_seek(t, &ti->block, key, key_len, &ti->key);
+	strbuf_reset(&ti->key);
+	do {
+		table_iter_next(ti);
+	} while (!ti->done && key_cmp(&ti->key, key, key_len) < 0);
+}
+
+static void decode_ref(const struct reftable_table *t, const struct strbuf *key,
+		       unsigned int type, const unsigned char *p, size_t len,
+		       struct reftable_ref_record *rec, struct strbuf *target)
+{
+	const unsigned char *end = p + len;
+	const unsigned int rawsz = the_hash_algo->rawsz;
+	uint64_t delta;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->refname = key->buf;
+	rec->type = type;
+	if (get_varint(&p, end, &delta) ||
+	    delta > t->max_update_index - t->min_update_index)
+		die_corrupt(t);
+	rec->update_index = t->min_update_index + delta;
+
+	switch (type) {
+	case REFTABLE_REF_DELETION:
+		break;
+	case REFTABLE_REF_VAL1:
+		if (end - p < rawsz)
+			die_corrupt(t);
+		hashcpy(rec->value.hash, p);
+		p += rawsz;
+		break;
+	case REFTABLE_REF_VAL2:
+		if (end - p < 2 * rawsz)
+			die_corrupt(t);
+		hashcpy(rec->value.hash, p);
+		hashcpy(rec->peeled.hash, p + rawsz);
+		p += 2 * rawsz;
+		break;
+	case REFTABLE_REF_SYMREF:
+		strbuf_reset(target);
+		strbuf_add(target, p, end - p);
+		rec->target = target->buf;
+		p = end;
+		break;
+	default:
+		die_corrupt(t);
+	}
+	if (p != end)
+		die_corrupt(t);
+}
+
+static void decode_log(const struct reftable_table *t, const struct strbuf *key,
+		       unsigned int type, const unsigned char *p, size_t len,
+		       struct reftable_log_record *rec,
+		       struct strbuf *ident, struct strbuf *message)
+{
+	const unsigned char *end = p + len;
+	const unsigned int rawsz = the_hash_algo->rawsz;
+	const char *nul = memchr(key->buf, '\0', key->len);
+	uint64_t timestamp, ident_len;
+
+	memset(rec, 0, sizeof(*rec));
+	if (!nul || key->buf + key->len - nul != 9)
+		die_corrupt(t);
+	rec->refname = key->buf;
+	rec->update_index = ~get_be64(nul + 1);
+	rec->type = type;
+
+	if (type == REFTABLE_LOG_DELETION) {
+		if (len)
+			die_corrupt(t);
+		return;
+	}
+	if (type != REFTABLE_LOG_UPDATE || end - p < 2 * rawsz)
+		die_corrupt(t);
+	hashcpy(rec->old_oid.hash, p);
+	hashcpy(rec->new_oid.hash, p + rawsz);
+	p += 2 * rawsz;
+	if (get_varint(&p, end, &timestamp) || end - p < 2)
+		die_corrupt(t);
+	rec->timestamp = timestamp;
+	rec->tz = (int16_t)get_be16(p);
+	p += 2;
+	if (get_varint(&p, end, &ident_len) || ident_len > end - p)
+		die_corrupt(t);
+	strbuf_reset(ident);
+	strbuf_add(ident, p, ident_len);
+	p += ident_len;
+	strbuf_reset(message);
+	strbuf_add(message, p, end - p);
+	rec->ident = ident->buf;
+	rec->message = message->buf;
+}
+
+/* Writing tables */
+
+struct index_entry {
+	char *key;
+	size_t len;
+	uint64_t offset;
+};
+
+struct table_writer {
+	struct tempfile *tempfile;
+	uint64_t offset;
+	int error;
+
+	unsigned int block_size;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+	uint64_t ref_index;
+	uint64_t log_start;
+
+	/* the block being written */
+	int block_type;
+	struct strbuf block;
+	uint32_t *restarts;
+	size_t restarts_nr, restarts_alloc;
+	size_t records_nr;
+	struct strbuf last_key;
+	int has_last_key;
+
+	/* the last key and offset of each block of the current section */
+	struct index_entry *index;
+	size_t index_nr, index_alloc;
+
+	struct strbuf key;
+	struct strbuf value;
+	struct strbuf record;
+};
+
+static void writer_write(struct table_writer *w, const void *buf, size_t len)
+{
+	if (!w->error &&
+	    write_in_full(get_tempfile_fd(w->tempfile), buf, len) < 0)
+		w->error = errno ? errno : EIO;
+	w->offset += len;
+}
+
+static void writer_flush_block(struct table_writer *w)
+{
+	unsigned char buf[4];
+	size_t i;
+
+	if (!w->records_nr)
+		return;
+	for (i = 0; i < w->restarts_nr; i++) {
+		put_be32(buf, w->restarts[i]);
+		strbuf_add(&w->block, buf, 4);
+	}
+	put_be32(buf, w->restarts_nr);
+	strbuf_add(&w->block, buf, 4);
+	put_be32(w->block.buf + 1, w->block.len);
+
+	if (w->block_type != BLOCK_TYPE_INDEX) {
+		struct index_entry *e;
+
+		ALLOC_GROW(w->index, w->index_nr + 1, w->index_alloc);
+		e = &w->index[w->index_nr++];
+		e->key = xmemdupz(w->last_key.buf, w->last_key.len);
+		e->len = w->last_key.len;
+		e->offset = w->offset;
+	}
+	writer_write(w, w->block.buf, w->block.len);
+
+	strbuf_reset(&w->block);
+	w->restarts_nr = 0;
+	w->records_nr = 0;
+}
+
+static void writer_add(struct table_writer *w, const char *key, size_t key_len,
+		       unsigned int type, const struct strbuf *value)
+{
+	size_t restarts_size;
+	int restart;
+
+	if (w->has_last_key && key_cmp(&w->last_key, key, key_len) >= 0)
+		BUG("reftable records added out of order");
+
+	for (;;) {
+		size_t prefix_len = 0;
+
+		restart = !(w->records_nr % REFTABLE_RESTART_INTERVAL);
+		if (!restart)
+			while (prefix_len < key_len &&
+			       prefix_len < w->last_key.len &&
+			       key[prefix_len] == w->last_key.buf[prefix_len])
+				prefix_len++;
+
+		strbuf_reset(&w->record);
+		put_varint(&w->record, prefix_len);
+		put_varint(&w->record, (uint64_t)(key_len - prefix_len) << 3 | type);
+		strbuf_add(&w->record, key + prefix_len, key_len - prefix_len);
+		put_varint(&w->record, value->len);
+		strbuf_addbuf(&w->record, value);
+
+		/* index blocks are not limited in size */
+		restarts_size = 4 * (w->restarts_nr + restart + 1);
+		if (!w->records_nr || w->block_type == BLOCK_TYPE_INDEX ||
+		    w->block.len + w->record.len + restarts_size <= w->block_size)
+			break;
+		writer_flush_block(w);
+	}
+
+	if (!w->records_nr) {
+		strbuf_addch(&w->block, w->block_type);
+		strbuf_addf(&w->block, "%c%c%c%c", 0, 0, 0, 0);
+	}
+	if (restart) {
+		ALLOC_GROW(w->restarts, w->restarts_nr + 1, w->restarts_alloc);
+		w->restarts[w->restarts_nr++] = w->block.len;
+	}
+	strbuf_addbuf(&w->block, &w->record);
+	w->records_nr++;
+
+	strbuf_reset(&w->last_key);
+	strbuf_add(&w->last_key, key, key_len);
+	w->has_last_key = 1;
+}
+
+/*
+ * Flush the section being written, and write its index if it spans
+ * several blocks. Return the offset of that index, or 0.
+ */
+static uint64_t writer_finish_section(struct table_writer *w)
+{
+	uint64_t index_offset = 0;
+	size_t i;
+
+	writer_flush_block(w);
+	if (w->index_nr > 1) {
+		index_offset = w->offset;
+		w->block_type = BLOCK_TYPE_INDEX;
+		w->has_last_key = 0;
+		for (i = 0; i < w->index_nr; i++) {
+			strbuf_reset(&w->value);
+			put_varint(&w->value, w->index[i].offset);
+			writer_add(w, w->index[i].key, w->index[i].len, 0,
+				   &w->value);
+		}
+		writer_flush_block(w);
+	}
+	for (i = 0; i < w->index_nr; i++)
+		free(w->index[i].key);
+	w->index_nr = 0;
+	w->has_last_key = 0;
+	return index_offset;
+}
+
+static void writer_add_ref(struct table_writer *w,
+			   const struct reftable_ref_record *rec)
+{
+	const unsigned int rawsz = the_hash_algo->rawsz;
+
+	if (rec->update_index < w->min_update_index ||
+	    rec->update_index > w->max_update_index)
+		BUG("update index of reftable record out of range");
+
+	strbuf_reset(&w->value);
+	put_varint(&w->value, rec->update_index - w->min_update_index);
+	switch (rec->type) {
+	case REFTABLE_REF_DELETION:
+		break;
+	case REFTABLE_REF_VAL1:
+		strbuf_add(&w->value, rec->value.hash, rawsz);
+		break;
+	case REFTABLE_REF_VAL2:
+		strbuf_add(&w->value, rec->value.hash, rawsz);
+		strbuf_add(&w->value, rec->peeled.hash, rawsz);
+		break;
+	case REFTABLE_REF_SYMREF:
+		strbuf_addstr(&w->value, rec->target);
+		break;
+	default:
+		BUG("unknown reftable ref type %u", rec->type);
+	}
+	writer_add(w, rec->refname, strlen(rec->refname), rec->type, &w->value);
+}
+
+static void log_key(struct strbuf *key, const char *refname,
+		    uint64_t update_index)
+{
+	unsigned char buf[8];
+
+	strbuf_reset(key);
+	strbuf_addstr(key, refname);
+	strbuf_addch(key, '\0');
+	put_be64(buf, ~update_index);
+	strbuf_add(key, buf, 8);
+}
+
+static void writer_add_log(struct table_writer *w,
+			   const struct reftable_log_record *rec)
+{
+	const unsigned int rawsz = the_hash_algo->rawsz;
+
+	if (rec->update_index < w->min_update_index ||
+	    rec->update_index > w->max_update_index)
+		BUG("update index of reftable record out of range");
+
+	log_key(&w->key, rec->refname, rec->update_index);
+	strbuf_reset(&w->value);
+	if (rec->type == REFTABLE_LOG_UPDATE) {
+		size_t ident_len = strlen(rec->ident);
+		uint16_t tz = rec->tz;
+
+		strbuf_add(&w->value, rec->old_oid.hash, rawsz);
+		strbuf_add(&w->value, rec->new_oid.hash, rawsz);
+		put_varint(&w->value, rec->timestamp);
+		strbuf_addch(&w->value, tz >> 8);
+		strbuf_addch(&w->value, tz & 0xff);
+		put_varint(&w->value, ident_len);
+		strbuf_add(&w->value, rec->ident, ident_len);
+		strbuf_addstr(&w->value, rec->message);
+	} else if (rec->type != REFTABLE_LOG_DELETION) {
+		BUG("unknown reftable log type %u", rec->type);
+	}
+	writer_add(w, w->key.buf, w->key.len, rec->type, &w->value);
+}
+
+static int writer_begin(struct reftable_stack *st, struct table_writer *w,
+			uint64_t min_update_index, uint64_t max_update_index,
+			struct strbuf *err)
+{
+	unsigned char header[REFTABLE_HEADER_SIZE];
+	char *template = xstrfmt("%s/tmp_table_XXXXXX", st->dir);
+
+	memset(w, 0, sizeof(*w));
+	strbuf_init(&w->block, 0);
+	strbuf_init(&w->last_key, 0);
+	strbuf_init(&w->key, 0);
+	strbuf_init(&w->value, 0);
+	strbuf_init(&w->record, 0);
+
+	w->tempfile = mks_tempfile_m(template, 0666);
+	if (!w->tempfile) {
+		strbuf_addf(err, "unable to create '%s': %s",
+			    template, strerror(errno));
+		free(template);
+		return -1;
+	}
+	free(template);
+
+	w->block_size = st->block_size;
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+	w->block_type = BLOCK_TYPE_REF;
+	fill_header(header, w->block_size, min_update_index, max_update_index);
+	writer_write(w, header, sizeof(header));
+	return 0;
+}
+
+static void writer_begin_logs(struct table_writer *w)
+{
+	w->ref_index = writer_finish_section(w);
+	w->log_start = w->offset;
+	w->block_type = BLOCK_TYPE_LOG;
+}
+
+static void writer_release(struct table_writer *w)
+{
+	size_t i;
+
+	for (i = 0; i < w->index_nr; i++)
+		free(w->index[i].key);
+	free(w->index);
+	free(w->restarts);
+	strbuf_release(&w->block);
+	strbuf_release(&w->last_key);
+	strbuf_release(&w->key);
+	strbuf_release(&w->value);
+	strbuf_release(&w->record);
+}
+
+/*
+ * Finish writing the table, move it to its final name and open it.
+ * Return NULL on errors.
+ */
+static struct reftable_table *writer_finish(struct reftable_stack *st,
+					    struct table_writer *w,
+					    struct strbuf *err)
+{
+	unsigned char footer[REFTABLE_FOOTER_SIZE];
+	struct reftable_table *t = NULL;
+	const char *tmp_path, *suffix;
+	char *name = NULL, *path = NULL;
+	uint64_t log_index;
+
+	if (w->block_type == BLOCK_TYPE_REF)
+		writer_begin_logs(w);
+	log_index = writer_finish_section(w);
+
+	fill_header(footer, w->block_size, w->min_update_index,
+		    w->max_update_index);
+	put_be64(footer + REFTABLE_HEADER_SIZE, w->ref_index);
+	put_be64(footer + REFTABLE_HEADER_SIZE + 8, w->log_start);
+	put_be64(footer + REFTABLE_HEADER_SIZE + 16, log_index);
+	put_be32(footer + REFTABLE_FOOTER_SIZE - 4,
+		 crc32(crc32(0, NULL, 0), footer, REFTABLE_FOOTER_SIZE - 4));
+	writer_write(w, footer, sizeof(footer));
+
+	tmp_path = get_tempfile_path(w->tempfile);
+	if (w->error || close_tempfile_gently(w->tempfile)) {
+		strbuf_addf(err, "unable to write '%s': %s", tmp_path,
+			    strerror(w->error ? w->error : errno));
+		delete_tempfile(&w->tempfile);
+		goto out;
+	}
+
+	/* borrow the unique suffix of the temporary file */
+	suffix = tmp_path + strlen(tmp_path) - 6;
+	name = xstrfmt("0x%012"PRIx64"-0x%012"PRIx64"-%s.ref",
+		       w->min_update_index, w->max_update_index, suffix);
+	path = xstrfmt("%s/%s", st->dir, name);
+	if (rename_tempfile(&w->tempfile, path)) {
+		strbuf_addf(err, "unable to write '%s': %s", path,
+			    strerror(errno));
+		goto out;
+	}
+	adjust_shared_perm(path);
+
+	t = open_table(st->dir, name);
+	if (!t)
+		strbuf_addf(err, "unable to open '%s': %s", path,
+			    strerror(errno));
+
+out:
+	free(name);
+	free(path);
+	writer_release(w);
+	return t;
+}
+
+/* The stack */
+
+void reftable_stack_init(struct reftable_stack *st, const char *dir)
+{
+	memset(st, 0, sizeof(*st));
+	st->dir = xstrdup(dir);
+	st->list_file = xstrfmt("%s/tables.list", dir);
+	st->block_size = REFTABLE_DEFAULT_BLOCK_SIZE;
+	st->auto_compact = 1;
+	strbuf_init(&st->scratch, 0);
+}
+
+static void clear_tables(struct reftable_stack *st)
+{
+	size_t i;
+
+	for (i = 0; i < st->nr; i++)
+		release_table(st->tables[i]);
+	FREE_AND_NULL(st->tables);
+	st->nr = st->alloc = 0;
+	st->loaded = 0;
+}
+
+void reftable_stack_release(struct reftable_stack *st)
+{
+	clear_tables(st);
+	stat_validity_clear(&st->list_validity);
+	FREE_AND_NULL(st->dir);
+	FREE_AND_NULL(st->list_file);
+	strbuf_release(&st->scratch);
+}
+
+int reftable_stack_init_db(struct reftable_stack *st, struct strbuf *err)
+{
+	int fd;
+
+	if (mkdir(st->dir, 0777) && errno != EEXIST) {
+		strbuf_addf(err, "unable to create directory '%s': %s",
+			    st->dir, strerror(errno));
+		return -1;
+	}
+	adjust_shared_perm(st->dir);
+
+	fd = open(st->list_file, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (fd < 0) {
+		if (errno == EEXIST)
+			return 0;
+		strbuf_addf(err, "unable to create '%s': %s",
+			    st->list_file, strerror(errno));
+		return -1;
+	}
+	close(fd);
+	adjust_shared_perm(st->list_file);
+	return 0;
+}
+
+static struct reftable_table *find_table(struct reftable_stack *st,
+					 const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < st->nr; i++)
+		if (!strcmp(st->tables[i]->name, name))
+			return st->tables[i];
+	return NULL;
+}
+
+void reftable_stack_reload(struct reftable_stack *st)
+{
+	int retries = 10;
+
+	if (st->loaded &&
+	    stat_validity_check(&st->list_validity, st->list_file))
+		return;
+
+	/*
+	 * A table listed in "tables.list" can disappear before we get
+	 * to open it if another process compacts the stack meanwhile;
+	 * the list has changed by then, so try again.
+	 */
+	for (;;) {
+		struct strbuf list = STRBUF_INIT;
+		struct string_list names = STRING_LIST_INIT_NODUP;
+		struct reftable_table **tables = NULL;
+		size_t nr = 0, alloc = 0, i;
+		int missing = 0;
+		int fd;
+
+		fd = open(st->list_file, O_RDONLY);
+		if (fd < 0) {
+			if (errno != ENOENT)
+				die_errno(_("couldn't read '%s'"), st->list_file);
+			stat_validity_clear(&st->list_validity);
+		} else {
+			stat_validity_update(&st->list_validity, fd);
+			if (strbuf_read(&list, fd, 0) < 0)
+				die_errno(_("couldn't read '%s'"), st->list_file);
+			close(fd);
+		}
+
+		string_list_split_in_place(&names, list.buf, '\n', -1);
+		for (i = 0; i < names.nr; i++) {
+			const char *name = names.items[i].string;
+			struct reftable_table *t;
+
+			if (!*name)
+				continue;
+			if (strchr(name, '/') || *name == '.')
+				die(_("corrupt reftable list '%s'"), st->list_file);
+			t = find_table(st, name);
+			if (t) {
+				t->refcount++;
+			} else {
+				t = open_table(st->dir, name);
+				if (!t && errno == ENOENT && --retries) {
+					missing = 1;
+					break;
+				} else if (!t) {
+					die_errno(_("couldn't open reftable '%s/%s'"),
+						  st->dir, name);
+				}
+			}
+			ALLOC_GROW(tables, nr + 1, alloc);
+			tables[nr++] = t;
+		}
+		string_list_clear(&names, 0);
+		strbuf_release(&list);
+
+		if (missing) {
+			for (i = 0; i < nr; i++)
+				release_table(tables[i]);
+			free(tables);
+			continue;
+		}
+
+		clear_tables(st);
+		st->tables = tables;
+		st->nr = nr;
+		st->alloc = alloc;
+		st->loaded = 1;
+		return;
+	}
+}
+
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st)
+{
+	uint64_t max = 0;
+	size_t i;
+
+	reftable_stack_reload(st);
+	for (i = 0; i < st->nr; i++)
+		if (max < st->tables[i]->max_update_index)
+			max = st->tables[i]->max_update_index;
+	return max + 1;
+}
+
+int reftable_stack_read_ref(struct reftable_stack *st, const char *refname,
+			    struct reftable_ref_record *rec)
+{
+	struct table_iter ti;
+	size_t len = strlen(refname), i;
+	int ret = 1;
+
+	reftable_stack_reload(st);
+	memset(&ti, 0, sizeof(ti));
+	strbuf_init(&ti.key, 0);
+	for (i = st->nr; i-- > 0; ) {
+		table_iter_seek(&ti, st->tables[i], SECTION_REFS, refname, len);
+		if (ti.done || key_cmp(&ti.key, refname, len))
+			continue;
+		decode_ref(ti.t, &ti.key, ti.type, ti.value, ti.value_len,
+			   rec, &st->scratch);
+		rec->refname = refname;
+		ret = rec->type == REFTABLE_REF_DELETION;
+		break;
+	}
+	strbuf_release(&ti.key);
+	return ret;
+}
+
+/*
+ * An iterator merging the records of several tables. A record hides
+ * the records with the same key in older tables; deletions are only
+ * returned with 'keep_deletions'.
+ */
+struct reftable_iterator {
+	int section;
+	int keep_deletions;
+	char *refname;
+
+	struct reftable_table **tables;
+	struct table_iter *subs;
+	size_t nr;
+
+	/* the current record */
+	struct reftable_table *t;
+	struct strbuf key;
+	unsigned int type;
+	const unsigned char *value;
+	size_t value_len;
+
+	struct strbuf buf1, buf2;
+};
+
+static struct reftable_iterator *merged_iter_begin(struct reftable_table **tables,
+						   size_t nr, int section,
+						   const char *key, size_t key_len,
+						   int keep_deletions)
+{
+	struct reftable_iterator *it = xcalloc(1, sizeof(*it));
+	size_t i;
+
+	it->section = section;
+	it->keep_deletions = keep_deletions;
+	it->nr = nr;
+	ALLOC_ARRAY(it->tables, nr);
+	it->subs = xcalloc(nr, sizeof(*it->subs));
+	strbuf_init(&it->key, 0);
+	strbuf_init(&it->buf1, 0);
+	strbuf_init(&it->buf2, 0);
+
+	for (i = 0; i < nr; i++) {
+		it->tables[i] = tables[i];
+		tables[i]->refcount++;
+		strbuf_init(&it->subs[i].key, 0);
+		table_iter_seek(&it->subs[i], tables[i], section, key, key_len);
+	}
+	return it;
+}
+
+static int merged_iter_next(struct reftable_iterator *it)
+{
+	for (;;) {
+		struct table_iter *min = NULL;
+		size_t i;
+
+		/* on ties, the newest table wins */
+		for (i = 0; i < it->nr; i++) {
+			struct table_iter *ti = &it->subs[i];
+
+			if (!ti->done &&
+			    (!min || key_cmp(&ti->key, min->key.buf, min->key.len) <= 0))
+				min = ti;
+		}
+		if (!min)
+			return 1;
+
+		strbuf_reset(&it->key);
+		strbuf_addbuf(&it->key, &min->key);
+		it->t = min->t;
+		it->type = min->type;
+		it->value = min->value;
+		it->value_len = min->value_len;
+
+		for (i = 0; i < it->nr; i++) {
+			struct table_iter *ti = &it->subs[i];
+
+			if (!ti->done &&
+			    !key_cmp(&ti->key, it->key.buf, it->key.len))
+				table_iter_next(ti);
+		}
+
+		if (it->type || it->keep_deletions)
+			return 0;
+	}
+}
+
+struct reftable_iterator *reftable_stack_seek_ref(struct reftable_stack *st,
+						  const char *refname)
+{
+	reftable_stack_reload(st);
+	return merged_iter_begin(st->tables, st->nr, SECTION_REFS,
+				 refname, strlen(refname), 0);
+}
+
+struct reftable_iterator *reftable_stack_seek_log(struct reftable_stack *st,
+						  const char *refname)
+{
+	struct reftable_iterator *it;
+
+	reftable_stack_reload(st);
+	/* the logs of "refname" start with "refname\0" */
+	it = merged_iter_begin(st->tables, st->nr, SECTION_LOGS,
+			       refname, *refname ? strlen(refname) + 1 : 0, 0);
+	if (*refname)
+		it->refname = xstrdup(refname);
+	return it;
+}
+
+int reftable_iterator_next_ref(struct reftable_iterator *it,
+			       struct reftable_ref_record *rec)
+{
+	if (it->section != SECTION_REFS)
+		BUG("reftable_iterator_next_ref() called for logs");
+	if (merged_iter_next(it))
+		return 1;
+	decode_ref(it->t, &it->key, it->type, it->value, it->value_len,
+		   rec, &it->buf1);
+	return 0;
+}
+
+int reftable_iterator_next_log(struct reftable_iterator *it,
+			       struct reftable_log_record *rec)
+{
+	if (it->section != SECTION_LOGS)
+		BUG("reftable_iterator_next_log() called for refs");
+	if (merged_iter_next(it))
+		return 1;
+	decode_log(it->t, &it->key, it->type, it->value, it->value_len,
+		   rec, &it->buf1, &it->buf2);
+	if (it->refname && strcmp(rec->refname, it->refname))
+		return 1;
+	return 0;
+}
+
+void reftable_iterator_free(struct reftable_iterator *it)
+{
+	size_t i;
+
+	if (!it)
+		return;
+	for (i = 0; i < it->nr; i++) {
+		strbuf_release(&it->subs[i].key);
+		release_table(it->tables[i]);
+	}
+	free(it->subs);
+	free(it->tables);
+	free(it->refname);
+	strbuf_release(&it->key);
+	strbuf_release(&it->buf1);
+	strbuf_release(&it->buf2);
+	free(it);
+}
+
+/* Updating the stack */
+
+int reftable_stack_lock(struct reftable_stack *st, struct strbuf *err)
+{
+	static int timeout_configured = 0;
+	static int timeout_value = 1000;
+
+	if (!timeout_configured) {
+		git_config_get_int("reftable.locktimeout", &timeout_value);
+		timeout_configured = 1;
+	}
+
+	/* the stack of a worktree is created on its first update */
+	if (mkdir(st->dir, 0777) && errno != EEXIST) {
+		strbuf_addf(err, "unable to create directory '%s': %s",
+			    st->dir, strerror(errno));
+		return -1;
+	}
+
+	if (hold_lock_file_for_update_timeout(&st->lock, st->list_file, 0,
+					      timeout_value) < 0) {
+		unable_to_lock_message(st->list_file, errno, err);
+		return -1;
+	}
+
+	/*
+	 * The list might have changed the moment before we locked it;
+	 * make sure we see the current version.
+	 */
+	st->loaded = 0;
+	reftable_stack_reload(st);
+	return 0;
+}
+
+void reftable_stack_unlock(struct reftable_stack *st)
+{
+	if (!is_lock_file_locked(&st->lock))
+		BUG("reftable_stack_unlock() called when not locked");
+	rollback_lock_file(&st->lock);
+}
+
+/*
+ * Write the list of the tables of the stack and unlock it.
+ */
+static int commit_stack_list(struct reftable_stack *st, struct strbuf *err)
+{
+	struct strbuf list = STRBUF_INIT;
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < st->nr; i++)
+		strbuf_addf(&list, "%s\n", st->tables[i]->name);
+	if (write_in_full(get_lock_file_fd(&st->lock), list.buf, list.len) < 0 ||
+	    commit_lock_file(&st->lock) < 0) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    st->list_file, strerror(errno));
+		rollback_lock_file(&st->lock);
+		ret = -1;
+	} else {
+		adjust_shared_perm(st->list_file);
+	}
+
+	/* reread the list, but keep the tables we have open */
+	st->loaded = 0;
+	strbuf_release(&list);
+	return ret;
+}
+
+static void remove_tables(struct reftable_stack *st, struct string_list *names)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t i;
+
+	for (i = 0; i < names->nr; i++) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", st->dir, names->items[i].string);
+		/* this fails on some platforms while the table is mapped */
+		unlink(path.buf);
+	}
+	strbuf_release(&path);
+}
+
+/*
+ * Merge the tables 'first' to 'last' of the locked stack into one, in
+ * memory; their names are added to 'obsolete', to be removed once the
+ * new list is written.
+ */
+static int compact_range(struct reftable_stack *st, size_t first, size_t last,
+			 struct string_list *obsolete, struct strbuf *err)
+{
+	uint64_t min = UINT64_MAX, max = 0;
+	struct reftable_ref_record ref;
+	struct reftable_log_record log;
+	struct reftable_iterator *it;
+	struct reftable_table *t;
+	struct table_writer w;
+	size_t i;
+
+	for (i = first; i <= last; i++) {
+		if (min > st->tables[i]->min_update_index)
+			min = st->tables[i]->min_update_index;
+		if (max < st->tables[i]->max_update_index)
+			max = st->tables[i]->max_update_index;
+	}
+	if (writer_begin(st, &w, min, max, err))
+		return -1;
+
+	/* tombstones only matter if there are older tables */
+	it = merged_iter_begin(st->tables + first, last - first + 1,
+			       SECTION_REFS, "", 0, first > 0);
+	while (!reftable_iterator_next_ref(it, &ref))
+		writer_add_ref(&w, &ref);
+	reftable_iterator_free(it);
+
+	writer_begin_logs(&w);
+	it = merged_iter_begin(st->tables + first, last - first + 1,
+			       SECTION_LOGS, "", 0, first > 0);
+	while (!reftable_iterator_next_log(it, &log))
+		writer_add_log(&w, &log);
+	reftable_iterator_free(it);
+
+	t = writer_finish(st, &w, err);
+	if (!t)
+		return -1;
+
+	for (i = first; i <= last; i++) {
+		string_list_append(obsolete, st->tables[i]->name);
+		release_table(st->tables[i]);
+	}
+	st->tables[first] = t;
+	MOVE_ARRAY(st->tables + first + 1, st->tables + last + 1,
+		   st->nr - last - 1);
+	st->nr -= last - first;
+	return 0;
+}
+
+/*
+ * Merge the newest tables of the stack as long as a table is not at
+ * least twice as large as the tables above it, so that the sizes of
+ * the tables decrease geometrically from the bottom of the stack.
+ */
+static void auto_compact(struct reftable_stack *st, struct string_list *obsolete)
+{
+	struct strbuf err = STRBUF_INIT;
+	size_t first, total;
+
+	if (st->nr < 2)
+		return;
+	first = st->nr - 1;
+	total = st->tables[first]->size;
+	while (first > 0 && st->tables[first - 1]->size <= 2 * total)
+		total += st->tables[--first]->size;
+	if (st->nr - first < 2)
+		return;
+
+	/* the stack is still fine without it */
+	if (compact_range(st, first, st->nr - 1, obsolete, &err))
+		warning(_("unable to compact reftables: %s"), err.buf);
+	strbuf_release(&err);
+}
+
+static int ref_record_cmp(const void *va, const void *vb)
+{
+	const struct reftable_ref_record *a = va, *b = vb;
+
+	return strcmp(a->refname, b->refname);
+}
+
+static int log_record_cmp(const void *va, const void *vb)
+{
+	const struct reftable_log_record *a = va, *b = vb;
+	int cmp = strcmp(a->refname, b->refname);
+
+	if (cmp)
+		return cmp;
+	/* the newest entry first */
+	return a->update_index < b->update_index ? 1 :
+		a->update_index > b->update_index ? -1 : 0;
+}
+
+int reftable_stack_add(struct reftable_stack *st,
+		       struct reftable_ref_record *refs, size_t refs_nr,
+		       struct reftable_log_record *logs, size_t logs_nr,
+		       struct strbuf *err)
+{
+	struct string_list obsolete = STRING_LIST_INIT_DUP;
+	uint64_t min = UINT64_MAX, max = 0;
+	struct reftable_table *t;
+	struct table_writer w;
+	size_t i;
+	int ret;
+
+	if (!is_lock_file_locked(&st->lock))
+		BUG("reftable_stack_add() called when not locked");
+	if (!refs_nr && !logs_nr) {
+		reftable_stack_unlock(st);
+		return 0;
+	}
+
+	QSORT(refs, refs_nr, ref_record_cmp);
+	QSORT(logs, logs_nr, log_record_cmp);
+	for (i = 0; i < refs_nr; i++) {
+		if (min > refs[i].update_index)
+			min = refs[i].update_index;
+		if (max < refs[i].update_index)
+			max = refs[i].update_index;
+	}
+	for (i = 0; i < logs_nr; i++) {
+		if (min > logs[i].update_index)
+			min = logs[i].update_index;
+		if (max < logs[i].update_index)
+			max = logs[i].update_index;
+	}
+
+	if (writer_begin(st, &w, min, max, err)) {
+		reftable_stack_unlock(st);
+		return -1;
+	}
+	for (i = 0; i < refs_nr; i++)
+		writer_add_ref(&w, &refs[i]);
+	writer_begin_logs(&w);
+	for (i = 0; i < logs_nr; i++)
+		writer_add_log(&w, &logs[i]);
+	t = writer_finish(st, &w, err);
+	if (!t) {
+		reftable_stack_unlock(st);
+		return -1;
+	}
+
+	ALLOC_GROW(st->tables, st->nr + 1, st->alloc);
+	st->tables[st->nr++] = t;
+	if (st->auto_compact)
+		auto_compact(st, &obsolete);
+
+	ret = commit_stack_list(st, err);
+	if (!ret)
+		remove_tables(st, &obsolete);
+	string_list_clear(&obsolete, 0);
+	return ret;
+}
+
+/*
+ * Find the files in the directory of the locked stack that are not
+ * part of it, nor about to be removed: leftovers of interrupted
+ * updates.
+ */
+static void find_stale_tables(struct reftable_stack *st,
+			      struct string_list *obsolete,
+			      struct string_list *stale)
+{
+	struct dirent *de;
+	DIR *dir = opendir(st->dir);
+
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if (!ends_with(de->d_name, ".ref") &&
+		    !starts_with(de->d_name, "tmp_table_"))
+			continue;
+		if (find_table(st, de->d_name) ||
+		    unsorted_string_list_has_string(obsolete, de->d_name))
+			continue;
+		string_list_append(stale, de->d_name);
+	}
+	closedir(dir);
+}
+
+int reftable_stack_compact_all(struct reftable_stack *st, struct strbuf *err)
+{
+	struct string_list obsolete = STRING_LIST_INIT_DUP;
+	struct string_list stale = STRING_LIST_INIT_DUP;
+	int ret;
+
+	if (reftable_stack_lock(st, err))
+		return -1;
+	if (st->nr > 1 && compact_range(st, 0, st->nr - 1, &obsolete, err)) {
+		reftable_stack_unlock(st);
+		return -1;
+	}
+
+	/* nobody else can be writing a table while we hold the lock */
+	find_stale_tables(st, &obsolete, &stale);
+	remove_tables(st, &stale);
+
+	ret = commit_stack_list(st, err);
+	if (!ret)
+		remove_tables(st, &obsolete);
+	string_list_clear(&obsolete, 0);
+	string_list_clear(&stale, 0);
+	return ret;
+}
@@ -0,0 +1,160 @@
+#ifndef REFS_REFTABLE_H
+#define REFS_REFTABLE_H
+
+#include "../lockfile.h"
+
+/*
+ * Reading and writing the tables of the "reftable" ref storage
+ * backend.
+ *
+ * A table is an immutable file holding ref records, sorted by
+ * refname, followed by log (reflog) records, sorted by refname and
+ * then from the newest to the oldest entry. Records are grouped in
+ * blocks and prefix-compressed against the preceding record; every
+ * few records a "restart point" stores its full key, so that a block
+ * can be binary searched. When a section spans more than one block,
+ * an index block lists the last key of each of them, so that finding
+ * a key reads O(log n) records.
+ *
+ * The tables of a repository form a stack, listed oldest first in the
+ * file "tables.list". A change is made by writing a new table with
+ * the changed records and atomically replacing "tables.list" under its
+ * lock; a record supersedes the records with the same key in older
+ * tables, and deletions are recorded as tombstones. Adjacent tables
+ * are merged ("compacted") as the stack grows, so that it stays
+ * logarithmic in the number of changes.
+ */
+
+/* Types of ref records */
+#define REFTABLE_REF_DELETION	0
+#define REFTABLE_REF_VAL1	1 /* an object name */
+#define REFTABLE_REF_VAL2	2 /* a tag, and the object it peels to */
+#define REFTABLE_REF_SYMREF	3
+
+/* Types of log records */
+#define REFTABLE_LOG_DELETION	0
+#define REFTABLE_LOG_UPDATE	1
+
+struct reftable_ref_record {
+	const char *refname;
+	uint64_t update_index;
+	unsigned int type;
+	struct object_id value;
+	struct object_id peeled;
+	const char *target;
+};
+
+struct reftable_log_record {
+	const char *refname;
+	uint64_t update_index;
+	unsigned int type;
+	struct object_id old_oid;
+	struct object_id new_oid;
+	const char *ident; /* "Name <email>" */
+	timestamp_t timestamp;
+	int tz;
+	const char *message; /* without the trailing newline */
+};
+
+struct reftable_table;
+
+struct reftable_stack {
+	char *dir;
+	char *list_file;
+
+	/* The tables of the stack, oldest first */
+	struct reftable_table **tables;
+	size_t nr, alloc;
+	int loaded;
+	struct stat_validity list_validity;
+
+	struct lock_file lock;
+
+	/* Options for writing tables */
+	unsigned int block_size;
+	int auto_compact;
+
+	/* Backing store of the record returned by reftable_stack_read_ref() */
+	struct strbuf scratch;
+};
+
+/*
+ * Initialize a stack for the tables in the directory "dir". Nothing
+ * is read until the stack is first used.
+ */
+void reftable_stack_init(struct reftable_stack *st, const char *dir);
+void reftable_stack_release(struct reftable_stack *st);
+
+/*
+ * Create the directory of the stack and an empty "tables.list", unless
+ * they exist already. Return 0 on success. On errors, write an error
+ * message to `err` and return a nonzero value.
+ */
+int reftable_stack_init_db(struct reftable_stack *st, struct strbuf *err);
+
+/*
+ * Make sure that the stack reflects the current "tables.list". This is
+ * cheap if it has not changed. Dies if a table cannot be read.
+ */
+void reftable_stack_reload(struct reftable_stack *st);
+
+/* Return the update index for the next change of the stack. */
+uint64_t reftable_stack_next_update_index(struct reftable_stack *st);
+
+/*
+ * Look up the ref record of `refname` in the stack. Return 0 and fill
+ * in `rec` if the ref exists, and 1 otherwise. The strings of `rec`
+ * are valid until the next call to this function.
+ */
+int reftable_stack_read_ref(struct reftable_stack *st, const char *refname,
+			    struct reftable_ref_record *rec);
+
+/*
+ * Iterate over the records of the stack, in order, starting with the
+ * ref records whose refname is at least `refname`, or with the log
+ * records of `refname` (pass "" for all of them). The iterator sees
+ * the stack as it was when it was created. Records are returned with
+ * reftable_iterator_next_ref() or reftable_iterator_next_log(), which
+ * return 0 for a record and 1 at the end of the iteration; the
+ * strings of a record are valid until the next call.
+ */
+struct reftable_iterator;
+struct reftable_iterator *reftable_stack_seek_ref(struct reftable_stack *st,
+						  const char *refname);
+struct reftable_iterator *reftable_stack_seek_log(struct reftable_stack *st,
+						  const char *refname);
+int reftable_iterator_next_ref(struct reftable_iterator *it,
+			       struct reftable_ref_record *rec);
+int reftable_iterator_next_log(struct reftable_iterator *it,
+			       struct reftable_log_record *rec);
+void reftable_iterator_free(struct reftable_iterator *it);
+
+/*
+ * Lock the stack for an update, and reload it so that it is current
+ * while it is locked. Return 0 on success. On errors, write an error
+ * message to `err` and return a nonzero value.
+ */
+int reftable_stack_lock(struct reftable_stack *st, struct strbuf *err);
+void reftable_stack_unlock(struct reftable_stack *st);
+
+/*
+ * Write the given records as a new table on top of the locked stack,
+ * compact the stack if `auto_compact` is set, and unlock it. The
+ * records are sorted by this function, and must not contain the same
+ * key twice. Return 0 on success. On errors, write an error message
+ * to `err`, unlock the stack and return a nonzero value.
+ */
+int reftable_stack_add(struct reftable_stack *st,
+		       struct reftable_ref_record *refs, size_t refs_nr,
+		       struct reftable_log_record *logs, size_t logs_nr,
+		       struct strbuf *err);
+
+/*
+ * Merge all tables of the stack into one, dropping the tombstones,
+ * and remove stale tables from its directory. Return 0 on success.
+ * On errors, write an error message to `err` and return a nonzero
+ * value.
+ */
+int reftable_stack_compact_all(struct reftable_stack *st, struct strbuf *err);
+
+#endif /* REFS_REFTABLE_H */
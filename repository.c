@@ -155,6 +155,7 @@ int repo_init(struct repository *repo,
 		goto error;
 
 	repo_set_hash_algo(repo, format.hash_algo);
+	repo->ref_storage_format = format.ref_storage;
 
 	if (worktree)
 		repo_set_worktree(repo, worktree);
@@ -226,6 +227,7 @@ void repo_clear(struct repository *repo)
 	FREE_AND_NULL(repo->index_file);
 	FREE_AND_NULL(repo->worktree);
 	FREE_AND_NULL(repo->submodule_prefix);
+	FREE_AND_NULL(repo->ref_storage_format);
 
 	raw_object_store_clear(repo->objects);
 	FREE_AND_NULL(repo->objects);
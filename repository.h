@@ -90,6 +90,12 @@ struct repository {
 	/* Repository's current hash algorithm, as serialized on disk. */
 	const struct git_hash_algo *hash_algo;
 
+	/*
+	 * The backend storing the repository's refs, as recorded in
+	 * extensions.refStorage, or NULL for the default "files" one.
+	 */
+	char *ref_storage_format;
+
 	/* Configurations */
 
 	/* Indicate if a repository has a different 'commondir' from 'gitdir' */
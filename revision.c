@@ -27,6 +27,7 @@
 #include "commit-reach.h"
 #include "commit-graph.h"
 #include "prio-queue.h"
+#include "bloom.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -463,8 +464,97 @@ static void file_change(struct diff_options *options,
 	options->flags.has_changes = 1;
 }
 
+static struct trace_key trace_bloom = TRACE_KEY_INIT(BLOOM);
+
+static struct {
+	int filter_not_present;
+	int maybe;
+	int definitely_not;
+} bloom_count;
+
+static void trace_bloom_filter_statistics_atexit(void)
+{
+	trace_printf_key(&trace_bloom,
+			 "statistics: filter_not_present=%d maybe=%d definitely_not=%d",
+			 bloom_count.filter_not_present, bloom_count.maybe,
+			 bloom_count.definitely_not);
+}
+
+static void prepare_to_use_bloom_filter(struct rev_info *revs)
+{
+	struct pathspec_item *pi;
+	struct commit_graph *g;
+	char *path;
+	size_t len;
+
+	if (!revs->prune || !revs->dense)
+		return;
+	if (revs->prune_data.nr != 1)
+		return;
+	if (revs->diffopt.flags.follow_renames)
+		return;
+
+	/*
+	 * The filters only know about literal paths (and their leading
+	 * directories), so anything with glob or other magic has to go
+	 * through the tree diff.
+	 */
+	pi = &revs->prune_data.items[0];
+	if (pi->magic & ~PATHSPEC_LITERAL)
+		return;
+	if (pi->nowildcard_len < pi->len)
+		return;
+
+	if (!prepare_commit_graph(revs->repo))
+		return;
+	g = revs->repo->objects->commit_graph;
+	if (!get_bloom_filter_settings(g))
+		return;
+
+	path = xstrdup(pi->match);
+	len = strlen(path);
+	while (len && path[len - 1] == '/')
+		path[--len] = '\0';
+	if (!len) {
+		free(path);
+		return;
+	}
+
+	revs->bloom_filter_settings = get_bloom_filter_settings(g);
+	revs->bloom_key = xmalloc(sizeof(struct bloom_key));
+	fill_bloom_key(path, len, revs->bloom_key, revs->bloom_filter_settings);
+	free(path);
+
+	if (trace_want(&trace_bloom))
+		atexit(trace_bloom_filter_statistics_atexit);
+}
+
+static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
+						 struct commit *commit)
+{
+	struct bloom_filter filter;
+	int result;
+
+	if (!load_bloom_filter_from_graph(revs->repo->objects->commit_graph,
+					  &filter, commit)) {
+		bloom_count.filter_not_present++;
+		return -1;
+	}
+
+	result = bloom_filter_contains(&filter, revs->bloom_key,
+				       revs->bloom_filter_settings);
+
+	if (result)
+		bloom_count.maybe++;
+	else
+		bloom_count.definitely_not++;
+
+	return result;
+}
+
 static int rev_compare_tree(struct rev_info *revs,
-			    struct commit *parent, struct commit *commit)
+			    struct commit *parent, struct commit *commit,
+			    int nth_parent)
 {
 	struct tree *t1 = get_commit_tree(parent);
 	struct tree *t2 = get_commit_tree(commit);
@@ -492,6 +582,14 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
+	/*
+	 * The filter was computed against the first parent, so it can
+	 * only tell us that the pathspec is TREESAME to that one.
+	 */
+	if (revs->bloom_key && !nth_parent &&
+	    !check_maybe_different_in_bloom_filter(revs, commit))
+		return REV_TREE_SAME;
+
 	tree_difference = REV_TREE_SAME;
 	revs->pruning.flags.has_changes = 0;
 	if (diff_tree_oid(&t1->object.oid, &t2->object.oid, "",
@@ -694,7 +792,7 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 			die("cannot simplify commit %s (because of %s)",
 			    oid_to_hex(&commit->object.oid),
 			    oid_to_hex(&p->object.oid));
-		switch (rev_compare_tree(revs, p, commit)) {
+		switch (rev_compare_tree(revs, p, commit, nth_parent)) {
 		case REV_TREE_SAME:
 			if (!revs->simplify_history || !relevant_commit(p)) {
 				/* Even if a merge with an uninteresting
@@ -2915,7 +3013,7 @@ define_commit_slab(indegree_slab, int);
 define_commit_slab(author_date_slab, timestamp_t);
 
 struct topo_walk_info {
-	uint32_t min_generation;
+	timestamp_t min_generation;
 	struct prio_queue explore_queue;
 	struct prio_queue indegree_queue;
 	struct prio_queue topo_queue;
@@ -2961,7 +3059,7 @@ static void explore_walk_step(struct rev_info *revs)
 }
 
 static void explore_to_depth(struct rev_info *revs,
-			     uint32_t gen_cutoff)
+			     timestamp_t gen_cutoff)
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
 	struct commit *c;
@@ -3001,7 +3099,7 @@ static void indegree_walk_step(struct rev_info *revs)
 }
 
 static void compute_indegrees_to_depth(struct rev_info *revs,
-				       uint32_t gen_cutoff)
+				       timestamp_t gen_cutoff)
 {
 	struct topo_walk_info *info = revs->topo_walk_info;
 	struct commit *c;
@@ -3154,6 +3252,9 @@ int prepare_revision_walk(struct rev_info *revs)
 				       FOR_EACH_OBJECT_PROMISOR_ONLY);
 	}
 
+	if (!revs->reflog_info)
+		prepare_to_use_bloom_filter(revs);
+
 	if (revs->no_walk != REVISION_WALK_NO_WALK_UNSORTED)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
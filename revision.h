@@ -241,6 +241,14 @@ struct rev_info {
 	struct diff_options diffopt;
 	struct diff_options pruning;
 
+	/*
+	 * Hashes of the single literal pathspec we are limited to, used
+	 * to consult the changed-path Bloom filters of the commit-graph
+	 * before diffing trees. NULL if the filters cannot be used.
+	 */
+	struct bloom_key *bloom_key;
+	struct bloom_filter_settings *bloom_filter_settings;
+
 	struct reflog_walk_info *reflog_info;
 	struct decoration children;
 	struct decoration merge_simplification;
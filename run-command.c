@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "config.h"
 #include "run-command.h"
 #include "exec-cmd.h"
 #include "sigchain.h"
@@ -1335,6 +1336,28 @@ int run_hook_le(const char *const *env, const char *name, ...)
 	return ret;
 }
 
+int prepare_auto_maintenance(int quiet, struct child_process *maint)
+{
+	int enabled;
+
+	if (!git_config_get_bool("maintenance.auto", &enabled) && !enabled)
+		return 0;
+
+	maint->git_cmd = 1;
+	argv_array_pushl(&maint->args, "maintenance", "run", "--auto", NULL);
+	argv_array_push(&maint->args, quiet ? "--quiet" : "--no-quiet");
+	return 1;
+}
+
+int run_auto_maintenance(int quiet)
+{
+	struct child_process maint = CHILD_PROCESS_INIT;
+
+	if (!prepare_auto_maintenance(quiet, &maint))
+		return 0;
+	return run_command(&maint);
+}
+
 struct io_pump {
 	/* initialized by caller */
 	int fd;
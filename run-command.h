@@ -66,6 +66,19 @@ LAST_ARG_MUST_BE_NULL
 extern int run_hook_le(const char *const *env, const char *name, ...);
 extern int run_hook_ve(const char *const *env, const char *name, va_list args);
 
+/*
+ * Prepare "maint" to run "git maintenance run --auto", which commands
+ * run after they created objects or refs. Returns 0 if automatic
+ * maintenance is disabled by maintenance.auto, 1 otherwise.
+ */
+int prepare_auto_maintenance(int quiet, struct child_process *maint);
+
+/*
+ * Run "git maintenance run --auto" unless maintenance.auto disables
+ * it; any error is reported by the child.
+ */
+int run_auto_maintenance(int quiet);
+
 #define RUN_COMMAND_NO_STDIN 1
 #define RUN_GIT_CMD	     2	/*If this is to be git sub-command */
 #define RUN_COMMAND_STDOUT_TO_STDERR 4
@@ -15,6 +15,7 @@
 #include "revision.h"
 #include "rerere.h"
 #include "merge-recursive.h"
+#include "merge-ort.h"
 #include "refs.h"
 #include "argv-array.h"
 #include "quote.h"
@@ -554,9 +555,28 @@ static int do_recursive_merge(struct commit *base, struct commit *next,
 	for (xopt = opts->xopts; xopt != opts->xopts + opts->xopts_nr; xopt++)
 		parse_merge_opt(&o, *xopt);
 
-	clean = merge_trees(&o,
-			    head_tree,
-			    next_tree, base_tree, &result);
+	if (((opts->strategy && !strcmp(opts->strategy, "ort")) ||
+	     (!opts->strategy && merge_ort_by_default())) && !o.subtree_shift) {
+		struct merge_result ort_result;
+		struct strbuf sb = STRBUF_INIT;
+
+		if (index_has_changes(&the_index, head_tree, &sb)) {
+			error(_("Your local changes to the following files would be overwritten by merge:\n  %s"),
+			      sb.buf);
+			strbuf_release(&sb);
+			clean = -1;
+		} else {
+			merge_incore_nonrecursive(&o, base_tree, head_tree,
+						  next_tree, &ort_result);
+			merge_switch_to_result(&o, head_tree, &ort_result, 1,
+					       !is_rebase_i(opts));
+			clean = ort_result.clean;
+			merge_finalize(&o, &ort_result);
+		}
+	} else
+		clean = merge_trees(&o,
+				    head_tree,
+				    next_tree, base_tree, &result);
 	if (is_rebase_i(opts) && clean <= 0)
 		fputs(o.obuf.buf, stdout);
 	strbuf_release(&o.obuf);
@@ -1870,7 +1890,8 @@ static int do_pick_commit(enum todo_command command, struct commit *commit,
 
 	if (is_rebase_i(opts) && write_author_script(msg.message) < 0)
 		res = -1;
-	else if (!opts->strategy || !strcmp(opts->strategy, "recursive") || command == TODO_REVERT) {
+	else if (!opts->strategy || !strcmp(opts->strategy, "recursive") ||
+		 !strcmp(opts->strategy, "ort") || command == TODO_REVERT) {
 		res = do_recursive_merge(base, next, base_label, next_label,
 					 &head, &msgbuf, opts);
 		if (res < 0)
@@ -4,6 +4,7 @@
 #include "dir.h"
 #include "string-list.h"
 #include "chdir-notify.h"
+#include "refs.h"
 
 static int inside_git_dir = -1;
 static int inside_work_tree = -1;
@@ -439,7 +440,12 @@ static int check_repo_format(const char *var, const char *value, void *vdata)
 			data->partial_clone = xstrdup(value);
 		} else if (!strcmp(ext, "worktreeconfig"))
 			data->worktree_config = git_config_bool(var, value);
-		else
+		else if (!strcmp(ext, "refstorage")) {
+			if (!value)
+				return config_error_nonbool(var);
+			free(data->ref_storage);
+			data->ref_storage = xstrdup(value);
+		} else
 			string_list_append(&data->unknown_extensions, ext);
 	}
 
@@ -478,6 +484,8 @@ static int check_repository_format_gently(const char *gitdir, struct repository_
 	repository_format_precious_objects = candidate->precious_objects;
 	repository_format_partial_clone = candidate->partial_clone;
 	repository_format_worktree_config = candidate->worktree_config;
+	free(the_repository->ref_storage_format);
+	the_repository->ref_storage_format = candidate->ref_storage;
 	string_list_clear(&candidate->unknown_extensions, 0);
 
 	if (repository_format_worktree_config) {
@@ -517,9 +525,25 @@ int read_repository_format(struct repository_format *format, const char *path)
 	format->hash_algo = GIT_HASH_SHA1;
 	string_list_init(&format->unknown_extensions, 1);
 	git_config_from_file(check_repo_format, path, format);
+	/* extensions are only defined for version 1 */
+	if (format->version < 1)
+		FREE_AND_NULL(format->ref_storage);
 	return format->version;
 }
 
+void clear_repository_format(struct repository_format *format)
+{
+	free(format->partial_clone);
+	free(format->ref_storage);
+	free(format->work_tree);
+	string_list_clear(&format->unknown_extensions, 0);
+	memset(format, 0, sizeof(*format));
+	format->version = -1;
+	format->is_bare = -1;
+	format->hash_algo = GIT_HASH_SHA1;
+	string_list_init(&format->unknown_extensions, 1);
+}
+
 int verify_repository_format(const struct repository_format *format,
 			     struct strbuf *err)
 {
@@ -529,6 +553,13 @@ int verify_repository_format(const struct repository_format *format,
 		return -1;
 	}
 
+	if (format->ref_storage &&
+	    !ref_storage_backend_exists(format->ref_storage)) {
+		strbuf_addf(err, _("unknown ref storage format '%s'"),
+			    format->ref_storage);
+		return -1;
+	}
+
 	if (format->version >= 1 && format->unknown_extensions.nr) {
 		int i;
 
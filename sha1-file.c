@@ -32,6 +32,7 @@
 #include "packfile.h"
 #include "fetch-object.h"
 #include "object-store.h"
+#include "midx.h"
 
 /* The maximum size for an object header. */
 #define MAX_HEADER_LEN 32
@@ -359,10 +360,15 @@ struct strbuf *alt_scratch_buf(struct alternate_object_database *alt)
 	return &alt->scratch;
 }
 
+/*
+ * Like alt_scratch_buf() plus the loose object path, but in the
+ * caller's buffer, so that concurrent object readers do not share one.
+ */
 static const char *alt_sha1_path(struct alternate_object_database *alt,
-				 const unsigned char *sha1)
+				 const unsigned char *sha1, struct strbuf *buf)
 {
-	struct strbuf *buf = alt_scratch_buf(alt);
+	strbuf_reset(buf);
+	strbuf_addf(buf, "%s/", alt->path);
 	fill_sha1_path(buf, sha1);
 	return buf->buf;
 }
@@ -744,13 +750,19 @@ static int check_and_freshen_local(const struct object_id *oid, int freshen)
 static int check_and_freshen_nonlocal(const struct object_id *oid, int freshen)
 {
 	struct alternate_object_database *alt;
+	struct strbuf buf = STRBUF_INIT;
+	int ret = 0;
+
 	prepare_alt_odb(the_repository);
 	for (alt = the_repository->objects->alt_odb_list; alt; alt = alt->next) {
-		const char *path = alt_sha1_path(alt, oid->hash);
-		if (check_and_freshen_file(path, freshen))
-			return 1;
+		const char *path = alt_sha1_path(alt, oid->hash, &buf);
+		if (check_and_freshen_file(path, freshen)) {
+			ret = 1;
+			break;
+		}
 	}
-	return 0;
+	strbuf_release(&buf);
+	return ret;
 }
 
 static int check_and_freshen(const struct object_id *oid, int freshen)
@@ -886,28 +898,24 @@ int git_open_cloexec(const char *name, int flags)
  * Find "sha1" as a loose object in the local repository or in an alternate.
  * Returns 0 on success, negative on failure.
  *
- * The "path" out-parameter will give the path of the object we found (if any).
- * Note that it may point to static storage and is only valid until another
- * call to sha1_file_name(), etc.
+ * On return, "path" holds the path of the object we found (if any).
  */
 static int stat_sha1_file(struct repository *r, const unsigned char *sha1,
-			  struct stat *st, const char **path)
+			  struct stat *st, struct strbuf *path)
 {
 	struct alternate_object_database *alt;
-	static struct strbuf buf = STRBUF_INIT;
 
-	strbuf_reset(&buf);
-	sha1_file_name(r, &buf, sha1);
-	*path = buf.buf;
+	strbuf_reset(path);
+	sha1_file_name(r, path, sha1);
 
-	if (!lstat(*path, st))
+	if (!lstat(path->buf, st))
 		return 0;
 
 	prepare_alt_odb(r);
 	errno = ENOENT;
 	for (alt = r->objects->alt_odb_list; alt; alt = alt->next) {
-		*path = alt_sha1_path(alt, sha1);
-		if (!lstat(*path, st))
+		alt_sha1_path(alt, sha1, path);
+		if (!lstat(path->buf, st))
 			return 0;
 	}
 
@@ -916,29 +924,27 @@ static int stat_sha1_file(struct repository *r, const unsigned char *sha1,
 
 /*
  * Like stat_sha1_file(), but actually open the object and return the
- * descriptor. See the caveats on the "path" parameter above.
+ * descriptor.
  */
 static int open_sha1_file(struct repository *r,
-			  const unsigned char *sha1, const char **path)
+			  const unsigned char *sha1, struct strbuf *path)
 {
 	int fd;
 	struct alternate_object_database *alt;
 	int most_interesting_errno;
-	static struct strbuf buf = STRBUF_INIT;
 
-	strbuf_reset(&buf);
-	sha1_file_name(r, &buf, sha1);
-	*path = buf.buf;
+	strbuf_reset(path);
+	sha1_file_name(r, path, sha1);
 
-	fd = git_open(*path);
+	fd = git_open(path->buf);
 	if (fd >= 0)
 		return fd;
 	most_interesting_errno = errno;
 
 	prepare_alt_odb(r);
 	for (alt = r->objects->alt_odb_list; alt; alt = alt->next) {
-		*path = alt_sha1_path(alt, sha1);
-		fd = git_open(*path);
+		alt_sha1_path(alt, sha1, path);
+		fd = git_open(path->buf);
 		if (fd >= 0)
 			return fd;
 		if (most_interesting_errno == ENOENT)
@@ -957,11 +963,14 @@ static void *map_sha1_file_1(struct repository *r, const char *path,
 {
 	void *map;
 	int fd;
+	struct strbuf buf = STRBUF_INIT;
 
 	if (path)
 		fd = git_open(path);
-	else
-		fd = open_sha1_file(r, sha1, &path);
+	else {
+		fd = open_sha1_file(r, sha1, &buf);
+		path = buf.buf;
+	}
 	map = NULL;
 	if (fd >= 0) {
 		struct stat st;
@@ -971,12 +980,14 @@ static void *map_sha1_file_1(struct repository *r, const char *path,
 			if (!*size) {
 				/* mmap() is forbidden on empty files */
 				error(_("object file %s is empty"), path);
+				strbuf_release(&buf);
 				return NULL;
 			}
 			map = xmmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
 		}
 		close(fd);
 	}
+	strbuf_release(&buf);
 	return map;
 }
 
@@ -1196,9 +1207,12 @@ static int sha1_loose_object_info(struct repository *r,
 	 * object even exists.
 	 */
 	if (!oi->typep && !oi->type_name && !oi->sizep && !oi->contentp) {
-		const char *path;
+		struct strbuf path = STRBUF_INIT;
 		struct stat st;
-		if (stat_sha1_file(r, sha1, &st, &path) < 0)
+		int ret = stat_sha1_file(r, sha1, &st, &path);
+
+		strbuf_release(&path);
+		if (ret < 0)
 			return -1;
 		if (oi->disk_sizep)
 			*oi->disk_sizep = st.st_size;
@@ -1408,7 +1422,7 @@ void *read_object_file_extended(const struct object_id *oid,
 {
 	void *data;
 	const struct packed_git *p;
-	const char *path;
+	struct strbuf path = STRBUF_INIT;
 	struct stat st;
 	const struct object_id *repl = lookup_replace ?
 		lookup_replace_object(the_repository, oid) : oid;
@@ -1428,7 +1442,8 @@ void *read_object_file_extended(const struct object_id *oid,
 
 	if (!stat_sha1_file(the_repository, repl->hash, &st, &path))
 		die(_("loose object %s (stored in %s) is corrupt"),
-		    oid_to_hex(repl), path);
+		    oid_to_hex(repl), path.buf);
+	strbuf_release(&path);
 
 	if ((p = has_packed_and_bad(repl->hash)) != NULL)
 		die(_("packed object %s (stored in %s) is corrupt"),
@@ -1437,6 +1452,33 @@ void *read_object_file_extended(const struct object_id *oid,
 	return NULL;
 }
 
+void enable_concurrent_object_reads(struct repository *r)
+{
+	if (r->objects->concurrent_reads) {
+		r->objects->concurrent_reads++;
+		return;
+	}
+
+	/*
+	 * Do all the lazy setup of the read path now, while there is
+	 * only one thread.
+	 */
+	prepare_alt_odb(r);
+	if (read_replace_refs)
+		prepare_replace_object(r);
+	begin_concurrent_pack_access(r);
+	r->objects->concurrent_reads = 1;
+}
+
+void disable_concurrent_object_reads(struct repository *r)
+{
+	if (!r->objects->concurrent_reads)
+		BUG("object reads are not concurrent");
+	if (--r->objects->concurrent_reads)
+		return;
+	end_concurrent_pack_access(r);
+}
+
 void *read_object_with_reference(const struct object_id *oid,
 				 const char *required_type_name,
 				 unsigned long *size,
@@ -1693,16 +1735,52 @@ static int freshen_loose_object(const struct object_id *oid)
 	return check_and_freshen(oid, 1);
 }
 
+/* Find a pack other than a cruft pack that has the object. */
+static struct packed_git *find_non_cruft_pack(struct repository *r,
+					      const struct object_id *oid)
+{
+	struct multi_pack_index *m;
+	struct packed_git *p;
+	uint32_t i;
+
+	for (m = r->objects->multi_pack_index; m; m = m->next) {
+		for (i = 0; i < m->num_packs; i++) {
+			if (prepare_midx_pack(m, i))
+				continue;
+			p = m->packs[i];
+			if (!p->is_cruft && find_pack_entry_one(oid->hash, p))
+				return p;
+		}
+	}
+	for (p = r->objects->packed_git; p; p = p->next)
+		if (!p->is_cruft && find_pack_entry_one(oid->hash, p))
+			return p;
+	return NULL;
+}
+
 static int freshen_packed_object(const struct object_id *oid)
 {
 	struct pack_entry e;
+	struct packed_git *p;
+
 	if (!find_pack_entry(the_repository, oid, &e))
 		return 0;
-	if (e.p->freshened)
+	/*
+	 * The mtimes of the objects of a cruft pack are recorded in its
+	 * .mtimes file, not in that of the pack; freshen another pack
+	 * that has the object, or write it loose to make it recent again.
+	 */
+	p = e.p;
+	if (p->is_cruft) {
+		p = find_non_cruft_pack(the_repository, oid);
+		if (!p)
+			return 0;
+	}
+	if (p->freshened)
 		return 1;
-	if (!freshen_file(e.p->pack_name))
+	if (!freshen_file(p->pack_name))
 		return 0;
-	e.p->freshened = 1;
+	p->freshened = 1;
 	return 1;
 }
 
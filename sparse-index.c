@@ -0,0 +1,295 @@
+#include "cache.h"
+#include "config.h"
+#include "cache-tree.h"
+#include "dir.h"
+#include "pathspec.h"
+#include "sparse-index.h"
+#include "tree.h"
+
+int is_sparse_index_allowed(struct index_state *istate)
+{
+	return core_apply_sparse_checkout &&
+	       !istate->split_index &&
+	       git_config_get_sparse_index();
+}
+
+static struct cache_entry *make_sparse_directory_entry(struct index_state *istate,
+						       struct strbuf *path,
+						       const struct object_id *oid)
+{
+	struct cache_entry *ce = make_empty_cache_entry(istate, path->len);
+
+	ce->ce_mode = S_IFDIR;
+	ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	ce->ce_namelen = path->len;
+	oidcpy(&ce->oid, oid);
+	memcpy(ce->name, path->buf, path->len);
+	return ce;
+}
+
+/*
+ * Can the entries in [start, end), which are all the entries below the
+ * directory 'path', be replaced by a sparse directory entry?
+ */
+static int can_collapse(struct index_state *istate, int start, int end,
+			struct strbuf *path, struct cache_tree *it)
+{
+	int i;
+
+	/* we need the tree object that the entry will point at */
+	if (!it || it->entry_count != end - start)
+		return 0;
+
+	for (i = start; i < end; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (!ce_skip_worktree(ce) || ce_stage(ce) ||
+		    S_ISGITLINK(ce->ce_mode) ||
+		    (ce->ce_flags & (CE_REMOVE | CE_INTENT_TO_ADD)))
+			return 0;
+	}
+
+	/*
+	 * Files that the user created there would otherwise look
+	 * untracked.
+	 */
+	return !file_exists(path->buf);
+}
+
+/*
+ * Collapse what can be collapsed among the entries in [start, end),
+ * which are all the entries below 'path' ("" for the top level) and are
+ * described by the cache-tree 'it', if any. The surviving entries are
+ * moved down to start at 'dst'; returns the position after the last one.
+ *
+ * Unless 'keep' is set, the collapsed entries are freed and the name
+ * hash is kept up to date; with 'keep', the caller still owns the
+ * collapsed entries elsewhere and will put them back.
+ */
+static int collapse_directories(struct index_state *istate,
+				int dst, int start, int end,
+				struct strbuf *path, struct cache_tree *it,
+				int keep)
+{
+	int i;
+
+	if (path->len && can_collapse(istate, start, end, path, it)) {
+		for (i = start; i < end && !keep; i++) {
+			remove_name_hash(istate, istate->cache[i]);
+			discard_cache_entry(istate->cache[i]);
+		}
+		istate->cache[dst] = make_sparse_directory_entry(istate, path,
+								  &it->oid);
+		if (!keep)
+			add_name_hash(istate, istate->cache[dst]);
+		istate->sparse_index = 1;
+		return dst + 1;
+	}
+
+	for (i = start; i < end; ) {
+		struct cache_entry *ce = istate->cache[i];
+		const char *name = ce->name + path->len;
+		const char *slash = strchr(name, '/');
+		size_t len = path->len;
+		int next;
+
+		if (!slash) {
+			istate->cache[dst++] = ce;
+			i++;
+			continue;
+		}
+
+		strbuf_add(path, name, slash - name + 1);
+		for (next = i + 1; next < end; next++)
+			if (!starts_with(istate->cache[next]->name, path->buf))
+				break;
+		dst = collapse_directories(istate, dst, i, next, path,
+					   cache_tree_find(it, path->buf + len),
+					   keep);
+		strbuf_setlen(path, len);
+		i = next;
+	}
+	return dst;
+}
+
+/*
+ * Collapse the index. With 'full', the full index is being collapsed
+ * only to be written out: its collapsed entries and cache-tree are left
+ * alone and the cache-tree is saved in 'full' for restore_full_index().
+ */
+static int do_convert_to_sparse(struct index_state *istate,
+				struct full_index *full)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	/*
+	 * Make sure the cache-tree knows the trees of the directories
+	 * that could be collapsed, without writing new tree objects.
+	 */
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_REPAIR))
+		return 0;
+
+	trace_performance_enter();
+	istate->cache_nr = collapse_directories(istate, 0, 0, istate->cache_nr,
+						&path, istate->cache_tree,
+						!!full);
+	strbuf_release(&path);
+	if (!istate->sparse_index) {
+		trace_performance_leave("convert_to_sparse");
+		return 0;
+	}
+
+	/* the entry counts of the collapsed subtrees changed */
+	if (full)
+		full->cache_tree = istate->cache_tree;
+	else
+		cache_tree_free(&istate->cache_tree);
+	istate->cache_tree = cache_tree();
+	cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_REPAIR);
+	trace_performance_leave("convert_to_sparse");
+	return 1;
+}
+
+int convert_to_sparse(struct index_state *istate)
+{
+	if (istate->sparse_index || !istate->cache_nr ||
+	    !is_sparse_index_allowed(istate))
+		return 0;
+	return do_convert_to_sparse(istate, NULL);
+}
+
+int convert_to_sparse_temporarily(struct index_state *istate,
+				  struct full_index *full)
+{
+	memset(full, 0, sizeof(*full));
+	if (istate->sparse_index || !istate->cache_nr ||
+	    !is_sparse_index_allowed(istate))
+		return 0;
+
+	full->cache = istate->cache;
+	full->cache_nr = istate->cache_nr;
+	full->cache_alloc = istate->cache_alloc;
+	ALLOC_ARRAY(istate->cache, full->cache_nr);
+	COPY_ARRAY(istate->cache, full->cache, full->cache_nr);
+	istate->cache_alloc = full->cache_nr;
+
+	if (!do_convert_to_sparse(istate, full)) {
+		free(istate->cache);
+		istate->cache = full->cache;
+		istate->cache_nr = full->cache_nr;
+		istate->cache_alloc = full->cache_alloc;
+		memset(full, 0, sizeof(*full));
+		return 0;
+	}
+	return 1;
+}
+
+void restore_full_index(struct index_state *istate, struct full_index *full)
+{
+	unsigned int i;
+
+	if (!full->cache)
+		return;
+
+	for (i = 0; i < istate->cache_nr; i++)
+		if (S_ISSPARSEDIR(istate->cache[i]->ce_mode))
+			discard_cache_entry(istate->cache[i]);
+	free(istate->cache);
+	cache_tree_free(&istate->cache_tree);
+
+	istate->cache = full->cache;
+	istate->cache_nr = full->cache_nr;
+	istate->cache_alloc = full->cache_alloc;
+	istate->cache_tree = full->cache_tree;
+	istate->sparse_index = 0;
+	memset(full, 0, sizeof(*full));
+}
+
+static int add_path_to_index(const struct object_id *oid,
+			     struct strbuf *base, const char *path,
+			     unsigned int mode, int stage, void *context)
+{
+	struct index_state *istate = context;
+	size_t len = base->len + strlen(path);
+	struct cache_entry *ce;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+
+	ce = make_empty_cache_entry(istate, len);
+	ce->ce_mode = create_ce_mode(mode);
+	ce->ce_flags = create_ce_flags(stage) | CE_SKIP_WORKTREE;
+	ce->ce_namelen = len;
+	oidcpy(&ce->oid, oid);
+	memcpy(ce->name, base->buf, base->len);
+	memcpy(ce->name + base->len, path, len - base->len);
+
+	ALLOC_GROW(istate->cache, istate->cache_nr + 1, istate->cache_alloc);
+	istate->cache[istate->cache_nr++] = ce;
+	add_name_hash(istate, ce);
+	return 0;
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	struct cache_entry **old_cache;
+	unsigned int i, old_nr;
+	struct pathspec ps;
+
+	if (!istate->sparse_index)
+		return;
+
+	trace_performance_enter();
+	old_cache = istate->cache;
+	old_nr = istate->cache_nr;
+	istate->cache = NULL;
+	istate->cache_nr = istate->cache_alloc = 0;
+	ALLOC_GROW(istate->cache, old_nr, istate->cache_alloc);
+	memset(&ps, 0, sizeof(ps));
+
+	for (i = 0; i < old_nr; i++) {
+		struct cache_entry *ce = old_cache[i];
+		struct tree *tree;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode)) {
+			ALLOC_GROW(istate->cache, istate->cache_nr + 1,
+				   istate->cache_alloc);
+			istate->cache[istate->cache_nr++] = ce;
+			continue;
+		}
+
+		tree = parse_tree_indirect(&ce->oid);
+		if (!tree)
+			die(_("unable to expand sparse directory '%s': "
+			      "bad tree %s"), ce->name, oid_to_hex(&ce->oid));
+		remove_name_hash(istate, ce);
+		if (read_tree_recursive(tree, ce->name, ce_namelen(ce), 0, &ps,
+					add_path_to_index, istate))
+			die(_("unable to expand sparse directory '%s'"),
+			    ce->name);
+		if (istate->cache_tree)
+			prime_cache_tree_subtree(istate, ce->name, tree);
+		discard_cache_entry(ce);
+	}
+	free(old_cache);
+	istate->sparse_index = 0;
+	trace_performance_leave("ensure_full_index");
+}
+
+int sparse_directories_present(struct index_state *istate)
+{
+	int i;
+
+	if (!istate->sparse_index)
+		return 0;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (S_ISSPARSEDIR(ce->ce_mode) && file_exists(ce->name))
+			return 1;
+	}
+	return 0;
+}
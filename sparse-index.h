@@ -0,0 +1,63 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+struct index_state;
+
+/*
+ * A sparse index stores each directory whose entries are all outside of
+ * the sparse checkout (all marked CE_SKIP_WORKTREE, and the directory
+ * absent from the working tree) as a single "sparse directory" entry,
+ * named after the directory with a trailing slash and pointing at its
+ * tree. The "sdir" index extension marks an index that may contain such
+ * entries.
+ *
+ * It is only used when core.sparseCheckout and index.sparse are both
+ * enabled and the split index is not.
+ */
+
+/*
+ * Is this index allowed to be written in its sparse form?
+ */
+int is_sparse_index_allowed(struct index_state *istate);
+
+/*
+ * Replace the directories of a full index that can be collapsed by
+ * sparse directory entries. Does nothing and returns 0 if the index is
+ * already sparse or cannot be made sparse; returns 1 otherwise.
+ */
+int convert_to_sparse(struct index_state *istate);
+
+/*
+ * The entries and cache-tree of a full index that was collapsed only to
+ * be written out.
+ */
+struct full_index {
+	struct cache_entry **cache;
+	unsigned int cache_nr, cache_alloc;
+	struct cache_tree *cache_tree;
+};
+
+/*
+ * Like convert_to_sparse(), but keep the entries of the full index in
+ * 'full' so that restore_full_index() can put them back without
+ * expanding the sparse directories again.
+ */
+int convert_to_sparse_temporarily(struct index_state *istate,
+				  struct full_index *full);
+void restore_full_index(struct index_state *istate, struct full_index *full);
+
+/*
+ * Replace all sparse directory entries of a sparse index with the
+ * entries of the trees they stand for.
+ */
+void ensure_full_index(struct index_state *istate);
+
+/*
+ * Does any of the sparse directories of the index exist in the working
+ * tree? Commands that do understand sparse directory entries still need
+ * the full index when one does, for example to tell tracked files from
+ * untracked ones in it.
+ */
+int sparse_directories_present(struct index_state *istate);
+
+#endif
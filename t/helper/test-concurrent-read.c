@@ -0,0 +1,111 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "config.h"
+#include "object.h"
+#include "object-store.h"
+#include "thread-utils.h"
+
+/*
+ * Read the objects named on stdin from several threads at once, each
+ * going through all of them starting at a different one, and check
+ * that all threads got the same results. For each object, print its
+ * type, its size and whether its contents match its name.
+ */
+
+struct read_result {
+	enum object_type type;
+	unsigned long size;
+	int ok;
+};
+
+struct read_thread {
+	pthread_t thread;
+	struct object_id *oids;
+	int nr, start;
+	struct read_result *results;
+};
+
+static void *read_objects(void *data)
+{
+	struct read_thread *t = data;
+	int i;
+
+	for (i = 0; i < t->nr; i++) {
+		int n = (t->start + i) % t->nr;
+		struct read_result *r = &t->results[n];
+		void *buf = read_object_file(&t->oids[n], &r->type, &r->size);
+
+		r->ok = buf &&
+			!check_object_signature(&t->oids[n], buf, r->size,
+						type_name(r->type));
+		free(buf);
+	}
+	return NULL;
+}
+
+int cmd__concurrent_read(int argc, const char **argv)
+{
+	struct strbuf line = STRBUF_INIT;
+	struct object_id *oids = NULL;
+	struct read_thread *threads;
+	int nr = 0, alloc = 0, nr_threads = 1, i, j;
+
+	if (argc == 2 && skip_prefix(argv[1], "--threads=", &argv[1]))
+		nr_threads = atoi(argv[1]);
+	else if (argc != 1)
+		usage("test-tool concurrent-read [--threads=<n>]");
+	if (nr_threads < 1 || (!HAVE_THREADS && nr_threads > 1))
+		die("cannot read with %d threads", nr_threads);
+
+	setup_git_directory();
+	git_config(git_default_config, NULL);
+
+	while (strbuf_getline(&line, stdin) != EOF) {
+		ALLOC_GROW(oids, nr + 1, alloc);
+		if (get_oid_hex(line.buf, &oids[nr++]))
+			die("not an object name: %s", line.buf);
+	}
+	strbuf_release(&line);
+	if (!nr)
+		return 0;
+
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	enable_concurrent_object_reads(the_repository);
+	for (i = 0; i < nr_threads; i++) {
+		struct read_thread *t = &threads[i];
+
+		t->oids = oids;
+		t->nr = nr;
+		t->start = (int)((uint64_t)nr * i / nr_threads);
+		t->results = xcalloc(nr, sizeof(*t->results));
+		if (nr_threads == 1)
+			read_objects(t);
+		else if (pthread_create(&t->thread, NULL, read_objects, t))
+			die("unable to create thread");
+	}
+	for (i = 0; nr_threads > 1 && i < nr_threads; i++)
+		if (pthread_join(threads[i].thread, NULL))
+			die("unable to join thread");
+	disable_concurrent_object_reads(the_repository);
+
+	for (j = 0; j < nr; j++) {
+		struct read_result *r = &threads[0].results[j];
+
+		for (i = 1; i < nr_threads; i++) {
+			struct read_result *o = &threads[i].results[j];
+
+			if (o->type != r->type || o->size != r->size ||
+			    o->ok != r->ok)
+				die("threads 0 and %d disagree about %s", i,
+				    oid_to_hex(&oids[j]));
+		}
+		printf("%s %s %lu %s\n", oid_to_hex(&oids[j]),
+		       type_name(r->type), r->size, r->ok ? "ok" : "bad");
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		free(threads[i].results);
+	free(threads);
+	free(oids);
+	return 0;
+}
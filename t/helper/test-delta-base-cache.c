@@ -0,0 +1,46 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "config.h"
+#include "object-store.h"
+#include "packfile.h"
+
+/*
+ * Read the objects named on stdin, then print for each object named on
+ * the command line whether the delta base cache holds it, and the size
+ * of all the bases it holds.
+ */
+int cmd__delta_base_cache(int argc, const char **argv)
+{
+	struct strbuf line = STRBUF_INIT;
+	struct object_id oid;
+	int i;
+
+	setup_git_directory();
+	git_config(git_default_config, NULL);
+
+	while (strbuf_getline(&line, stdin) != EOF) {
+		enum object_type type;
+		unsigned long size;
+		void *data;
+
+		if (get_oid_hex(line.buf, &oid))
+			die("not an object name: %s", line.buf);
+		data = read_object_file(&oid, &type, &size);
+		if (!data)
+			die("unable to read %s", line.buf);
+		free(data);
+	}
+	strbuf_release(&line);
+
+	for (i = 1; i < argc; i++) {
+		struct pack_entry e;
+
+		if (get_oid_hex(argv[i], &oid) ||
+		    !find_pack_entry(the_repository, &oid, &e))
+			die("not a packed object: %s", argv[i]);
+		printf("%s %s\n", argv[i],
+		       in_delta_base_cache(e.p, e.offset) ? "cached" : "not cached");
+	}
+	printf("size %"PRIuMAX"\n", (uintmax_t)delta_base_cache_size());
+	return 0;
+}
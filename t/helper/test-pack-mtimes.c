@@ -0,0 +1,37 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "object-store.h"
+#include "packfile.h"
+#include "pack-mtimes.h"
+
+/*
+ * Print the objects of the cruft pack whose .pack file is named on
+ * the command line with their mtimes, in the order of its .idx file.
+ */
+int cmd__pack_mtimes(int argc, const char **argv)
+{
+	struct packed_git *p;
+	struct object_id oid;
+	uint32_t i;
+
+	if (argc != 2)
+		usage("test-tool pack-mtimes <pack-name.pack>");
+
+	setup_git_directory();
+
+	for (p = get_all_packs(the_repository); p; p = p->next)
+		if (!strcmp(basename(p->pack_name), argv[1]))
+			break;
+	if (!p)
+		die("could not find pack '%s'", argv[1]);
+	if (open_pack_index(p) || load_pack_mtimes(p))
+		die("could not load the mtimes of '%s'", argv[1]);
+
+	for (i = 0; i < p->num_objects; i++) {
+		nth_packed_object_oid(&oid, p, i);
+		printf("%s %"PRIu32"\n", oid_to_hex(&oid),
+		       nth_packed_mtime(p, i));
+	}
+
+	return 0;
+}
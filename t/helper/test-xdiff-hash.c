@@ -0,0 +1,72 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "xdiff-interface.h"
+#include "xdiff/xtypes.h"
+#include "xdiff/xutils.h"
+
+static const char *usage_msg =
+	"test-tool xdiff-hash [--ignore-all-space | --ignore-space-change |\n"
+	"                      --ignore-space-at-eol | --ignore-cr-at-eol]\n"
+	"                     [--rounds=<n>] <file>";
+
+static int ulong_cmp(const void *va, const void *vb)
+{
+	unsigned long a = *(const unsigned long *)va;
+	unsigned long b = *(const unsigned long *)vb;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Split <file> into lines and hash them the way xdl_prepare_ctx() does,
+ * <n> times over, then print the number of lines and of distinct hashes.
+ * Meant to be timed, e.g. by p4000-diff-algorithms.sh.
+ */
+int cmd__xdiff_hash(int argc, const char **argv)
+{
+	struct strbuf buf = STRBUF_INIT;
+	unsigned long *hashes = NULL;
+	size_t nr = 0, alloc = 0, distinct, i;
+	long flags = 0;
+	int rounds = 1, round;
+
+	for (argv++, argc--; argc > 1; argv++, argc--) {
+		if (!strcmp(*argv, "--ignore-all-space"))
+			flags |= XDF_IGNORE_WHITESPACE;
+		else if (!strcmp(*argv, "--ignore-space-change"))
+			flags |= XDF_IGNORE_WHITESPACE_CHANGE;
+		else if (!strcmp(*argv, "--ignore-space-at-eol"))
+			flags |= XDF_IGNORE_WHITESPACE_AT_EOL;
+		else if (!strcmp(*argv, "--ignore-cr-at-eol"))
+			flags |= XDF_IGNORE_CR_AT_EOL;
+		else if (skip_prefix(*argv, "--rounds=", argv))
+			rounds = atoi(*argv);
+		else
+			usage(usage_msg);
+	}
+	if (argc != 1 || rounds < 1)
+		usage(usage_msg);
+	if (strbuf_read_file(&buf, *argv, 0) < 0)
+		die_errno("unable to read '%s'", *argv);
+
+	for (round = 0; round < rounds; round++) {
+		char const *cur = buf.buf, *top = buf.buf + buf.len;
+
+		nr = 0;
+		while (cur < top) {
+			ALLOC_GROW(hashes, nr + 1, alloc);
+			hashes[nr++] = xdl_hash_record(&cur, top, flags);
+		}
+	}
+
+	QSORT(hashes, nr, ulong_cmp);
+	for (i = distinct = 0; i < nr; i++)
+		if (!i || hashes[i] != hashes[i - 1])
+			distinct++;
+	printf("%"PRIuMAX" lines, %"PRIuMAX" distinct hashes\n",
+	       (uintmax_t)nr, (uintmax_t)distinct);
+
+	free(hashes);
+	strbuf_release(&buf);
+	return 0;
+}
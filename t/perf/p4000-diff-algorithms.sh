@@ -26,4 +26,33 @@ test_perf 'log -p -3000 --patience' '
 	git log -p -3000 --patience >/dev/null
 '
 
+for threads in 1 4
+do
+	test_perf "log -p -3000, $threads diff thread(s)" "
+		git -c diff.threads=$threads log -p -3000 >/dev/null
+	"
+
+	test_perf "log --stat -3000, $threads diff thread(s)" "
+		git -c diff.threads=$threads log --stat -3000 >/dev/null
+	"
+done
+
+test_expect_success 'setup generated files' '
+	test_seq 200000 |
+	sed "s/^/a generated line, long enough to span several words: /" >gen.a &&
+	sed "s/7\$/seven/" gen.a >gen.b
+'
+
+test_perf 'xdiff line hashing' '
+	test-tool xdiff-hash --rounds=20 gen.a
+'
+
+test_perf 'xdiff line hashing --ignore-all-space' '
+	test-tool xdiff-hash --ignore-all-space --rounds=20 gen.a
+'
+
+test_perf 'diff --no-index generated files' '
+	git diff --no-index gen.a gen.b >/dev/null || :
+'
+
 test_done
@@ -0,0 +1,38 @@
+#!/bin/sh
+
+test_description="Tests inexact rename detection performance"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+test_checkout_worktree
+
+test_expect_success 'setup' '
+	git config --local user.name perf &&
+	git config --local user.email perf@example.com &&
+	git ls-files -- "*.c" "*.h" "*.txt" | head -n 2000 >files &&
+	while read f
+	do
+		echo "renamed by perf test" >>"$f" &&
+		mkdir -p "moved/$(dirname "$f")" &&
+		# a new basename, so that the files are not paired up early
+		git mv "$f" "moved/$f.moved" || return 1
+	done <files &&
+	git commit -q -a -m "move and edit files"
+'
+
+for threads in 1 2 4
+do
+	test_perf "diff -M, $threads thread(s)" "
+		git -c diff.renameThreads=$threads diff -M -l0 --raw HEAD^ HEAD >/dev/null
+	"
+done
+
+for bands in 8 16 32
+do
+	test_perf "diff -M beyond the rename limit, $bands bands" "
+		git -c diff.renameLshBands=$bands diff -M -l100 --raw HEAD^ HEAD >/dev/null
+	"
+done
+
+test_done
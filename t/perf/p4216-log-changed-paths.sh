@@ -0,0 +1,60 @@
+#!/bin/sh
+
+test_description='Tests path-limited history with changed-path Bloom filters'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+# Pick a file several directories deep pseudo-randomly.  The sort key
+# is the blob hash, so it is stable.
+test_expect_success 'select a file' '
+	git ls-tree -r HEAD | grep ^100644 | grep / |
+	sort -k 3 | head -1 | cut -f 2 >filelist
+'
+
+file=$(cat filelist)
+dir=$(dirname "$file")
+export file dir
+
+test_expect_success 'write commit-graph without changed paths' '
+	git commit-graph write --reachable &&
+	git config core.commitGraph true
+'
+
+test_perf 'git log -- <file> (no filters)' '
+	git log --oneline -- "$file" >/dev/null
+'
+
+test_perf 'git log -- <dir> (no filters)' '
+	git log --oneline -- "$dir" >/dev/null
+'
+
+test_perf 'git blame <file> (no filters)' '
+	git blame "$file" >/dev/null
+'
+
+test_perf 'git log -L <file> (no filters)' '
+	git log --no-renames -L 1:"$file" >/dev/null
+'
+
+test_expect_success 'write commit-graph with changed paths' '
+	git commit-graph write --reachable --changed-paths
+'
+
+test_perf 'git log -- <file> (with filters)' '
+	git log --oneline -- "$file" >/dev/null
+'
+
+test_perf 'git log -- <dir> (with filters)' '
+	git log --oneline -- "$dir" >/dev/null
+'
+
+test_perf 'git blame <file> (with filters)' '
+	git blame "$file" >/dev/null
+'
+
+test_perf 'git log -L <file> (with filters)' '
+	git log --no-renames -L 1:"$file" >/dev/null
+'
+
+test_done
@@ -0,0 +1,46 @@
+#!/bin/sh
+
+test_description='Tests the startup cost of the reverse index'
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_expect_success 'setup bitmapped pack' '
+	git config pack.writebitmaps true &&
+	git repack -adb &&
+	git rev-parse HEAD >tip &&
+	git rev-list --objects --all | cut -d" " -f1 | head -n 1000 >objects
+'
+
+# Each of the commands below only touches a handful of bitmap positions
+# or object sizes, so the time to sort all offsets of the .idx when no
+# .rev is present dominates.
+for rev in false true
+do
+	test_expect_success "set pack.writeReverseIndex=$rev" '
+		git config pack.writeReverseIndex $rev &&
+		git index-pack --rev-index $(ls .git/objects/pack/pack-*.pack) &&
+		if test $rev = false
+		then
+			rm -f .git/objects/pack/pack-*.rev
+		fi
+	'
+
+	test_perf "rev-list --count with bitmaps (rev=$rev)" '
+		git rev-list --use-bitmap-index --count HEAD >/dev/null
+	'
+
+	test_perf "cat-file objectsize:disk (rev=$rev)" '
+		git cat-file --batch-check="%(objectsize:disk)" <objects >/dev/null
+	'
+
+	test_perf "upload-pack of the tip (rev=$rev)" '
+		{
+			echo "0032want $(cat tip)" &&
+			printf 0000 &&
+			echo "0009done"
+		} | git upload-pack . >/dev/null
+	'
+done
+
+test_done
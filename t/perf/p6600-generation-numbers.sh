@@ -0,0 +1,75 @@
+#!/bin/sh
+
+test_description='Tests reachability walks with both kinds of generation numbers'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+# Pick an old tag (or, failing that, an old commit) so that --contains
+# has to decide reachability for most of the refs, and an old and a new
+# commit for merge-base, so that it has to walk deep into history.
+test_expect_success 'select commits' '
+	git rev-list --first-parent HEAD >first-parent &&
+	lines=$(wc -l <first-parent) &&
+	old=$(sed -n "$(($lines * 3 / 4 + 1))p" first-parent) &&
+	merge=$(git rev-list --min-parents=2 --max-count=1 HEAD) &&
+	if test -n "$merge"
+	then
+		base_tip=$(git rev-parse "$merge^2")
+	else
+		base_tip=$old
+	fi &&
+	contains=$(git describe --tags --abbrev=0 "$old" 2>/dev/null || echo "$old") &&
+	test_export old base_tip contains
+'
+
+test_expect_success 'write commit-graph with topological levels' '
+	git config core.commitGraph true &&
+	git -c commitGraph.generationVersion=1 commit-graph write --reachable
+'
+
+test_perf 'merge-base (topological levels)' '
+	git -c commitGraph.generationVersion=1 merge-base HEAD $base_tip >/dev/null
+'
+
+test_perf 'merge-base --is-ancestor (topological levels)' '
+	git -c commitGraph.generationVersion=1 merge-base --is-ancestor $old HEAD
+'
+
+test_perf 'tag --contains (topological levels)' '
+	git -c commitGraph.generationVersion=1 tag --contains $contains >/dev/null
+'
+
+test_perf 'branch -a --contains (topological levels)' '
+	git -c commitGraph.generationVersion=1 branch -a --contains $old >/dev/null
+'
+
+test_perf 'log --graph -100 (topological levels)' '
+	git -c commitGraph.generationVersion=1 log --graph --oneline -100 >/dev/null
+'
+
+test_expect_success 'write commit-graph with corrected commit dates' '
+	git -c commitGraph.generationVersion=2 commit-graph write --reachable
+'
+
+test_perf 'merge-base (corrected commit dates)' '
+	git -c commitGraph.generationVersion=2 merge-base HEAD $base_tip >/dev/null
+'
+
+test_perf 'merge-base --is-ancestor (corrected commit dates)' '
+	git -c commitGraph.generationVersion=2 merge-base --is-ancestor $old HEAD
+'
+
+test_perf 'tag --contains (corrected commit dates)' '
+	git -c commitGraph.generationVersion=2 tag --contains $contains >/dev/null
+'
+
+test_perf 'branch -a --contains (corrected commit dates)' '
+	git -c commitGraph.generationVersion=2 branch -a --contains $old >/dev/null
+'
+
+test_perf 'log --graph -100 (corrected commit dates)' '
+	git -c commitGraph.generationVersion=2 log --graph --oneline -100 >/dev/null
+'
+
+test_done
@@ -19,5 +19,34 @@ test_perf 'grep --cached, cheap regex' '
 test_perf 'grep --cached, expensive regex' '
 	git grep --cached "^.* *some_nonexistent_string$" || :
 '
+test_perf 'grep HEAD, cheap regex' '
+	git grep some_nonexistent_string HEAD || :
+'
+test_perf 'grep HEAD, expensive regex' '
+	git grep "^.* *some_nonexistent_string$" HEAD || :
+'
+test_perf 'grep HEAD, expensive regex, --threads=1' '
+	git grep --threads=1 "^.* *some_nonexistent_string$" HEAD || :
+'
+
+test_perf 'grep --build-index, from scratch' '
+	rm -f "$(git rev-parse --git-path objects/info/grep-index)" &&
+	git grep --build-index
+'
+test_perf 'grep --build-index, up to date' '
+	git grep --build-index
+'
+test_perf 'grep HEAD, cheap regex, with index' '
+	git grep some_nonexistent_string HEAD || :
+'
+test_perf 'grep -F HEAD, with index' '
+	git grep -F some_nonexistent_string HEAD || :
+'
+test_perf 'grep --cached, cheap regex, with index' '
+	git grep --cached some_nonexistent_string || :
+'
+test_perf 'grep HEAD, expensive regex, with index' '
+	git grep "^.* *some_nonexistent_string$" HEAD || :
+'
 
 test_done
@@ -0,0 +1,37 @@
+#!/bin/sh
+
+test_description='Tests blame performance with blame.cache'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+# Pick the file changed by the most of the last 1000 commits.
+test_expect_success 'select a file' '
+	git log --format= --name-only -1000 HEAD |
+	sort | uniq -c | sort -nr | head -1 |
+	sed "s/^ *[0-9]* //" >filelist &&
+	git rev-list -1 HEAD~20 -- "$(cat filelist)" >older
+'
+
+file=$(cat filelist)
+older=$(cat older)
+export file older
+
+test_perf 'blame <file>' '
+	git blame -- "$file" >/dev/null
+'
+
+test_expect_success 'record the blame of an older commit' '
+	rm -rf "$(git rev-parse --git-path objects/info/blame-cache)" &&
+	git -c blame.cache=true blame $older -- "$file" >/dev/null
+'
+
+test_perf 'blame <file>, cache of an older commit' '
+	git -c blame.cache=true blame -- "$file" >/dev/null
+'
+
+test_perf 'blame -L <range> <file>, cache of an older commit' '
+	git -c blame.cache=true blame -L 1,20 -- "$file" >/dev/null
+'
+
+test_done
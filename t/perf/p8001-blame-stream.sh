@@ -0,0 +1,30 @@
+#!/bin/sh
+
+test_description='Tests how soon blame shows its first lines'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+# Pick the file changed by the most of the last 1000 commits.
+test_expect_success 'select a file' '
+	git log --format= --name-only -1000 HEAD |
+	sort | uniq -c | sort -nr | head -1 |
+	sed "s/^ *[0-9]* //" >filelist
+'
+
+file=$(cat filelist)
+export file
+
+test_perf 'blame --porcelain <file>' '
+	git blame --porcelain -- "$file" >/dev/null
+'
+
+test_perf 'blame --porcelain <file>, first line' '
+	git blame --porcelain -- "$file" | head -n 1 >/dev/null
+'
+
+test_perf 'blame --porcelain -L <range> <file>, first line' '
+	git blame --porcelain -L 1,20 -- "$file" | head -n 1 >/dev/null
+'
+
+test_done
@@ -0,0 +1,50 @@
+#!/bin/sh
+
+test_description='git for-each-repo builtin'
+
+. ./test-lib.sh
+
+test_expect_success 'run based on configured value' '
+	git init one &&
+	git init two &&
+	git init three &&
+	git -C two commit --allow-empty -m "DID NOT RUN" &&
+	git config run.key "$TRASH_DIRECTORY/one" &&
+	git config --add run.key "$TRASH_DIRECTORY/three" &&
+	git for-each-repo --config=run.key commit --allow-empty -m "ran" &&
+	git -C one log -1 --pretty=format:%s >message &&
+	grep ran message &&
+	git -C two log -1 --pretty=format:%s >message &&
+	! grep ran message &&
+	git -C three log -1 --pretty=format:%s >message &&
+	grep ran message &&
+	git for-each-repo --config=run.key -- commit --allow-empty -m "ran again" &&
+	git -C one log -1 --pretty=format:%s >message &&
+	grep again message &&
+	git -C two log -1 --pretty=format:%s >message &&
+	! grep again message &&
+	git -C three log -1 --pretty=format:%s >message &&
+	grep again message
+'
+
+test_expect_success 'a failure does not stop the other repositories' '
+	git config other.key "$TRASH_DIRECTORY/missing" &&
+	git config --add other.key "$TRASH_DIRECTORY/one" &&
+	test_must_fail git for-each-repo --config=other.key \
+		commit --allow-empty -m "after failure" &&
+	git -C one log -1 --pretty=format:%s >message &&
+	grep "after failure" message
+'
+
+test_expect_success 'do nothing on empty config' '
+	# the whole thing would fail if for-each-ref iterated even
+	# once, because "git help --no-such-option" would fail
+	git for-each-repo --config=bogus.config -- help --no-such-option
+'
+
+test_expect_success '--config is required' '
+	test_must_fail git for-each-repo -- status 2>err &&
+	test_i18ngrep "missing --config" err
+'
+
+test_done
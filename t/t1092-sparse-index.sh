@@ -0,0 +1,124 @@
+#!/bin/sh
+
+test_description='compare full and sparse indexes of a sparse checkout'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_SPARSE_INDEX
+
+# Run the same command in the full and in the sparse checkout and
+# compare the output.
+test_all_match () {
+	(cd full && "$@" >../full-out 2>../full-err) &&
+	(cd sparse && "$@" >../sparse-out 2>../sparse-err) &&
+	test_cmp full-out sparse-out &&
+	test_cmp full-err sparse-err
+}
+
+has_sparse_extension () {
+	grep sdir "$1/.git/index" >/dev/null
+}
+
+# Succeed if the command did not need to expand the index.
+stays_sparse () {
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" git -C sparse "$@" &&
+	! grep ensure_full_index trace
+}
+
+test_expect_success 'setup' '
+	git init original &&
+	(
+		cd original &&
+		mkdir -p deep/deeper folder1/sub folder2 &&
+		for f in a deep/a deep/deeper/a folder1/a folder1/sub/a folder2/a
+		do
+			echo "$f" >$f || return 1
+		done &&
+		git add . &&
+		test_tick &&
+		git commit -m initial &&
+		git checkout -b update &&
+		echo changed >folder1/a &&
+		echo changed >deep/a &&
+		test_tick &&
+		git commit -a -m update &&
+		git checkout master
+	) &&
+	cat >patterns <<-\EOF &&
+	/*
+	!/*/
+	/deep/
+	EOF
+	git clone original full &&
+	git clone original sparse &&
+	git -C sparse config index.sparse true &&
+	for repo in full sparse
+	do
+		git -C $repo config core.sparseCheckout true &&
+		cp patterns $repo/.git/info/sparse-checkout &&
+		git -C $repo read-tree -mu HEAD || return 1
+	done
+'
+
+test_expect_success 'sparse index collapses directories outside the checkout' '
+	has_sparse_extension sparse &&
+	! has_sparse_extension full &&
+	test_path_is_missing sparse/folder1 &&
+	test_path_is_file sparse/deep/deeper/a
+'
+
+test_expect_success 'status and add keep the index sparse' '
+	stays_sparse status &&
+	test_all_match git status --porcelain=v2 &&
+	echo more >>sparse/deep/a &&
+	echo more >>full/deep/a &&
+	stays_sparse add deep/a &&
+	git -C full add deep/a &&
+	test_all_match git status --porcelain=v2 &&
+	has_sparse_extension sparse
+'
+
+test_expect_success 'commit and diff agree with the full index' '
+	test_tick &&
+	test_all_match git commit -m "change deep/a" &&
+	test_all_match git diff HEAD~1 --stat &&
+	test_all_match git rev-parse HEAD^{tree} &&
+	has_sparse_extension sparse
+'
+
+test_expect_success 'ls-files sees every path' '
+	test_all_match git ls-files -t
+'
+
+test_expect_success 'switching branches' '
+	test_all_match git checkout update &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git rev-parse HEAD^{tree} &&
+	test_all_match git checkout master &&
+	has_sparse_extension sparse
+'
+
+test_expect_success 'recreated directories are expanded' '
+	test_when_finished "rm -rf full/folder2 sparse/folder2" &&
+	mkdir full/folder2 sparse/folder2 &&
+	echo untracked >full/folder2/new &&
+	echo untracked >sparse/folder2/new &&
+	test_all_match git status --porcelain=v2 --untracked-files=all
+'
+
+test_expect_success 'changing the sparse patterns' '
+	echo "/folder1/" >>full/.git/info/sparse-checkout &&
+	echo "/folder1/" >>sparse/.git/info/sparse-checkout &&
+	test_all_match git read-tree -mu HEAD &&
+	test_path_is_file sparse/folder1/sub/a &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git ls-files -t
+'
+
+test_expect_success 'index.sparse=false writes a full index' '
+	git -C sparse -c index.sparse=false read-tree -mu HEAD &&
+	! has_sparse_extension sparse &&
+	test_all_match git ls-files -t
+'
+
+test_done
@@ -0,0 +1,291 @@
+#!/bin/sh
+
+test_description='the reftable ref storage backend'
+
+. ./test-lib.sh
+
+INVALID_SHA1=aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa
+
+test_expect_success 'init --ref-format=reftable' '
+	git init --ref-format=reftable repo &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	test "$(git -C repo config core.repositoryformatversion)" = 1 &&
+	test "$(git -C repo config extensions.refstorage)" = reftable &&
+	echo "ref: refs/heads/.invalid" >expect &&
+	test_cmp expect repo/.git/HEAD &&
+	test "$(git -C repo symbolic-ref HEAD)" = refs/heads/master
+'
+
+test_expect_success 'GIT_DEFAULT_REF_FORMAT picks the format of new repositories' '
+	GIT_DEFAULT_REF_FORMAT=reftable git init env &&
+	test_path_is_file env/.git/reftable/tables.list &&
+	GIT_DEFAULT_REF_FORMAT=bogus test_must_fail git init bogus 2>err &&
+	test_i18ngrep "unknown ref storage format" err
+'
+
+test_expect_success 'reinit keeps the format, and refuses another' '
+	git -C repo init &&
+	test "$(git -C repo config extensions.refstorage)" = reftable &&
+	test_must_fail git -C repo init --ref-format=files 2>err &&
+	test_i18ngrep "different ref storage format" err
+'
+
+test_expect_success 'unknown ref storage format is rejected' '
+	git init unknown &&
+	git -C unknown config core.repositoryformatversion 1 &&
+	git -C unknown config extensions.refstorage bogus &&
+	test_must_fail git -C unknown rev-parse HEAD 2>err &&
+	test_i18ngrep "unknown ref storage format" err
+'
+
+test_expect_success 'extensions.refstorage is ignored in version 0' '
+	git init v0 &&
+	git -C v0 config extensions.refstorage bogus &&
+	git -C v0 symbolic-ref HEAD >actual &&
+	echo refs/heads/master >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'setup history' '
+	(
+		cd repo &&
+		test_commit A &&
+		test_commit B &&
+		git tag -a -m annotated ann A &&
+		git branch side A
+	)
+'
+
+test_expect_success 'refs are not stored in files' '
+	test_path_is_missing repo/.git/refs/heads/master &&
+	test_path_is_missing repo/.git/packed-refs &&
+	test_path_is_missing repo/.git/logs
+'
+
+test_expect_success 'for-each-ref and show-ref' '
+	cat >expect <<-EOF &&
+	$(git -C repo rev-parse master) commit refs/heads/master
+	$(git -C repo rev-parse side) commit refs/heads/side
+	$(git -C repo rev-parse A) commit refs/tags/A
+	$(git -C repo rev-parse B) commit refs/tags/B
+	$(git -C repo rev-parse ann) tag refs/tags/ann
+	EOF
+	git -C repo for-each-ref --format="%(objectname) %(objecttype) %(refname)" >actual &&
+	test_cmp expect actual &&
+	git -C repo show-ref -d ann >actual &&
+	cat >expect <<-EOF &&
+	$(git -C repo rev-parse ann) refs/tags/ann
+	$(git -C repo rev-parse A) refs/tags/ann^{}
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'update-ref checks the old value' '
+	(
+		cd repo &&
+		test_must_fail git update-ref refs/heads/side B B 2>err &&
+		test_i18ngrep "is at $(git rev-parse A) but expected $(git rev-parse B)" err &&
+		git update-ref refs/heads/side B A &&
+		test "$(git rev-parse side)" = "$(git rev-parse B)" &&
+		test_must_fail git update-ref refs/heads/new A $(git rev-parse B) 2>err &&
+		test_i18ngrep "unable to resolve reference" err &&
+		test_must_fail git update-ref refs/heads/side $INVALID_SHA1 2>err &&
+		test_i18ngrep "nonexistent object" err
+	)
+'
+
+test_expect_success 'D/F conflicts are detected' '
+	(
+		cd repo &&
+		test_must_fail git update-ref refs/heads/side/sub A 2>err &&
+		test_i18ngrep "refs/heads/side.* exists" err &&
+		test_must_fail git update-ref refs/heads refs/tags/A 2>err
+	)
+'
+
+test_expect_success 'transactions are atomic' '
+	(
+		cd repo &&
+		cat >stdin <<-EOF &&
+		create refs/heads/one $(git rev-parse A)
+		update refs/heads/side $(git rev-parse A) $(git rev-parse A)
+		EOF
+		test_must_fail git update-ref --stdin <stdin &&
+		test_must_fail git rev-parse --verify -q refs/heads/one &&
+		cat >stdin <<-EOF &&
+		create refs/heads/one $(git rev-parse A)
+		create refs/heads/two $(git rev-parse B)
+		delete refs/heads/side
+		EOF
+		git update-ref --stdin <stdin &&
+		git rev-parse refs/heads/one refs/heads/two &&
+		test_must_fail git rev-parse --verify -q refs/heads/side
+	)
+'
+
+test_expect_success 'reflogs are kept in the tables' '
+	(
+		cd repo &&
+		git reflog show --format="%gs" master >actual &&
+		cat >expect <<-\EOF &&
+		commit: B
+		commit (initial): A
+		EOF
+		test_cmp expect actual &&
+		git reflog show --format="%gs" HEAD >actual &&
+		test_cmp expect actual &&
+		git reflog exists refs/heads/two &&
+		test_must_fail git reflog exists refs/heads/side &&
+		git rev-parse master@{1} >actual &&
+		git rev-parse A >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'symbolic refs and detached HEAD' '
+	(
+		cd repo &&
+		git symbolic-ref refs/heads/sym refs/heads/one &&
+		test "$(git symbolic-ref refs/heads/sym)" = refs/heads/one &&
+		git update-ref refs/heads/sym B &&
+		test "$(git rev-parse one)" = "$(git rev-parse B)" &&
+		git update-ref -d --no-deref refs/heads/sym &&
+		git checkout -q --detach A &&
+		test_must_fail git symbolic-ref -q HEAD &&
+		git checkout -q master &&
+		test "$(git symbolic-ref HEAD)" = refs/heads/master
+	)
+'
+
+test_expect_success 'pseudorefs are stored in files' '
+	(
+		cd repo &&
+		git update-ref ORIG_HEAD A &&
+		test "$(cat .git/ORIG_HEAD)" = "$(git rev-parse A)" &&
+		echo "update ORIG_HEAD $(git rev-parse B)" |
+		git update-ref --stdin &&
+		test "$(git rev-parse ORIG_HEAD)" = "$(git rev-parse B)" &&
+		git update-ref -d ORIG_HEAD &&
+		test_path_is_missing .git/ORIG_HEAD
+	)
+'
+
+test_expect_success 'branch rename and copy carry the reflog' '
+	(
+		cd repo &&
+		git reflog show --format="%H" two >expect &&
+		git branch -m two renamed &&
+		test_must_fail git rev-parse --verify -q two &&
+		test_must_fail git reflog exists refs/heads/two &&
+		git reflog show --format="%gs" -n 1 renamed >actual &&
+		echo "Branch: renamed refs/heads/two to refs/heads/renamed" >msg &&
+		test_cmp msg actual &&
+		git reflog show --format="%H" --skip=1 renamed >actual &&
+		test_cmp expect actual &&
+		git branch -c renamed copied &&
+		git rev-parse renamed copied &&
+		git reflog show --format="%gs" -n 1 copied >actual &&
+		echo "Branch: copied refs/heads/renamed to refs/heads/copied" >msg &&
+		test_cmp msg actual &&
+		git reflog show --format="%H" --skip=2 copied >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'reflog expire and delete' '
+	(
+		cd repo &&
+		test_commit C &&
+		test_commit D &&
+		git reflog delete master@{1} &&
+		git reflog show --format="%gs" master >actual &&
+		cat >expect <<-\EOF &&
+		commit: D
+		commit: B
+		commit (initial): A
+		EOF
+		test_cmp expect actual &&
+		git reflog expire --expire=all master &&
+		git reflog show master >actual &&
+		test_must_be_empty actual &&
+		git reflog exists refs/heads/master
+	)
+'
+
+test_expect_success 'the stack is compacted automatically' '
+	(
+		cd repo &&
+		for i in $(test_seq 50)
+		do
+			git update-ref refs/heads/auto-$i A || return 1
+		done &&
+		test_line_count -lt 12 .git/reftable/tables.list &&
+		test $(git for-each-ref refs/heads/auto-* | wc -l) = 50
+	)
+'
+
+test_expect_success 'pack-refs compacts the stack into one table' '
+	(
+		cd repo &&
+		git -c reftable.autocompaction=false update-ref refs/heads/x A &&
+		git -c reftable.autocompaction=false update-ref refs/heads/y A &&
+		git pack-refs --all &&
+		test_line_count = 1 .git/reftable/tables.list &&
+		ls .git/reftable >actual &&
+		test_line_count = 2 actual &&
+		git rev-parse x y auto-50 &&
+		git reflog show --format="%gs" HEAD >actual &&
+		test_line_count = 6 actual
+	)
+'
+
+test_expect_success 'many refs span several blocks' '
+	(
+		cd repo &&
+		git rev-parse A >oid &&
+		for i in $(test_seq 1000)
+		do
+			echo "create refs/tags/many-$i $(cat oid)" || return 1
+		done >stdin &&
+		git -c reftable.blocksize=256 update-ref --stdin <stdin &&
+		git -c reftable.blocksize=256 pack-refs &&
+		test $(git for-each-ref refs/tags/many-* | wc -l) = 1000 &&
+		git rev-parse many-1 many-500 many-1000 &&
+		test_must_fail git rev-parse --verify -q many-1001 &&
+		git for-each-ref --format="%(refname)" refs/tags/many-99 >actual &&
+		echo refs/tags/many-99 >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'a corrupt table is reported' '
+	git init --ref-format=reftable corrupt &&
+	test_commit -C corrupt A &&
+	table=$(head -n 1 corrupt/.git/reftable/tables.list) &&
+	echo garbage >corrupt/.git/reftable/$table &&
+	test_must_fail git -C corrupt rev-parse HEAD 2>err &&
+	test_i18ngrep "corrupt reftable" err
+'
+
+test_expect_success 'clone into a reftable repository' '
+	GIT_DEFAULT_REF_FORMAT=reftable git clone repo clone &&
+	test "$(git -C clone config extensions.refstorage)" = reftable &&
+	git -C repo rev-parse master >expect &&
+	git -C clone rev-parse origin/master >actual &&
+	test_cmp expect actual &&
+	test "$(git -C clone symbolic-ref refs/remotes/origin/HEAD)" = refs/remotes/origin/master
+'
+
+test_expect_success 'linked worktrees have their own HEAD' '
+	git -C repo worktree add ../wt -b wt-branch A &&
+	test "$(git -C wt symbolic-ref HEAD)" = refs/heads/wt-branch &&
+	test "$(git -C repo symbolic-ref HEAD)" = refs/heads/master &&
+	git -C wt update-ref refs/bisect/wt A &&
+	test_must_fail git -C repo rev-parse --verify -q refs/bisect/wt &&
+	git -C wt rev-parse --verify refs/bisect/wt &&
+	git -C repo rev-parse --verify worktrees/wt/HEAD &&
+	git -C repo worktree list >actual &&
+	grep "wt-branch" actual
+'
+
+test_done
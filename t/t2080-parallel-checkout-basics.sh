@@ -0,0 +1,159 @@
+#!/bin/sh
+
+test_description='parallel-checkout basics
+
+Check that parallel checkout writes the same working tree, and records
+the same stat data in the index, as the sequential one.
+'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_CHECKOUT_WORKERS
+
+# Run "git -C <dir> <args>" with the given number of workers, making
+# sure that this many were spawned (none for the sequential case).
+test_checkout_workers () {
+	workers=$1 &&
+	shift &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -c checkout.workers=$workers \
+		-c checkout.thresholdForParallelism=0 "$@" &&
+	if test $workers -gt 1
+	then
+		expected_workers=$workers
+	else
+		expected_workers=0
+	fi &&
+	{ grep "run_command: .*checkout--worker" trace || :; } >workers &&
+	test_line_count = $expected_workers workers
+}
+
+# The working tree and the index must match between the two clones.
+test_same_checkout () {
+	git -C "$1" diff-files --exit-code &&
+	git -C "$2" diff-files --exit-code &&
+	git -C "$1" ls-files -s >expect &&
+	git -C "$2" ls-files -s >actual &&
+	test_cmp expect actual &&
+	for f in $(git -C "$1" ls-files)
+	do
+		test_cmp "$1/$f" "$2/$f" || return 1
+	done
+}
+
+test_expect_success 'setup' '
+	git init src &&
+	(
+		cd src &&
+		for d in a b c/d
+		do
+			mkdir -p $d &&
+			for f in 1 2 3 4 5 6 7 8 9 10 11 12
+			do
+				echo "$d/$f" >$d/$f || return 1
+			done
+		done &&
+		echo exec >a/exec &&
+		chmod +x a/exec &&
+		printf "one\ntwo\n" >crlf &&
+		echo "\$Id\$" >ident &&
+		printf "h\0i\0\n\0" >encoded &&
+		echo "rot13 me" >filtered &&
+		cat >.gitattributes <<-\EOF &&
+		crlf text eol=crlf
+		ident ident
+		encoded working-tree-encoding=UTF-16LE
+		filtered filter=rot13
+		EOF
+		git add . &&
+		git update-index --chmod=+x a/exec &&
+		test_tick &&
+		git commit -m initial &&
+		git checkout -b other &&
+		rm -r b &&
+		echo changed >a/1 &&
+		mkdir b &&
+		echo "b is now a directory of new files" >b/new &&
+		git add -A &&
+		test_tick &&
+		git commit -m other &&
+		git checkout master
+	) &&
+	git config --global filter.rot13.smudge "\"$(pwd)/rot13.sh\"" &&
+	git config --global filter.rot13.clean "\"$(pwd)/rot13.sh\"" &&
+	write_script rot13.sh <<-\EOF
+	tr "a-zA-Z" "n-za-mN-ZA-M"
+	EOF
+'
+
+test_expect_success 'sequential clone' '
+	test_checkout_workers 1 clone src sequential
+'
+
+test_expect_success 'parallel clone' '
+	test_checkout_workers 2 clone src parallel &&
+	test_same_checkout sequential parallel
+'
+
+test_expect_success 'filtered entries are checked out by the main process' '
+	echo "ebg13 zr" >expect &&
+	test_cmp expect parallel/filtered
+'
+
+test_expect_success 'parallel checkout of another branch' '
+	test_checkout_workers 1 -C sequential checkout other &&
+	test_checkout_workers 2 -C parallel checkout other &&
+	test_same_checkout sequential parallel &&
+	test_path_is_file parallel/b/new
+'
+
+test_expect_success 'parallel reset --hard' '
+	test_checkout_workers 1 -C sequential reset --hard master &&
+	test_checkout_workers 2 -C parallel reset --hard master &&
+	test_same_checkout sequential parallel
+'
+
+test_expect_success SYMLINKS 'parallel checkout of symlinks' '
+	(
+		cd src &&
+		git checkout -b symlinks master &&
+		ln -s a/1 link &&
+		ln -s c/d dirlink &&
+		git add link dirlink &&
+		test_tick &&
+		git commit -m symlinks &&
+		git checkout master
+	) &&
+	git -C sequential fetch origin symlinks &&
+	git -C parallel fetch origin symlinks &&
+	test_checkout_workers 1 -C sequential checkout FETCH_HEAD &&
+	test_checkout_workers 2 -C parallel checkout FETCH_HEAD &&
+	test_same_checkout sequential parallel &&
+	test -h parallel/link &&
+	test "$(readlink parallel/dirlink)" = c/d
+'
+
+test_expect_success 'the threshold keeps small checkouts sequential' '
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -c checkout.workers=2 \
+		-c checkout.thresholdForParallelism=1000 clone src small &&
+	! grep checkout--worker trace &&
+	git -C small diff-files --exit-code
+'
+
+test_expect_success CASE_INSENSITIVE_FS 'colliding paths are written sequentially' '
+	git init collisions &&
+	(
+		cd collisions &&
+		echo lower >file &&
+		git add file &&
+		echo upper >FILE &&
+		git update-index --add --cacheinfo 100644,$(git hash-object -w FILE),FILE &&
+		test_tick &&
+		git commit -m collisions
+	) &&
+	test_checkout_workers 2 clone collisions collided 2>err &&
+	test_i18ngrep "the following paths have collided" err
+'
+
+test_done
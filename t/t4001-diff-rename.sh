@@ -262,4 +262,96 @@ test_expect_success 'diff-tree -l0 defaults to a big rename limit, not zero' '
 	grep "myotherfile.*myfile" actual
 '
 
+test_expect_success 'threaded rename detection finds the same renames' '
+	mkdir threads &&
+	for i in 1 2 3 4 5 6 7 8 9
+	do
+		test_write_lines common1 common2 common3 common4 "own $i" \
+			>threads/file$i || return 1
+	done &&
+	git add threads &&
+	git commit -m "files to rename" &&
+	mkdir threads-moved &&
+	for i in 1 2 3 4 5 6 7 8 9
+	do
+		git mv threads/file$i threads-moved/moved$i &&
+		echo "edit $i" >>threads-moved/moved$i || return 1
+	done &&
+	git add threads-moved &&
+	git commit -m "move and edit" &&
+	git -c diff.renameThreads=1 diff -M -C -C --raw HEAD^ HEAD >expect &&
+	GIT_TEST_RENAME_THREADS=4 git diff -M -C -C --raw HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	grep "R0*[0-9]*	threads/file5	threads-moved/moved5" actual
+'
+
+test_expect_success 'a unique basename match is preferred' '
+	mkdir basename basename-moved &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >basename/file &&
+	git add basename &&
+	git commit -m "file to move" &&
+	git rm basename/file &&
+	test_write_lines 1 2 3 4 5 6 7 8 x y >basename-moved/file &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 z >basename-moved/other &&
+	git add basename-moved &&
+	git commit -m "move and edit" &&
+	git diff -M --name-status HEAD^ HEAD >actual &&
+	grep "^R[0-9]*	basename/file	basename-moved/file" actual
+'
+
+test_expect_success 'renames beyond the rename limit are found' '
+	mkdir lsh &&
+	for i in 1 2 3 4 5 6 7 8 9
+	do
+		test_write_lines "$i one" "$i two" "$i three" "$i four" \
+			"$i five" "$i six" "$i seven" "$i eight" >lsh/file$i ||
+		return 1
+	done &&
+	git add lsh &&
+	git commit -m "files to rename" &&
+	mkdir lsh-moved &&
+	for i in 1 2 3 4 5 6 7 8 9
+	do
+		git mv lsh/file$i lsh-moved/moved$i &&
+		echo "edit $i" >>lsh-moved/moved$i || return 1
+	done &&
+	git add lsh-moved &&
+	git commit -m "rename and edit" &&
+	git diff -M -l2 --name-status HEAD^ HEAD >actual 2>err &&
+	test_must_be_empty err &&
+	grep "^R" actual >renames &&
+	test_line_count = 9 renames &&
+	grep "^R[0-9]*	lsh/file5	lsh-moved/moved5" actual &&
+	git -c diff.renameLshBands=0 diff -M -l2 --name-status \
+		HEAD^ HEAD >actual 2>err &&
+	test_i18ngrep "inexact rename detection was skipped" err &&
+	! grep "^R" actual
+'
+
+test_expect_success 'threaded rename detection agrees on converted files' '
+	test_when_finished "rm -f .gitattributes; git reset --hard" &&
+	mkdir filtered &&
+	test_seq 1 60 | sed "s/^/unrelated big line /" >filtered/a-big &&
+	test_seq 1 4 | sed "s/^/small content /" >filtered/b-small &&
+	test_seq 1 30 | sed "s/^/other file line /" >filtered/c-other &&
+	git add filtered &&
+	git commit -m "files to filter" &&
+	git config filter.strip.clean "sed /PADDING/d" &&
+	echo "z* filter=strip" >.gitattributes &&
+	{
+		test_write_lines 1 2 3 four | sed "s/^/small content /" &&
+		test_seq 1 60 | sed "s/^/PADDING /"
+	} >filtered/z-dst1 &&
+	{
+		test_seq 1 30 | sed "s/^/other file line /" &&
+		echo extra
+	} >filtered/z-dst2 &&
+	git rm -q filtered/a-big filtered/b-small filtered/c-other &&
+	git add -N filtered/z-dst1 filtered/z-dst2 &&
+	git -c diff.renameThreads=1 diff -M --raw HEAD -- filtered >expect &&
+	GIT_TEST_RENAME_THREADS=2 git diff -M --raw HEAD -- filtered >actual &&
+	test_cmp expect actual &&
+	grep "R[0-9]*	filtered/b-small	filtered/z-dst1" actual
+'
+
 test_done
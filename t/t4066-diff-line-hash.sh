@@ -0,0 +1,47 @@
+#!/bin/sh
+
+test_description='xdiff line hashing'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	# lines of every length up to a few words, each repeated at
+	# different offsets from the start of the buffer
+	line= &&
+	for i in 0 1 2 3 4 5 6 7 8 9 a b c d e f g h i j k l m n o p q
+	do
+		line="$line$i" &&
+		echo "$line" &&
+		echo "x$line" &&
+		echo "$line"
+	done >lines &&
+	cat lines lines >input &&
+	printf "\n\n" >>input
+'
+
+test_expect_success 'equal lines hash equally' '
+	test-tool xdiff-hash input >actual &&
+	lines=$(wc -l <input) &&
+	distinct=$(sort -u input | wc -l) &&
+	echo $lines lines, $distinct distinct hashes >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'an incomplete last line is split correctly' '
+	printf "abcdefghijklmnop\nabcdefghijklmnop" >incomplete &&
+	test-tool xdiff-hash incomplete >actual &&
+	echo "2 lines, 1 distinct hashes" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'whitespace-ignoring variants still work' '
+	printf "a b\na  b\nab\n" >ws &&
+	test-tool xdiff-hash --ignore-space-change ws >actual &&
+	echo "3 lines, 2 distinct hashes" >expect &&
+	test_cmp expect actual &&
+	test-tool xdiff-hash --ignore-all-space ws >actual &&
+	echo "3 lines, 1 distinct hashes" >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,96 @@
+#!/bin/sh
+
+test_description='diff output does not depend on diff.threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 20)
+	do
+		test_seq $i $((i + 40)) >file$i || return 1
+	done &&
+	test_seq 1 100 >moved &&
+	printf "binary\000file\n" >binary &&
+	echo exec >script &&
+	echo old >removed &&
+	test_seq 1000 1100 >renamed &&
+	test_seq 1 50 >rewritten &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+
+	for i in $(test_seq 1 20)
+	do
+		test_seq $((i + 3)) $((i + 50)) >file$i || return 1
+	done &&
+	test_seq 51 100 >moved &&
+	test_seq 1 50 >>moved &&
+	printf "binary\000file\001\n" >binary &&
+	test_chmod +x script &&
+	git rm -q removed &&
+	git mv renamed renamed-too &&
+	echo 1101 >>renamed-too &&
+	test_seq 100 150 >rewritten &&
+	echo new >added &&
+	git add . &&
+	test_tick &&
+	git commit -m second
+'
+
+# Run "git $@" with one thread and with several, and compare.
+check_threads () {
+	git -c diff.threads=1 "$@" >expect &&
+	git -c diff.threads=4 "$@" >actual &&
+	test_cmp expect actual &&
+	git "$@" >actual &&
+	test_cmp expect actual
+}
+
+for args in \
+	"log -p" "log -p -M" "log -p -B -M" "log -p --binary" \
+	"log -p --color" "log -p --color-moved" "log -p --color-moved=zebra" \
+	"log -p --color-moved --color-moved-ws=ignore-all-space" \
+	"log --stat" "log --stat -M" "log --numstat" "log --shortstat" \
+	"log -p --stat" "log --patch-with-raw" "log -p --full-index" \
+	"log -p -U1 -w" "log -p --function-context" "log -p -R" \
+	"log -p --word-diff" "log -p --graph" "format-patch --stdout -1" \
+	"diff HEAD~1 HEAD" "diff --stat HEAD~1 HEAD" "diff-tree -p -r HEAD"
+do
+	test_expect_success "git $args" "
+		check_threads $args
+	"
+done
+
+test_expect_success 'diffs of the index use a single thread' '
+	test_seq 7 48 >file5 &&
+	git add file5 &&
+	check_threads diff --cached &&
+	check_threads diff --cached --stat HEAD~1 &&
+	git reset -q --hard
+'
+
+test_expect_success 'textconv falls back to a single thread' '
+	write_script hexdump <<-\EOF &&
+	od -An -tx1 "$1"
+	EOF
+	echo "file1* diff=hex" >.gitattributes &&
+	git config diff.hex.textconv "\"$PWD\"/hexdump" &&
+	check_threads log -p &&
+	check_threads log --stat
+'
+
+test_expect_success '--exit-code and --quiet' '
+	git -c diff.threads=4 diff --exit-code HEAD HEAD &&
+	test_expect_code 1 git -c diff.threads=4 diff --exit-code HEAD~1 HEAD \
+		>/dev/null &&
+	test_expect_code 1 git -c diff.threads=4 diff --quiet HEAD~1 HEAD &&
+	test_expect_code 1 git -c diff.threads=4 diff --stat --exit-code \
+		HEAD~1 HEAD >/dev/null
+'
+
+test_expect_success 'diff.threads must not be negative' '
+	test_must_fail git -c diff.threads=-1 log -p 2>err &&
+	test_i18ngrep "diff.threads" err
+'
+
+test_done
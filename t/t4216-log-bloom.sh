@@ -0,0 +1,185 @@
+#!/bin/sh
+
+test_description='git log for a path with Bloom filters'
+. ./test-lib.sh
+
+# The tests below control which commits are in the commit-graph.
+GIT_TEST_COMMIT_GRAPH=0
+
+test_expect_success 'setup test - repo, commits, commit graph, log outputs' '
+	git init &&
+	mkdir A A/B A/B/C &&
+	test_commit c1 A/file1 &&
+	test_commit c2 A/B/file2 &&
+	test_commit c3 A/B/C/file3 &&
+	test_commit c4 A/file1 &&
+	test_commit c5 A/B/file2 &&
+	test_commit c6 A/B/C/file3 &&
+	test_commit c7 A/file1 &&
+	test_commit c8 A/B/file2 &&
+	test_commit c9 A/B/C/file3 &&
+	test_commit c10 file_to_be_deleted &&
+	git checkout -b side HEAD~4 &&
+	test_commit side-1 file4 &&
+	git checkout master &&
+	git merge side &&
+	test_commit c11 file5 &&
+	mv file5 file5_renamed &&
+	git add file5_renamed &&
+	git commit -m "rename" &&
+	rm file_to_be_deleted &&
+	git add . &&
+	git commit -m "file removed" &&
+	git commit-graph write --reachable --changed-paths
+'
+
+graph_read_expect () {
+	NUM_CHUNKS=6
+	cat >expect <<- EOF
+	header: 43475048 1 1 $NUM_CHUNKS 0
+	num_commits: $1
+	chunks: oid_fanout oid_lookup commit_metadata generation_data bloom_indexes bloom_data
+	EOF
+	git commit-graph read >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'commit-graph write wrote out the bloom chunks' '
+	graph_read_expect 15
+'
+
+# Turn off any inherited trace output
+unset GIT_TRACE_BLOOM
+
+setup () {
+	rm -f trace.perf &&
+	git -c core.commitGraph=false log --pretty="format:%s" $1 >log_wo_bloom &&
+	GIT_TRACE_BLOOM="$(pwd)/trace.perf" git -c core.commitGraph=true log --pretty="format:%s" $1 >log_w_bloom
+}
+
+test_bloom_filters_used () {
+	log_args=$1
+	setup "$log_args" &&
+	grep -q "definitely_not=[1-9]" trace.perf &&
+	test_cmp log_wo_bloom log_w_bloom
+}
+
+test_bloom_filters_not_used () {
+	log_args=$1
+	setup "$log_args" &&
+	test_path_is_missing trace.perf &&
+	test_cmp log_wo_bloom log_w_bloom
+}
+
+for path in A A/B A/B/C A/file1 A/B/file2 A/B/C/file3 file4 file5 file5_renamed file_to_be_deleted
+do
+	for option in "" \
+	      "--all" \
+		      "--full-history" \
+		      "--full-history --simplify-merges" \
+		      "--simplify-merges" \
+		      "--simplify-by-decoration" \
+		      "--first-parent" \
+		      "--topo-order" \
+		      "--date-order" \
+		      "--author-date-order" \
+		      "--ancestry-path side..master"
+	do
+		test_expect_success "git log option: $option for path: $path" '
+			test_bloom_filters_used "$option -- $path"
+		'
+	done
+done
+
+test_expect_success 'git log -- folder works with and without the trailing slash' '
+	test_bloom_filters_used "-- A" &&
+	test_bloom_filters_used "-- A/"
+'
+
+test_expect_success 'git log for path that does not exist. ' '
+	test_bloom_filters_used "-- path_does_not_exist"
+'
+
+test_expect_success 'git log with --walk-reflogs does not use Bloom filters' '
+	test_bloom_filters_not_used "--walk-reflogs -- A"
+'
+
+test_expect_success 'git log -- multiple path specs does not use Bloom filters' '
+	test_bloom_filters_not_used "-- file4 A/file1"
+'
+
+test_expect_success 'git log with wildcard pathspec does not use Bloom filters' '
+	test_bloom_filters_not_used "-- file_to_be_*"
+'
+
+test_expect_success 'git log with --follow does not use Bloom filters' '
+	test_bloom_filters_not_used "--follow -- file4"
+'
+
+test_expect_success 'git log with --sparse does not use Bloom filters' '
+	test_bloom_filters_not_used "--sparse -- file4"
+'
+
+test_expect_success 'git log with magic pathspec does not use Bloom filters' '
+	test_bloom_filters_not_used "-- :(icase)file4"
+'
+
+test_expect_success 'git blame output is the same with and without Bloom filters' '
+	for file in A/file1 A/B/file2 A/B/C/file3 file4
+	do
+		git -c core.commitGraph=false blame $file >blame_wo_bloom &&
+		git -c core.commitGraph=true blame $file >blame_w_bloom &&
+		test_cmp blame_wo_bloom blame_w_bloom || return 1
+	done
+'
+
+test_expect_success 'git log -L output is the same with and without Bloom filters' '
+	for file in A/file1 A/B/file2 A/B/C/file3 file4
+	do
+		git -c core.commitGraph=false log -L 1,1:$file >line_wo_bloom &&
+		git -c core.commitGraph=true log -L 1,1:$file >line_w_bloom &&
+		test_cmp line_wo_bloom line_w_bloom || return 1
+	done
+'
+
+test_expect_success 'commits missing from the commit-graph fall back to tree diffs' '
+	test_commit c12 A/file1 &&
+	test_commit c13 file4 &&
+	test_bloom_filters_used "-- A/file1" &&
+	grep -q "filter_not_present=2" trace.perf
+'
+
+# Point the first entry of the Bloom filter index past the end of the
+# Bloom filter data.
+corrupt_bloom_index () {
+	perl -e '
+		open(my $fh, "+<", $ARGV[0]) or die "open: $!";
+		binmode $fh;
+		read($fh, my $header, 8) == 8 or die "short read";
+		my $nr = ord(substr($header, 6, 1));
+		for (1 .. $nr) {
+			read($fh, my $entry, 12) == 12 or die "short read";
+			my ($id, $hi, $lo) = unpack("a4NN", $entry);
+			next unless $id eq "BIDX";
+			seek($fh, $hi * 2**32 + $lo, 0) or die "seek: $!";
+			print $fh pack("N", 0xffffffff);
+			exit 0;
+		}
+		die "no BIDX chunk";
+	' "$1"
+}
+
+test_expect_success PERL 'out-of-range Bloom filter offsets are ignored' '
+	graph=.git/objects/info/commit-graph &&
+	test_when_finished "rm -f $graph" &&
+	rm -f $graph &&
+	git commit-graph write --reachable --changed-paths &&
+	chmod u+w $graph &&
+	corrupt_bloom_index $graph &&
+	git -c core.commitGraph=false log --pretty="format:%s" -- A/file1 >expect &&
+	git -c core.commitGraph=true log --pretty="format:%s" -- A/file1 >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep "ignoring out-of-range offsets" err
+'
+
+test_done
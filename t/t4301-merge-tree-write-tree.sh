@@ -0,0 +1,160 @@
+#!/bin/sh
+
+test_description='git merge-tree --write-tree and the ort merge strategy'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_MERGE_ALGORITHM
+
+test_expect_success setup '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >numbers &&
+	test_write_lines a b c d e f g h i >letters &&
+	echo hello >greeting &&
+	echo base >whatever &&
+	git add numbers letters greeting whatever &&
+	test_tick &&
+	git commit -m base &&
+
+	git branch side1 &&
+	git branch side2 &&
+
+	git checkout side1 &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >numbers &&
+	git mv letters alphabet &&
+	echo hi >greeting &&
+	echo side1 >whatever &&
+	test_tick &&
+	git commit -a -m side1 &&
+
+	git checkout side2 &&
+	test_write_lines 0 1 2 3 4 5 6 7 8 9 >numbers &&
+	test_write_lines a b c d e f g h i j >letters &&
+	echo side2 >whatever &&
+	test_tick &&
+	git commit -a -m side2 &&
+
+	git checkout -b clean2 master &&
+	test_write_lines a b c d e f g h i j >letters &&
+	test_tick &&
+	git commit -a -m clean2
+'
+
+test_expect_success 'clean merge with a rename' '
+	git merge-tree --write-tree side1 clean2 >out &&
+	test_line_count = 1 out &&
+	tree=$(cat out) &&
+	git rev-parse $tree:alphabet >actual &&
+	git rev-parse clean2:letters >expect &&
+	test_cmp expect actual &&
+	test_must_fail git rev-parse --verify -q $tree:letters &&
+	git rev-parse $tree:numbers >actual &&
+	git rev-parse side1:numbers >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'conflicted merge reports the stages and messages' '
+	test_expect_code 1 git merge-tree --write-tree side1 side2 >out &&
+	tree=$(head -n 1 out) &&
+	git cat-file -t $tree >type &&
+	echo tree >expect &&
+	test_cmp expect type &&
+	cat >expect <<-EOF &&
+	100644 $(git rev-parse master:whatever) 1	whatever
+	100644 $(git rev-parse side1:whatever) 2	whatever
+	100644 $(git rev-parse side2:whatever) 3	whatever
+
+	EOF
+	sed -n "2,5p" out >actual &&
+	test_cmp expect actual &&
+	grep "CONFLICT (content): Merge conflict in whatever" out &&
+	git cat-file -p $tree:whatever >merged &&
+	grep "^<<<<<<< side1" merged &&
+	test_write_lines 0 1 2 3 4 5 6 7 8 9 10 >expect &&
+	git cat-file -p $tree:numbers >actual &&
+	test_cmp expect actual &&
+	test_write_lines a b c d e f g h i j >expect &&
+	git cat-file -p $tree:alphabet >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'content merges of renames use the merged attributes' '
+	git checkout -f -b attr-base master &&
+	echo "* merge=union" >.gitattributes &&
+	test_write_lines 1 2 3 >renamed &&
+	git add .gitattributes renamed &&
+	test_tick &&
+	git commit -m attr-base &&
+	git checkout -b attr-side1 &&
+	git mv renamed renamed-1 &&
+	test_write_lines 1 2 3 side1 >renamed-1 &&
+	test_tick &&
+	git commit -a -m attr-side1 &&
+	git checkout -b attr-side2 attr-base &&
+	git mv renamed renamed-2 &&
+	test_write_lines 1 2 3 side2 >renamed-2 &&
+	test_tick &&
+	git commit -a -m attr-side2 &&
+	git checkout -f master &&
+	test_expect_code 1 git merge-tree --write-tree attr-side1 attr-side2 >out &&
+	grep "CONFLICT (rename/rename)" out &&
+	tree=$(head -n 1 out) &&
+	test_write_lines 1 2 3 side1 side2 >expect &&
+	git cat-file -p $tree:renamed-1 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'merge-tree --write-tree leaves the index alone' '
+	git checkout -f master &&
+	git diff-index --cached --exit-code HEAD &&
+	test_expect_code 1 git merge-tree --write-tree side1 side2 >/dev/null &&
+	git diff-index --cached --exit-code HEAD &&
+	git diff-files --exit-code
+'
+
+test_expect_success 'merge-tree --write-tree works in a bare repository' '
+	git clone --bare . bare.git &&
+	git -C bare.git merge-tree --write-tree side1 clean2 >actual &&
+	git merge-tree --write-tree side1 clean2 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'merge -s ort matches merge -s recursive' '
+	git checkout -f -b ort-merge side1 &&
+	test_must_fail git merge -s ort side2 &&
+	git ls-files -s >ort-index &&
+	cp whatever ort-whatever &&
+	git reset --hard &&
+	git checkout -f -b recursive-merge side1 &&
+	test_must_fail git merge -s recursive side2 &&
+	git ls-files -s >recursive-index &&
+	test_cmp recursive-index ort-index &&
+	test_cmp whatever ort-whatever &&
+	git reset --hard
+'
+
+test_expect_success 'merge -s ort refuses to overwrite local changes' '
+	git checkout -f -b ort-dirty side1 &&
+	echo dirty >>alphabet &&
+	test_must_fail git merge -s ort clean2 &&
+	grep dirty alphabet &&
+	git checkout -f side1
+'
+
+test_expect_success 'cherry-pick --strategy=ort' '
+	git checkout -f -b ort-pick side1 &&
+	git cherry-pick --strategy=ort clean2 &&
+	test_write_lines a b c d e f g h i j >expect &&
+	test_cmp expect alphabet &&
+	test_path_is_missing letters &&
+	git diff-files --exit-code
+'
+
+test_expect_success 'GIT_TEST_MERGE_ALGORITHM=ort uses ort by default' '
+	git checkout -f -b ort-default side1 &&
+	GIT_TRACE_PERFORMANCE="$(pwd)/perf" GIT_TEST_MERGE_ALGORITHM=ort \
+		git merge clean2 &&
+	grep "merge-ort:" perf &&
+	test_cmp expect alphabet
+'
+
+test_done
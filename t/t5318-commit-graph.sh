@@ -58,16 +58,16 @@ graph_git_behavior 'no graph' full commits/3 commits/1
 
 graph_read_expect() {
 	OPTIONAL=""
-	NUM_CHUNKS=3
+	NUM_CHUNKS=4
 	if test ! -z $2
 	then
 		OPTIONAL=" $2"
-		NUM_CHUNKS=$((3 + $(echo "$2" | wc -w)))
+		NUM_CHUNKS=$((4 + $(echo "$2" | wc -w)))
 	fi
 	cat >expect <<- EOF
 	header: 43475048 1 1 $NUM_CHUNKS 0
 	num_commits: $1
-	chunks: oid_fanout oid_lookup commit_metadata$OPTIONAL
+	chunks: oid_fanout oid_lookup commit_metadata generation_data$OPTIONAL
 	EOF
 	git commit-graph read >output &&
 	test_cmp expect output
@@ -340,7 +340,7 @@ GRAPH_BYTE_HASH=5
 GRAPH_BYTE_CHUNK_COUNT=6
 GRAPH_CHUNK_LOOKUP_OFFSET=8
 GRAPH_CHUNK_LOOKUP_WIDTH=12
-GRAPH_CHUNK_LOOKUP_ROWS=5
+GRAPH_CHUNK_LOOKUP_ROWS=6
 GRAPH_BYTE_OID_FANOUT_ID=$GRAPH_CHUNK_LOOKUP_OFFSET
 GRAPH_BYTE_OID_LOOKUP_ID=$(($GRAPH_CHUNK_LOOKUP_OFFSET + \
 			    1 * $GRAPH_CHUNK_LOOKUP_WIDTH))
@@ -361,8 +361,12 @@ GRAPH_BYTE_COMMIT_WRONG_PARENT=$(($GRAPH_COMMIT_DATA_OFFSET + $HASH_LEN + 3))
 GRAPH_BYTE_COMMIT_GENERATION=$(($GRAPH_COMMIT_DATA_OFFSET + $HASH_LEN + 11))
 GRAPH_BYTE_COMMIT_DATE=$(($GRAPH_COMMIT_DATA_OFFSET + $HASH_LEN + 12))
 GRAPH_COMMIT_DATA_WIDTH=$(($HASH_LEN + 16))
-GRAPH_OCTOPUS_DATA_OFFSET=$(($GRAPH_COMMIT_DATA_OFFSET + \
-			     $GRAPH_COMMIT_DATA_WIDTH * $NUM_COMMITS))
+GRAPH_GENERATION_DATA_OFFSET=$(($GRAPH_COMMIT_DATA_OFFSET + \
+				$GRAPH_COMMIT_DATA_WIDTH * $NUM_COMMITS))
+GRAPH_GENERATION_DATA_WIDTH=4
+GRAPH_BYTE_GENERATION_DATA=$(($GRAPH_GENERATION_DATA_OFFSET + 3))
+GRAPH_OCTOPUS_DATA_OFFSET=$(($GRAPH_GENERATION_DATA_OFFSET + \
+			     $GRAPH_GENERATION_DATA_WIDTH * $NUM_COMMITS))
 GRAPH_BYTE_OCTOPUS=$(($GRAPH_OCTOPUS_DATA_OFFSET + 4))
 GRAPH_BYTE_FOOTER=$(($GRAPH_OCTOPUS_DATA_OFFSET + 4 * $NUM_OCTOPUS_EDGES))
 
@@ -474,6 +478,11 @@ test_expect_success 'detect incorrect commit date' '
 		"commit date"
 '
 
+test_expect_success 'detect incorrect generation data' '
+	corrupt_graph_and_verify $GRAPH_BYTE_GENERATION_DATA "\01" \
+		"corrected commit date"
+'
+
 test_expect_success 'detect incorrect parent for octopus merge' '
 	corrupt_graph_and_verify $GRAPH_BYTE_OCTOPUS "\01" \
 		"invalid parent"
@@ -529,4 +538,96 @@ test_expect_success 'get_commit_tree_in_graph works for non-the_repository' '
 	test_cmp expect actual
 '
 
+commit_at () {
+	GIT_COMMITTER_DATE="@$1 +0000" &&
+	GIT_AUTHOR_DATE="@$1 +0000" &&
+	export GIT_COMMITTER_DATE GIT_AUTHOR_DATE &&
+	git commit --allow-empty -m "$2" &&
+	git tag "$2" &&
+	sane_unset GIT_COMMITTER_DATE GIT_AUTHOR_DATE
+}
+
+test_expect_success 'setup commits with skewed dates' '
+	cd "$TRASH_DIRECTORY" &&
+	rm -rf skew &&
+	git init skew &&
+	(
+		cd skew &&
+		git config core.commitGraph true &&
+		commit_at 1500000000 A &&
+		commit_at 1400000000 B &&
+		commit_at 1600000000 C &&
+		git checkout -b side A &&
+		commit_at 1550000000 D &&
+		git merge --no-ff -m E C &&
+		git tag E &&
+		commit_at 1300000000 F &&
+		git checkout master &&
+		commit_at 1450000000 G
+	)
+'
+
+test_expect_success 'corrected commit dates are written by default' '
+	cd "$TRASH_DIRECTORY/skew" &&
+	git commit-graph write --reachable &&
+	git commit-graph read >output &&
+	grep "chunks: .* generation_data" output &&
+	git commit-graph verify
+'
+
+skew_git_behavior () {
+	test_expect_success "corrected commit dates: $1" '
+		cd "$TRASH_DIRECTORY/skew" &&
+		graph_git_two_modes "merge-base -a F G" &&
+		graph_git_two_modes "merge-base --independent A B C D E F G" &&
+		graph_git_two_modes "tag --contains B" &&
+		graph_git_two_modes "tag --merged F" &&
+		graph_git_two_modes "log --topo-order --format=%s F G" &&
+		graph_git_two_modes "log --graph --format=%s G..F"
+	'
+}
+
+skew_git_behavior 'walks match'
+
+test_expect_success 'commitGraph.generationVersion=1 writes topological levels only' '
+	cd "$TRASH_DIRECTORY/skew" &&
+	git -c commitGraph.generationVersion=1 commit-graph write --reachable &&
+	git commit-graph read >output &&
+	! grep generation_data output &&
+	git commit-graph verify
+'
+
+skew_git_behavior 'walks match with topological levels'
+
+test_expect_success 'commitGraph.generationVersion=1 ignores generation data' '
+	cd "$TRASH_DIRECTORY/skew" &&
+	git commit-graph write --reachable &&
+	git -c commitGraph.generationVersion=1 log --topo-order --format=%s F G >actual &&
+	git -c core.commitGraph=false log --topo-order --format=%s F G >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success TIME_IS_64BIT 'corrected commit date offsets that overflow' '
+	cd "$TRASH_DIRECTORY" &&
+	rm -rf overflow &&
+	git init overflow &&
+	(
+		cd overflow &&
+		git config core.commitGraph true &&
+		commit_at 1 root &&
+		commit_at 16000000000 future &&
+		commit_at 2 past &&
+		commit_at 3 pastpast &&
+		git checkout -b side root &&
+		commit_at 4 other &&
+		git commit-graph write --reachable &&
+		git commit-graph read >output &&
+		grep "chunks: .* generation_data generation_data_overflow" output &&
+		git commit-graph verify &&
+		graph_git_two_modes "merge-base master side" &&
+		graph_git_two_modes "tag --contains future" &&
+		graph_git_two_modes "log --topo-order --format=%s master side"
+	)
+'
+
 test_done
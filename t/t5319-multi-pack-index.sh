@@ -348,4 +348,151 @@ test_expect_success 'verify incorrect 64-bit offset' '
 		"incorrect object offset"
 '
 
+
+# Write a pack of the objects reachable from $2 but not from $3 into
+# the repository $1, creating commits as needed so that the pack holds
+# about $4 commits.
+make_pack () {
+	for i in $(test_seq $4)
+	do
+		test_commit -C $1 "$2-$i" >/dev/null || return 1
+	done &&
+	git -C $1 rev-list --objects "$2-$4" ${3:+"^$3"} |
+	git -C $1 pack-objects .git/objects/pack/pack >/dev/null &&
+	git -C $1 prune-packed
+}
+
+test_expect_success 'setup expire tests' '
+	git init dup &&
+	make_pack dup one "" 1 &&
+	make_pack dup two one-1 2 &&
+	make_pack dup three two-2 3 &&
+	make_pack dup four three-3 4 &&
+	make_pack dup five four-4 5 &&
+	git -C dup multi-pack-index write &&
+	git -C dup rev-list --objects --all | sort >dup-objects
+'
+
+test_expect_success 'expire does not remove any packs' '
+	ls dup/.git/objects/pack >expect &&
+	git -C dup multi-pack-index expire &&
+	ls dup/.git/objects/pack >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'expire removes unreferenced packs' '
+	(
+		cd dup &&
+		git rev-list --objects two-2 |
+		git pack-objects .git/objects/pack/pack >combined &&
+		ls .git/objects/pack/*.pack >before &&
+		git multi-pack-index write &&
+		git multi-pack-index expire &&
+		ls .git/objects/pack/*.pack >after &&
+		test_line_count = 6 before &&
+		test_line_count = 4 after &&
+		grep $(cat combined) after &&
+		test-tool read-midx .git/objects | grep "\.idx$" >midx-packs &&
+		test_line_count = 4 midx-packs &&
+		git multi-pack-index verify &&
+		git rev-list --objects --all | sort >actual &&
+		test_cmp ../dup-objects actual &&
+		git fsck
+	)
+'
+
+test_expect_success 'expire respects .keep files' '
+	(
+		cd dup &&
+		keep=.git/objects/pack/pack-$(cat combined) &&
+		touch $keep.keep &&
+		git rev-list --objects three-3 |
+		git pack-objects .git/objects/pack/pack >combined &&
+		git multi-pack-index write &&
+		git multi-pack-index expire &&
+		test_path_is_file $keep.pack &&
+		test-tool read-midx .git/objects | grep "\.idx$" >midx-packs &&
+		test_line_count = 4 midx-packs &&
+		git rev-list --objects --all | sort >actual &&
+		test_cmp ../dup-objects actual &&
+		rm $keep.keep
+	)
+'
+
+test_expect_success 'repack --batch-size is only for the repack verb' '
+	test_must_fail git -C dup multi-pack-index write --batch-size=100 2>err &&
+	test_i18ngrep "only for .repack." err
+'
+
+test_expect_success 'repack with a small batch-size does nothing' '
+	ls dup/.git/objects/pack >expect &&
+	git -C dup multi-pack-index repack --batch-size=1 &&
+	ls dup/.git/objects/pack >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'repack --batch-size combines the oldest small packs' '
+	git init batch &&
+	test_when_finished "rm -fr batch" &&
+	(
+		cd batch &&
+		make_pack . one "" 1 &&
+		make_pack . two one-1 1 &&
+		make_pack . three two-1 1 &&
+		make_pack . big three-1 20 &&
+		i=0 &&
+		for p in $(ls -tr .git/objects/pack/*.pack)
+		do
+			i=$(($i + 1)) &&
+			test-tool chmtime =$((-1000 + $i)) $p || return 1
+		done &&
+		git rev-list --objects --all | sort >expect &&
+		git multi-pack-index write &&
+
+		ls -S .git/objects/pack/*.pack >by-size &&
+		big=$(head -n 1 by-size) &&
+		small=$(tail -n 1 by-size) &&
+		size=$(wc -c <$small) &&
+
+		git multi-pack-index repack --batch-size=$(($size * 3)) &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 5 packs &&
+		git multi-pack-index expire &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 2 packs &&
+		grep $big packs &&
+		git multi-pack-index verify &&
+		git rev-list --objects --all | sort >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'repack without --batch-size combines all packs' '
+	(
+		cd dup &&
+		git multi-pack-index repack &&
+		git multi-pack-index expire &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 1 packs &&
+		git rev-list --objects --all | sort >actual &&
+		test_cmp ../dup-objects actual &&
+		git fsck
+	)
+'
+
+test_expect_success 'expire keeps the bitmap with --bitmap' '
+	(
+		cd dup &&
+		make_pack . six five-5 2 &&
+		git multi-pack-index write --bitmap &&
+		git multi-pack-index repack --bitmap &&
+		git multi-pack-index expire --bitmap &&
+		ls .git/objects/pack/multi-pack-index-*.bitmap >bitmaps &&
+		test_line_count = 1 bitmaps &&
+		git -c core.multiPackIndex=true rev-list --count --all --use-bitmap-index >actual &&
+		git rev-list --count --all >expect &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -0,0 +1,290 @@
+#!/bin/sh
+
+test_description='split commit graph'
+. ./test-lib.sh
+
+GIT_TEST_COMMIT_GRAPH=0
+
+test_expect_success 'setup repo' '
+	git init &&
+	git config core.commitGraph true &&
+	infodir=".git/objects/info" &&
+	graphdir="$infodir/commit-graphs" &&
+	test_oid_init
+'
+
+graph_read_expect() {
+	NUM_BASE=0
+	NUM_CHUNKS=4
+	OPTIONAL=""
+	if test ! -z $2
+	then
+		NUM_BASE=$2
+		NUM_CHUNKS=5
+		OPTIONAL=" base_graphs"
+	fi
+	cat >expect <<- EOF
+	header: 43475048 1 1 $NUM_CHUNKS $NUM_BASE
+	num_commits: $1
+	chunks: oid_fanout oid_lookup commit_metadata generation_data$OPTIONAL
+	EOF
+	if test ! -z $2
+	then
+		echo "num_base_graphs: $2" >>expect
+	fi &&
+	git commit-graph read >output &&
+	test_cmp expect output
+}
+
+test_expect_success 'create commits and write commit-graph' '
+	for i in $(test_seq 3)
+	do
+		test_commit $i &&
+		git branch commits/$i || return 1
+	done &&
+	git commit-graph write --reachable &&
+	test_path_is_file $infodir/commit-graph &&
+	graph_read_expect 3
+'
+
+graph_git_two_modes() {
+	git -c core.commitGraph=true $1 >output
+	git -c core.commitGraph=false $1 >expect
+	test_cmp expect output
+}
+
+graph_git_behavior() {
+	MSG=$1
+	BRANCH=$2
+	COMPARE=$3
+	test_expect_success "check normal git operations: $MSG" '
+		graph_git_two_modes "log --oneline $BRANCH" &&
+		graph_git_two_modes "log --topo-order $BRANCH" &&
+		graph_git_two_modes "log --graph $COMPARE..$BRANCH" &&
+		graph_git_two_modes "branch -vv" &&
+		graph_git_two_modes "merge-base -a $BRANCH $COMPARE"
+	'
+}
+
+graph_git_behavior 'graph exists' commits/3 commits/1
+
+verify_chain_files_exist() {
+	for hash in $(cat $1/commit-graph-chain)
+	do
+		test_path_is_file $1/graph-$hash.graph || return 1
+	done
+}
+
+test_expect_success 'add more commits, and write a new base graph' '
+	git reset --hard commits/1 &&
+	for i in $(test_seq 4 5)
+	do
+		test_commit $i &&
+		git branch commits/$i || return 1
+	done &&
+	git reset --hard commits/2 &&
+	for i in $(test_seq 6 10)
+	do
+		test_commit $i &&
+		git branch commits/$i || return 1
+	done &&
+	git reset --hard commits/2 &&
+	git merge commits/4 &&
+	git branch merge/1 &&
+	git reset --hard commits/4 &&
+	git merge commits/6 &&
+	git branch merge/2 &&
+	git commit-graph write --reachable &&
+	graph_read_expect 12
+'
+
+test_expect_success 'add three more commits, write a tip graph' '
+	git reset --hard commits/3 &&
+	git merge merge/1 &&
+	git merge commits/5 &&
+	git merge merge/2 &&
+	git branch merge/3 &&
+	git commit-graph write --reachable --split &&
+	test_path_is_missing $infodir/commit-graph &&
+	test_path_is_file $graphdir/commit-graph-chain &&
+	ls $graphdir/graph-*.graph >graph-files &&
+	test_line_count = 2 graph-files &&
+	verify_chain_files_exist $graphdir
+'
+
+graph_git_behavior 'split commit-graph: merge 3 vs 2' merge/3 merge/2
+
+test_expect_success 'add one commit, write a tip graph' '
+	test_commit 11 &&
+	git branch commits/11 &&
+	git commit-graph write --reachable --split &&
+	test_path_is_missing $infodir/commit-graph &&
+	test_path_is_file $graphdir/commit-graph-chain &&
+	ls $graphdir/graph-*.graph >graph-files &&
+	test_line_count = 3 graph-files &&
+	verify_chain_files_exist $graphdir &&
+	graph_read_expect 1 2
+'
+
+graph_git_behavior 'three-layer commit-graph: commit 11 vs 6' commits/11 commits/6
+
+test_expect_success 'add one commit, write a merged graph' '
+	test_commit 12 &&
+	git branch commits/12 &&
+	git commit-graph write --reachable --split &&
+	test_path_is_file $graphdir/commit-graph-chain &&
+	test_line_count = 2 $graphdir/commit-graph-chain &&
+	ls $graphdir/graph-*.graph >graph-files &&
+	test_line_count = 2 graph-files &&
+	verify_chain_files_exist $graphdir
+'
+
+graph_git_behavior 'merged commit-graph: commit 12 vs 6' commits/12 commits/6
+
+test_expect_success 'split write without new commits leaves the chain alone' '
+	cp $graphdir/commit-graph-chain chain-before &&
+	git commit-graph write --reachable --split &&
+	test_cmp chain-before $graphdir/commit-graph-chain
+'
+
+test_expect_success 'create fork and chain across alternate' '
+	git clone . fork &&
+	(
+		cd fork &&
+		git config core.commitGraph true &&
+		rm -rf $graphdir &&
+		echo "$(pwd)/../.git/objects" >.git/objects/info/alternates &&
+		test_commit 13 &&
+		git branch commits/13 &&
+		git commit-graph write --reachable --split &&
+		test_path_is_file $graphdir/commit-graph-chain &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		git -c core.commitGraph=true  rev-list HEAD >expect &&
+		git -c core.commitGraph=false rev-list HEAD >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'verify a split commit-graph' '
+	git commit-graph verify &&
+	git commit-graph verify --shallow
+'
+
+test_expect_success 'test merge strategy constants' '
+	git clone . merge-2 &&
+	(
+		cd merge-2 &&
+		git config core.commitGraph true &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		test_commit 14 &&
+		git commit-graph write --reachable --split --size-multiple=2 &&
+		test_line_count = 3 $graphdir/commit-graph-chain
+	) &&
+	git clone . merge-10 &&
+	(
+		cd merge-10 &&
+		git config core.commitGraph true &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		test_commit 14 &&
+		git commit-graph write --reachable --split --size-multiple=10 &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		ls $graphdir/graph-*.graph >graph-files &&
+		test_line_count = 1 graph-files
+	) &&
+	git clone . merge-10-expire &&
+	(
+		cd merge-10-expire &&
+		git config core.commitGraph true &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		test_commit 15 &&
+		git commit-graph write --reachable --split --size-multiple=10 --expire-time=1980-01-01 &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		ls $graphdir/graph-*.graph >graph-files &&
+		test_line_count = 3 graph-files
+	) &&
+	git clone --no-hardlinks . max-commits &&
+	(
+		cd max-commits &&
+		git config core.commitGraph true &&
+		test_line_count = 2 $graphdir/commit-graph-chain &&
+		test_commit 16 &&
+		test_commit 17 &&
+		git commit-graph write --reachable --split --max-commits=1 &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		ls $graphdir/graph-*.graph >graph-files &&
+		test_line_count = 1 graph-files
+	)
+'
+
+test_expect_success 'changed-path filters in some layers only' '
+	git clone . bloom &&
+	(
+		cd bloom &&
+		git config core.commitGraph true &&
+		test_commit 18 &&
+		git commit-graph write --reachable --split &&
+		test_commit 19 &&
+		git commit-graph write --reachable --split --changed-paths &&
+		test_line_count = 3 $graphdir/commit-graph-chain &&
+		git commit-graph read >output &&
+		grep bloom_data output &&
+		for path in 19.t 18.t 6.t
+		do
+			git -c core.commitGraph=true log --oneline -- $path >actual &&
+			git -c core.commitGraph=false log --oneline -- $path >expect &&
+			test_cmp expect actual || return 1
+		done
+	)
+'
+
+test_expect_success 'layers without generation data' '
+	git clone . gen-v1 &&
+	(
+		cd gen-v1 &&
+		git config core.commitGraph true &&
+		test_commit 21 &&
+		git -c commitGraph.generationVersion=1 commit-graph write --reachable --split &&
+		git commit-graph read >output &&
+		! grep generation_data output &&
+		git commit-graph verify &&
+		test_commit 22 &&
+		git commit-graph write --reachable --split &&
+		git commit-graph read >output &&
+		! grep generation_data output &&
+		git commit-graph verify &&
+		git -c core.commitGraph=true  log --topo-order --oneline >expect &&
+		git -c core.commitGraph=false log --topo-order --oneline >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'writing a full graph removes the chain' '
+	git clone . full &&
+	(
+		cd full &&
+		git config core.commitGraph true &&
+		git commit-graph write --reachable &&
+		test_path_is_file $infodir/commit-graph &&
+		test_path_is_missing $graphdir/commit-graph-chain &&
+		test_path_is_missing $graphdir/graph-*.graph &&
+		git commit-graph verify
+	)
+'
+
+test_expect_success 'fetch.writeCommitGraph adds a layer' '
+	git clone . fetch-graph &&
+	test_commit 20 &&
+	(
+		cd fetch-graph &&
+		git config core.commitGraph true &&
+		git config fetch.writeCommitGraph true &&
+		git fetch origin &&
+		test_path_is_file $graphdir/commit-graph-chain &&
+		git -c core.commitGraph=true  rev-list origin/master >expect &&
+		git -c core.commitGraph=false rev-list origin/master >actual &&
+		test_cmp expect actual &&
+		git commit-graph verify
+	)
+'
+
+test_done
@@ -0,0 +1,193 @@
+#!/bin/sh
+
+test_description='on-disk reverse index'
+. ./test-lib.sh
+
+# The below tests want control over the 'pack.writeReverseIndex' setting
+# themselves to assert various combinations of it with other options.
+sane_unset GIT_TEST_WRITE_REV_INDEX
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	test_commit base &&
+
+	pack=$(git pack-objects --all $packdir/pack) &&
+	rev=$packdir/pack-$pack.rev &&
+
+	test_path_is_missing $rev
+'
+
+test_index_pack () {
+	rm -f $rev &&
+	conf=$1 &&
+	shift &&
+	# remove the index since Windows won't overwrite an existing file
+	rm $packdir/pack-$pack.idx &&
+	git -c pack.writeReverseIndex=$conf index-pack "$@" \
+		$packdir/pack-$pack.pack
+}
+
+test_expect_success 'index-pack with pack.writeReverseIndex' '
+	test_index_pack "" &&
+	test_path_is_missing $rev &&
+
+	test_index_pack false &&
+	test_path_is_missing $rev &&
+
+	test_index_pack true &&
+	test_path_is_file $rev
+'
+
+test_expect_success 'index-pack with --[no-]rev-index' '
+	for conf in "" true false
+	do
+		test_index_pack "$conf" --rev-index &&
+		test_path_exists $rev &&
+
+		test_index_pack "$conf" --no-rev-index &&
+		test_path_is_missing $rev || return 1
+	done
+'
+
+test_expect_success 'index-pack can verify reverse indexes' '
+	test_when_finished "rm -f $rev" &&
+	test_index_pack true &&
+
+	test_path_is_file $rev &&
+	git index-pack --rev-index --verify $packdir/pack-$pack.pack &&
+
+	# Intentionally corrupt the reverse index.
+	chmod u+w $rev &&
+	printf "xxxx" | dd of=$rev bs=1 count=4 conv=notrunc &&
+
+	test_must_fail git index-pack --rev-index --verify \
+		$packdir/pack-$pack.pack 2>err &&
+	grep "validation error" err
+'
+
+test_expect_success 'index-pack infers reverse index name with -o' '
+	git index-pack --rev-index -o other.idx $packdir/pack-$pack.pack &&
+	test_path_is_file other.idx &&
+	test_path_is_file $packdir/pack-$pack.rev
+'
+
+test_expect_success 'pack-objects respects pack.writeReverseIndex' '
+	test_when_finished "rm -fr pack-1-*" &&
+
+	git -c pack.writeReverseIndex= pack-objects --all pack-1 &&
+	test_path_is_missing pack-1-*.rev &&
+
+	git -c pack.writeReverseIndex=false pack-objects --all pack-1 &&
+	test_path_is_missing pack-1-*.rev &&
+
+	git -c pack.writeReverseIndex=true pack-objects --all pack-1 &&
+	test_path_is_file pack-1-*.rev
+'
+
+test_expect_success 'reverse index is not generated when available on disk' '
+	test_index_pack true &&
+	test_path_is_file $rev &&
+
+	git rev-parse HEAD >tip &&
+	GIT_TEST_REV_INDEX_DIE_IN_MEMORY=1 git cat-file \
+		--batch-check="%(objectsize:disk)" <tip
+'
+
+test_expect_success 'the reverse index is generated in memory without a .rev' '
+	rm -f $rev &&
+	git rev-parse HEAD >tip &&
+	test_must_fail env GIT_TEST_REV_INDEX_DIE_IN_MEMORY=1 git cat-file \
+		--batch-check="%(objectsize:disk)" <tip
+'
+
+test_expect_success 'revindex in-memory vs on-disk' '
+	git init repo &&
+	test_when_finished "rm -fr repo" &&
+	(
+		cd repo &&
+
+		test_commit commit &&
+
+		git rev-list --objects --all | cut -d" " -f1 >objects &&
+
+		git -c pack.writeReverseIndex=false repack -ad &&
+		test_path_is_missing $packdir/pack-*.rev &&
+		git cat-file --batch-check="%(objectsize:disk) %(objectname)" \
+			<objects >in-core &&
+
+		git -c pack.writeReverseIndex=true repack -ad &&
+		test_path_is_file $packdir/pack-*.rev &&
+		git cat-file --batch-check="%(objectsize:disk) %(objectname)" \
+			<objects >on-disk &&
+
+		test_cmp on-disk in-core
+	)
+'
+
+test_expect_success 'a stale reverse index is ignored' '
+	git init stale &&
+	test_when_finished "rm -fr stale" &&
+	(
+		cd stale &&
+		test_commit one &&
+		git -c pack.writeReverseIndex=true repack -ad &&
+		cp $packdir/pack-*.rev ../one.rev &&
+		test_commit two &&
+		git -c pack.writeReverseIndex=true repack -ad &&
+		rev=$(ls $packdir/pack-*.rev) &&
+		chmod u+w $rev &&
+		cp ../one.rev $rev &&
+
+		git rev-list --objects --all | cut -d" " -f1 >objects &&
+		git cat-file --batch-check="%(objectsize:disk) %(objectname)" \
+			<objects >actual 2>err &&
+		test_i18ngrep "reverse-index file .* has the wrong size" err &&
+		rm $rev &&
+		git cat-file --batch-check="%(objectsize:disk) %(objectname)" \
+			<objects >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'bitmaps can be used with an on-disk reverse index' '
+	git init bitmap &&
+	test_when_finished "rm -fr bitmap" &&
+	(
+		cd bitmap &&
+		for i in $(test_seq 1 5)
+		do
+			test_commit $i || return 1
+		done &&
+		git -c pack.writeReverseIndex=true repack -adb &&
+		test_path_is_file $packdir/pack-*.rev &&
+
+		git rev-list --count HEAD >expect &&
+		GIT_TEST_REV_INDEX_DIE_IN_MEMORY=1 \
+			git rev-list --use-bitmap-index --count HEAD >actual &&
+		test_cmp expect actual &&
+		GIT_TEST_REV_INDEX_DIE_IN_MEMORY=1 \
+			git rev-list --test-bitmap HEAD
+	)
+'
+
+test_expect_success 'repack -d removes the reverse index of deleted packs' '
+	git init gone &&
+	test_when_finished "rm -fr gone" &&
+	(
+		cd gone &&
+		test_commit one &&
+		git -c pack.writeReverseIndex=true repack -d &&
+		test_commit two &&
+		git -c pack.writeReverseIndex=true repack -d &&
+		ls $packdir/pack-*.rev >revs &&
+		test_line_count = 2 revs &&
+		git -c pack.writeReverseIndex=true repack -ad &&
+		ls $packdir/pack-*.rev >revs &&
+		test_line_count = 1 revs &&
+		git count-objects -v >output &&
+		grep "^garbage: 0" output
+	)
+'
+
+test_done
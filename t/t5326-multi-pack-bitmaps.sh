@@ -0,0 +1,292 @@
+#!/bin/sh
+
+test_description='exercise reachability bitmaps of the multi-pack-index'
+. ./test-lib.sh
+
+midx_bitmaps () {
+	ls .git/objects/pack/ | sed -n "/^multi-pack-index-.*\.bitmap$/p"
+}
+
+test_expect_success 'setup repo with history spread over several packs' '
+	git config core.multiPackIndex true &&
+	for i in $(test_seq 1 5)
+	do
+		test_commit $i || return 1
+	done &&
+	git repack -d &&
+	git checkout -b other HEAD~2 &&
+	for i in $(test_seq 1 5)
+	do
+		test_commit side-$i || return 1
+	done &&
+	git repack -d &&
+	git checkout master &&
+	git merge other &&
+	for i in $(test_seq 6 10)
+	do
+		test_commit $i || return 1
+	done &&
+	git repack -d &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 3 packs
+'
+
+test_expect_success 'write a multi-pack-index with a bitmap' '
+	git multi-pack-index write --bitmap &&
+	test_path_is_file .git/objects/pack/multi-pack-index &&
+	midx_bitmaps >bitmaps &&
+	test_line_count = 1 bitmaps
+'
+
+test_expect_success 'rev-list --test-bitmap uses the multi-pack bitmap' '
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "^Bitmap v1 test" err &&
+	grep "^OK!" err
+'
+
+rev_list_tests () {
+	state=$1
+
+	test_expect_success "counting commits via bitmap ($state)" '
+		git rev-list --count HEAD >expect &&
+		git rev-list --use-bitmap-index --count HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting partial commits via bitmap ($state)" '
+		git rev-list --count HEAD~5..HEAD >expect &&
+		git rev-list --use-bitmap-index --count HEAD~5..HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting non-linear history ($state)" '
+		git rev-list --count other...master >expect &&
+		git rev-list --use-bitmap-index --count other...master >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "enumerate --objects ($state)" '
+		git rev-list --objects --all >full &&
+		cut -d" " -f1 full | sort >expect &&
+		git rev-list --use-bitmap-index --objects --all >actual.raw &&
+		cut -d" " -f1 actual.raw | sort >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "enumerate partial --objects ($state)" '
+		git rev-list --objects HEAD~3..HEAD >full &&
+		cut -d" " -f1 full | sort >expect &&
+		git rev-list --use-bitmap-index --objects HEAD~3..HEAD >actual.raw &&
+		cut -d" " -f1 actual.raw | sort >actual &&
+		test_cmp expect actual
+	'
+}
+
+rev_list_tests 'multi-pack bitmap'
+
+test_expect_success 'count-objects does not report the bitmap as garbage' '
+	git count-objects -v >output &&
+	grep "^garbage: 0" output
+'
+
+test_expect_success 'pack-objects from the multi-pack bitmap' '
+	git pack-objects --stdout --revs --use-bitmap-index <<-EOF >full.pack &&
+	HEAD
+	EOF
+	git index-pack --strict full.pack &&
+	git show-index <full.idx >objects &&
+	cut -d" " -f2 objects | sort >actual &&
+	git rev-list --objects HEAD >full &&
+	cut -d" " -f1 full | sort >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'incremental pack-objects from the multi-pack bitmap' '
+	git pack-objects --stdout --revs --use-bitmap-index <<-EOF >incr.pack &&
+	HEAD
+	^HEAD~3
+	EOF
+	git index-pack incr.pack &&
+	git show-index <incr.idx >objects &&
+	cut -d" " -f2 objects | sort >actual &&
+	git rev-list --objects HEAD ^HEAD~3 >full &&
+	cut -d" " -f1 full | sort >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone from a repository with a multi-pack bitmap' '
+	git clone --no-local --bare . clone.git &&
+	git -C clone.git rev-parse HEAD >actual &&
+	git rev-parse HEAD >expect &&
+	test_cmp expect actual &&
+	git -C clone.git fsck
+'
+
+test_expect_success 'the bitmap is ignored without core.multiPackIndex' '
+	test_must_fail env GIT_TEST_MULTI_PACK_INDEX=0 \
+		git -c core.multiPackIndex=false rev-list --test-bitmap HEAD 2>err &&
+	test_i18ngrep "failed to load bitmap indexes" err
+'
+
+test_expect_success 'new packs make the bitmap stale' '
+	test_commit 11 &&
+	git repack -d &&
+	git multi-pack-index write &&
+	midx_bitmaps >bitmaps &&
+	test_line_count = 0 bitmaps &&
+	git rev-list --use-bitmap-index --count HEAD >actual &&
+	git rev-list --count HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rewrite the bitmap for the new multi-pack-index' '
+	git multi-pack-index write --bitmap &&
+	midx_bitmaps >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	git rev-list --test-bitmap HEAD
+'
+
+rev_list_tests 'rewritten multi-pack bitmap'
+
+test_expect_success 'pack bitmaps are not used while a multi-pack bitmap exists' '
+	git pack-objects --all --write-bitmap-index .git/objects/pack/pack </dev/null &&
+	git multi-pack-index write --bitmap &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	test_i18ngrep ! "ignoring extra bitmap file" err &&
+	grep "^OK!" err
+'
+
+test_expect_success 'commits missing from the multi-pack-index get no bitmap' '
+	test_commit loose &&
+	rm -f .git/objects/pack/multi-pack-index* &&
+	git multi-pack-index write --bitmap 2>err &&
+	test_i18ngrep "1 reachable commit is not fully in the multi-pack-index" err &&
+	midx_bitmaps >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	git rev-list --test-bitmap HEAD^ 2>err &&
+	grep "^OK!" err &&
+	git rev-list --use-bitmap-index --count HEAD >actual &&
+	git rev-list --count HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clearing the multi-pack-index removes its bitmap' '
+	git repack -d &&
+	git multi-pack-index write --bitmap &&
+	midx_bitmaps >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	git repack -ad &&
+	test_path_is_missing .git/objects/pack/$(cat bitmaps)
+'
+
+test_expect_success '--object-dir uses the refs of the repository owning it' '
+	git init owner &&
+	test_when_finished "rm -fr owner" &&
+	test_commit -C owner one &&
+	test_commit -C owner two &&
+	git -C owner repack -d &&
+	git multi-pack-index --object-dir=owner/.git/objects write --bitmap &&
+	ls owner/.git/objects/pack/multi-pack-index-*.bitmap &&
+	git -C owner -c core.multiPackIndex=true rev-list --test-bitmap two 2>err &&
+	grep "^OK!" err
+'
+
+# Send the objects named by the revisions on stdin with pack-objects,
+# index the result in the repository $1, and check that it holds all
+# of the objects named.
+send_pack () {
+	git rev-list --objects --stdin <revs | sort >expect-objects &&
+	git pack-objects --stdout --revs --delta-base-offset --progress \
+		<revs >sent.pack 2>err &&
+	git init $1 &&
+	git -C $1 index-pack --stdin <sent.pack &&
+	idx=$(ls $1/.git/objects/pack/pack-*.idx) &&
+	git show-index <$idx | cut -d" " -f2 | sort >actual-objects &&
+	cut -d" " -f1 expect-objects | sort >expect &&
+	test_cmp expect actual-objects
+}
+
+test_expect_success 'setup multi-pack reuse' '
+	git init reuse &&
+	(
+		cd reuse &&
+		git config core.multiPackIndex true &&
+		test_seq 1000 >file &&
+		test_seq 500 >other &&
+		for i in $(test_seq 1 12)
+		do
+			sed "s/^$i$/changed-$i/" <file >tmp &&
+			mv tmp file &&
+			echo "$i" >>other &&
+			git add file other &&
+			test_commit $i &&
+			if test $(($i % 4)) = 0
+			then
+				git repack -d -q
+			fi || return 1
+		done &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 3 packs &&
+		git multi-pack-index write --bitmap
+	)
+'
+
+test_expect_success 'all objects of all packs are reused verbatim' '
+	(
+		cd reuse &&
+		echo HEAD >revs &&
+		send_pack full &&
+		grep "pack-reused $(wc -l <expect)" err &&
+		git -C full fsck
+	)
+'
+
+# Print the first of two delta objects of the pack $1 that have the
+# same base. Leaving it out puts a gap between the base and the second
+# delta.
+first_sibling_delta () {
+	git verify-pack -v $1 |
+	awk 'NF == 7 { print $5, $1, $7 }' | sort -n |
+	awk 'seen[$3]++ { print first[$3]; exit } { first[$3] = $2 }'
+}
+
+test_expect_success 'partial reuse fixes up delta offsets' '
+	(
+		cd reuse &&
+		for idx in .git/objects/pack/pack-*.idx
+		do
+			first_sibling_delta $idx || return 1
+		done >skip &&
+		test_line_count -gt 0 skip &&
+		{
+			echo HEAD &&
+			sed "s/^/^/" skip
+		} >revs &&
+		send_pack partial &&
+		grep "pack-reused [1-9]" err &&
+
+		printf "HEAD\n^6\n" >revs &&
+		send_pack partial-range &&
+		grep "pack-reused [1-9]" err
+	)
+'
+
+test_expect_success 'objects the midx picked from another pack are not reused twice' '
+	(
+		cd reuse &&
+		git rev-list --objects 6 |
+		git pack-objects .git/objects/pack/pack &&
+		git multi-pack-index write --bitmap &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 4 packs &&
+		echo HEAD >revs &&
+		send_pack dup &&
+		grep "pack-reused [1-9]" err &&
+		git -C dup fsck &&
+
+		printf "HEAD\n^3\n" >revs &&
+		send_pack dup-partial
+	)
+'
+
+test_done
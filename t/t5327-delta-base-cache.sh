@@ -0,0 +1,50 @@
+#!/bin/sh
+
+test_description='the delta base cache and its limit'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_seq 1 20000 >big &&
+	for i in $(test_seq 1 100)
+	do
+		test_seq 1 400 | sed "s/^/$i /" >small-$i || return 1
+	done &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	echo more >>big &&
+	for i in $(test_seq 1 100)
+	do
+		echo more >>small-$i || return 1
+	done &&
+	test_tick &&
+	git commit -a -m more &&
+	git repack -adf &&
+
+	# the older version of big is a delta against the newer one
+	big=$(git rev-parse HEAD:big) &&
+	idx=$(ls .git/objects/pack/pack-*.idx) &&
+	git verify-pack -v $idx >verify &&
+	grep " $big\$" verify &&
+
+	git rev-list --objects --all >objects &&
+	grep -v " big\$" objects | cut -d" " -f1 >small-objects &&
+	cut -d" " -f1 objects >all-objects
+'
+
+test_expect_success 'a big base can use more than its share of the cache' '
+	# 16 shards would give each one 64k; big is about 108k
+	test_config core.deltaBaseCacheLimit 1m &&
+	test-tool delta-base-cache $big <all-objects >actual &&
+	grep "^$big cached\$" actual
+'
+
+test_expect_success 'the cache is kept within its limit' '
+	test_config core.deltaBaseCacheLimit 16k &&
+	test-tool delta-base-cache <small-objects >actual &&
+	size=$(sed -n "s/^size //p" actual) &&
+	test "$size" -gt 0 &&
+	test "$size" -le 16384
+'
+
+test_done
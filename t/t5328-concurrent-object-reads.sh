@@ -0,0 +1,99 @@
+#!/bin/sh
+
+test_description='read objects from several threads at once'
+. ./test-lib.sh
+
+test_expect_success 'setup repository with deltas' '
+	for i in $(test_seq 1 20)
+	do
+		test_seq 1 300 | sed "s/^/file $i line /" >file-$i || return 1
+	done &&
+	git add . &&
+	test_tick &&
+	git commit -m base &&
+	for c in $(test_seq 1 20)
+	do
+		for i in $(test_seq 1 20)
+		do
+			echo "commit $c" >>file-$i || return 1
+		done &&
+		test_tick &&
+		git commit -q -a -m "commit $c" || return 1
+	done &&
+	git repack -adf --depth=50 &&
+
+	# and a few loose objects, too
+	echo loose >loose &&
+	git add loose &&
+	test_tick &&
+	git commit -m loose &&
+
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	idx=$(ls .git/objects/pack/pack-*.idx) &&
+	git verify-pack -v $idx >verify &&
+	grep "chain length = " verify
+'
+
+# Small windows, few of them and a tiny delta base cache make the
+# threads map, unmap and evict all the time.
+test_expect_success PTHREADS 'threads read the same objects as a single thread' '
+	test_config core.packedGitWindowSize 8k &&
+	test_config core.packedGitLimit 32k &&
+	test_config core.deltaBaseCacheLimit 4k &&
+	test-tool concurrent-read <objects >expect &&
+	! grep " bad\$" expect &&
+	test_line_count = $(wc -l <objects) expect &&
+	for i in 1 2 3
+	do
+		test-tool concurrent-read --threads=8 <objects >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success PTHREADS 'grep --threads finds the same lines as a single thread' '
+	test_config core.deltaBaseCacheLimit 4k &&
+	git grep --threads=1 -e "line 1[0-9]" HEAD HEAD~5 HEAD~10 >expect &&
+	git grep --threads=8 -e "line 1[0-9]" HEAD HEAD~5 HEAD~10 >actual &&
+	test_cmp expect actual
+'
+
+# Once grep has written its first lines it has prepared the list of
+# packs; moving the loose objects into a new pack only then makes its
+# threads miss the objects they have not read yet, so they have to
+# reprepare the list of packs while others are walking it.
+test_expect_success PTHREADS,PIPE 'grep --threads copes with a concurrent reprepare' '
+	mkfifo grep-out &&
+	for round in $(test_seq 1 3)
+	do
+		mkdir round-$round &&
+		awk -v r=$round "BEGIN {
+			for (i = 1; i <= 1000; i++) {
+				f = \"round-\" r \"/file-\" i;
+				for (l = 1; l <= 200; l++)
+					print \"round \" r \" file \" i \" line \" l >f;
+				close(f);
+			}
+		}" &&
+		git add round-$round &&
+		test_tick &&
+		git commit -q -m "round $round" &&
+		git grep --threads=1 -e "line 7\$" HEAD -- round-$round >expect &&
+		test_line_count = 1000 expect &&
+		mkdir pack-$round &&
+		git rev-list --objects HEAD^..HEAD |
+		git pack-objects -q pack-$round/pack >/dev/null || return 1
+
+		git grep --threads=8 -e "line 7\$" HEAD -- round-$round >grep-out &
+		{
+			read -r line &&
+			echo "$line" >actual &&
+			mv pack-$round/* .git/objects/pack/ &&
+			git prune-packed &&
+			cat >>actual
+		} <grep-out &&
+		wait $! &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_done
@@ -0,0 +1,164 @@
+#!/bin/sh
+
+test_description='cruft packs of unreachable objects'
+
+. ./test-lib.sh
+
+objdir=.git/objects
+packdir=$objdir/pack
+
+# Print the objects of the cruft pack with their mtimes, one
+# "<oid> <mtime>" pair per line.
+cruft_objects () {
+	mtimes=$(ls $packdir/pack-*.mtimes) &&
+	pack=$(basename ${mtimes%.mtimes}.pack) &&
+	test-tool pack-mtimes $pack
+}
+
+loose_path () {
+	echo $objdir/$(echo "$1" | sed "s|..|&/|")
+}
+
+# Write an unreachable blob with content $1 and mtime $2 (a test-tool
+# chmtime argument), and print its object ID.
+unreachable_blob () {
+	oid=$(echo "$1" | git hash-object -w --stdin) &&
+	test-tool chmtime --verbose "=$2" $(loose_path $oid) >/dev/null &&
+	echo $oid
+}
+
+test_expect_success 'setup' '
+	test_commit base &&
+	git checkout -b side &&
+	test_commit side &&
+	git checkout master
+'
+
+test_expect_success 'repack --cruft rejects incompatible options' '
+	test_must_fail git repack --cruft -A 2>err &&
+	test_i18ngrep "incompatible" err &&
+	test_must_fail git repack --cruft 2>err &&
+	test_i18ngrep "requires -d" err &&
+	test_must_fail git repack --cruft-expiration=now -a -d 2>err &&
+	test_i18ngrep "requires --cruft" err &&
+	test_must_fail git pack-objects --cruft --stdout </dev/null 2>err &&
+	test_i18ngrep "cannot be used" err
+'
+
+test_expect_success 'repack --cruft packs unreachable objects with their mtimes' '
+	git repack -a -d &&
+	git branch -D side &&
+	git reflog expire --expire=all --all &&
+	one=$(unreachable_blob one -1000) &&
+	two=$(unreachable_blob two -2000) &&
+	mtime_one=$(test-tool chmtime --get $(loose_path $one)) &&
+	mtime_two=$(test-tool chmtime --get $(loose_path $two)) &&
+
+	git repack --cruft -d &&
+
+	ls $packdir/pack-*.pack >packs &&
+	test_line_count = 2 packs &&
+	ls $packdir/pack-*.mtimes >mtimes &&
+	test_line_count = 1 mtimes &&
+	test_path_is_missing $(loose_path $one) &&
+	test_path_is_missing $(loose_path $two) &&
+	cruft_objects >actual &&
+	grep "^$one $mtime_one\$" actual &&
+	grep "^$two $mtime_two\$" actual &&
+	git cat-file -e $one &&
+	git cat-file -e $two &&
+	git fsck
+'
+
+test_expect_success 'the cruft pack holds only unreachable objects' '
+	git rev-list --objects --all | cut -d" " -f1 | sort >reachable &&
+	cruft_objects | cut -d" " -f1 >cruft &&
+	comm -12 reachable cruft >both &&
+	test_must_be_empty both
+'
+
+test_expect_success 'a second repack --cruft keeps the old mtimes' '
+	cruft_objects >expect &&
+	git repack --cruft -d &&
+	ls $packdir/pack-*.mtimes >mtimes &&
+	test_line_count = 1 mtimes &&
+	cruft_objects >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'writing a cruft object again freshens it loose' '
+	echo one | git hash-object -w --stdin &&
+	test_path_is_file $(loose_path $one)
+'
+
+test_expect_success 'a copy in another pack is freshened instead' '
+	rm -f $(loose_path $one) &&
+	name=$(echo $one | git pack-objects $packdir/pack) &&
+	test_when_finished "rm -f $packdir/pack-$name.*" &&
+	test-tool chmtime =-1000 $packdir/pack-$name.pack &&
+	old=$(test-tool chmtime --get $packdir/pack-$name.pack) &&
+	echo one | git hash-object -w --stdin &&
+	test_path_is_missing $(loose_path $one) &&
+	new=$(test-tool chmtime --get $packdir/pack-$name.pack) &&
+	test $new -gt $old
+'
+
+test_expect_success '--cruft-expiration drops old unreachable objects' '
+	rm -f $(loose_path $one) &&
+	old=$(unreachable_blob old -10000) &&
+	git repack --cruft --cruft-expiration=5000.seconds.ago -d &&
+	cruft_objects | cut -d" " -f1 >actual &&
+	grep $one actual &&
+	! grep $old actual &&
+
+	# expired loose objects are left for prune
+	test_path_is_file $(loose_path $old) &&
+	git prune --expire=5000.seconds.ago &&
+	! git cat-file -e $old &&
+	git cat-file -e $one
+'
+
+test_expect_success 'objects reachable from recent cruft objects are kept' '
+	git init recent &&
+	test_when_finished "rm -fr recent" &&
+	(
+		cd recent &&
+		test_commit base &&
+		blob=$(echo old-blob | git hash-object -w --stdin) &&
+		test-tool chmtime =-10000 $(loose_path $blob) &&
+		tree=$(printf "100644 blob %s\tfile\n" $blob | git mktree) &&
+		git repack --cruft --cruft-expiration=5000.seconds.ago -d &&
+		cruft_objects | cut -d" " -f1 >actual &&
+		grep $blob actual &&
+		grep $tree actual &&
+
+		git prune --expire=5000.seconds.ago &&
+		git cat-file -e $blob &&
+		git cat-file -e $tree &&
+
+		git repack --cruft --cruft-expiration=now -d &&
+		! git cat-file -e $blob &&
+		! git cat-file -e $tree
+	)
+'
+
+test_expect_success 'gc --cruft writes a cruft pack' '
+	git init gc &&
+	test_when_finished "rm -fr gc" &&
+	(
+		cd gc &&
+		test_commit base &&
+		blob=$(unreachable_blob unreachable -100) &&
+		git gc --cruft &&
+		ls $packdir/pack-*.mtimes >mtimes &&
+		test_line_count = 1 mtimes &&
+		test_path_is_missing $(loose_path $blob) &&
+		git cat-file -e $blob &&
+
+		git -c gc.cruftPacks=true gc --prune=now &&
+		! git cat-file -e $blob &&
+		git fsck
+	)
+'
+
+test_done
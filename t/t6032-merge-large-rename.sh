@@ -59,7 +59,8 @@ test_rename() {
 test_rename 5 ok
 
 test_expect_success 'set diff.renamelimit to 4' '
-	git config diff.renamelimit 4
+	git config diff.renamelimit 4 &&
+	git config diff.renameLshBands 0
 '
 test_rename 4 ok
 test_rename 5 fail
@@ -70,6 +71,11 @@ test_expect_success 'set merge.renamelimit to 5' '
 test_rename 5 ok
 test_rename 6 fail
 
+test_expect_success 'look for renames beyond the limit' '
+	git config --unset diff.renameLshBands
+'
+test_rename 6 ok
+
 test_expect_success 'setup large simple rename' '
 	git config --unset merge.renamelimit &&
 	git config --unset diff.renamelimit &&
@@ -0,0 +1,167 @@
+#!/bin/sh
+
+test_description='built-in file system watcher'
+
+. ./test-lib.sh
+
+if ! test_have_prereq FSMONITOR_DAEMON
+then
+	skip_all='built-in fsmonitor not supported on this platform'
+	test_done
+fi
+
+# The tests below decide themselves which monitor to use.
+sane_unset GIT_TEST_FSMONITOR
+
+stop_daemon () {
+	git fsmonitor--daemon stop || :
+}
+
+# Compare the output of "git status" with and without the daemon.
+test_status_matches () {
+	git -c core.fsmonitor=false status --porcelain --untracked-files=all >expect &&
+	git -c core.fsmonitor=true status --porcelain --untracked-files=all >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	mkdir -p dir1/sub dir2 &&
+	for f in tracked modified dir1/tracked dir1/modified dir1/sub/file \
+		 dir2/tracked dir2/modified
+	do
+		echo initial >$f || return 1
+	done &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	git config core.fsmonitor true &&
+	cat >.git/info/exclude <<-\EOF
+	expect
+	actual
+	err
+	EOF
+'
+
+test_expect_success 'status reports a daemon that is not running' '
+	test_must_fail git fsmonitor--daemon status >actual &&
+	test_i18ngrep "not watching" actual &&
+	test_must_fail git fsmonitor--daemon stop
+'
+
+test_expect_success 'start, status and stop the daemon' '
+	test_when_finished stop_daemon &&
+	git fsmonitor--daemon start &&
+	test_path_exists .git/fsmonitor--daemon.ipc &&
+	git fsmonitor--daemon status >actual &&
+	test_i18ngrep "is watching" actual &&
+	test_must_fail git fsmonitor--daemon start 2>err &&
+	test_i18ngrep "already running" err &&
+	git fsmonitor--daemon stop &&
+	test_path_is_missing .git/fsmonitor--daemon.ipc &&
+	test_must_fail git fsmonitor--daemon status
+'
+
+test_expect_success 'status starts the daemon on demand' '
+	test_when_finished stop_daemon &&
+	git status &&
+	git fsmonitor--daemon status
+'
+
+test_expect_success 'core.fsmonitor=false does not start the daemon' '
+	git -c core.fsmonitor=false status &&
+	test_must_fail git fsmonitor--daemon status
+'
+
+test_expect_success PERL 'a stalled client does not block the daemon' '
+	test_when_finished "stop_daemon; rm -f stall.pl" &&
+	cat >stall.pl <<-\EOF &&
+	use IO::Socket::UNIX;
+	my $s = IO::Socket::UNIX->new(Peer => shift) or die "connect: $!";
+	$SIG{ALRM} = sub { die "the daemon is still waiting for us\n" };
+	alarm 30;
+	# send nothing and wait for the daemon to give up on us
+	my $n = sysread($s, my $buf, 1);
+	print defined $n && !$n ? "closed\n" : "unexpected answer\n";
+	EOF
+	git fsmonitor--daemon start &&
+	"$PERL_PATH" stall.pl .git/fsmonitor--daemon.ipc >actual &&
+	echo closed >expect &&
+	test_cmp expect actual &&
+	git fsmonitor--daemon status
+'
+
+test_expect_success 'the daemon reports modified files' '
+	test_when_finished "stop_daemon; git reset --hard" &&
+	git status &&
+	git status &&
+	echo changed >modified &&
+	echo changed >dir1/modified &&
+	test_status_matches &&
+	echo changed again >dir1/sub/file &&
+	test_status_matches
+'
+
+test_expect_success 'the daemon reports new and deleted files' '
+	test_when_finished "stop_daemon; git reset --hard; git clean -fdx" &&
+	git status &&
+	git status &&
+	echo new >new &&
+	echo new >dir2/new &&
+	rm dir1/tracked &&
+	test_status_matches &&
+	rm new &&
+	test_status_matches
+'
+
+test_expect_success 'the daemon reports new and removed directories' '
+	test_when_finished "stop_daemon; git reset --hard; git clean -fdx" &&
+	git status &&
+	git status &&
+	mkdir -p dir3/deep &&
+	echo new >dir3/deep/file &&
+	test_status_matches &&
+	rm -r dir1/sub &&
+	test_status_matches
+'
+
+test_expect_success 'the daemon reports renamed directories' '
+	test_when_finished "stop_daemon; git reset --hard; git clean -fdx" &&
+	git status &&
+	git status &&
+	mv dir1 moved &&
+	test_status_matches &&
+	echo changed >moved/modified &&
+	test_status_matches &&
+	mv moved dir1 &&
+	test_status_matches
+'
+
+test_expect_success 'the daemon reports changes to the index and worktree' '
+	test_when_finished "stop_daemon; git reset --hard; git clean -fdx" &&
+	git status &&
+	echo changed >dir2/modified &&
+	git add dir2/modified &&
+	test_status_matches &&
+	git commit -m changed &&
+	test_status_matches &&
+	git reset --hard HEAD^ &&
+	test_status_matches
+'
+
+test_expect_success 'the daemon reports new commits in a submodule' '
+	test_when_finished "stop_daemon; git reset --hard HEAD^; git clean -fdx" &&
+	git init sm &&
+	test_commit -C sm one &&
+	git add sm &&
+	git commit -m "add submodule" &&
+	git status &&
+	git status &&
+	test_commit -C sm two &&
+	test_status_matches &&
+	git add sm &&
+	git diff --cached --name-only >actual &&
+	echo sm >expect &&
+	test_cmp expect actual
+'
+
+test_done
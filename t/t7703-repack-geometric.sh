@@ -0,0 +1,159 @@
+#!/bin/sh
+
+test_description='git repack --geometric works correctly'
+
+. ./test-lib.sh
+
+GIT_TEST_MULTI_PACK_INDEX=0
+
+objdir=.git/objects
+midx=$objdir/pack/multi-pack-index
+
+# Write a pack of the objects reachable from $1 but not from $2,
+# creating commits as needed so that the pack holds about $3 objects.
+make_pack () {
+	for i in $(test_seq $3)
+	do
+		test_commit "$1-$i" >/dev/null || return 1
+	done &&
+	git rev-list --objects "$1-$3" ${2:+"^$2"} |
+	git pack-objects $objdir/pack/pack >/dev/null &&
+	git prune-packed
+}
+
+test_expect_success '--geometric with no packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		git repack --geometric 2 >out &&
+		test_i18ngrep "Nothing new to pack" out
+	)
+'
+
+test_expect_success '--geometric rejects bad arguments' '
+	test_must_fail git repack --geometric=1 2>err &&
+	test_i18ngrep "must be at least 2" err &&
+	test_must_fail git repack -a --geometric=2 2>err &&
+	test_i18ngrep "incompatible" err
+'
+
+test_expect_success '--geometric with an intact progression' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack one "" 1 &&
+		make_pack two one-1 2 &&
+		make_pack three two-2 6 &&
+		ls $objdir/pack/*.pack | sort >before &&
+		git repack --geometric 2 -d &&
+		ls $objdir/pack/*.pack | sort >after &&
+		test_cmp before after &&
+		test_path_is_file $midx
+	)
+'
+
+test_expect_success '--geometric with a broken progression rolls up the small packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack big "" 30 &&
+		big=$(ls $objdir/pack/*.pack) &&
+		make_pack small-a big-30 1 &&
+		make_pack small-b small-a-1 1 &&
+		make_pack small-c small-b-1 1 &&
+		test_commit loose &&
+		git rev-list --objects --all | sort >expect &&
+
+		git repack --geometric 2 -d &&
+
+		ls $objdir/pack/*.pack >packs &&
+		test_line_count = 2 packs &&
+		grep "$big" packs &&
+		test_path_is_missing $objdir/$(git rev-parse loose | sed "s|..|&/|") &&
+		git rev-list --objects --all | sort >actual &&
+		test_cmp expect actual &&
+		git fsck &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success '--geometric rolls up a pack that the combined pack outgrows' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack big "" 20 &&
+		big=$(ls $objdir/pack/*.pack) &&
+		make_pack medium big-20 4 &&
+		make_pack small-a medium-4 2 &&
+		make_pack small-b small-a-2 2 &&
+
+		# small-b breaks the progression; small-a and small-b
+		# make 12 objects, too many to sit below medium with
+		# its 12, so medium is rolled up, too.
+		git repack --geometric 2 -d &&
+
+		ls $objdir/pack/*.pack >packs &&
+		test_line_count = 2 packs &&
+		grep "$big" packs &&
+		git fsck
+	)
+'
+
+test_expect_success '--geometric leaves kept packs alone' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack one "" 1 &&
+		kept=$(ls $objdir/pack/*.pack) &&
+		touch ${kept%.pack}.keep &&
+		make_pack two one-1 1 &&
+		make_pack three two-1 1 &&
+
+		git repack --geometric 2 -d &&
+
+		ls $objdir/pack/*.pack >packs &&
+		test_line_count = 2 packs &&
+		grep "$kept" packs
+	)
+'
+
+test_expect_success '--geometric without -d keeps the rolled up packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack one "" 1 &&
+		make_pack two one-1 1 &&
+
+		git repack --geometric 2 &&
+
+		ls $objdir/pack/*.pack >packs &&
+		test_line_count = 3 packs &&
+		git multi-pack-index verify
+	)
+'
+
+test_expect_success '--geometric with -b writes a multi-pack bitmap' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack one "" 8 &&
+		make_pack two one-8 1 &&
+		make_pack three two-1 1 &&
+
+		git repack --geometric 2 -d -b &&
+
+		ls $objdir/pack/multi-pack-index-*.bitmap &&
+		git rev-list --count --all --use-bitmap-index >actual &&
+		git rev-list --count --all >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_done
@@ -931,6 +931,18 @@ do
 	"
 done
 
+for opt in HEAD "HEAD HEAD~1" --cached
+do
+	test_expect_success "grep --threads=8 $opt matches serial grep" "
+		git grep --threads=1 -n -e o $opt >expect &&
+		git grep --threads=8 -n -e o $opt >actual &&
+		test_cmp expect actual &&
+		git grep --threads=1 -l -e o $opt >expect &&
+		git grep --threads=8 -l -e o $opt >actual &&
+		test_cmp expect actual
+	"
+done
+
 test_expect_success !PTHREADS,C_LOCALE_OUTPUT 'grep --threads=N or pack.threads=N warns when no pthreads' '
 	git grep --threads=2 Hello hello_world 2>err &&
 	grep ^warning: err >warnings &&
@@ -0,0 +1,135 @@
+#!/bin/sh
+
+test_description='git grep with a trigram index'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir dir other &&
+	printf "hello world\nanother line\n" >hello &&
+	printf "int main(void)\n{\n\treturn 0;\n}\n" >dir/main.c &&
+	printf "Mixed CASE text\nfoo+bar (baz)\n" >dir/case &&
+	printf "caf\303\251 cr\303\250me\n" >other/utf8 &&
+	printf "a\000binary\000zzzfile\n" >other/binary &&
+	: >other/empty &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	echo "a new line" >>hello &&
+	printf "xyzzy\n" >other/new &&
+	git add . &&
+	test_tick &&
+	git commit -m second
+'
+
+eacute=$(printf "\303\251")
+Eacute=$(printf "\303\211")
+
+# Compare the output and exit code of "git grep" with and without the
+# index, single- and multi-threaded.
+check_grep () {
+	mv .git/objects/info/grep-index saved-index &&
+	{ git grep "$@" HEAD HEAD~1 >expect; status=$?; } &&
+	mv saved-index .git/objects/info/grep-index &&
+	test_expect_code $status git grep --threads=1 "$@" HEAD HEAD~1 >actual.1 &&
+	test_expect_code $status git grep "$@" HEAD HEAD~1 >actual &&
+	test_cmp expect actual.1 &&
+	test_cmp expect actual
+}
+
+test_expect_success 'searching without an index' '
+	test_path_is_missing .git/objects/info/grep-index &&
+	git grep -l world HEAD >actual &&
+	echo HEAD:hello >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'build the index for HEAD~1' '
+	git grep --build-index HEAD~1 &&
+	test_path_is_file .git/objects/info/grep-index
+'
+
+for args in \
+	world "-F world" "-n -e return" "-i mixed" "-i -F CASE" \
+	"-E 'foo\+bar'" "-F 'foo+bar'" "-E '(baz|none)'" "-E 'wor?ld'" \
+	"'hel*o'" "'foo\(bar\)*'" "-E 'w[aeiou]rld'" "'a\{1,2\}nother'" \
+	"-c o" "-w line" "-e zzz --or -e xyzzy" "-e another --and -e line" \
+	"--not -e world" "-v world" "-L world" "-P 'wor.d'" "-a zzzfile" \
+	"'caf$eacute'" "-i 'CAF$Eacute'" "-E 'caf$eacute+'" \
+	"'nothing.matches'" "-l new"
+do
+	test_expect_success "grep $args with a partial index" "
+		check_grep $args
+	"
+done
+
+test_expect_success 'index the new commit incrementally' '
+	cp .git/objects/info/grep-index old-index &&
+	git grep --build-index &&
+	! test_cmp_bin old-index .git/objects/info/grep-index
+'
+
+test_expect_success 'rebuilding an up-to-date index changes nothing' '
+	cp .git/objects/info/grep-index old-index &&
+	git grep --build-index HEAD HEAD~1 &&
+	test_cmp_bin old-index .git/objects/info/grep-index
+'
+
+for args in world "-F xyzzy" "-i MIXED" "-E '(baz|none)'" "-c line" "-L world"
+do
+	test_expect_success "grep $args with a full index" "
+		check_grep $args
+	"
+done
+
+test_expect_success 'grep --cached with the index' '
+	git grep --cached -n line >actual &&
+	mv .git/objects/info/grep-index saved-index &&
+	git grep --cached -n line >expect &&
+	mv saved-index .git/objects/info/grep-index &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the index lets grep skip blobs' '
+	git repack -adq &&
+	test_must_fail env GIT_TRACE_PACK_ACCESS="$(pwd)/trace.indexed" \
+		git grep -e nonexistent HEAD &&
+	mv .git/objects/info/grep-index saved-index &&
+	test_must_fail env GIT_TRACE_PACK_ACCESS="$(pwd)/trace.plain" \
+		git grep -e nonexistent HEAD &&
+	mv saved-index .git/objects/info/grep-index &&
+	test_line_count -lt $(wc -l <trace.plain) trace.indexed
+'
+
+test_expect_success 'a corrupt index is ignored' '
+	echo garbage >.git/objects/info/grep-index &&
+	git grep -l world HEAD >actual 2>err &&
+	echo HEAD:hello >expect &&
+	test_cmp expect actual &&
+	test_i18ngrep "grep index" err
+'
+
+test_expect_success '--build-index replaces a corrupt index' '
+	git grep --build-index 2>err &&
+	test_i18ngrep "grep index" err &&
+	git grep -l world HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'an index with a bad checksum is ignored' '
+	test_oid_init &&
+	git grep --build-index &&
+	size=$(wc -c <.git/objects/info/grep-index) &&
+	printf "\377" |
+	dd of=.git/objects/info/grep-index bs=1 conv=notrunc \
+		seek=$(($size - $(test_oid rawsz) - 1)) &&
+	git grep -l world HEAD >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep "bad checksum" err
+'
+
+test_expect_success '--build-index rejects non-trees' '
+	test_must_fail git grep --build-index $(git rev-parse HEAD:hello)
+'
+
+test_done
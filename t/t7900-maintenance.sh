@@ -0,0 +1,369 @@
+#!/bin/sh
+
+test_description='git maintenance builtin'
+
+. ./test-lib.sh
+
+GIT_TEST_COMMIT_GRAPH=0
+GIT_TEST_MULTI_PACK_INDEX=0
+
+# Run "$@" with GIT_TRACE and keep the child commands it started in
+# "run-commands".
+trace_run_commands () {
+	rm -f "$TRASH_DIRECTORY/trace" &&
+	GIT_TRACE="$TRASH_DIRECTORY/trace" "$@" &&
+	sed -n "s/.*run_command: //p" "$TRASH_DIRECTORY/trace" >run-commands
+}
+
+test_expect_success 'help text' '
+	test_expect_code 129 git maintenance -h 2>err &&
+	test_i18ngrep "usage: git maintenance <subcommand>" err &&
+	test_expect_code 128 git maintenance barf 2>err &&
+	test_i18ngrep "invalid subcommand: barf" err
+'
+
+test_expect_success 'run [--auto|--quiet]' '
+	trace_run_commands git maintenance run 2>/dev/null &&
+	grep "^git gc --quiet$" run-commands &&
+	trace_run_commands git maintenance run --auto 2>/dev/null &&
+	! grep "git gc" run-commands &&
+	test_commit pack-one &&
+	git repack -d -q &&
+	test_commit pack-two &&
+	git repack -d -q &&
+	trace_run_commands git -c gc.autoPackLimit=1 -c gc.autoDetach=false \
+		maintenance run --auto --quiet &&
+	grep "^git gc --auto --quiet$" run-commands
+'
+
+test_expect_success 'commands run auto maintenance unless disabled' '
+	trace_run_commands git commit --quiet --allow-empty -m auto &&
+	grep "^git maintenance run --auto --quiet$" run-commands &&
+	trace_run_commands git -c maintenance.auto=false \
+		commit --quiet --allow-empty -m no-auto &&
+	! grep "maintenance" run-commands
+'
+
+test_expect_success 'maintenance.<task>.enabled' '
+	git config maintenance.gc.enabled false &&
+	git config maintenance.commit-graph.enabled true &&
+	trace_run_commands git maintenance run 2>err &&
+	! grep "git gc" run-commands &&
+	grep "^git commit-graph write --split --reachable$" run-commands &&
+	test_path_is_file .git/objects/info/commit-graphs/commit-graph-chain &&
+	git config --unset maintenance.gc.enabled &&
+	git config --unset maintenance.commit-graph.enabled
+'
+
+test_expect_success 'run --task=<task>' '
+	trace_run_commands git maintenance run --task=commit-graph 2>/dev/null &&
+	! grep "git gc" run-commands &&
+	grep "git commit-graph write" run-commands &&
+	trace_run_commands git maintenance run --task=commit-graph --task=gc 2>/dev/null &&
+	grep -e "git gc" -e "git commit-graph" run-commands >both &&
+	grep -n "git commit-graph" both | grep "^1:" &&
+	grep -n "git gc" both | grep "^2:"
+'
+
+test_expect_success 'run --task=bogus' '
+	test_must_fail git maintenance run --task=bogus 2>err &&
+	test_i18ngrep "is not a valid task" err
+'
+
+test_expect_success 'run --task duplicate' '
+	test_must_fail git maintenance run --task=gc --task=gc 2>err &&
+	test_i18ngrep "cannot be selected multiple times" err
+'
+
+test_expect_success 'commit-graph auto condition' '
+	COMMAND="maintenance run --task=commit-graph --auto --quiet" &&
+	git config core.commitGraph true &&
+	git commit-graph write --reachable &&
+
+	trace_run_commands git -c maintenance.commit-graph.auto=1 $COMMAND &&
+	! grep "commit-graph write" run-commands &&
+	trace_run_commands git -c maintenance.commit-graph.auto=0 $COMMAND &&
+	! grep "commit-graph write" run-commands &&
+	test_commit first &&
+	trace_run_commands git -c maintenance.commit-graph.auto=2 $COMMAND &&
+	! grep "commit-graph write" run-commands &&
+	trace_run_commands git -c maintenance.commit-graph.auto=1 $COMMAND &&
+	grep "commit-graph write" run-commands &&
+	trace_run_commands git -c maintenance.commit-graph.auto=-1 $COMMAND &&
+	grep "commit-graph write" run-commands
+'
+
+test_expect_success 'prefetch multiple remotes' '
+	git clone . clone1 &&
+	git clone . clone2 &&
+	git remote add remote1 "file://$(pwd)/clone1" &&
+	git remote add remote2 "file://$(pwd)/clone2" &&
+	git -C clone1 checkout -b one &&
+	git -C clone2 checkout -b two &&
+	test_commit -C clone1 one &&
+	test_commit -C clone2 two &&
+	rm -f .git/FETCH_HEAD &&
+	git maintenance run --task=prefetch 2>/dev/null &&
+	test_path_is_missing .git/FETCH_HEAD &&
+	git rev-parse --verify -q refs/prefetch/remote1/one &&
+	git rev-parse --verify -q refs/prefetch/remote2/two &&
+	test_must_fail git rev-parse --verify -q refs/remotes/remote1/one &&
+	git for-each-ref --format="%(refname)" refs/tags >tags &&
+	! grep -e "/one$" -e "/two$" tags &&
+	git log prefetch/remote1/one &&
+	git log prefetch/remote2/two
+'
+
+test_expect_success 'loose-objects task' '
+	# Repack everything so we know the state of the object dir
+	git repack -adk &&
+
+	# Hack to stop maintenance from running during "git commit"
+	echo in use >.git/objects/maintenance.lock &&
+
+	# Assuming that "git commit" creates at least one loose object
+	test_commit create-loose-object &&
+	rm .git/objects/maintenance.lock &&
+
+	ls .git/objects >obj-dir-before &&
+	test -s obj-dir-before &&
+	ls .git/objects/pack/*.pack >packs-before &&
+	test_line_count = 1 packs-before &&
+
+	# The first run creates a pack-file
+	# but does not delete loose objects.
+	git maintenance run --task=loose-objects &&
+	ls .git/objects >obj-dir-between &&
+	test_cmp obj-dir-before obj-dir-between &&
+	ls .git/objects/pack/*.pack >packs-between &&
+	test_line_count = 2 packs-between &&
+	ls .git/objects/pack/loose-*.pack >loose-packs &&
+	test_line_count = 1 loose-packs &&
+
+	# The second run deletes loose objects
+	# but does not create a pack-file.
+	git maintenance run --task=loose-objects &&
+	ls .git/objects >obj-dir-after &&
+	cat >expect <<-\EOF &&
+	info
+	pack
+	EOF
+	test_cmp expect obj-dir-after &&
+	ls .git/objects/pack/*.pack >packs-after &&
+	test_cmp packs-between packs-after
+'
+
+test_expect_success 'loose-objects auto condition' '
+	COMMAND="maintenance run --task=loose-objects --auto --quiet" &&
+
+	trace_run_commands git -c maintenance.loose-objects.auto=1 $COMMAND &&
+	! grep "prune-packed" run-commands &&
+	printf data-A | git hash-object -t blob --stdin -w &&
+	trace_run_commands git -c maintenance.loose-objects.auto=2 $COMMAND &&
+	! grep "prune-packed" run-commands &&
+	trace_run_commands git -c maintenance.loose-objects.auto=0 $COMMAND &&
+	! grep "prune-packed" run-commands &&
+	printf data-B | git hash-object -t blob --stdin -w &&
+	trace_run_commands git -c maintenance.loose-objects.auto=2 $COMMAND &&
+	grep "prune-packed" run-commands &&
+	grep "pack-objects --quiet" run-commands
+'
+
+test_expect_success 'incremental-repack task' '
+	git init repack &&
+	test_when_finished "rm -fr repack" &&
+	(
+		cd repack &&
+		git maintenance run --task=incremental-repack 2>err &&
+		test_i18ngrep "core.multiPackIndex is disabled" err &&
+		git config core.multiPackIndex true &&
+
+		for i in 1 2 3 4
+		do
+			test_commit $i &&
+			git repack -d -q || return 1
+		done &&
+		ls .git/objects/pack/*.pack >packs-before &&
+		test_line_count = 4 packs-before &&
+
+		trace_run_commands git -c maintenance.incremental-repack.auto=5 \
+			maintenance run --task=incremental-repack --auto &&
+		! grep "git multi-pack-index" run-commands &&
+
+		# the first run rolls the packs up, but cannot expire them
+		# before the multi-pack-index points at the new pack
+		trace_run_commands git -c maintenance.incremental-repack.auto=4 \
+			maintenance run --task=incremental-repack --auto &&
+		cat >expect <<-\EOF &&
+		git multi-pack-index write
+		git multi-pack-index expire
+		EOF
+		grep "git multi-pack-index" run-commands >actual &&
+		head -n 2 actual >actual-head &&
+		test_cmp expect actual-head &&
+		grep "^git multi-pack-index repack --batch-size=[1-9][0-9]*$" actual &&
+		ls .git/objects/pack/*.pack >packs-after &&
+		test_line_count = 5 packs-after &&
+		git multi-pack-index verify &&
+
+		# the next run expires the packs that were rolled up
+		git maintenance run --task=incremental-repack &&
+		ls .git/objects/pack/*.pack >packs-after &&
+		comm -23 packs-before packs-after >expired &&
+		test_line_count -ge 2 expired &&
+		git multi-pack-index verify &&
+		git fsck &&
+
+		# all packs are now in the multi-pack-index
+		trace_run_commands git -c maintenance.incremental-repack.auto=1 \
+			maintenance run --task=incremental-repack --auto &&
+		! grep "git multi-pack-index" run-commands
+	)
+'
+
+test_expect_success 'pack-refs task' '
+	git update-ref refs/heads/loose HEAD &&
+	test_path_is_file .git/refs/heads/loose &&
+	git maintenance run --task=pack-refs &&
+	test_path_is_missing .git/refs/heads/loose &&
+	git rev-parse --verify loose
+'
+
+test_expect_success 'maintenance is skipped while another one runs' '
+	echo in use >.git/objects/maintenance.lock &&
+	test_when_finished "rm -f .git/objects/maintenance.lock" &&
+	trace_run_commands git maintenance run --no-quiet --task=gc 2>err &&
+	! grep "git gc" run-commands &&
+	test_i18ngrep "skipping maintenance" err &&
+	trace_run_commands git maintenance run --auto 2>err &&
+	test_must_be_empty err
+'
+
+test_expect_success '--auto and --schedule incompatible' '
+	test_must_fail git maintenance run --auto --schedule=daily 2>err &&
+	test_i18ngrep "at most one" err
+'
+
+test_expect_success 'invalid --schedule value' '
+	test_must_fail git maintenance run --schedule=annually 2>err &&
+	test_i18ngrep "unrecognized --schedule" err
+'
+
+test_expect_success '--schedule inheritance weekly -> daily -> hourly' '
+	git config maintenance.loose-objects.enabled true &&
+	git config maintenance.loose-objects.schedule hourly &&
+	git config maintenance.commit-graph.enabled true &&
+	git config maintenance.commit-graph.schedule daily &&
+	git config maintenance.incremental-repack.enabled true &&
+	git config maintenance.incremental-repack.schedule weekly &&
+	test_config core.multiPackIndex true &&
+
+	trace_run_commands git maintenance run --schedule=hourly 2>/dev/null &&
+	grep "prune-packed" run-commands &&
+	! grep "commit-graph write" run-commands &&
+	! grep "git multi-pack-index write" run-commands &&
+
+	trace_run_commands git maintenance run --schedule=daily 2>/dev/null &&
+	grep "prune-packed" run-commands &&
+	grep "commit-graph write" run-commands &&
+	! grep "git multi-pack-index write" run-commands &&
+
+	trace_run_commands git maintenance run --schedule=weekly 2>/dev/null &&
+	grep "prune-packed" run-commands &&
+	grep "commit-graph write" run-commands &&
+	grep "git multi-pack-index write" run-commands &&
+
+	git config --remove-section maintenance.loose-objects &&
+	git config --remove-section maintenance.commit-graph &&
+	git config --remove-section maintenance.incremental-repack
+'
+
+test_expect_success 'maintenance.strategy inheritance' '
+	git config maintenance.strategy incremental &&
+	test_config core.multiPackIndex true &&
+
+	trace_run_commands git maintenance run --schedule=hourly --quiet &&
+	grep "git fetch remote1" run-commands &&
+	grep "commit-graph write" run-commands &&
+	! grep "prune-packed" run-commands &&
+	! grep "git gc" run-commands &&
+
+	trace_run_commands git maintenance run --schedule=weekly --quiet &&
+	grep "prune-packed" run-commands &&
+	grep "git multi-pack-index write" run-commands &&
+	grep "git pack-refs" run-commands &&
+	! grep "git gc" run-commands &&
+
+	# a configured schedule wins over the strategy
+	git config maintenance.prefetch.schedule weekly &&
+	trace_run_commands git maintenance run --schedule=hourly --quiet &&
+	! grep "git fetch" run-commands &&
+
+	git config --unset maintenance.strategy &&
+	git config --remove-section maintenance.prefetch
+'
+
+test_expect_success 'register and unregister' '
+	test_when_finished git config --global --unset-all maintenance.repo &&
+	git config --global --add maintenance.repo /existing1 &&
+	git config --global --add maintenance.repo /existing2 &&
+	git config --global --get-all maintenance.repo >before &&
+	git maintenance register &&
+	git config --global --get-all maintenance.repo >actual &&
+	cp before after &&
+	pwd >>after &&
+	test_cmp after actual &&
+	test "$(git config maintenance.auto)" = false &&
+	test "$(git config maintenance.strategy)" = incremental &&
+
+	# registering twice does not duplicate the entry
+	git maintenance register &&
+	git config --global --get-all maintenance.repo >actual &&
+	test_cmp after actual &&
+
+	git maintenance unregister &&
+	git config --global --get-all maintenance.repo >actual &&
+	test_cmp before actual &&
+	test_must_fail git maintenance unregister 2>err &&
+	test_i18ngrep "is not registered" err &&
+
+	git config --unset maintenance.auto &&
+	git config --unset maintenance.strategy
+'
+
+test_expect_success 'start and stop update the crontab' '
+	write_script mock-crontab <<-\EOF &&
+	if test "$1" = -l
+	then
+		cat crontab
+	else
+		cat >crontab
+	fi
+	EOF
+	echo "@reboot true" >crontab &&
+	test_when_finished git config --global --unset-all maintenance.repo &&
+
+	PATH="$PWD:$PATH" GIT_TEST_CRONTAB="mock-crontab" git maintenance start &&
+	grep "^@reboot true\$" crontab &&
+	grep "for-each-repo --config=maintenance.repo maintenance run --schedule=hourly" crontab &&
+	grep "for-each-repo --config=maintenance.repo maintenance run --schedule=daily" crontab &&
+	grep "for-each-repo --config=maintenance.repo maintenance run --schedule=weekly" crontab &&
+	pwd >expect &&
+	git config --global --get-all maintenance.repo >actual &&
+	test_cmp expect actual &&
+
+	# starting again does not duplicate the schedule
+	PATH="$PWD:$PATH" GIT_TEST_CRONTAB="mock-crontab" git maintenance start &&
+	grep -c "BEGIN GIT MAINTENANCE" crontab >count &&
+	echo 1 >expect &&
+	test_cmp expect count &&
+
+	PATH="$PWD:$PATH" GIT_TEST_CRONTAB="mock-crontab" git maintenance stop &&
+	echo "@reboot true" >expect &&
+	test_cmp expect crontab &&
+
+	git config --unset maintenance.auto &&
+	git config --unset maintenance.strategy
+'
+
+test_done
@@ -275,4 +275,49 @@ test_expect_success 'blame file with CRLF core.autocrlf=true' '
 	grep "A U Thor" actual
 '
 
+test_expect_success 'setup file with a line inserted later' '
+	test_write_lines a b d e >gap &&
+	git add gap &&
+	git commit -m "gap without c" &&
+	test_write_lines a b c d e >gap &&
+	git commit -a -m "gap with c"
+'
+
+test_expect_success 'blame -L does not join groups across ranges' '
+	git rev-parse HEAD^ >commit &&
+	echo "$(cat commit) 1 1 2" >expect &&
+	echo "$(cat commit) 3 4 2" >>expect &&
+	git blame --porcelain -L 1,2 -L 4,5 gap >actual.raw &&
+	grep "^[0-9a-f]\{40\} [0-9]* [0-9]* [0-9]*\$" actual.raw >actual &&
+	test_cmp expect actual &&
+	git blame -s -L 1,2 -L 4,5 gap >actual &&
+	test_line_count = 4 actual
+'
+
+test_expect_success 'porcelain output matches incremental output' '
+	git blame --incremental ten_lines >incremental &&
+	grep "^[0-9a-f]\{40\} " incremental | sort >expect &&
+	git blame --porcelain ten_lines >porcelain &&
+	grep "^[0-9a-f]\{40\} [0-9]* [0-9]* [0-9]*\$" porcelain | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'porcelain output is shown before the blame is done' '
+	test_write_lines 1 2 3 >streamed &&
+	git add streamed &&
+	git commit -m "streamed" &&
+	test_write_lines one 2 3 >streamed &&
+	git commit -a -m "streamed, changed" &&
+	GIT_FLUSH=1 GIT_TRACE_PERFORMANCE=2 \
+		git blame --porcelain HEAD -- streamed >out 2>&1 &&
+	grep -n "^$(git rev-parse HEAD) 1 1 1\$" out >first &&
+	grep -n "performance: .* assign_blame\$" out >done &&
+	test $(cut -d: -f1 first) -lt $(cut -d: -f1 done) &&
+	GIT_FLUSH=1 GIT_TRACE_PERFORMANCE=2 \
+		git blame HEAD -- streamed >out 2>&1 &&
+	grep -n "^[0-9a-f^]* (" out >first &&
+	grep -n "performance: .* assign_blame\$" out >done &&
+	test $(head -n 1 first | cut -d: -f1) -gt $(cut -d: -f1 done)
+'
+
 test_done
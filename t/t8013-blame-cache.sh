@@ -0,0 +1,129 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+
+. ./test-lib.sh
+
+cache_dir=.git/objects/info/blame-cache
+
+commit_as () {
+	git add -A &&
+	test_tick &&
+	git commit -q -m "$1" &&
+	git tag "$1"
+}
+
+# Build a history with edits, a rename, a merge and whitespace changes.
+test_expect_success 'setup' '
+	test_seq 1 20 >file &&
+	commit_as one &&
+	sed -e "s/^5\$/five/" -e "s/^15\$/fifteen/" file >tmp &&
+	mv tmp file &&
+	commit_as two &&
+	git mv file renamed &&
+	sed -e "s/^10\$/ten/" renamed >tmp &&
+	mv tmp renamed &&
+	echo 21 >>renamed &&
+	commit_as three &&
+	git checkout -b topic &&
+	sed -e "s/^2\$/two/" renamed >tmp &&
+	mv tmp renamed &&
+	commit_as side &&
+	git checkout master &&
+	sed -e "s/^19\$/nineteen/" renamed >tmp &&
+	mv tmp renamed &&
+	commit_as four &&
+	test_merge merge topic &&
+	sed -e "s/^ten\$/  ten/" -e "1d" renamed >tmp &&
+	mv tmp renamed &&
+	commit_as five
+'
+
+# Compare "git blame $@" with and without the cache, twice, so that the
+# second run can use what the first one recorded.
+check_blame () {
+	git blame "$@" >expect &&
+	git -c blame.cache=true blame "$@" >actual &&
+	test_cmp expect actual &&
+	git -c blame.cache=true blame "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'blame without the cache does not create it' '
+	git blame renamed >/dev/null &&
+	test_path_is_missing $cache_dir
+'
+
+test_expect_success 'blame records whole-file blames' '
+	git -c blame.cache=true blame three -- renamed >/dev/null &&
+	test_path_is_dir $cache_dir &&
+	find $cache_dir -type f >records &&
+	test_line_count = 1 records
+'
+
+test_expect_success 'blame at later commits stops at the cached commit' '
+	git -c blame.cache=true blame --show-stats four -- renamed >actual &&
+	grep "num commits: 1" actual &&
+	git -c blame.cache=true blame --show-stats four -- renamed >actual &&
+	grep "num commits: 0" actual
+'
+
+for args in \
+	"renamed" "--porcelain renamed" "--line-porcelain renamed" \
+	"-b renamed" "--root renamed" "-n -f renamed" "-w renamed" \
+	"--first-parent renamed" "--no-follow renamed" "--minimal renamed" \
+	"-L 3,8 renamed" "-L 10,+3 renamed" "four -- renamed" \
+	"side -- renamed" "merge -- renamed" "two -- file" "one -- file"
+do
+	test_expect_success "blame $args" "
+		check_blame $args
+	"
+done
+
+test_expect_success 'ranges are not recorded' '
+	rm -rf $cache_dir &&
+	git -c blame.cache=true blame -L 2,4 five -- renamed >/dev/null &&
+	test_path_is_missing $cache_dir
+'
+
+test_expect_success 'options affecting the blame are part of the key' '
+	git -c blame.cache=true blame five -- renamed >/dev/null &&
+	git -c blame.cache=true blame -w five -- renamed >/dev/null &&
+	find $cache_dir -type f >records &&
+	test_line_count = 2 records
+'
+
+test_expect_success 'uncommitted changes are blamed on top of the cache' '
+	echo uncommitted >>renamed &&
+	check_blame renamed &&
+	check_blame --porcelain renamed &&
+	git checkout renamed
+'
+
+test_expect_success 'copy detection and ranges do not use the cache' '
+	check_blame -C renamed &&
+	check_blame -M renamed &&
+	check_blame two..five -- renamed &&
+	check_blame --reverse one..five -- file
+'
+
+test_expect_success 'incremental output blames the same lines' '
+	git blame --incremental renamed >expect.raw &&
+	git -c blame.cache=true blame --incremental renamed >actual.raw &&
+	grep "^[0-9a-f]\{40\} " expect.raw | sort >expect &&
+	grep "^[0-9a-f]\{40\} " actual.raw | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a corrupt record is ignored' '
+	git blame five -- renamed >expect &&
+	for f in $(find $cache_dir -type f)
+	do
+		echo garbage >"$f" || return 1
+	done &&
+	git -c blame.cache=true blame five -- renamed >actual 2>err &&
+	test_cmp expect actual &&
+	test_i18ngrep "corrupt blame cache" err
+'
+
+test_done
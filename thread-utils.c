@@ -123,3 +123,36 @@ int dummy_pthread_join(pthread_t pthread, void **retval)
 }
 
 #endif
+
+#if !defined(__ATOMIC_ACQUIRE) || !defined(__ATOMIC_RELEASE)
+#if !defined(NO_PTHREADS) && !defined(GIT_WINDOWS_NATIVE)
+static pthread_mutex_t publish_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void *fallback_load_acquire_ptr(void *const *ptr)
+{
+	void *val;
+
+#ifdef GIT_WINDOWS_NATIVE
+	val = *(void *volatile const *)ptr;
+	MemoryBarrier();
+#else
+	pthread_mutex_lock(&publish_mutex);
+	val = *ptr;
+	pthread_mutex_unlock(&publish_mutex);
+#endif
+	return val;
+}
+
+void fallback_store_release_ptr(void **ptr, void *val)
+{
+#ifdef GIT_WINDOWS_NATIVE
+	MemoryBarrier();
+	*(void *volatile *)ptr = val;
+#else
+	pthread_mutex_lock(&publish_mutex);
+	*ptr = val;
+	pthread_mutex_unlock(&publish_mutex);
+#endif
+}
+#endif
@@ -53,5 +53,25 @@ int dummy_pthread_init(void *);
 int online_cpus(void);
 int init_recursive_mutex(pthread_mutex_t*);
 
+/*
+ * Publish a pointer to data that was filled in before, for threads
+ * that read it without holding a lock: once a thread sees the new
+ * value through load_acquire_ptr(), it also sees that data. Plain
+ * stores and loads give no such guarantee, as both the compiler and
+ * the CPU may reorder them.
+ */
+#if defined(__ATOMIC_ACQUIRE) && defined(__ATOMIC_RELEASE)
+#define load_acquire_ptr(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define store_release_ptr(ptr, val) \
+	__atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#else
+void *fallback_load_acquire_ptr(void *const *ptr);
+void fallback_store_release_ptr(void **ptr, void *val);
+#define load_acquire_ptr(ptr) \
+	fallback_load_acquire_ptr((void *const *)(ptr))
+#define store_release_ptr(ptr, val) \
+	fallback_store_release_ptr((void **)(ptr), (void *)(val))
+#endif
+
 
 #endif /* THREAD_COMPAT_H */
@@ -551,12 +551,8 @@ static int fetch_with_import(struct transport *transport,
 		}
 	}
 	strbuf_release(&buf);
-	if (auto_gc) {
-		const char *argv_gc_auto[] = {
-			"gc", "--auto", "--quiet", NULL,
-		};
-		run_command_v_opt(argv_gc_auto, RUN_GIT_CMD);
-	}
+	if (auto_gc)
+		run_auto_maintenance(1);
 	return 0;
 }
 
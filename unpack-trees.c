@@ -12,6 +12,8 @@
 #include "refs.h"
 #include "attr.h"
 #include "split-index.h"
+#include "sparse-index.h"
+#include "parallel-checkout.h"
 #include "dir.h"
 #include "submodule.h"
 #include "submodule-config.h"
@@ -383,7 +385,7 @@ static int check_updates(struct unpack_trees_options *o)
 	struct progress *progress;
 	struct index_state *index = &o->result;
 	struct checkout state = CHECKOUT_INIT;
-	int i;
+	int i, pc_workers, pc_threshold;
 
 	trace_performance_enter();
 	state.force = 1;
@@ -440,20 +442,33 @@ static int check_updates(struct unpack_trees_options *o)
 		fetch_if_missing = fetch_if_missing_store;
 		oid_array_clear(&to_fetch);
 	}
+
+	get_parallel_checkout_configs(&pc_workers, &pc_threshold);
+	if (!o->update || o->dry_run)
+		pc_workers = 1;
+	if (pc_workers > 1)
+		init_parallel_checkout();
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
 		if (ce->ce_flags & CE_UPDATE) {
+			size_t last_pc_queue_size = pc_queue_size();
+
 			if (ce->ce_flags & CE_WT_REMOVE)
 				BUG("both update and delete flags are set on %s",
 				    ce->name);
-			display_progress(progress, ++cnt);
 			ce->ce_flags &= ~CE_UPDATE;
 			if (o->update && !o->dry_run) {
 				errs |= checkout_entry(ce, &state, NULL);
 			}
+			/* queued entries are counted when they are written */
+			if (last_pc_queue_size == pc_queue_size())
+				display_progress(progress, ++cnt);
 		}
 	}
+	if (pc_workers > 1)
+		errs |= run_parallel_checkout(&state, pc_workers, pc_threshold,
+					      progress, &cnt);
 	stop_progress(&progress);
 	errs |= finish_delayed_checkout(&state);
 	if (o->update)
@@ -1184,6 +1199,58 @@ static void debug_unpack_callback(int n,
 		debug_name_entry(i, names + i);
 }
 
+/*
+ * If the index has a sparse directory entry for the directory p that
+ * the traversal is looking at, return it.
+ */
+static struct cache_entry *find_sparse_directory(struct traverse_info *info,
+						 const struct name_entry *p)
+{
+	struct unpack_trees_options *o = info->data;
+	struct cache_entry *ce;
+	int pos;
+
+	if (o->diff_index_cached) {
+		ce = next_cache_entry(o);
+	} else {
+		pos = find_cache_pos(info, p);
+		if (pos >= -1)
+			return NULL;
+		ce = o->src_index->cache[-2 - pos];
+	}
+	if (!ce || !S_ISSPARSEDIR(ce->ce_mode) ||
+	    do_compare_entry(ce, info, p) ||
+	    ce_namelen(ce) != traverse_path_len(info, p) + 1)
+		return NULL;
+	return ce;
+}
+
+/*
+ * unpack_trees() made sure that all the trees have the same directory
+ * as the sparse directory entry ce, so there is nothing to look at
+ * below it: hand the entry to the merge function as a whole, the way
+ * traverse_by_cache_tree() does with the entries it takes.
+ */
+static int unpack_sparse_directory(int n, struct cache_entry *ce,
+				   struct unpack_trees_options *o)
+{
+	struct cache_entry *src[MAX_UNPACK_TREES + 1] = { NULL, };
+	struct cache_entry *tree_ce;
+	int i, rc;
+
+	tree_ce = make_transient_cache_entry(ce->ce_mode, &ce->oid, ce->name, 0);
+	if (!tree_ce)
+		return -1;
+	tree_ce->ce_mode = ce->ce_mode; /* not a gitlink */
+	src[0] = ce;
+	for (i = 1; i <= n; i++)
+		src[i] = tree_ce;
+	rc = call_unpack_fn((const struct cache_entry * const *)src, o);
+	discard_cache_entry(tree_ce);
+	mark_ce_used(ce, o);
+	return rc;
+}
+
 /*
  * Note that traverse_by_cache_tree() duplicates some logic in this function
  * without actually calling it. If you change the logic here you may need to
@@ -1252,6 +1319,16 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 
 	/* Now handle any directories.. */
 	if (dirmask) {
+		if (o->merge && o->src_index->sparse_index) {
+			struct cache_entry *ce = find_sparse_directory(info, p);
+
+			if (ce) {
+				if (unpack_sparse_directory(n, ce, o) < 0)
+					return -1;
+				return mask;
+			}
+		}
+
 		/* special case: "diff-index --cached" looking at a tree */
 		if (o->diff_index_cached &&
 		    n == 1 && dirmask == 1 && S_ISDIR(names->mode)) {
@@ -1467,6 +1544,62 @@ static int verify_absent(const struct cache_entry *,
  *
  * CE_ADDED, CE_UNPACKED and CE_NEW_SKIP_WORKTREE are used internally
  */
+/*
+ * Does the tree described by desc have the tree oid at path?
+ */
+static int tree_desc_has_tree(const struct tree_desc *desc, const char *path,
+			      const struct object_id *oid)
+{
+	struct tree_desc d = *desc;
+	struct name_entry entry;
+	const char *slash = strchrnul(path, '/');
+	int len = slash - path;
+	struct object_id found;
+	unsigned mode;
+
+	while (tree_entry(&d, &entry)) {
+		if (tree_entry_len(&entry) != len ||
+		    memcmp(entry.path, path, len))
+			continue;
+		if (!S_ISDIR(entry.mode))
+			return 0;
+		if (!*slash)
+			return oideq(entry.oid, oid);
+		return !get_tree_entry(entry.oid, slash + 1, &found, &mode) &&
+			S_ISDIR(mode) && oideq(&found, oid);
+	}
+	return 0;
+}
+
+/*
+ * The merge functions can take a sparse directory entry as a whole only
+ * if all the trees have the very same directory; otherwise we need to
+ * look at the individual entries.
+ */
+static int sparse_directories_match_trees(unsigned len, struct tree_desc *t,
+					  struct index_state *istate)
+{
+	struct strbuf path = STRBUF_INIT;
+	int i, ret = 1;
+	unsigned j;
+
+	if (!len)
+		return 0;
+
+	for (i = 0; ret && i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (!S_ISSPARSEDIR(ce->ce_mode))
+			continue;
+		strbuf_reset(&path);
+		strbuf_add(&path, ce->name, ce_namelen(ce) - 1);
+		for (j = 0; ret && j < len; j++)
+			ret = tree_desc_has_tree(t + j, path.buf, &ce->oid);
+	}
+	strbuf_release(&path);
+	return ret;
+}
+
 int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options *o)
 {
 	int i, ret;
@@ -1489,8 +1622,18 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		free(sparse);
 	}
 
+	/*
+	 * Applying the sparse-checkout patterns, or splicing a tree in
+	 * below a prefix, needs the entries of the sparse directories.
+	 */
+	if (o->merge && o->src_index->sparse_index &&
+	    (!o->skip_sparse_checkout || o->prefix ||
+	     !sparse_directories_match_trees(len, t, o->src_index)))
+		ensure_full_index(o->src_index);
+
 	memset(&o->result, 0, sizeof(o->result));
 	o->result.initialized = 1;
+	o->result.sparse_index = o->merge && o->src_index->sparse_index;
 	o->result.timestamp.sec = o->src_index->timestamp.sec;
 	o->result.timestamp.nsec = o->src_index->timestamp.nsec;
 	o->result.version = o->src_index->version;
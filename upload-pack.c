@@ -344,7 +344,7 @@ static int got_oid(const char *hex, struct object_id *oid,
 static int ok_to_give_up(const struct object_array *have_obj,
 			 struct object_array *want_obj)
 {
-	uint32_t min_generation = GENERATION_NUMBER_ZERO;
+	timestamp_t min_generation = GENERATION_NUMBER_ZERO;
 
 	if (!have_obj->nr)
 		return 0;
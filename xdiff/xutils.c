@@ -298,20 +298,74 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 	return ha;
 }
 
+/*
+ * Helpers to look at a whole unsigned long worth of bytes at once:
+ * XDL_WORD_HAS_NEWLINE() is non-zero iff one of the bytes of 'w' is a
+ * newline, and its lowest set bit is in the first such byte.
+ */
+#define XDL_WORD_ONES (~0UL / 0xff)
+#define XDL_WORD_HIGHS (XDL_WORD_ONES << 7)
+#define XDL_WORD_HAS_ZERO(w) (((w) - XDL_WORD_ONES) & ~(w) & XDL_WORD_HIGHS)
+#define XDL_WORD_HAS_NEWLINE(w) XDL_WORD_HAS_ZERO((w) ^ (XDL_WORD_ONES * '\n'))
+#define XDL_WORD_HASH_MUL ((unsigned long) 0x9e3779b97f4a7c15ULL)
+
+/*
+ * Return the number of bytes before the newline in the word 'w' read
+ * from 'ptr', and clear the bytes from it on.
+ */
+static inline size_t xdl_word_line_prefix(unsigned long *w, char const *ptr,
+					  unsigned long has_newline) {
+	size_t n;
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+	__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	n = __builtin_ctzl(has_newline) / CHAR_BIT;
+	*w &= (1UL << (n * CHAR_BIT)) - 1;
+#else
+	for (n = 0; ptr[n] != '\n'; n++)
+		;
+	*w = 0;
+	memcpy(w, ptr, n);
+#endif
+	return n;
+}
+
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
-	unsigned long ha = 5381;
+	unsigned long ha = 5381, w, has_newline;
 	char const *ptr = *data;
+	size_t n;
 
 	if (flags & XDF_WHITESPACE_FLAGS)
 		return xdl_hash_record_with_whitespace(data, top, flags);
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
-		ha += (ha << 5);
-		ha ^= (unsigned long) *ptr;
+	/*
+	 * Scan for the end of the line and hash it a word at a time;
+	 * the words are taken from the start of the line, so that equal
+	 * lines hash equally wherever they are. The hash only has to be
+	 * consistent with itself, as the whitespace-ignoring variant is
+	 * never used on the same pair of files.
+	 */
+	for (;; ptr += sizeof(w)) {
+		if (top - ptr < (long) sizeof(w)) {
+			for (n = 0; ptr + n < top && ptr[n] != '\n'; n++)
+				;
+			w = 0;
+			memcpy(&w, ptr, n);
+			break;
+		}
+		memcpy(&w, ptr, sizeof(w));
+		has_newline = XDL_WORD_HAS_NEWLINE(w);
+		if (has_newline) {
+			n = xdl_word_line_prefix(&w, ptr, has_newline);
+			break;
+		}
+		ha = (ha ^ w) * XDL_WORD_HASH_MUL;
 	}
+	ha = ((ha ^ w) * XDL_WORD_HASH_MUL) ^ n;
+	ptr += n;
 	*data = ptr < top ? ptr + 1: ptr;
 
-	return ha;
+	return ha ^ (ha >> (sizeof(ha) * CHAR_BIT / 2));
 }
 
 unsigned int xdl_hashbits(unsigned int size) {